@@ -0,0 +1,524 @@
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "url.h"
+
+/*
+	Benchmark the URL functions on deterministic corpora, and write one JSON
+	object per line and per function and corpus to the standard output, so
+	that runs can be compared :
+
+	{"function":"url_Canonicalize","corpus":"proxy","urls":..,"bytes":..,
+	 "ns_per_url":..,"bytes_per_s":..,"allocs_per_url":..}
+
+	Corpora are generated from a fixed seed, so they are the same on every
+	run. Allocations are counted by wrapping malloc(), calloc() and realloc()
+	around the glibc ones : "allocs_per_url" is null on other C libraries.
+
+	To compile : gcc -std=c99 -Wall -O2 bench_url.c url.c -o bench_url -lm
+*/
+
+// Default minimum time spent on each function and corpus, in milliseconds
+#define BENCH_TIME 200
+
+// Relative URL given to url_MakeAbsolute()
+#define BENCH_RELATIVE "../img/./logo.png?v=2"
+
+
+#ifdef __GLIBC__
+#define BENCH_ALLOCS
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t allocs;
+
+void *malloc(size_t size)
+{
+	allocs++;
+	return(__libc_malloc(size));
+}
+
+void *calloc(size_t count, size_t size)
+{
+	allocs++;
+	return(__libc_calloc(count, size));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return(__libc_realloc(ptr, size));
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+#endif
+
+
+typedef struct {
+	const char *name;
+	char **urls;
+	size_t *lens;
+	size_t count, cap;
+	uint64_t bytes;
+} Corpus;
+
+typedef struct {
+	const char *name;
+	void (*run)(const char *url, size_t len);
+} Function;
+
+
+// Longest URL of all the corpora, for the url_ParseNextKeyValuePair() copy
+static size_t max_len;
+static char *query_copy;
+
+
+static void BenchCanonicalize(const char *url, size_t len)
+{
+	free(url_Canonicalize(url, len, NULL));
+}
+
+static void BenchNormalize(const char *url, size_t len)
+{
+	free(url_Normalize(url, len, NULL));
+}
+
+static void BenchEscape(const char *url, size_t len)
+{
+	free(url_Escape(url, len, NULL));
+}
+
+static void BenchUnescape(const char *url, size_t len)
+{
+	free(url_Unescape(url, len, NULL));
+}
+
+static void BenchGetHostname(const char *url, size_t len)
+{
+	(void)len;
+	free(url_GetHostname(url));
+}
+
+static void BenchMakeAbsolute(const char *url, size_t len)
+{
+	(void)len;
+	free(url_MakeAbsolute(url, BENCH_RELATIVE));
+}
+
+static void BenchParseNextKeyValuePair(const char *url, size_t len)
+{
+	const char *query = memchr(url, '?', len);
+	if(query==NULL)
+		return;
+	memcpy(query_copy, query+1, len - (query+1-url) + 1);
+
+	char *next = query_copy, *key, *value;
+	while(next)
+		next = url_ParseNextKeyValuePair(next, &key, &value, NULL);
+}
+
+static const Function functions[] = {
+	{ "url_Canonicalize", BenchCanonicalize },
+	{ "url_Normalize", BenchNormalize },
+	{ "url_Escape", BenchEscape },
+	{ "url_Unescape", BenchUnescape },
+	{ "url_GetHostname", BenchGetHostname },
+	{ "url_MakeAbsolute", BenchMakeAbsolute },
+	{ "url_ParseNextKeyValuePair", BenchParseNextKeyValuePair },
+};
+
+
+// xorshift64* generator, always started from the same seed
+static uint64_t seed;
+
+static uint64_t Random(void)
+{
+	seed ^= seed >> 12;
+	seed ^= seed << 25;
+	seed ^= seed >> 27;
+	return(seed * 2685821657736338717ULL);
+}
+
+static unsigned Pick(unsigned n)
+{
+	return(Random() % n);
+}
+
+
+static void Add(Corpus *c, const char *url, size_t len)
+{
+	if(c->count == c->cap) {
+		c->cap = c->cap ? 2*c->cap : 1024;
+		c->urls = realloc(c->urls, c->cap * sizeof(char *));
+		c->lens = realloc(c->lens, c->cap * sizeof(size_t));
+		if(c->urls==NULL || c->lens==NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	char *copy = malloc(len+1);
+	if(copy==NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	memcpy(copy, url, len);
+	copy[len] = '\0';
+	c->urls[c->count] = copy;
+	c->lens[c->count++] = len;
+	c->bytes += len;
+	if(len > max_len)
+		max_len = len;
+}
+
+
+// Growable string used to build the URLs
+typedef struct {
+	char *data;
+	size_t len, cap;
+} Buffer;
+
+static void Append(Buffer *b, const char *str, size_t len)
+{
+	if(b->len + len + 1 > b->cap) {
+		while(b->len + len + 1 > b->cap)
+			b->cap = b->cap ? 2*b->cap : 256;
+		if((b->data = realloc(b->data, b->cap))==NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(b->data + b->len, str, len);
+	b->len += len;
+	b->data[b->len] = '\0';
+}
+
+static void AppendString(Buffer *b, const char *str)
+{
+	Append(b, str, strlen(str));
+}
+
+static void AppendWord(Buffer *b, unsigned syllables)
+{
+	static const char *parts[] = { "ka", "lo", "mi", "ne", "ru", "sa", "ti", "vo", "zen", "bar", "cor", "dex" };
+	for(unsigned i=0; i<syllables; i++)
+		AppendString(b, parts[Pick(sizeof(parts)/sizeof(parts[0]))]);
+}
+
+
+static void CorpusGoogle(Corpus *c)
+{
+	static const char *vectors[] = {
+		"http://host/%25%32%35",
+		"http://host/%25%32%35%25%32%35",
+		"http://host/%2525252525252525",
+		"http://host/asdf%25%32%35asd",
+		"http://host/%%%25%32%35asd%%",
+		"http://www.google.com/",
+		"http://%31%36%38%2e%31%38%38%2e%39%39%2e%32%36/%2E%73%65%63%75%72%65/%77%77%77%2E%65%62%61%79%2E%63%6F%6D/",
+		"http://195.127.0.11/uploads/%20%20%20%20/.verify/.eBaysecure=updateuserdataxplimnbqmn-xplmvalidateinfoswqpcmlx=hgplmcx/",
+		"http://host%23.com/%257Ea%2521b%2540c%2523d%2524e%25f%255E00%252611%252A22%252833%252944_55%252B",
+		"http://3279880203/blah",
+		"http://www.google.com/blah/..",
+		"www.google.com/",
+		"www.google.com",
+		"http://www.evil.com/blah#frag",
+		"http://www.GOOgle.com/",
+		"http://www.google.com.../",
+		"http://www.google.com/foo\tbar\rbaz\n2",
+		"http://www.google.com/q?",
+		"http://www.google.com/q?r?",
+		"http://www.google.com/q?r?s",
+		"http://evil.com/foo#bar#baz",
+		"http://evil.com/foo;",
+		"http://evil.com/foo?bar;",
+		"http://\x01\x80.com/",
+		"http://notrailingslash.com",
+		"http://www.gotaport.com:1234/",
+		"  http://www.google.com/  ",
+		"http:// leadingspace.com/",
+		"http://%20leadingspace.com/",
+		"%20leadingspace.com/",
+		"https://www.securesite.com/",
+		"http://host.com/ab%23cd",
+		"http://host.com//twoslashes?more//slashes",
+	};
+	for(size_t i=0; i<sizeof(vectors)/sizeof(vectors[0]); i++)
+		Add(c, vectors[i], strlen(vectors[i]));
+}
+
+
+// URLs as found in proxy logs : mixed case, ports, dot segments, queries
+static void CorpusProxy(Corpus *c)
+{
+	static const char *schemes[] = { "http://", "https://", "HTTP://", "" };
+	static const char *tlds[] = { ".com", ".net", ".org", ".fr", ".co.uk", ".io" };
+	static const char *segments[] = { "/index.html", "/./", "/../", "//", "/static", "/v2", "/api", "/Images", "/%7Euser" };
+	static const char *values[] = { "1", "true", "en-US", "a%20b", "%2Fpath", "x+y", "" };
+	Buffer b = { NULL, 0, 0 };
+
+	for(int i=0; i<10000; i++) {
+		b.len = 0;
+		AppendString(&b, schemes[Pick(4)]);
+		if(Pick(2))
+			AppendString(&b, "www.");
+		AppendWord(&b, 1+Pick(3));
+		if(Pick(3)==0) {
+			AppendString(&b, ".");
+			AppendWord(&b, 2);
+		}
+		AppendString(&b, tlds[Pick(6)]);
+		if(Pick(8)==0)
+			AppendString(&b, Pick(2) ? ":8080" : ":443");
+		for(unsigned n=Pick(6); n>0; n--) {
+			if(Pick(2))
+				AppendString(&b, segments[Pick(9)]);
+			else {
+				AppendString(&b, "/");
+				AppendWord(&b, 1+Pick(4));
+			}
+		}
+		if(Pick(2)) {
+			AppendString(&b, "?");
+			for(unsigned n=1+Pick(6); n>0; n--) {
+				AppendWord(&b, 1+Pick(2));
+				AppendString(&b, "=");
+				AppendString(&b, values[Pick(7)]);
+				if(n>1)
+					AppendString(&b, "&");
+			}
+		}
+		if(Pick(10)==0)
+			AppendString(&b, "#section");
+		Add(c, b.data, b.len);
+	}
+	free(b.data);
+}
+
+
+// Characters percent-encoded again and again ("%252541" is "%41" is "A")
+static void CorpusNested(Corpus *c)
+{
+	Buffer b = { NULL, 0, 0 };
+	char token[64];
+
+	for(int i=0; i<2000; i++) {
+		b.len = 0;
+		AppendString(&b, "http://");
+		AppendWord(&b, 2);
+		AppendString(&b, ".com/");
+		for(unsigned n=1+Pick(8); n>0; n--) {
+			unsigned depth = Pick(9);
+			size_t len = 0;
+			token[len++] = '%';
+			for(unsigned d=0; d<depth; d++) {
+				token[len++] = '2';
+				token[len++] = '5';
+			}
+			len += sprintf(token+len, "%02X", 0x21 + Pick(94));
+			Append(&b, token, len);
+			if(Pick(2))
+				AppendWord(&b, 1);
+		}
+		Add(c, b.data, b.len);
+	}
+	free(b.data);
+}
+
+
+// Queries of a few kilobytes, as sent by trackers and search forms
+static void CorpusLongQuery(Corpus *c)
+{
+	Buffer b = { NULL, 0, 0 };
+
+	for(int i=0; i<500; i++) {
+		b.len = 0;
+		AppendString(&b, "https://");
+		AppendWord(&b, 2);
+		AppendString(&b, ".com/collect?");
+		while(b.len < 2048 + Pick(2048)) {
+			AppendWord(&b, 1+Pick(3));
+			AppendString(&b, "=");
+			AppendWord(&b, 1+Pick(8));
+			AppendString(&b, Pick(4) ? "&" : "%26");
+		}
+		Add(c, b.data, b.len);
+	}
+	free(b.data);
+}
+
+
+// Internationalized host names, raw UTF-8, percent-encoded or punycode
+static void CorpusIDN(Corpus *c)
+{
+	static const char *hosts[] = {
+		"b\xc3\xbc" "cher.de",
+		"\xd0\xbf\xd1\x80\xd0\xb8\xd0\xbc\xd0\xb5\xd1\x80.\xd1\x80\xd1\x84",
+		"\xe4\xbe\x8b\xe3\x81\x88.\xe3\x83\x86\xe3\x82\xb9\xe3\x83\x88",
+		"%E4%BE%8B%E3%81%88.jp",
+		"xn--bcher-kva.de",
+		"www.xn--e1afmkfd.xn--p1ai",
+		"M\xc3\x9cNCHEN.example",
+	};
+	Buffer b = { NULL, 0, 0 };
+
+	for(int i=0; i<2000; i++) {
+		b.len = 0;
+		AppendString(&b, Pick(2) ? "http://" : "https://");
+		AppendString(&b, hosts[Pick(7)]);
+		AppendString(&b, "/");
+		AppendWord(&b, 1+Pick(3));
+		if(Pick(2))
+			AppendString(&b, "/caf\xc3\xa9?q=\xc3\xa9t\xc3\xa9");
+		Add(c, b.data, b.len);
+	}
+	free(b.data);
+}
+
+
+// Inline images of a few hundred kilobytes
+static void CorpusData(Corpus *c)
+{
+	static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	Buffer b = { NULL, 0, 0 };
+
+	for(int i=0; i<8; i++) {
+		b.len = 0;
+		AppendString(&b, "data:image/png;base64,");
+		size_t len = 128*1024 + Pick(256*1024);
+		for(size_t j=0; j<len; j++)
+			Append(&b, &base64[Pick(64)], 1);
+		AppendString(&b, "==");
+		Add(c, b.data, b.len);
+	}
+	free(b.data);
+}
+
+
+static uint64_t Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec);
+}
+
+
+static void Measure(const Function *f, const Corpus *c, uint64_t min_ns)
+{
+	// Warm up caches and the allocator
+	for(size_t i=0; i<c->count; i++)
+		f->run(c->urls[i], c->lens[i]);
+
+#ifdef BENCH_ALLOCS
+	allocs = 0;
+#endif
+	uint64_t rounds = 0, start = Now(), elapsed;
+	do {
+		for(size_t i=0; i<c->count; i++)
+			f->run(c->urls[i], c->lens[i]);
+		rounds++;
+		elapsed = Now() - start;
+	} while(elapsed < min_ns);
+
+	uint64_t urls = rounds * c->count, bytes = rounds * c->bytes;
+	printf("{\"function\":\"%s\",\"corpus\":\"%s\",\"urls\":%llu,\"bytes\":%llu,\"ns_per_url\":%.1f,\"bytes_per_s\":%.0f,\"allocs_per_url\":",
+		f->name, c->name, (unsigned long long)urls, (unsigned long long)bytes,
+		(double)elapsed / urls, bytes * 1e9 / elapsed);
+#ifdef BENCH_ALLOCS
+	printf("%.2f}\n", (double)allocs / urls);
+#else
+	printf("null}\n");
+#endif
+	fflush(stdout);
+}
+
+
+static void Usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-t ms] [-c corpus] [-f function]\n"
+		"  Benchmark the URL functions and write JSON lines to stdout.\n"
+		"  -t ms         Minimum time per function and corpus (default %d).\n"
+		"  -c corpus     Only run this corpus : google, proxy, nested, longquery,\n"
+		"                idn or data.\n"
+		"  -f function   Only run this function, e.g. url_Canonicalize.\n",
+		name, BENCH_TIME);
+}
+
+
+int main(int argc, char *argv[])
+{
+	long ms = BENCH_TIME;
+	const char *only_corpus = NULL, *only_function = NULL;
+
+	int opt;
+	while((opt = getopt(argc, argv, "t:c:f:")) != -1) {
+		switch(opt) {
+			case 't':
+				ms = strtol(optarg, NULL, 10);
+				if(ms <= 0) {
+					Usage(argv[0]);
+					return(1);
+				}
+				break;
+			case 'c':
+				only_corpus = optarg;
+				break;
+			case 'f':
+				only_function = optarg;
+				break;
+			default:
+				Usage(argv[0]);
+				return(1);
+		}
+	}
+
+	Corpus corpora[] = {
+		{ .name = "google" },
+		{ .name = "proxy" },
+		{ .name = "nested" },
+		{ .name = "longquery" },
+		{ .name = "idn" },
+		{ .name = "data" },
+	};
+	void (*generators[])(Corpus *) = { CorpusGoogle, CorpusProxy, CorpusNested, CorpusLongQuery, CorpusIDN, CorpusData };
+	size_t corpus_count = sizeof(corpora)/sizeof(corpora[0]);
+
+	for(size_t i=0; i<corpus_count; i++) {
+		seed = 0x9E3779B97F4A7C15ULL + i;
+		generators[i](&corpora[i]);
+	}
+	if((query_copy = malloc(max_len+1))==NULL) {
+		perror("malloc");
+		return(1);
+	}
+
+	for(size_t f=0; f<sizeof(functions)/sizeof(functions[0]); f++) {
+		if(only_function && strcmp(only_function, functions[f].name))
+			continue;
+		for(size_t i=0; i<corpus_count; i++)
+			if(only_corpus==NULL || strcmp(only_corpus, corpora[i].name)==0)
+				Measure(&functions[f], &corpora[i], (uint64_t)ms*1000000);
+	}
+
+	for(size_t i=0; i<corpus_count; i++) {
+		for(size_t j=0; j<corpora[i].count; j++)
+			free(corpora[i].urls[j]);
+		free(corpora[i].urls);
+		free(corpora[i].lens);
+	}
+	free(query_copy);
+	return(0);
+}
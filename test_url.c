@@ -4,8 +4,25 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
 
 #include "url.h"
+#include "url_rules.h"
+#include "url_stream.h"
+#include "url_dedupe.h"
+#include "url_topk.h"
+#include "url_intern.h"
+#include "url_dict.h"
+#include "url_batch.h"
+#include "url_columns.h"
+#include "url_sort.h"
+#include "url_pipeline.h"
+#include "url_shm.h"
+#include "url_html.h"
+#include "url_robots.h"
+#include "url_form.h"
 
 /*
 	Run google tests as described in 
@@ -14,7 +31,7 @@
 	One test is known to fail : "http://3279880203/blah" because canonicalization of IP address 
 	is currently not supported.
 
-	To compile : gcc -std=c99 -Wall test_url.c url.c -o test_url
+	To compile : gcc -std=c99 -Wall test_url.c url.c url_rules.c url_stream.c url_dedupe.c url_topk.c url_intern.c url_dict.c url_batch.c url_columns.c url_sort.c url_pipeline.c url_shm.c url_html.c url_robots.c url_form.c -o test_url -pthread -lm
 */
 
 
@@ -54,6 +71,251 @@ void TestMakeAbsolute(char *parent_url, char *url, char *expected_result)
 
 
 
+void TestCanonicalizeAndHash(char *url)
+{
+	uint64_t hash, hash128[2];
+	char *str = url_CanonicalizeAndHash(url, 0, NULL, 42, &hash);
+	char *str128 = url_CanonicalizeAndHash128(url, 0, NULL, 42, hash128);
+	char *expected = url_Canonicalize(url, 0, NULL);
+
+	if(str==NULL || str128==NULL || expected==NULL) {
+		fprintf(stderr, "Error while canonicalizing URL [%s]\n", url);
+	} else {
+		if(	   strcmp(expected, str) || strcmp(expected, str128)
+			|| hash != url_Hash64(expected, 0, 42)
+			|| hash128[0] != hash || hash128[1] != url_Hash64(expected, 0, ~(uint64_t)42))
+			printf(">>> FAILED [%s]>[%s] hash %016llx\n", url, str, (unsigned long long)hash);
+		else
+			printf("PASSED: [%s]>[%s] hash %016llx\n", url, str, (unsigned long long)hash);
+	}
+	free(str);
+	free(str128);
+	free(expected);
+}
+
+
+void TestLengths(char *url)
+{
+	char *escaped = url_Escape(url, 0, NULL);
+	char *full = url_EscapeIncludingReservedChars(url, 0, NULL);
+	char *canonical = url_CanonicalizeWithFullEscape(url, 0, NULL);
+	size_t escaped_len = url_EscapedLength(url, 0, false);
+	size_t full_len = url_EscapedLength(url, 0, true);
+	int64_t canonical_len = url_CanonicalLength(url, 0, true);
+
+	if(	   escaped_len != strlen(escaped) || full_len != strlen(full)
+		|| (canonical ? canonical_len != (int64_t)strlen(canonical) : canonical_len != -1))
+		printf(">>> FAILED [%s] >lengths %zu %zu %lld>\n", url, escaped_len, full_len, (long long)canonical_len);
+	else
+		printf("PASSED: [%s] >lengths %zu %zu %lld\n", url, escaped_len, full_len, (long long)canonical_len);
+	free(escaped);
+	free(full);
+	free(canonical);
+}
+
+
+void TestEquivalent(char *url1, char *url2, bool expected_result)
+{
+	bool equivalent = url_Equivalent(url1, 0, url2, 0);
+	if(equivalent != expected_result)
+		printf(">>> FAILED [%s], [%s] >%d expected %d>\n", url1, url2, equivalent, expected_result);
+	else
+		printf("PASSED: [%s], [%s] >%d\n", url1, url2, equivalent);
+}
+
+
+typedef struct {
+	char data[256];
+	size_t len;
+} Collected;
+
+
+void Collect(void *ctx, const char *bytes, size_t len)
+{
+	Collected *out = ctx;
+	if(out->len + len < sizeof(out->data)) {
+		memcpy(out->data + out->len, bytes, len);
+		out->len += len;
+	}
+	out->data[out->len] = '\0';
+}
+
+
+void TestCanonicalizerPolicy(url_canonicalizer *c, Collected *out, char *url, int policy, size_t max_len)
+{
+	// Feed the URL one byte at a time
+	out->len = 0;
+	url_CanonicalizerSetOpaquePolicy(c, policy, max_len);
+	for(size_t i=0; url[i]; i++)
+		url_CanonicalizerFeed(c, url+i, 1);
+	int ret = url_CanonicalizerFinish(c);
+
+	char *expected = url_CanonicalizeWithOpaquePolicy(url, 0, NULL, policy, max_len);
+	if(expected==NULL ? ret!=-1 : ret!=0 || strcmp(out->data, expected))
+		printf(">>> FAILED [%s] >[%s] expected [%s]>\n", url, ret ? "" : out->data, expected ? expected : "");
+	else
+		printf("PASSED: [%s] >[%s] byte by byte\n", url, ret ? "" : out->data);
+	free(expected);
+}
+
+
+void TestCanonicalizer(url_canonicalizer *c, Collected *out, char *url)
+{
+	TestCanonicalizerPolicy(c, out, url, URL_OPAQUE_PASSTHROUGH, 0);
+}
+
+
+int CheckSorted(void *ctx, const char *url, size_t len)
+{
+	char **last = ctx;
+	if(*last && strcmp(*last, url) >= 0)
+		printf(">>> FAILED [%s] sorted after [%s]\n", url, *last);
+	free(*last);
+	*last = strdup(url);
+	return(0);
+}
+
+
+void TestRules(const url_rules *rules, char *url, long expected_result)
+{
+	char *str = url_Canonicalize(url, 0, NULL);
+	if(str==NULL) {
+		fprintf(stderr, "Error while canonicalizing URL [%s]\n", url);
+		return;
+	}
+
+	long rule = url_RulesMatch(rules, str, 0);
+	if(rule != expected_result)
+		printf(">>> FAILED [%s] >%ld expected %ld>\n", str, rule, expected_result);
+	else
+		printf("PASSED: [%s] >%ld\n", str, rule);
+
+	free(str);
+}
+
+
+
+
+typedef struct {
+	size_t lines;
+	size_t bytes;
+	uint64_t sequences;
+} Totals;
+
+// Stage run by several threads : lengths of the canonicalized URLs, handed to the next stage,
+// in memory aligned on 16 bytes
+int MeasureStage(void *ctx, url_pipeline_batch *batch)
+{
+	(void)ctx;
+	size_t count = url_PipelineBatchCount(batch);
+	char *odd = url_PipelineBatchAlloc(batch, 1);
+	size_t *lens = url_PipelineBatchAlloc(batch, count*sizeof(size_t));
+	if(odd==NULL || lens==NULL || ((uintptr_t)odd & 15) || ((uintptr_t)lens & 15))
+		return(-1);
+	for(size_t i=0; i<count; i++)
+		if(url_BatchGet(url_PipelineBatchURLs(batch), i, &lens[i])==NULL)
+			lens[i] = 0;
+	url_PipelineBatchSetData(batch, lens);
+	return(0);
+}
+
+// Last stage, in one thread
+int TotalStage(void *ctx, url_pipeline_batch *batch)
+{
+	Totals *totals = ctx;
+	const size_t *lens = url_PipelineBatchData(batch);
+	if(lens==NULL)
+		return(-1);
+	for(size_t i=0; i<url_PipelineBatchCount(batch); i++)
+		totals->bytes += lens[i];
+	totals->lines += url_PipelineBatchCount(batch);
+	totals->sequences += url_PipelineBatchSequence(batch);
+	return(0);
+}
+
+
+void *ShmServe(void *shm)
+{
+	url_ShmServe(shm);
+	return(NULL);
+}
+
+// Compare the canonicalizations of the worker with url_Canonicalize(), one
+// by one then pipelined. Return the number of differences.
+size_t TestShmClient(url_shm_client *client, size_t count)
+{
+	size_t differences = 0;
+	char url[64];
+	for(size_t i=0; i<count; i++) {
+		snprintf(url, sizeof(url), "http://WWW.Host%zu.com/a/../%zu/./p%%41?q#f", i%13, i);
+		char *expected = url_Canonicalize(url, 0, NULL);
+		char *got = url_ShmCanonicalize(client, url, 0, NULL);
+		differences += got==NULL || strcmp(expected, got)!=0;
+		free(expected);
+		free(got);
+	}
+
+	uint64_t next = 0;
+	for(size_t i=0; i<count; i++) {
+		snprintf(url, sizeof(url), "http://host.com/%zu/../%zu", i, i*3);
+		while(url_ShmSubmit(client, url, 0, i)) {
+			uint64_t tag;
+			const char *got;
+			char *expected;
+			url_ShmReceive(client, &tag, &got, NULL);
+			snprintf(url, sizeof(url), "http://host.com/%llu/../%llu", (unsigned long long)tag, (unsigned long long)tag*3);
+			expected = url_Canonicalize(url, 0, NULL);
+			differences += tag!=next++ || strcmp(expected, got)!=0;
+			free(expected);
+			snprintf(url, sizeof(url), "http://host.com/%zu/../%zu", i, i*3);
+		}
+	}
+	uint64_t tag;
+	const char *got;
+	while(url_ShmReceive(client, &tag, &got, NULL)!=-1)
+		differences += tag!=next++;
+	return(differences + (next!=count));
+}
+
+
+// Compare the links extracted with url_Canonicalize(url_MakeAbsolute()) of
+// the links expected. Return the number of differences.
+size_t TestHtmlLinks(const url_batch *links, const char *base, const char **expected, size_t count)
+{
+	if(links==NULL || url_BatchCount(links)!=count)
+		return(count+1);
+	size_t differences = 0;
+	for(size_t i=0; i<count; i++) {
+		char *absolute = url_MakeAbsolute(base, expected[i]);
+		char *canonical = url_Canonicalize(absolute, 0, NULL);
+		const char *got = url_BatchGet(links, i, NULL);
+		differences += got==NULL || strcmp(canonical, got)!=0;
+		free(absolute);
+		free(canonical);
+	}
+	return(differences);
+}
+
+
+// Append the pairs of a form as "key:value|", '!' marking truncated keys
+// and '+' partial values
+int FormCollect(void *ctx, const char *key, size_t key_len, const char *value, size_t value_len, int flags)
+{
+	char *pairs = ctx;
+	size_t len = strlen(pairs);
+	snprintf(pairs + len, 256 - len, "%s%s:%s%s|", key, flags & URL_FORM_TRUNCATED ? "!" : "", value, flags & URL_FORM_PARTIAL ? "+" : "");
+	return(0);
+}
+
+
+// Count the calls, asking to stop at the first one
+int FormStop(void *ctx, const char *key, size_t key_len, const char *value, size_t value_len, int flags)
+{
+	(*(int *)ctx)++;
+	return(1);
+}
+
+
 int main(int argc, char *argv[])
 {
 	char *url = "http://www.test.in/wp/page.html/script.php?bill=1274fadc7%2Fpart%2Fabo2F&value2=put some value here; value3#fragment";
@@ -167,8 +429,519 @@ int main(int argc, char *argv[])
 
 
 
-}
-	
 
+	printf("%sXXH64 test vectors\n", url_Hash64("", 0, 0)==0xEF46DB3751D8E999ULL && url_Hash64("a", 0, 0)==0xD24EC4F1A98C6E5BULL ? "PASSED: " : ">>> FAILED ");
+	TestCanonicalizeAndHash("http://www.google.com/");
+	TestCanonicalizeAndHash("http://host/%25%32%35%25%32%35");
+	TestCanonicalizeAndHash("http://\x01\x80.com/a/long/enough/path/to/fill/several/stripes?and=a&query=string");
+
+	TestLengths("http://\x01\x80.com/a/long/enough/path/to/fill/several/stripes?and=a&query=string#frag");
+	TestLengths(" www.Example.com/%41%2523[x]/../y?a=\"b\"&c=d%e9 ");
+	TestLengths("");
+
+	TestEquivalent("HTTP://www.evil.com/blah#frag", "http://www.evil.com/blah", true);
+	TestEquivalent("http://host/%25%32%35", "http://host/%2525252525252525", true);
+	TestEquivalent("www.google.com", "http://www.google.com/", true);
+	TestEquivalent("http://www.google.com/blah/..", "http://www.google.com/", true);
+	TestEquivalent("http://3279880203/blah", "http://195.127.0.11/blah", true);
+	TestEquivalent("http://a.com/x?y=%2e%2e/", "http://a.com/x?y=../", true);
+	TestEquivalent("http://a.com/x?y=1", "http://b.com/x?y=1", false);
+	TestEquivalent("http://a.com/x/../y", "http://a.com/x/y", false);
+	TestEquivalent("http://a.com/", "http://a.com/x", false);
+	TestEquivalent("  ", "http://a.com/", false);
+
+	const char *dedupe_list[] = {
+		"http://www.google.com/", "www.google.com", "HTTP://www.GOOgle.com/#frag",
+		"http://host/%25%32%35", "http://host/%2525252525252525", "http://host/%25%25",
+	};
+	url_dedupe *dedupe = url_DedupeNew(URL_DEDUPE_FINGERPRINT128, 0);
+	url_dedupe *dedupe_hll = url_DedupeNew(URL_DEDUPE_HLL, 0);
+	int first_seen = 0;
+	for(size_t i=0; i<sizeof(dedupe_list)/sizeof(dedupe_list[0]); i++) {
+		first_seen += url_DedupeAdd(dedupe, dedupe_list[i], 0);
+		url_DedupeAdd(dedupe_hll, dedupe_list[i], 0);
+	}
+	printf("%sdedupe first seen %d, distinct %llu, estimate %llu\n",
+		first_seen==3 && url_DedupeCount(dedupe)==3 && url_DedupeCount(dedupe_hll)==3 ? "PASSED: " : ">>> FAILED ",
+		first_seen, (unsigned long long)url_DedupeCount(dedupe), (unsigned long long)url_DedupeCount(dedupe_hll));
+	url_DedupeFree(dedupe);
+	url_DedupeFree(dedupe_hll);
+
+	url_topk *topk = url_TopkNew(2, 1024, 0);
+	url_topk *topk_other = url_TopkNew(2, 1024, 0);
+	for(int i=0; i<50; i++) {
+		url_TopkAddHost(topk, "http://www.google.com/search", 0);
+		url_TopkAddHost(topk_other, "http://example.com/", 0);
+		if(i%5==0)
+			url_TopkAddHost(topk, "http://example.com/", 0);
+		if(i%2==0)
+			url_TopkAddHost(topk_other, "http://google.com/", 0);
+		char key[32];
+		snprintf(key, sizeof(key), "rare%d.com", i);
+		url_TopkAdd(topk, key, 0, 1);
+	}
+	url_TopkMerge(topk, topk_other);
+	url_topk_item items[2];
+	size_t top = url_TopkList(topk, items, 2);
+	printf("%stop hosts [%s] %llu, [%s] %llu\n",
+		top==2 && strcmp(items[0].key, "google.com")==0 && items[0].count-items[0].error<=75 && items[0].count>=75
+			&& strcmp(items[1].key, "example.com")==0 && items[1].count>=60 && url_TopkEstimate(topk, "google.com", 0)>=75 ? "PASSED: " : ">>> FAILED ",
+		top>0 ? items[0].key : "", top>0 ? (unsigned long long)items[0].count : 0,
+		top>1 ? items[1].key : "", top>1 ? (unsigned long long)items[1].count : 0);
+	url_TopkFree(topk);
+	url_TopkFree(topk_other);
+
+	url_intern *intern = url_InternNew(0);
+	uint32_t id_google = url_InternAdd(intern, "http://www.google.com/", 0);
+	uint32_t id_host = url_InternAddHost(intern, "http://www.google.com/search?q=1", 0);
+	uint32_t id_again = url_InternAdd(intern, "http://www.google.com/", 0);
+	size_t interned_len;
+	const char *interned = url_InternGet(intern, id_host, &interned_len);
+	printf("%sintern ids %u %u %u [%s]\n",
+		id_google==0 && id_host==1 && id_again==0 && interned && strcmp(interned, "google.com")==0 && interned_len==10
+			&& url_InternFind(intern, "google.com", 0)==1 && url_InternFind(intern, "example.com", 0)==URL_INTERN_NONE
+			&& url_InternCount(intern)==2 ? "PASSED: " : ">>> FAILED ",
+		id_google, id_host, id_again, interned ? interned : "");
+	url_InternFree(intern);
+
+	const char *dict_list[] = {
+		"http://example.com/", "http://example.com/a/b", "http://example.com/a/c",
+		"http://example.org/", "http://www.google.com/", "http://www.google.com/search?q=1",
+	};
+	url_dict_builder *dict_builder = url_DictBuilderNew("test_url.dict", 4);
+	for(size_t i=0; i<sizeof(dict_list)/sizeof(dict_list[0]); i++)
+		url_DictBuilderAdd(dict_builder, dict_list[i], 0);
+	int dict_built = url_DictBuilderFinish(dict_builder);
+	url_dict *dict = url_DictOpen("test_url.dict");
+	int dict_prefixed = 0;
+	url_dict_cursor *cursor = url_DictScan(dict, "http://example.com/a/", 0);
+	while(url_DictNext(cursor, NULL))
+		dict_prefixed++;
+	url_DictCursorFree(cursor);
+	printf("%sdictionary file, %d strings with prefix\n",
+		dict_built==0 && url_DictCount(dict)==6 && url_DictFind(dict, "http://www.google.com/", 0)==4
+			&& url_DictFind(dict, "http://example.com/a/", 0)==-1 && dict_prefixed==2 ? "PASSED: " : ">>> FAILED ",
+		dict_prefixed);
+	url_DictClose(dict);
+	remove("test_url.dict");
+
+	const char *batch_list[] = { "www.google.com", "  ", "http://Example.com:8080/a/../b?x=1" };
+	url_batch *batch = url_BatchNew();
+	size_t batch_done = url_CanonicalizeBatch(batch, batch_list, NULL, 3);
+	url_columns_writer *columns_writer = url_ColumnsWriterNew("test_url.columns");
+	url_ColumnsWriterAddBatch(columns_writer, batch);
+	url_ColumnsWriterAdd(columns_writer, "http://www.google.com/search?q=1", 0);
+	int columns_written = url_ColumnsWriterFinish(columns_writer);
+	url_columns *columns = url_ColumnsOpen("test_url.columns");
+	const uint32_t *host_ids = url_ColumnsHostIds(columns);
+	const char *columns_query = url_ColumnsGet(columns, URL_COLUMN_QUERY, 1, NULL);
+	printf("%sbatch and columnar file [%s] [%s] [%s]\n",
+		batch_done==2 && url_BatchGet(batch, 1, NULL)==NULL && columns_written==0 && url_ColumnsCount(columns)==3
+			&& url_ColumnsHostCount(columns)==2 && host_ids[0]==host_ids[2]
+			&& strcmp(url_ColumnsHostName(columns, host_ids[1], NULL), "example.com:8080")==0
+			&& strcmp(url_ColumnsGet(columns, URL_COLUMN_PATH, 1, NULL), "/b")==0
+			&& url_ColumnsGet(columns, URL_COLUMN_QUERY, 0, NULL)==NULL && columns_query && strcmp(columns_query, "x=1")==0 ? "PASSED: " : ">>> FAILED ",
+		url_ColumnsGet(columns, URL_COLUMN_SCHEME, 1, NULL), url_ColumnsGet(columns, URL_COLUMN_HOST, 1, NULL), url_ColumnsGet(columns, URL_COLUMN_PATH, 1, NULL));
+	url_ColumnsClose(columns);
+	url_BatchFree(batch);
+	remove("test_url.columns");
+
+	url_sorter *sorter = url_SorterNew(NULL, 4096, 2);
+	for(int i=0; i<2000; i++) {
+		char sort_url[64];
+		snprintf(sort_url, sizeof(sort_url), "HTTP://host%d.com/%d%s", i%10, (i/10)%50, i%3 ? "#frag" : "");
+		url_SorterAdd(sorter, sort_url, 0);
+	}
+	char *last_sorted = NULL;
+	int64_t sorted = url_SorterFinish(sorter, CheckSorted, &last_sorted);
+	printf("%sexternal sort, %lld distinct URLs, last [%s]\n", sorted==500 ? "PASSED: " : ">>> FAILED ",
+		(long long)sorted, last_sorted ? last_sorted : "");
+	free(last_sorted);
+	url_SorterFree(sorter);
+
+	// Enough runs to be merged while adding, on two levels
+	sorter = url_SorterNew(NULL, 4096, 0);
+	for(int i=0; i<60000; i++) {
+		char sort_url[64];
+		snprintf(sort_url, sizeof(sort_url), "http://host%d.com/%d", i%20000%7, i%20000);
+		url_SorterAdd(sorter, sort_url, 0);
+	}
+	last_sorted = NULL;
+	sorted = url_SorterFinish(sorter, CheckSorted, &last_sorted);
+	printf("%sexternal sort of many runs, %lld distinct URLs\n", sorted==20000 ? "PASSED: " : ">>> FAILED ", (long long)sorted);
+	free(last_sorted);
+	url_SorterFree(sorter);
+
+	Collected collected;
+	url_canonicalizer *canonicalizer = url_CanonicalizerNew(false, 128, Collect, &collected);
+	TestCanonicalizer(canonicalizer, &collected, "  HTTP://www.Example.com:80/a/./b/../%2563?x=%41#frag ");
+	TestCanonicalizer(canonicalizer, &collected, "3279880203/%%%32%35");
+	TestCanonicalizer(canonicalizer, &collected, " \t ");
+	collected.len = 0;
+	url_CanonicalizerFeed(canonicalizer, "http://example.com/?", 20);
+	for(int i=0; i<1000; i++)
+		url_CanonicalizerFeed(canonicalizer, "0123456789", 10);
+	int long_query = url_CanonicalizerFinish(canonicalizer);
+	for(int i=0; i<1000; i++)
+		url_CanonicalizerFeed(canonicalizer, "/0123456789", 11);
+	int long_path = url_CanonicalizerFinish(canonicalizer);
+	printf("%sbounded canonicalizer state, long query %d, long path %d\n",
+		long_query==0 && long_path==-1 ? "PASSED: " : ">>> FAILED ", long_query, long_path);
+
+	TestCanonicalize(" DATA:text/plain,A%20b c\t\u00e9#frag ", "data:text/plain,A%20b%20c%C3%A9");
+	TestCanonicalize("JavaScript:alert(1)//x/../y", "javascript:alert(1)//x/../y");
+	TestCanonicalizer(canonicalizer, &collected, "  mailTo:Someone@Example.com?subject=%41 b#x");
+	TestCanonicalizerPolicy(canonicalizer, &collected, "data:image/png;base64,iVBORw0KGgo", URL_OPAQUE_TRUNCATE, 10);
+	TestCanonicalizerPolicy(canonicalizer, &collected, "blob:https://example.com/550e8400", URL_OPAQUE_HASH, 0);
+	TestCanonicalizer(canonicalizer, &collected, "data:image/png;base64,iVBORw0KGgo");
+	url_CanonicalizerFree(canonicalizer);
 
+	// The policy of a batch only applies to it, url_Normalize() unescapes
+	const char *opaque_list[] = { "data:image/png;base64,iVBORw0KGgo", "http://a.com/" };
+	url_batch *opaque_batch = url_BatchNew();
+	url_BatchSetOpaquePolicy(opaque_batch, URL_OPAQUE_TRUNCATE, 10);
+	url_CanonicalizeBatch(opaque_batch, opaque_list, NULL, 2);
+	const char *opaque_truncated = url_BatchGet(opaque_batch, 0, NULL);
+	char *opaque_canonical = url_Canonicalize(opaque_list[0], 0, NULL);
+	char *opaque_normalized = url_Normalize(" DATA:text/plain,A%20b c\t#frag ", 31, NULL);
+	printf("%sopaque policy [%s] [%s] [%s]\n",
+		opaque_truncated && strcmp(opaque_truncated, "data:image")==0 && strcmp(opaque_canonical, opaque_list[0])==0
+			&& opaque_normalized && strcmp(opaque_normalized, "data:text/plain,A b c")==0 ? "PASSED: " : ">>> FAILED ",
+		opaque_truncated, opaque_canonical, opaque_normalized);
+	free(opaque_canonical);
+	free(opaque_normalized);
+	url_BatchFree(opaque_batch);
+
+	url_stats stats;
+	url_ResetStats();
+	free(url_Canonicalize("http://host/%2525252541/a/../b", 0, NULL));
+	bool stats_enabled = url_GetStats(&stats);
+	url_stats encode_stats;
+	url_ResetStats();
+	free(url_Encode("a%00 b", 0, NULL));	// Encoding stops at the decoded NUL
+	url_GetStats(&encode_stats);
+	if(stats_enabled)
+		printf("%sstatistics, %llu canonicalization, %llu escaped bytes, unescape depth 5: %llu\n",
+			stats.functions[URL_STATS_CANONICALIZE].calls==1 && stats.functions[URL_STATS_UNESCAPE].calls==1
+				&& stats.escaped==0 && stats.unescape_depth[5]==1 && stats.allocs>0 && encode_stats.escaped==0 ? "PASSED: " : ">>> FAILED ",
+			(unsigned long long)stats.functions[URL_STATS_CANONICALIZE].calls, (unsigned long long)stats.escaped,
+			(unsigned long long)stats.unescape_depth[5]);
+	else
+		printf("%sstatistics compiled out\n", stats.functions[URL_STATS_CANONICALIZE].calls==0 ? "PASSED: " : ">>> FAILED ");
 
+	// More than one group of lanes, simple URLs and the others in between
+	const char *lanes_list[] = {
+		"http://WWW.Example.com/A/b?Q=1", "HTTPS://a.b", "http://host/a//b", "http://1234/", "http://a.com?x",
+		"http://.a.com/", "http://a.com./x", "http://a.com/%41", "http://a.com/./x", "http://Ex.com:80/p#f",
+		"https://x.org/path/to/page.html?utm=1&b=2", "www.google.com", "http://a.com/x y", "ftp://a.com/",
+		"http://a.com/..", "http://a.b/c", "http://Z.com", "javascript://x", "http://a.com/\x80", "HTTP://b.NET/C"
+	};
+	size_t lanes_count = sizeof(lanes_list)/sizeof(lanes_list[0]);
+	url_batch *lanes_batch = url_BatchNew();
+	size_t lanes_done = url_CanonicalizeBatch(lanes_batch, lanes_list, NULL, lanes_count);
+	size_t lanes_same = 0, lanes_expected = 0;
+	for(size_t i=0; i<lanes_count; i++) {
+		char *expected = url_Canonicalize(lanes_list[i], 0, NULL);
+		const char *got = url_BatchGet(lanes_batch, i, NULL);
+		lanes_expected += expected!=NULL;
+		if(expected ? got && strcmp(expected, got)==0 : got==NULL)
+			lanes_same++;
+		free(expected);
+	}
+	printf("%sbatch lanes, %zu/%zu URLs as url_Canonicalize()\n",
+		lanes_same==lanes_count && lanes_done==lanes_expected ? "PASSED: " : ">>> FAILED ", lanes_same, lanes_count);
+	url_BatchFree(lanes_batch);
+
+	// Same URLs split by hostname, hostnames found in the lanes or not
+	const char *shards_list[] = { "http://www.A.com:8080/x", "http://www.a.com/y", "http://user:pw@a.com/", "http://a.com:80/%41" };
+	url_batch *shards_batch = url_BatchNewSharded(4);
+	size_t shards_done = url_CanonicalizeBatch(shards_batch, lanes_list, NULL, lanes_count);
+	shards_done += url_CanonicalizeBatch(shards_batch, shards_list, NULL, 4);
+	shards_done += url_CanonicalizeBatch(shards_batch, lanes_list, NULL, lanes_count);
+	size_t shards_wrong = 0, shards_total = 0;
+	for(size_t i=0; i<url_BatchCount(shards_batch); i++) {
+		const char *list_url = i<lanes_count ? lanes_list[i] : i<lanes_count+4 ? shards_list[i-lanes_count] : lanes_list[i-lanes_count-4];
+		char *expected = url_Canonicalize(list_url, 0, NULL);
+		size_t len, host_len = 0, expected_host_len;
+		const char *got = url_BatchGet(shards_batch, i, &len);
+		const char *host = url_BatchGetHost(shards_batch, i, &host_len);
+		if(expected ? got==NULL || strcmp(expected, got)!=0 || host!=got + (url_FindHostname(got, len, &expected_host_len) - got)
+				|| host_len!=expected_host_len : got!=NULL)
+			shards_wrong++;
+		free(expected);
+	}
+	for(unsigned shard=0; shard<url_BatchShards(shards_batch); shard++) {
+		size_t data_len = 0, offset = 0, previous = 0;
+		const char *data = url_BatchShardData(shards_batch, shard, &data_len);
+		for(size_t i=0; i<url_BatchShardCount(shards_batch, shard); i++) {
+			size_t len, index, host_len;
+			const char *url = url_BatchShardGet(shards_batch, shard, i, &len, &index);
+			const char *host = url_BatchGetHost(shards_batch, index, &host_len);
+			if(url_BatchHostShard(host, host_len, 4)!=shard || (i && index<=previous) || offset+len>=data_len || memcmp(data+offset, url, len+1))
+				shards_wrong++;
+			offset += len+1;
+			previous = index;
+		}
+		shards_total += url_BatchShardCount(shards_batch, shard);
+	}
+	printf("%sbatch shards, %zu URLs in 4 shards, %zu wrong\n",
+		shards_wrong==0 && shards_total==shards_done ? "PASSED: " : ">>> FAILED ", shards_total, shards_wrong);
+	url_BatchFree(shards_batch);
+
+	// Example of the Safe Browsing documentation
+	size_t lookup_count, lookup_len;
+	char *lookups = url_GetLookupExpressions("http://a.b.c/1/2.html?param=1", 0, &lookup_count, &lookup_len);
+	const char lookups_expected[] = "a.b.c/1/2.html?param=1\0a.b.c/1/2.html\0a.b.c/\0a.b.c/1/\0"
+		"b.c/1/2.html?param=1\0b.c/1/2.html\0b.c/\0b.c/1/";
+	printf("%slookup expressions, %zu for http://a.b.c/1/2.html?param=1\n",
+		lookups && lookup_count==8 && lookup_len==sizeof(lookups_expected) && memcmp(lookups, lookups_expected, lookup_len)==0 ? "PASSED: " : ">>> FAILED ",
+		lookup_count);
+	free(lookups);
+
+	// Small batches and rings, so that stages wait for each other
+	url_pipeline *pipeline = url_PipelineNew(64, 2);
+	Totals totals = { 0, 0, 0 };
+	url_PipelineAddStage(pipeline, "canonicalize", url_PipelineCanonicalize, NULL, 2);
+	url_PipelineAddStage(pipeline, "measure", MeasureStage, NULL, 2);
+	url_PipelineAddStage(pipeline, "total", TotalStage, &totals, 1);
+	int pipeline_status = url_PipelineStart(pipeline);
+	size_t pipeline_lines = 5000, pipeline_bytes = 0;
+	for(size_t i=0; i<pipeline_lines; i++) {
+		char line[64];
+		snprintf(line, sizeof(line), "http://Host%zu.example.com/a/../%zu/./p?q#f", i%37, i);
+		char *expected = url_Canonicalize(line, 0, NULL);
+		pipeline_bytes += strlen(expected);
+		free(expected);
+		pipeline_status |= url_PipelinePush(pipeline, line, 0);
+	}
+	pipeline_status |= url_PipelineFinish(pipeline);
+	url_pipeline_stats pipeline_stats[4];
+	int pipeline_stages = url_PipelineGetStats(pipeline, pipeline_stats, 4);
+	uint64_t batches = (pipeline_lines+63)/64;
+	printf("%spipeline, %zu lines of %zu bytes in %llu batches, max depth %zu\n",
+		pipeline_status==0 && pipeline_stages==4 && totals.lines==pipeline_lines && totals.bytes==pipeline_bytes
+			&& totals.sequences==batches*(batches-1)/2 && pipeline_stats[3].batches==batches
+			&& pipeline_stats[1].lines==pipeline_lines && pipeline_stats[2].max_depth<=2 ? "PASSED: " : ">>> FAILED ",
+		totals.lines, totals.bytes, (unsigned long long)pipeline_stats[3].batches, pipeline_stats[2].max_depth);
+	url_PipelineFree(pipeline);
+
+	// Worker in a thread, a client in another process and another one here
+	url_shm *shm = url_ShmNew(4, 8, 128);
+	pthread_t shm_thread;
+	pthread_create(&shm_thread, NULL, ShmServe, shm);
+	pid_t shm_child = fork();
+	if(shm_child==0) {
+		url_shm_client *client = url_ShmAttach(url_ShmFd(shm));
+		size_t differences = client ? TestShmClient(client, 2000) : 1;
+		url_ShmDetach(client);
+		_exit(differences ? 1 : 0);
+	}
+	url_shm_client *shm_client = url_ShmAttach(url_ShmFd(shm));
+	size_t shm_differences = TestShmClient(shm_client, 2000);
+	int shm_status = -1;
+	waitpid(shm_child, &shm_status, 0);
+
+	// A client dying with requests pending, its queue attached again
+	pid_t shm_dead = fork();
+	if(shm_dead==0) {
+		url_shm_client *client = url_ShmAttach(url_ShmFd(shm));
+		for(int i=0; client && i<8; i++)
+			url_ShmSubmit(client, "http://dead.com/", 0, 1000+i);
+		_exit(0);
+	}
+	waitpid(shm_dead, NULL, 0);
+	url_shm_client *shm_others[3];
+	for(int i=0; i<3; i++)
+		shm_others[i] = url_ShmAttach(url_ShmFd(shm));
+	for(int i=0; i<3; i++) {
+		shm_differences += shm_others[i] ? TestShmClient(shm_others[i], 200) : 1;
+		url_ShmDetach(shm_others[i]);
+	}
+
+	// Too long for a slot once canonicalized, then for the request itself
+	char shm_long[200];
+	memset(shm_long, ' ', sizeof(shm_long));
+	memcpy(shm_long, "http://a.com/", 13);
+	shm_long[100] = '\0';
+	char *shm_expected = url_Canonicalize(shm_long, 0, NULL);
+	char *shm_got = url_ShmCanonicalize(shm_client, shm_long, 0, NULL);
+	shm_differences += strcmp(shm_expected, shm_got)!=0;
+	free(shm_expected);
+	free(shm_got);
+	shm_long[sizeof(shm_long)-1] = '\0';
+	shm_expected = url_Canonicalize(shm_long, 0, NULL);
+	shm_got = url_ShmCanonicalize(shm_client, shm_long, 0, NULL);
+	shm_differences += strcmp(shm_expected, shm_got)!=0;
+	free(shm_expected);
+	free(shm_got);
+
+	url_ShmDetach(shm_client);
+	url_ShmStop(shm);
+	pthread_join(shm_thread, NULL);
+	url_ShmFree(shm);
+	printf("%sshared memory worker, %zu differences, child exit status %d\n",
+		shm_differences==0 && WIFEXITED(shm_status) && WEXITSTATUS(shm_status)==0 ? "PASSED: " : ">>> FAILED ",
+		shm_differences, WIFEXITED(shm_status) ? WEXITSTATUS(shm_status) : -1);
+
+	// Whole page, then one byte at a time
+	const char html_page[] =
+		"<html><head><title>a <a href=title.html></title>"
+		"<meta http-equiv=\"Refresh\" content=\"5; URL='refresh.html?a=1&amp;b=2'\">"
+		"<script>document.write('<a href=\"script.html\">');</script></head>"
+		"<body><!-- <a href=\"comment.html\"> --><p>Text &amp; <a href=\"a.html?x=1&amp;y=2&copy=3\">a</a>"
+		"<img alt='x > y' src = '../img/b.png'><A HREF = /root.html#top >"
+		"<a href=\"javascript:void(0)\"><a href=''><form action=\"&#x2F;post?q=&#233;\">"
+		"<a href=\"  //other.com/c d  \"><a class=x href=https://secure.com/e>";
+	const char *html_expected[] = {
+		"refresh.html?a=1&b=2", "a.html?x=1&y=2&copy=3", "../img/b.png", "/root.html#top",
+		"/post?q=\xc3\xa9", "//other.com/c d", "https://secure.com/e"
+	};
+	const char *html_base = "http://www.example.com/dir/page.html?x";
+	url_html *html = url_HtmlNew();
+	size_t html_differences = TestHtmlLinks(url_HtmlExtract(html, html_base, html_page, 0), html_base, html_expected, 7);
+	url_HtmlBegin(html, html_base, 0);
+	for(size_t i=0; i<sizeof(html_page)-1; i++)
+		url_HtmlFeed(html, html_page+i, 1);
+	html_differences += TestHtmlLinks(url_HtmlFinish(html), html_base, html_expected, 7);
+
+	// Only the first <base href> counts
+	const char *html_base_expected[] = { "x.html", "/y.html" };
+	html_differences += TestHtmlLinks(url_HtmlExtract(html, html_base,
+		"<base href=\"https://cdn.example.org/static/\"><base href=\"http://no.com/\"><a href=x.html><a href=/y.html>", 0),
+		"https://cdn.example.org/static/", html_base_expected, 2);
+	url_HtmlFree(html);
+	printf("%sHTML links, %zu differences\n", html_differences==0 ? "PASSED: " : ">>> FAILED ", html_differences);
+
+	// Longest match, Allow winning ties, wildcards, and the "*" group
+	const char *robots_txt =
+		"User-agent: OtherBot\nDisallow: /\n\n"
+		"User-agent: mybot/2.1 # comment\r\nUser-agent: AnotherBot\n"
+		"Disallow: /private\nAllow: /private/public\nDisallow: /*.gif$\n"
+		"Allow: /p\nDisallow: /p\nDisallow: /search?q=*&page=\nDisallow: /caf%c3%a9\nDisallow: /tmp$\nDisallow:\n\n"
+		"User-agent: *\nDisallow: /\n";
+	const struct { const char *url; int expected; } robots_tests[] = {
+		{ "http://example.com/", URL_ROBOTS_ALLOWED },
+		{ "http://example.com/private/x", URL_ROBOTS_DISALLOWED },
+		{ "http://example.com/private/public/y", URL_ROBOTS_ALLOWED },
+		{ "http://example.com/img/a.gif", URL_ROBOTS_DISALLOWED },
+		{ "http://example.com/img/a.gif?x", URL_ROBOTS_ALLOWED },
+		{ "http://example.com/p", URL_ROBOTS_ALLOWED },
+		{ "http://example.com/search?q=x&page=2", URL_ROBOTS_DISALLOWED },
+		{ "http://example.com/search?q=x", URL_ROBOTS_ALLOWED },
+		{ "http://example.com/caf\xc3\xa9/menu", URL_ROBOTS_DISALLOWED },
+		{ "http://example.com/tmp", URL_ROBOTS_DISALLOWED },
+		{ "http://example.com/tmp/", URL_ROBOTS_ALLOWED }
+	};
+	size_t robots_count = sizeof(robots_tests)/sizeof(robots_tests[0]), robots_same = 0;
+	url_robots_rules *robots_rules = url_RobotsCompile(robots_txt, 0, "MyBot/1.0");
+	for(size_t i=0; i<robots_count; i++) {
+		char *canonical = url_Canonicalize(robots_tests[i].url, 0, NULL);
+		robots_same += url_RobotsRulesMatch(robots_rules, canonical, 0)==robots_tests[i].expected;
+		free(canonical);
+	}
+	url_RobotsRulesFree(robots_rules);
+	robots_rules = url_RobotsCompile(robots_txt, 0, "Nobody");
+	robots_same += url_RobotsRulesMatch(robots_rules, "http://example.com/p", 0)==URL_ROBOTS_DISALLOWED;
+	robots_same += url_RobotsRulesMatch(robots_rules, "http://example.com/robots.txt", 0)==URL_ROBOTS_ALLOWED;
+	url_RobotsRulesFree(robots_rules);
+	printf("%srobots.txt rules, %zu/%zu URLs as expected\n", robots_same==robots_count+2 ? "PASSED: " : ">>> FAILED ", robots_same, robots_count+2);
+
+	// Two hosts kept : b.com is the least recently used when c.com comes
+	url_robots *robots = url_RobotsNew("MyBot", 2);
+	url_RobotsAdd(robots, "a.com", "User-agent: *\nDisallow: /a", 0);
+	url_RobotsAdd(robots, "b.com", "", 0);
+	int robots_a = url_RobotsCheck(robots, "http://www.a.com/a/b", 0);
+	url_RobotsAdd(robots, "c.com", "User-agent: mybot\nAllow: /", 0);
+
+	// The hostname of an URL with userinfo is escaped by url_GetHostname()
+	char *robots_user = url_Canonicalize("http://user@www.b.com/private/x", 0, NULL);
+	char *robots_user_host = url_GetHostname(robots_user);
+	url_robots *robots_users = url_RobotsNew("MyBot", 0);
+	url_RobotsAdd(robots_users, robots_user_host, "User-agent: *\nDisallow: /private", 0);
+	int robots_userinfo = url_RobotsCheck(robots_users, robots_user, 0);
+	url_RobotsFree(robots_users);
+	free(robots_user_host);
+	free(robots_user);
+	printf("%srobots.txt cache, a.com %d, b.com %d, c.com %d\n",
+		robots_a==URL_ROBOTS_DISALLOWED && url_RobotsCheck(robots, "http://a.com/", 0)==URL_ROBOTS_ALLOWED
+			&& url_RobotsCheck(robots, "http://b.com/", 0)==URL_ROBOTS_UNKNOWN
+			&& robots_userinfo==URL_ROBOTS_DISALLOWED
+			&& url_RobotsCheck(robots, "https://c.com/a", 0)==URL_ROBOTS_ALLOWED
+			&& url_RobotsCheck(robots, NULL, 0)==-1 ? "PASSED: " : ">>> FAILED ",
+		robots_a, url_RobotsCheck(robots, "http://b.com/", 0), url_RobotsCheck(robots, "http://c.com/a", 0));
+	url_RobotsFree(robots);
+
+	// Single decoding pass, '+' as space, whole body then one byte at a time
+	const char *form_body = "a=1&b=x+y%20z%2B&c=%2541&&d&e=%zz=%4&f%3Dg=h";
+	const char *form_expected = "a:1|b:x y z+|c:%41|d:|e:%zz=%4|f=g:h|";
+	char form_pairs[256] = "", form_chunked[256] = "", form_limited[256] = "";
+	url_form *form = url_FormNew(0, FormCollect, form_pairs);
+	url_FormFeed(form, form_body, strlen(form_body));
+	url_FormFinish(form);
+	url_FormFree(form);
+	form = url_FormNew(0, FormCollect, form_chunked);
+	for(size_t i=0; form_body[i]; i++)
+		url_FormFeed(form, form_body+i, 1);
+	url_FormFinish(form);
+	url_FormFree(form);
+
+	// Pairs longer than the limit
+	form = url_FormNew(4, FormCollect, form_limited);
+	url_FormFeed(form, "key12345=abcdefghij&k=v", 23);
+	url_FormFeed(form, "+", 1);
+	url_FormFinish(form);
+	url_FormFree(form);
+	// Callback stopping on a partial value
+	char form_long[103] = "k=";
+	memset(form_long+2, 'a', 100);
+	form_long[102] = '\0';
+	int form_calls = 0;
+	form = url_FormNew(16, FormStop, &form_calls);
+	int form_stopped = url_FormFeed(form, form_long, 102);
+	url_FormFinish(form);
+	url_FormFree(form);
+	char *form_encoded = url_FormEncode("a b&c=%41/\xc3\xa9*", 0, NULL);
+	char *form_url_encoded = url_Encode("a b", 0, NULL);
+	printf("%sform codec, [%s] [%s] [%s]\n",
+		strcmp(form_pairs, form_expected)==0 && strcmp(form_chunked, form_expected)==0
+			&& strcmp(form_limited, "key1!:abcd+|key1!:efgh+|key1!:ij|k:v |")==0
+			&& strcmp(form_encoded, "a+b%26c%3D%2541%2F%C3%A9*")==0 && strcmp(form_url_encoded, "a+b")==0
+			&& form_stopped==-1 && form_calls==1 ? "PASSED: " : ">>> FAILED ",
+		form_pairs, form_limited, form_encoded);
+	free(form_encoded);
+	free(form_url_encoded);
+
+	const char *rules_list[] = {
+		"example.com",
+		"ads.example.com/banner/",
+		"http://www.evil.com/phish",
+		"example.com/private",
+		".tracker.net:8080/",
+		"example.com",
+	};
+	url_rules *rules = url_RulesCompile(rules_list, sizeof(rules_list)/sizeof(rules_list[0]));
+	if(rules==NULL) {
+		fprintf(stderr, "Error while compiling rules\n");
+		exit(-1);
+	}
+	TestRules(rules, "http://example.com/", 0);
+	TestRules(rules, "http://www.EXAMPLE.com/index.html", 0);
+	TestRules(rules, "http://badexample.com/", URL_RULES_NO_MATCH);
+	TestRules(rules, "http://ads.example.com/banner/1.gif", 1);
+	TestRules(rules, "http://ads.example.com/banner", 0);
+	TestRules(rules, "http://example.com/private/data", 3);
+	TestRules(rules, "http://example.com:8080/privateer?x=1", 3);
+	TestRules(rules, "http://www.evil.com/phishing?id=1", 2);
+	TestRules(rules, "http://evil.com/phish", URL_RULES_NO_MATCH);
+	TestRules(rules, "http://www.evil.com/", URL_RULES_NO_MATCH);
+	TestRules(rules, "http://cdn.tracker.net/pixel", 4);
+	TestRules(rules, "http://example.org/", URL_RULES_NO_MATCH);
+
+	url_ruleset *ruleset = url_RulesetNew(rules);
+	const char *new_rules_list[] = { "example.org" };
+	url_RulesetSwap(ruleset, url_RulesCompile(new_rules_list, 1));
+	long rule = url_RulesetMatch(ruleset, "http://example.org/", 0);
+	printf("%sruleset swap [%ld]\n", rule==0 && url_RulesetMatch(ruleset, "http://example.com/", 0)==URL_RULES_NO_MATCH ? "PASSED: " : ">>> FAILED ", rule);
+	url_RulesetFree(ruleset);
+
+}
@@ -0,0 +1,123 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory_resource>
+#include <string_view>
+
+#include "url.hpp"
+#include "url_constexpr.hpp"
+
+/*
+	Check that the templates of url.hpp and the constexpr functions of
+	url_constexpr.hpp give the same results as the functions of url.c.
+
+	To compile : gcc -std=c99 -c url.c && g++ -std=c++20 -Wall test_url_hpp.cpp url.o -o test_url_hpp -lm
+*/
+
+
+void Check(const char *what, std::string_view src, const char *expected, std::string_view result)
+{
+	if(expected==NULL || result!=expected)
+		printf(">>> FAILED %s [%.*s]>[%.*s] expected [%s]\n", what, (int)src.size(), src.data(), (int)result.size(), result.data(), expected ? expected : "NULL");
+	else
+		printf("PASSED: %s [%.*s]>[%.*s]\n", what, (int)src.size(), src.data(), (int)result.size(), result.data());
+}
+
+
+constexpr bool Normalizes(std::string_view src, std::string_view expected)
+{
+	std::string dest;
+	return(url::constant::normalize(src, dest) && dest==expected);
+}
+
+// Opaque URLs are unescaped by normalize(), only cleaned by canonicalize()
+static_assert(Normalizes("mailto:%25", "mailto:%"));
+static_assert(Normalizes("javascript:mailto:data:%2F%2e%41?", "javascript:mailto:data:/.A?"));
+static_assert(url::canonical<"mailto:%25">().view()=="mailto:%25");
+
+
+int main(void)
+{
+	const char *urls[] = {
+		"http://host/%25%32%35",
+		"http://www.GOOgle.com/",
+		"http://host.com/ab%23cd",
+		"http://host/%%%25%32%35asd%%",
+		"http://www.google.com/q?r?s ",
+		"  http://www.google.com/a/../b/#frag",
+		"http://\x01\x80.com/",
+		"javascript:alert(1)#x",
+		"mailto:%25",
+		" javascript:mailto:data:%2F%2e%41? ",
+		"a:b;c=d?e [f]"
+	};
+
+	// A memory resource on the stack : no heap allocation for the results
+	char arena[4096];
+	for(size_t i=0; i<sizeof(urls)/sizeof(urls[0]); i++) {
+		std::pmr::monotonic_buffer_resource mr(arena, sizeof(arena), std::pmr::null_memory_resource());
+		std::string_view url = urls[i];
+		char buffer[256];
+		char *expected;
+
+		expected = url_Escape(url.data(), url.size(), NULL);
+		Check("escape", url, expected, url::escape(url, &mr));
+		free(expected);
+
+		expected = url_EscapeIncludingReservedChars(url.data(), url.size(), NULL);
+		size_t len = url::escape<url::escape_reserved>(url, buffer, sizeof(buffer));
+		Check("escape_reserved", url, expected, std::string_view(buffer, len));
+		free(expected);
+
+		expected = url_Unescape(url.data(), url.size(), NULL);
+		Check("unescape", url, expected, url::unescape(url, &mr));
+		free(expected);
+
+		expected = url_Encode(url.data(), url.size(), NULL);
+		Check("encode", url, expected, url::encode(url, &mr));
+		free(expected);
+
+		expected = url_Canonicalize(url.data(), url.size(), NULL);
+		Check("canonicalize", url, expected, url::canonicalize(url, &mr));
+		free(expected);
+
+		expected = url_CanonicalizeWithFullEscape(url.data(), url.size(), NULL);
+		len = url::canonicalize<url::escape_reserved>(url, buffer, sizeof(buffer));
+		Check("canonicalize_reserved", url, expected, len==url::npos ? "" : std::string_view(buffer, len));
+		free(expected);
+
+		std::string normalized;
+		expected = url_Normalize(url.data(), url.size(), NULL);
+		Check("constant::normalize", url, expected, url::constant::normalize(url, normalized) ? normalized : "");
+		free(expected);
+
+		std::string canonical;
+		expected = url_Canonicalize(url.data(), url.size(), NULL);
+		Check("constant::canonicalize", url, expected, url::constant::canonicalize(url, canonical) ? canonical : "");
+		free(expected);
+	}
+
+	// Single decoding pass
+	char buffer[32];
+	size_t len = url::unescape<url::unescape_once>("%2541%41", buffer, sizeof(buffer));
+	Check("unescape_once", "%2541%41", "%41A", std::string_view(buffer, len));
+
+	// Buffer too small : the length needed is returned
+	len = url::escape("a b", buffer, 3);
+	Check("escape_length", "a b", "5", len==5 ? "5" : "");
+	len = url::canonicalize(" \t ", buffer, sizeof(buffer));
+	Check("canonicalize_error", " \t ", "npos", len==url::npos ? "npos" : "");
+
+	// Canonicalized by the compiler
+	using namespace url::literals;
+	static constexpr auto literal = "http://3279880203/blah"_canonical;
+	static_assert(literal.view()=="http://195.127.0.11/blah");
+	Check("_canonical", "http://3279880203/blah", "http://195.127.0.11/blah", literal.view());
+
+	// SHA-256 of the expression "195.127.0.11/blah" starts with 5f2e66eb
+	char prefix[16];
+	snprintf(prefix, sizeof(prefix), "%02x%02x%02x%02x", literal.prefix[0], literal.prefix[1], literal.prefix[2], literal.prefix[3]);
+	Check("prefix", literal.view(), "5f2e66eb", prefix);
+
+	return(0);
+}
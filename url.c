@@ -12,6 +12,7 @@
 #include <string.h>
 #include <strings.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <netinet/in.h>
 
@@ -19,6 +20,23 @@
 	#include <bsd/stdlib.h>
 #endif
 
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#ifdef URL_STATS
+	#include <pthread.h>
+	#if defined(__x86_64__) || defined(__i386__)
+		#include <x86intrin.h>
+	#else
+		#include <time.h>
+	#endif
+#endif
+
+#ifdef URL_USDT
+	#include <sys/sdt.h>
+#endif
+
 #include "url.h"
 
 
@@ -28,6 +46,156 @@
 
 #define LOWERCASE(x) ((x)>='A' && (x)<='Z' ? (x)-'A'+'a' : (x))
 
+
+#ifdef URL_STATS
+
+// Counters of a thread, taken over by a new thread once it exits
+typedef struct url_stats_block {
+	url_stats stats;
+	struct url_stats_block *next;
+	int used;
+} url_stats_block;
+
+// Shared by the threads which could not allocate their own block, and
+// never taken over
+static url_stats_block url_StatsFallback = { .used = 1 };
+
+static url_stats_block *url_StatsBlocks = &url_StatsFallback;
+static __thread url_stats_block *url_StatsOwn;
+static pthread_key_t url_StatsKey;
+static pthread_once_t url_StatsOnce = PTHREAD_ONCE_INIT;
+
+static void url_StatsRelease(void *block)
+{
+	__atomic_store_n(&((url_stats_block *)block)->used, 0, __ATOMIC_RELEASE);
+}
+
+static void url_StatsInitKey(void)
+{
+	pthread_key_create(&url_StatsKey, url_StatsRelease);
+}
+
+static url_stats *url_StatsGet(void)
+{
+	url_stats_block *b = url_StatsOwn;
+	if(b)
+		return(&b->stats);
+
+	pthread_once(&url_StatsOnce, url_StatsInitKey);
+	for(b = __atomic_load_n(&url_StatsBlocks, __ATOMIC_ACQUIRE); b; b = b->next) {
+		int unused = 0;
+		if(__atomic_compare_exchange_n(&b->used, &unused, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+	}
+	if(b==NULL) {
+		if((b = calloc(1, sizeof(url_stats_block)))==NULL)
+			return(&url_StatsFallback.stats);
+		b->used = 1;
+		b->next = __atomic_load_n(&url_StatsBlocks, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&url_StatsBlocks, &b->next, b, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+	pthread_setspecific(url_StatsKey, b);
+	url_StatsOwn = b;
+	return(&b->stats);
+}
+
+// Only the owner thread adds to its counters : no atomic addition needed,
+// only atomic accesses for url_GetStats()
+static inline void url_StatsAdd(uint64_t *counter, uint64_t n)
+{
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t url_StatsNow(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return(__rdtsc());
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+static void url_StatsStage(int stage, uint64_t start)
+{
+	uint64_t cycles = url_StatsNow() - start;
+	int bucket = cycles ? 64 - __builtin_clzll(cycles) : 0;
+	if(bucket >= URL_STATS_BUCKETS)
+		bucket = URL_STATS_BUCKETS-1;
+	url_StatsAdd(&url_StatsGet()->cycles[stage][bucket], 1);
+}
+
+static void url_StatsCall(int function, size_t bytes_in, size_t bytes_out)
+{
+	url_stats *stats = url_StatsGet();
+	url_StatsAdd(&stats->functions[function].calls, 1);
+	url_StatsAdd(&stats->functions[function].bytes_in, bytes_in);
+	url_StatsAdd(&stats->functions[function].bytes_out, bytes_out);
+}
+
+static void url_StatsEscape(size_t bytes_in, size_t bytes_out, uint64_t start)
+{
+	url_StatsCall(URL_STATS_ESCAPE, bytes_in, bytes_out);
+	url_StatsAdd(&url_StatsGet()->escaped, (bytes_out - bytes_in)/2);
+	url_StatsStage(URL_STATS_STAGE_ESCAPE, start);
+}
+
+static void url_StatsDepth(unsigned depth)
+{
+	if(depth >= URL_STATS_DEPTHS)
+		depth = URL_STATS_DEPTHS-1;
+	url_StatsAdd(&url_StatsGet()->unescape_depth[depth], 1);
+}
+
+static void *url_StatsMalloc(size_t size)
+{
+	url_stats *stats = url_StatsGet();
+	url_StatsAdd(&stats->allocs, 1);
+	url_StatsAdd(&stats->alloc_bytes, size);
+	return(malloc(size));
+}
+
+#define URL_STATS_START(t)                 uint64_t t = url_StatsNow()
+#define URL_STATS_STAGE(stage, t)          url_StatsStage(stage, t)
+#define URL_STATS_CALL(function, in, out)  url_StatsCall(function, in, out)
+#define URL_STATS_ESCAPED(in, out, t)      url_StatsEscape(in, out, t)
+#define URL_STATS_DEPTH(depth)             url_StatsDepth(depth)
+
+// Count the allocations of all the functions below
+#define malloc(size) url_StatsMalloc(size)
+
+#else
+
+#define URL_STATS_START(t)
+#define URL_STATS_STAGE(stage, t)
+#define URL_STATS_CALL(function, in, out)
+#define URL_STATS_ESCAPED(in, out, t)
+#define URL_STATS_DEPTH(depth)
+
+#endif
+
+
+#ifdef URL_USDT
+
+// Static tracepoints of the "url" provider, a NOP until a tracer attaches
+// to them. Return probes give the input length, the output length and a
+// status : 0, or -1 if error.
+#define URL_PROBE_ENTRY(name, src, len)                DTRACE_PROBE2(url, name##__entry, src, len)
+#define URL_PROBE_RETURN(name, len, result, out)       DTRACE_PROBE3(url, name##__return, len, (result) ? (size_t)(out) : 0, (result) ? 0 : -1)
+#define URL_PROBE_PASS_ENTRY(src, len, depth)          DTRACE_PROBE3(url, unescape__entry, src, len, depth)
+#define URL_PROBE_PASS_RETURN(len, result, out, depth) DTRACE_PROBE4(url, unescape__return, len, (result) ? (size_t)(out) : 0, (result) ? 0 : -1, depth)
+
+#else
+
+#define URL_PROBE_ENTRY(name, src, len)
+#define URL_PROBE_RETURN(name, len, result, out)
+#define URL_PROBE_PASS_ENTRY(src, len, depth)
+#define URL_PROBE_PASS_RETURN(len, result, out, depth)
+
+#endif
+
 // Convert a "%AB" or "%ab" hexadecimal string to its integer value, or return -1 if was not an hex string
 static inline int url_DecodePercent(const char *s) {
 	if(	    s
@@ -40,6 +208,112 @@ static inline int url_DecodePercent(const char *s) {
 }
 
 
+// XXH64 primes
+#define URL_PRIME64_1 11400714785074694791ULL
+#define URL_PRIME64_2 14029467366897019727ULL
+#define URL_PRIME64_3  1609587929392839161ULL
+#define URL_PRIME64_4  9650029242287828579ULL
+#define URL_PRIME64_5  2870177450012600261ULL
+
+#define URL_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+// Streaming XXH64 state. Input is given by 32 bytes stripes, the
+// remaining tail being given to url_Hash64Final(). The tail buffer is only
+// used by url_Hash64Update().
+typedef url_hash64_state url_Hash64State;
+
+static inline uint64_t url_Read64(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return(v);
+}
+
+static inline uint32_t url_Read32(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return(v);
+}
+
+static inline uint64_t url_Hash64Round(uint64_t acc, uint64_t input)
+{
+	acc += input * URL_PRIME64_2;
+	acc = URL_ROTL64(acc, 31);
+	return(acc * URL_PRIME64_1);
+}
+
+static inline uint64_t url_Hash64Merge(uint64_t acc, uint64_t val)
+{
+	acc ^= url_Hash64Round(0, val);
+	return(acc * URL_PRIME64_1 + URL_PRIME64_4);
+}
+
+static inline void url_Hash64Init(url_Hash64State *state, uint64_t seed)
+{
+	state->v[0] = seed + URL_PRIME64_1 + URL_PRIME64_2;
+	state->v[1] = seed + URL_PRIME64_2;
+	state->v[2] = seed;
+	state->v[3] = seed - URL_PRIME64_1;
+	state->seed = seed;
+	state->total_len = 0;
+	state->tail_len = 0;
+}
+
+static inline void url_Hash64Stripe(url_Hash64State *state, const unsigned char *p)
+{
+	state->v[0] = url_Hash64Round(state->v[0], url_Read64(p));
+	state->v[1] = url_Hash64Round(state->v[1], url_Read64(p+8));
+	state->v[2] = url_Hash64Round(state->v[2], url_Read64(p+16));
+	state->v[3] = url_Hash64Round(state->v[3], url_Read64(p+24));
+	state->total_len += 32;
+}
+
+static uint64_t url_Hash64Final(const url_Hash64State *state, const unsigned char *p, size_t len)
+{
+	uint64_t h;
+
+	if(state->total_len > 0) {
+		h =   URL_ROTL64(state->v[0], 1)  + URL_ROTL64(state->v[1], 7)
+			+ URL_ROTL64(state->v[2], 12) + URL_ROTL64(state->v[3], 18);
+		h = url_Hash64Merge(h, state->v[0]);
+		h = url_Hash64Merge(h, state->v[1]);
+		h = url_Hash64Merge(h, state->v[2]);
+		h = url_Hash64Merge(h, state->v[3]);
+	} else
+		h = state->seed + URL_PRIME64_5;
+
+	h += state->total_len + len;
+
+	for( ; len>=8; p+=8, len-=8) {
+		h ^= url_Hash64Round(0, url_Read64(p));
+		h = URL_ROTL64(h, 27) * URL_PRIME64_1 + URL_PRIME64_4;
+	}
+	if(len>=4) {
+		h ^= (uint64_t)url_Read32(p) * URL_PRIME64_1;
+		h = URL_ROTL64(h, 23) * URL_PRIME64_2 + URL_PRIME64_3;
+		p +=4; len -=4;
+	}
+	for( ; len>0; p++, len--) {
+		h ^= (*p) * URL_PRIME64_5;
+		h = URL_ROTL64(h, 11) * URL_PRIME64_1;
+	}
+
+	h ^= h >> 33;
+	h *= URL_PRIME64_2;
+	h ^= h >> 29;
+	h *= URL_PRIME64_3;
+	h ^= h >> 32;
+	return(h);
+}
+
+
 static char *url_RFC3986_ReservedChars = "!*'();:@&=+$,/?#[]";
 
 /**
@@ -177,27 +451,18 @@ extern char *url_RemoveQuery(char *string, size_t *new_len)
 
 
 /**
- * Percent-decode a string, calling itself until all percent-decoding is done.
- * Returned string is stored in a newly allocated buffer that needs to be freed.
- * @param  string  Pointer to string to be decoded.
- * @param  len     Length of string or 0. If len is 0, strlen() will be called.
- * @param  new_len Pointer to a size_t where to store length of the decoded string.
- *                 Can be NULL if you don't need the length of the returned string.
- * @return         Pointer to a newly allocated decoded string. Needs to be freed
- *                 with free(). NULL if error.
+ * One decoding pass of url_Unescape(), calling itself as long as something
+ * was decoded.
+ * @param  depth Number of previous passes.
  */
-extern inline char *url_Unescape(const char *string, size_t len, size_t *new_len)
+static char *url_UnescapeAgain(const char *string, size_t len, size_t *new_len, unsigned depth)
 {
-
-	if(string==NULL)
-		return(NULL);
-
-	if(len==0)
-		len=strlen(string);
-
+	URL_PROBE_PASS_ENTRY(string, len, depth);
 	char *decoded_string = malloc(strlen(string)+1);
-	if(decoded_string==NULL) 
+	if(decoded_string==NULL) {
+		URL_PROBE_PASS_RETURN(len, decoded_string, 0, depth);
 		return(NULL);
+	}
 	char *begin_decoded = decoded_string;
 
 	for(; *string; string++, decoded_string++) { 
@@ -214,14 +479,16 @@ extern inline char *url_Unescape(const char *string, size_t len, size_t *new_len
 	*decoded_string = '\0';	
 
 	size_t decoded_string_length = decoded_string - begin_decoded;
+	URL_PROBE_PASS_RETURN(len, begin_decoded, decoded_string_length, depth);
 	if(decoded_string_length == len) {
 		// No more unescape() needed
+		URL_STATS_DEPTH(depth);
 		if(new_len)
 			*new_len = decoded_string - begin_decoded;
 		return(begin_decoded);
 	} else {
 		// Recursevely call Unescape()
-		char *next_string = url_Unescape(begin_decoded, decoded_string_length, new_len);
+		char *next_string = url_UnescapeAgain(begin_decoded, decoded_string_length, new_len, depth+1);
 		free(begin_decoded);
 		return(next_string);
 	}
@@ -229,49 +496,248 @@ extern inline char *url_Unescape(const char *string, size_t len, size_t *new_len
 }
 
 
-
 /**
- * Normalize an URL. The URL will be cleaned with url_RemoveTabCRLF(), then its 
- * fragment will be removed with url_RemoveFragment(). The URL will be unescaped
- * with url_Unescape() before being normalizes. Return a normalized URL in a 
- * newly allocated block of memory or NULL if error. 
- * @param  src     Pointer to string holding the URL to be normalized.
- * @param  len     Length of source string. If 0, strlen() will be called.
- * @param  new_len If not NULL, pointer to a size_t where the length of the new string will be stored.
- * @return         Pointer to a newly allocated string. Must freed using free(). Or
- *                 NULL of error.
+ * Percent-decode a string, calling itself until all percent-decoding is done.
+ * Returned string is stored in a newly allocated buffer that needs to be freed.
+ * @param  string  Pointer to string to be decoded.
+ * @param  len     Length of string or 0. If len is 0, strlen() will be called.
+ * @param  new_len Pointer to a size_t where to store length of the decoded string.
+ *                 Can be NULL if you don't need the length of the returned string.
+ * @return         Pointer to a newly allocated decoded string. Needs to be freed
+ *                 with free(). NULL if error.
  */
-extern char *url_Normalize(const char *src, const size_t len, size_t *new_len)
+extern inline char *url_Unescape(const char *string, size_t len, size_t *new_len)
 {
-	if(src==NULL)
+
+	if(string==NULL)
 		return(NULL);
 
-	size_t tmp;
+	if(len==0)
+		len=strlen(string);
 
+	size_t tmp;
 	if(new_len == NULL)
 		new_len = &tmp;
 
-// printf("url_Normalize() [%s]\n", src);
+	URL_STATS_START(start);
+	char *decoded = url_UnescapeAgain(string, len, new_len, 0);
+	URL_STATS_STAGE(URL_STATS_STAGE_UNESCAPE, start);
+	URL_STATS_CALL(URL_STATS_UNESCAPE, len, decoded ? *new_len : 0);
+	return(decoded);
+}
+
+
+// Schemes of the URLs canonicalized by url_CanonicalizeOpaque(), in
+// lowercase. Keep URL_OPAQUE_SCHEME_MAX up to date.
+static const struct {
+	const char *name;
+	size_t len;
+} url_OpaqueSchemes[] = {
+	{ "about", 5 },
+	{ "blob", 4 },
+	{ "data", 4 },
+	{ "javascript", 10 },
+	{ "mailto", 6 },
+};
+
+
+/**
+ * Return the length of the opaque scheme starting an URL, tab, CR and LF
+ * not counted, or 0 if it has none.
+ */
+static size_t url_OpaqueSchemeLength(const char *url, size_t len)
+{
+	const char *end = url + len;
+
+	// Leading spaces are removed by url_RemoveTabCRLF(), before tab, CR and LF
+	while(url<end && *url==' ')
+		url++;
+
+	char scheme[URL_OPAQUE_SCHEME_MAX];
+	size_t n = 0;
+	for( ; url<end; url++) {
+		char c = *url;
+		if(c=='\t' || c=='\r' || c=='\n')
+			continue;
+		if(c==':')
+			break;
+		c = LOWERCASE(c);
+		if(c<'a' || c>'z' || n==URL_OPAQUE_SCHEME_MAX)
+			return(0);
+		scheme[n++] = c;
+	}
+	if(url==end)
+		return(0);
+
+	for(size_t i=0; i<sizeof(url_OpaqueSchemes)/sizeof(url_OpaqueSchemes[0]); i++)
+		if(url_OpaqueSchemes[i].len==n && memcmp(url_OpaqueSchemes[i].name, scheme, n)==0)
+			return(n);
+	return(0);
+}
+
+
+/**
+ * Check if an URL, once cleaned of leading spaces, tab, CR and LF, starts
+ * with an opaque scheme followed by ':'. Only the scheme is read.
+ * @param  url Pointer to the URL.
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     true if the URL has an opaque scheme, false otherwise.
+ */
+extern bool url_IsOpaque(const char *url, size_t len)
+{
+	if(url==NULL)
+		return(false);
+	if(len==0)
+		len = strlen(url);
+	return(url_OpaqueSchemeLength(url, len) > 0);
+}
+
+
+static inline void url_OpaqueWrite(char *dest, size_t out, url_hash64_state *state, const char *bytes, size_t n)
+{
+	if(dest)
+		memcpy(dest + out, bytes, n);
+	if(state)
+		url_Hash64Update(state, bytes, n);
+}
+
 
-	char *str1 = url_RemoveTabCRLF(src, len, new_len);
+/**
+ * Write the passthrough canonicalized form of an URL with an opaque scheme,
+ * in a single pass and without intermediate copy.
+ * @param  src   Pointer to the URL.
+ * @param  len   Length of the URL.
+ * @param  dest  Buffer of at least max bytes, or NULL to only count them.
+ * @param  max   Maximum number of bytes written, escape sequences are not cut.
+ * @param  state If not NULL, hash state fed with the bytes.
+ * @return       Number of bytes written.
+ */
+static size_t url_OpaqueCopy(const char *src, size_t len, char *dest, size_t max, url_hash64_state *state)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	const char *end = src + len;
+	size_t out = 0;
+
+	// Same cleaning as url_RemoveTabCRLF() and url_RemoveFragment()
+	while(src<end && *src==' ')
+		src++;
+	while(end>src && *(end-1)==' ')
+		end--;
+
+	// Lowercase the scheme, only made of letters
+	for( ; src<end && *src!=':' && out<max; src++)
+		if(*src!='\t' && *src!='\r' && *src!='\n') {
+			char c = LOWERCASE(*src);
+			url_OpaqueWrite(dest, out++, state, &c, 1);
+		}
+
+	while(src<end && out<max) {
+		// Copy runs of bytes to be kept as they are at once
+		const char *run = src;
+		const char *stop = (size_t)(end - src) > max - out ? src + (max - out) : end;
+		while(src<stop && (unsigned char)*src>32 && (unsigned char)*src<127 && *src!='#')
+			src++;
+		size_t n = src - run;
+		url_OpaqueWrite(dest, out, state, run, n);
+		out += n;
+		if(src==end || out==max)
+			break;
+
+		unsigned char c = *(src++);
+		if(c=='\0' || c=='#')
+			break;
+		if(c=='\t' || c=='\r' || c=='\n')
+			continue;
+		if(max - out < 3)
+			break;
+		char escaped[3] = { '%', hex[c >> 4], hex[c & 15] };
+		url_OpaqueWrite(dest, out, state, escaped, 3);
+		out += 3;
+	}
+	return(out);
+}
+
+
+/**
+ * Canonicalize an URL with an opaque scheme. Used instead of url_Normalize()
+ * and the escape functions, for any of the url_Canonicalize*() functions.
+ * @param  src     Pointer to the URL.
+ * @param  len     Length of the URL.
+ * @param  new_len Pointer to a size_t where the length of the new string will be stored.
+ * @param  policy  URL_OPAQUE_PASSTHROUGH, URL_OPAQUE_TRUNCATE or URL_OPAQUE_HASH.
+ * @param  max_len Maximum length of the URL with URL_OPAQUE_TRUNCATE.
+ * @return         Pointer to newly allocated string. Must be freed with free().
+ *                 Or NULL if error.
+ */
+static char *url_CanonicalizeOpaque(const char *src, size_t len, size_t *new_len, int policy, size_t max_len)
+{
+	char *dest;
+	URL_STATS_START(start);
+
+	switch(policy) {
+		case URL_OPAQUE_TRUNCATE:
+			if((dest = malloc(max_len+1))==NULL)
+				return(NULL);
+			*new_len = url_OpaqueCopy(src, len, dest, max_len, NULL);
+			break;
+		case URL_OPAQUE_HASH: {
+			url_hash64_state state;
+			url_Hash64Start(&state, 0);
+			url_OpaqueCopy(src, len, NULL, SIZE_MAX, &state);
+			size_t scheme_len = url_OpaqueSchemeLength(src, len);
+			if((dest = malloc(scheme_len+1+16+1))==NULL)
+				return(NULL);
+			url_OpaqueCopy(src, len, dest, scheme_len+1, NULL);
+			*new_len = scheme_len+1 + sprintf(dest+scheme_len+1, "%016llx", (unsigned long long)url_Hash64Digest(&state));
+			break;
+		}
+		default:
+			*new_len = url_OpaqueCopy(src, len, NULL, SIZE_MAX, NULL);
+			if((dest = malloc(*new_len+1))==NULL)
+				return(NULL);
+			url_OpaqueCopy(src, len, dest, *new_len, NULL);
+	}
+	dest[*new_len] = '\0';
+	URL_STATS_STAGE(URL_STATS_STAGE_OPAQUE, start);
+	return(dest);
+}
+
+
+
+/**
+ * Steps of url_Normalize(), which checks its arguments and traces the calls.
+ * @param  src_len Length of source string, not 0.
+ * @param  new_len Pointer to a size_t where the length of the new string will be stored.
+ */
+static char *url_NormalizeSteps(const char *src, const size_t src_len, size_t *new_len)
+{
+	// URLs with an opaque scheme are only cleaned and unescaped
+	if(url_OpaqueSchemeLength(src, src_len)) {
+		char *cleaned = url_CanonicalizeOpaque(src, src_len, new_len, URL_OPAQUE_PASSTHROUGH, 0);
+		if(cleaned==NULL || memchr(cleaned, '%', *new_len)==NULL)
+			return(cleaned);
+		char *unescaped = url_Unescape(cleaned, *new_len, new_len);
+		free(cleaned);
+		return(unescaped);
+	}
+
+	URL_STATS_START(clean_start);
+	char *str1 = url_RemoveTabCRLF(src, src_len, new_len);
 	if(str1==NULL)
 		return(NULL);
 	if(strlen(str1) == 0) {
 		free(str1);
 		return(NULL);
 	}
-// printf("%-16s = [%s]\n", "CLEANED", str1);
-// printf("new_len = %ld\n", *new_len);
 	url_RemoveFragment(str1, new_len);
-// printf("%-16s = [%s]\n", "FRAGMENT REMOVED", str1);
-// printf("new_len = %ld\n", *new_len);	
+	URL_STATS_STAGE(URL_STATS_STAGE_CLEAN, clean_start);
 	char *str2 = url_Unescape(str1, *new_len, new_len);
 	if(str2==NULL) {
 		free(str1);
 		return(NULL);
 	}
-// printf("%-16s = [%s]\n", "UNESCAPED", str2);
-// printf("new_len = %ld\n", *new_len);		
+
+	URL_STATS_START(normalize_start);
 
 	// Save begining of source string
 	char *begin_source = str2;
@@ -396,7 +862,6 @@ extern char *url_Normalize(const char *src, const size_t len, size_t *new_len)
 					*(dest++) = *(str2++);
 			}
 		}
-// printf("%.*s\n", (int)(dest-begin_dest), begin_dest);
 	}
 	*dest='\0';
 
@@ -404,11 +869,11 @@ extern char *url_Normalize(const char *src, const size_t len, size_t *new_len)
 	free(str1); free(begin_source);
 	if(new_len)
 		*new_len = dest - begin_dest;
-// printf("url_Normalize() END dest=[%s] len=%ld\n", begin_dest, dest-begin_dest);
+	URL_STATS_STAGE(URL_STATS_STAGE_NORMALIZE, normalize_start);
+	URL_STATS_CALL(URL_STATS_NORMALIZE, src_len, dest - begin_dest);
 	return(begin_dest);
 
 bad:
-// printf("This is bad\n");
 	free(str1); 
 	free(begin_source);
 	if(begin_dest) {
@@ -417,6 +882,154 @@ bad:
 	return(NULL);
 }
 
+/**
+ * Normalize an URL. The URL will be cleaned with url_RemoveTabCRLF(), then its 
+ * fragment will be removed with url_RemoveFragment(). The URL will be unescaped
+ * with url_Unescape() before being normalizes. Return a normalized URL in a 
+ * newly allocated block of memory or NULL if error. URLs with an opaque scheme
+ * (see url_IsOpaque()) are only cleaned, then unescaped.
+ * @param  src     Pointer to string holding the URL to be normalized.
+ * @param  len     Length of source string. If 0, strlen() will be called.
+ * @param  new_len If not NULL, pointer to a size_t where the length of the new string will be stored.
+ * @return         Pointer to a newly allocated string. Must freed using free(). Or
+ *                 NULL of error.
+ */
+extern char *url_Normalize(const char *src, const size_t len, size_t *new_len)
+{
+	if(src==NULL)
+		return(NULL);
+
+	size_t tmp;
+
+	if(new_len == NULL)
+		new_len = &tmp;
+
+	size_t src_len = len ? len : strlen(src);
+	URL_PROBE_ENTRY(normalize, src, src_len);
+	char *normalized = url_NormalizeSteps(src, src_len, new_len);
+	URL_PROBE_RETURN(normalize, src_len, normalized, *new_len);
+	return(normalized);
+}
+
+
+#ifdef __SSE2__
+// Set the bytes of v between lo and hi (included) to 0xff, the others to 0
+static inline __m128i url_InRange(__m128i v, char lo, char hi)
+{
+	__m128i d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+	return(_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(hi-lo)), d));
+}
+
+// Count the bytes of 16 bytes blocks to be percent-encoded, until a block
+// holding a NUL character. Return the number of bytes read.
+static size_t url_EscapedBlocks(const char *src, size_t len, bool full_escape, size_t *escaped)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0, count = 0;
+
+	for( ; i+16<=len; i+=16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src+i));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)))
+			break;
+
+		// Bytes <= 32 or >= 128 are the ones lower than 33 as signed bytes
+		__m128i m = _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(33)), _mm_cmpeq_epi8(v, _mm_set1_epi8(127)));
+		if(full_escape) {
+			// '%' and "!*'();:@&=+$,/?#[]"
+			m = _mm_or_si128(m, _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), url_InRange(v, '!', ',')));
+			m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')), url_InRange(v, ':', ';')));
+			m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('=')), url_InRange(v, '?', '@')));
+			m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('[')), _mm_cmpeq_epi8(v, _mm_set1_epi8(']'))));
+		} else
+			m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('#')), _mm_cmpeq_epi8(v, _mm_set1_epi8('%'))));
+		count += __builtin_popcount(_mm_movemask_epi8(m));
+	}
+	*escaped = count;
+	return(i);
+}
+#endif
+
+
+/**
+ * Compute the exact length of the string returned by url_Escape(), or by
+ * url_EscapeIncludingReservedChars(), without allocating memory. Uses SSE2
+ * when available.
+ * @param  src         Pointer to the string to be percent-encoded.
+ * @param  len         Length of the string. If 0, strlen() will be used.
+ * @param  full_escape If true, reserved characters are counted as encoded,
+ *                     as url_EscapeIncludingReservedChars() does.
+ * @return             Length of the percent-encoded string, NUL character
+ *                     excluded.
+ */
+extern size_t url_EscapedLength(const char *src, size_t len, bool full_escape)
+{
+	if(src==NULL)
+		return(0);
+
+	if(len==0)
+		len = strlen(src);
+
+	size_t i = 0, escaped = 0;
+#ifdef __SSE2__
+	i = url_EscapedBlocks(src, len, full_escape, &escaped);
+#endif
+	for( ; i<len && src[i]; i++) {
+		unsigned char c = src[i];
+		if(c<=32 || c>=127 || c=='%' || (full_escape ? url_IsReserved(c) : c=='#'))
+			escaped++;
+	}
+	return(i + 2*escaped);
+}
+
+
+/**
+ * Percent-encode a string the way url_Escape() does, into a buffer of at
+ * least url_EscapedLength()+1 bytes, optionally feeding the encoded bytes to
+ * XXH64 states as they are written.
+ * @param  src      Pointer to source string to be percent-encoded.
+ * @param  len      Length of source string.
+ * @param  dest     Buffer receiving the NUL terminated encoded string.
+ * @param  src_used Pointer to a size_t where the number of bytes read will be stored.
+ * @param  seeds    Seeds of the hashes, if count is not 0.
+ * @param  hashes   Array where the hashes will be stored, if count is not 0.
+ * @param  count    Number of hashes to compute, 0, 1 or 2.
+ * @return          Length of the encoded string.
+ */
+static inline size_t url_EscapeWrite(const char *src, size_t len, char *dest, size_t *src_used, const uint64_t *seeds, uint64_t *hashes, int count)
+{
+	const unsigned char *usrc = (unsigned char *)src;
+	char *begin_dest = dest;
+
+	url_Hash64State state[2];
+	for(int i=0; i<count; i++)
+		url_Hash64Init(&state[i], seeds[i]);
+
+	// Stripes are hashed as soon as they are complete, while still in cache
+	const unsigned char *hashed = (unsigned char *)dest;
+
+	const unsigned char *end = usrc + len;
+	while(usrc<end && *usrc) {
+		if(*usrc<=32 || *usrc>=127 || *usrc=='#' || *usrc=='%') {
+			sprintf(dest, "%%%02X", *(usrc++));
+			dest +=3;
+		} else {
+			*(dest++) = *(usrc++);
+		}
+		if(count && (unsigned char *)dest - hashed >= 32) {
+			for(int i=0; i<count; i++)
+				url_Hash64Stripe(&state[i], hashed);
+			hashed += 32;
+		}
+	}
+
+	*dest='\0';
+	for(int i=0; i<count; i++)
+		hashes[i] = url_Hash64Final(&state[i], hashed, (unsigned char *)dest - hashed);
+
+	*src_used = (const char *)usrc - src;
+	return(dest - begin_dest);
+}
+
 
 /**
  * Percent-encode a string to be used as an URL. Return the encoded URL in a
@@ -433,29 +1046,25 @@ extern char *url_Escape(const char *src, size_t len, size_t *new_len)
 	if(src==NULL)
 		return(NULL);
 
-	const unsigned char *usrc = (unsigned char *)src;
 	if(len==0)
 		len = strlen(src);
 
-	char *dest = malloc(3*len+1);
-	if(dest==NULL)
+	URL_PROBE_ENTRY(escape, src, len);
+	URL_STATS_START(start);
+	char *dest = malloc(url_EscapedLength(src, len, false)+1);
+	if(dest==NULL) {
+		URL_PROBE_RETURN(escape, len, dest, 0);
 		return(NULL);
-	char *begin_dest = dest;
-
-	while(*usrc) {
-		if(*usrc<=32 || *usrc>=127 || *usrc=='#' || *usrc=='%') {
-			sprintf(dest, "%%%02X", *(usrc++));
-			dest +=3;
-		} else {
-			*(dest++) = *(usrc++);
-		}
 	}
 
-	*dest='\0';
+	size_t used;
+	size_t dest_len = url_EscapeWrite(src, len, dest, &used, NULL, NULL, 0);
+	URL_STATS_ESCAPED(used, dest_len, start);
+	URL_PROBE_RETURN(escape, len, dest, dest_len);
 
 	if(new_len)
-		*new_len = dest - begin_dest;
-	return(begin_dest);	
+		*new_len = dest_len;
+	return(dest);	
 }
 
 
@@ -479,12 +1088,14 @@ extern char *url_EscapeIncludingReservedChars(const char *src, size_t len, size_
 	if(len==0)
 		len = strlen(src);
 
-	char *dest = malloc(3*len+1);
+	URL_STATS_START(start);
+	char *dest = malloc(url_EscapedLength(src, len, true)+1);
 	if(dest==NULL)
 		return(NULL);
 	char *begin_dest = dest;
 
-	while(*usrc) {
+	const unsigned char *end = usrc + len;
+	while(usrc<end && *usrc) {
 		if(*usrc<=32 || *usrc>=127 || *usrc=='%' || url_IsReserved((char)*usrc)) {
 			sprintf(dest, "%%%02X", *(usrc++));
 			dest +=3;
@@ -494,6 +1105,7 @@ extern char *url_EscapeIncludingReservedChars(const char *src, size_t len, size_
 	}
 
 	*dest='\0';
+	URL_STATS_ESCAPED((const char *)usrc - src, dest - begin_dest, start);
 
 	if(new_len)
 		*new_len = dest - begin_dest;
@@ -502,10 +1114,83 @@ extern char *url_EscapeIncludingReservedChars(const char *src, size_t len, size_
 
 
 
+/**
+ * Percent-encode a normalized URL the same way url_Escape() does, feeding the
+ * encoded bytes to one or two XXH64 states as they are written.
+ * @param  src     Pointer to source string to be percent-encoded.
+ * @param  len     Length of source string.
+ * @param  new_len Pointer to a size_t where the length of the new string will be stored.
+ * @param  seeds   Seeds of the hashes.
+ * @param  hashes  Array where the hashes will be stored.
+ * @param  count   Number of hashes to compute, 1 or 2.
+ * @return         Pointer to newly allocated string. Must be freed with free().
+ *                 Or NULL if error.
+ */
+static char *url_EscapeAndHash(const char *src, size_t len, size_t *new_len, const uint64_t *seeds, uint64_t *hashes, int count)
+{
+	URL_STATS_START(start);
+	char *dest = malloc(url_EscapedLength(src, len, false)+1);
+	if(dest==NULL)
+		return(NULL);
+
+	size_t used;
+	*new_len = url_EscapeWrite(src, len, dest, &used, seeds, hashes, count);
+	URL_STATS_ESCAPED(used, *new_len, start);
+	return(dest);
+}
+
+/**
+ * Canonicalize an URL, for all the url_Canonicalize*() functions.
+ * @param  src         Pointer to source string holding the URL to be canonicalized.
+ * @param  len         Length of source string. If 0, strlen() will be used.
+ * @param  new_len     Pointer to a size_t where the length of the new string will be stored.
+ * @param  full_escape If true, reserved characters are encoded.
+ * @param  seeds       Seeds of the hashes, if count is not 0.
+ * @param  hashes      Array where the hashes will be stored, if count is not 0.
+ * @param  count       Number of hashes to compute, 0, 1 or 2.
+ * @param  policy      Policy for URLs with an opaque scheme.
+ * @param  max_len     Maximum length of opaque URLs with URL_OPAQUE_TRUNCATE.
+ * @return             Pointer to newly allocated string holding the canonicalized URL,
+ *                     or NULL if error. Must be freed with free().
+ */
+static char *url_CanonicalizeWith(const char *src, size_t len, size_t *new_len, bool full_escape, const uint64_t *seeds, uint64_t *hashes, int count, int policy, size_t max_len)
+{
+	if(len==0)
+		len = strlen(src);
+
+	URL_PROBE_ENTRY(canonicalize, src, len);
+	char *canonical;
+	if(url_OpaqueSchemeLength(src, len)) {
+		canonical = url_CanonicalizeOpaque(src, len, new_len, policy, max_len);
+		for(int i=0; canonical && i<count; i++)
+			hashes[i] = url_Hash64(canonical, *new_len, seeds[i]);
+	} else {
+		char *normalized = url_Normalize(src, len, new_len);
+		if(normalized==NULL) {
+			URL_PROBE_RETURN(canonicalize, len, normalized, 0);
+			return(NULL);
+		}
+		if(count)
+			canonical = url_EscapeAndHash(normalized, *new_len, new_len, seeds, hashes, count);
+		else if(full_escape)
+			canonical = url_EscapeIncludingReservedChars(normalized, *new_len, new_len);
+		else
+			canonical = url_Escape(normalized, *new_len, new_len);
+		free(normalized);
+	}
+
+	URL_STATS_CALL(URL_STATS_CANONICALIZE, len, canonical ? *new_len : 0);
+	URL_PROBE_RETURN(canonicalize, len, canonical, *new_len);
+	return(canonical);
+}
+
+
 /**
  * Canonicalize an URL as described in 
  * https://developers.google.com/safe-browsing/developers_guide_v3#Canonicalization.
  * Reserved characters "!*'();:@&=+$,/?#[]" are not encoded.
+ * URLs with an opaque scheme (see url_IsOpaque()) are only cleaned, in a
+ * single pass : they are not unescaped as url_Normalize() does.
  * Return canonicalized URL is a newly allocated buffer, or NULL if error.
  * @param  src     Pointer to source string holding the URL to be canonicalized.
  * @param  len     Length of source string. If 0, strlen() will be used.
@@ -521,21 +1206,16 @@ extern char *url_Canonicalize(const char *src, size_t len, size_t *new_len)
 	size_t tmp;
 	if(new_len == NULL)
 		new_len = &tmp;
-	
-	char *str3 = url_Normalize(src, len, new_len);
-	if(str3==NULL)
-		return(NULL);
-	char *str4 = url_Escape(str3, *new_len, new_len);
 
-	free(str3);
-	return(str4);
+	return(url_CanonicalizeWith(src, len, new_len, false, NULL, NULL, 0, URL_OPAQUE_PASSTHROUGH, 0));
 }
 
 
 /**
  * Canonicalize an URL as described in 
  * https://developers.google.com/safe-browsing/developers_guide_v3#Canonicalization.
- * Reserved characters "!*'();:@&=+$,/?#[]" ARE encoded.
+ * Reserved characters "!*'();:@&=+$,/?#[]" ARE encoded, except in URLs with
+ * an opaque scheme, canonicalized as url_Canonicalize() does.
  * Return canonicalized URL is a newly allocated buffer, or NULL if error.
  * @param  src     Pointer to source string holding the URL to be canonicalized.
  * @param  len     Length of source string. If 0, strlen() will be used.
@@ -552,13 +1232,171 @@ extern char *url_CanonicalizeWithFullEscape(const char *src, size_t len, size_t
 	if(new_len == NULL)
 		new_len = &tmp;
 
-	char *str3 = url_Normalize(src, len, new_len);
-	if(str3==NULL)
+	return(url_CanonicalizeWith(src, len, new_len, true, NULL, NULL, 0, URL_OPAQUE_PASSTHROUGH, 0));
+}
+
+
+
+
+/**
+ * Canonicalize an URL exactly like url_Canonicalize(), except for URLs with
+ * an opaque scheme, canonicalized following the given policy. The policy
+ * only applies to this call.
+ * @param  src     Pointer to source string holding the URL to be canonicalized.
+ * @param  len     Length of source string. If 0, strlen() will be used.
+ * @param  new_len If not NULL, pointer to a size_t where the length of the new string will be stored.
+ * @param  policy  URL_OPAQUE_PASSTHROUGH (as url_Canonicalize()), URL_OPAQUE_TRUNCATE
+ *                 or URL_OPAQUE_HASH.
+ * @param  max_len Maximum length of a canonicalized URL with the URL_OPAQUE_TRUNCATE
+ *                 policy, or 0 for URL_OPAQUE_MAX_LEN. Escape sequences are never cut.
+ * @return         Pointer to newly allocated string holding the canonicalized URL,
+ *                 or NULL if error. Must be freed with free().
+ */
+extern char *url_CanonicalizeWithOpaquePolicy(const char *src, size_t len, size_t *new_len, int policy, size_t max_len)
+{
+	if(src==NULL)
+		return(NULL);
+
+	size_t tmp;
+	if(new_len == NULL)
+		new_len = &tmp;
+
+	return(url_CanonicalizeWith(src, len, new_len, false, NULL, NULL, 0, policy, max_len ? max_len : URL_OPAQUE_MAX_LEN));
+}
+
+
+/**
+ * Canonicalize an URL exactly like url_Canonicalize(), and compute the XXH64
+ * hash of the canonicalized URL while it is written. The hash is the same
+ * as the one url_Hash64() would return for the returned string.
+ * @param  src     Pointer to source string holding the URL to be canonicalized.
+ * @param  len     Length of source string. If 0, strlen() will be used.
+ * @param  new_len If not NULL, pointer to a size_t where the length of the new string will be stored.
+ * @param  seed    Seed of the hash.
+ * @param  hash    Pointer to an uint64_t where the hash will be stored.
+ * @return         Pointer to newly allocated string holding the canonicalized URL,
+ *                 or NULL if error. Must be freed with free().
+ */
+extern char *url_CanonicalizeAndHash(const char *src, size_t len, size_t *new_len, uint64_t seed, uint64_t *hash)
+{
+	if(src==NULL || hash==NULL)
+		return(NULL);
+
+	size_t tmp;
+	if(new_len == NULL)
+		new_len = &tmp;
+
+	return(url_CanonicalizeWith(src, len, new_len, false, &seed, hash, 1, URL_OPAQUE_PASSTHROUGH, 0));
+}
+
+
+/**
+ * Canonicalize an URL exactly like url_Canonicalize(), and compute a 128 bits
+ * hash of the canonicalized URL while it is written. hash[0] is the XXH64
+ * hash of the canonicalized URL with the given seed, hash[1] is its XXH64
+ * hash with the complemented seed (~seed). Both halves hash the same bytes
+ * with the same function, so they are not independent : collisions are
+ * rarer than with hash[0] alone, but not as rare as with a true 128 bits hash.
+ * @param  src     Pointer to source string holding the URL to be canonicalized.
+ * @param  len     Length of source string. If 0, strlen() will be used.
+ * @param  new_len If not NULL, pointer to a size_t where the length of the new string will be stored.
+ * @param  seed    Seed of the hash.
+ * @param  hash    Array of two uint64_t where the hash will be stored.
+ * @return         Pointer to newly allocated string holding the canonicalized URL,
+ *                 or NULL if error. Must be freed with free().
+ */
+extern char *url_CanonicalizeAndHash128(const char *src, size_t len, size_t *new_len, uint64_t seed, uint64_t hash[2])
+{
+	if(src==NULL || hash==NULL)
 		return(NULL);
-	char *str4 = url_EscapeIncludingReservedChars(str3, *new_len, new_len);
 
-	free(str3);
-	return(str4);
+	size_t tmp;
+	if(new_len == NULL)
+		new_len = &tmp;
+
+	uint64_t seeds[2] = { seed, ~seed };
+	return(url_CanonicalizeWith(src, len, new_len, false, seeds, hash, 2, URL_OPAQUE_PASSTHROUGH, 0));
+}
+
+
+/**
+ * Compute the XXH64 hash of a string, as computed by url_CanonicalizeAndHash().
+ * @param  string Pointer to the string to be hashed.
+ * @param  len    Length of the string. If 0, strlen() will be used.
+ * @param  seed   Seed of the hash.
+ * @return        XXH64 hash of the string.
+ */
+extern uint64_t url_Hash64(const char *string, size_t len, uint64_t seed)
+{
+	url_Hash64State state;
+	url_Hash64Init(&state, seed);
+
+	if(string==NULL)
+		return(url_Hash64Final(&state, NULL, 0));
+
+	if(len==0)
+		len = strlen(string);
+
+	const unsigned char *p = (unsigned char *)string;
+	for( ; len>=32; p+=32, len-=32)
+		url_Hash64Stripe(&state, p);
+
+	return(url_Hash64Final(&state, p, len));
+}
+
+
+/**
+ * Start an incremental XXH64 hash.
+ * @param state Pointer to the state to be initialized.
+ * @param seed  Seed of the hash.
+ */
+extern void url_Hash64Start(url_hash64_state *state, uint64_t seed)
+{
+	url_Hash64Init(state, seed);
+}
+
+
+/**
+ * Add bytes to an incremental XXH64 hash.
+ * @param state Hash state.
+ * @param bytes Pointer to the bytes.
+ * @param len   Number of bytes.
+ */
+extern void url_Hash64Update(url_hash64_state *state, const char *bytes, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)bytes;
+
+	// Complete the pending stripe first
+	if(state->tail_len) {
+		size_t n = 32 - state->tail_len;
+		if(n > len)
+			n = len;
+		memcpy(state->tail + state->tail_len, p, n);
+		state->tail_len += n;
+		p += n;
+		len -= n;
+		if(state->tail_len < 32)
+			return;
+		url_Hash64Stripe(state, state->tail);
+		state->tail_len = 0;
+	}
+
+	for( ; len>=32; p+=32, len-=32)
+		url_Hash64Stripe(state, p);
+	memcpy(state->tail, p, len);
+	state->tail_len = len;
+}
+
+
+/**
+ * Return the hash of all the bytes given so far, the same as url_Hash64()
+ * would return for them. The state is not changed.
+ * @param  state Hash state.
+ * @return       XXH64 hash.
+ */
+extern uint64_t url_Hash64Digest(const url_hash64_state *state)
+{
+	return(url_Hash64Final(state, state->tail, state->tail_len));
 }
 
 
@@ -566,8 +1404,8 @@ extern char *url_CanonicalizeWithFullEscape(const char *src, size_t len, size_t
 /**
  * Encode a string to be compliant with application/x-www-form-urlencoded format.
  * It is the same as url_EscapeIncludingReservedChars() but it also replaces 
- * spaces with '+'. (NOTE & WARNING: THIS CODE IS OBVIOUSLY WRONG AS 32 AND ' '
- * ARE ACTUALLY THE SAME SPACE CHARACTER !!)
+ * spaces with '+'. The string is fully decoded first : see url_FormEncode()
+ * for a single pass.
  * @param  src     Pointer to string to be encoded.
  * @param  len     Length of string. If 0, strlen() will be used.
  * @param  new_len If not NULL, pointer to a size_t where the length of the 
@@ -590,7 +1428,14 @@ extern char *url_Encode(const char *src, size_t len, size_t *new_len)
 	if(str==NULL)
 		return(NULL);
 
-	char *dest = malloc(3*length+1);
+	// Spaces become '+', not the "%20" counted by url_EscapedLength()
+	size_t spaces = 0;
+	for(const char *p=str; *p; p++)
+		if(*p==' ')
+			spaces++;
+
+	URL_STATS_START(start);
+	char *dest = malloc(url_EscapedLength(str, length, true) - 2*spaces + 1);
 	if(dest==NULL) {
 		free(str);
 		return(NULL);
@@ -599,20 +1444,20 @@ extern char *url_Encode(const char *src, size_t len, size_t *new_len)
 
 	unsigned char *usrc = (unsigned char *)str;
 	while(*usrc) {
-		if(*usrc<=32 || *usrc>=127 || *usrc=='%' || url_IsReserved((char)*usrc)) {
-			sprintf(dest, "%%%02X", *(usrc++));
-			dest +=3;
-		} else if(*usrc==' ') {
-			// (NOTE & WARNING: THIS CODE IS OBVIOUSLY WRONG AS 32 AND ' '
- 			// ARE ACTUALLY THE SAME SPACE CHARACTER !!
+		if(*usrc==' ') {
+			// Tested first, as 32 is also one of the bytes escaped below
 			*(dest++) = '+';
 			usrc++;
+		} else if(*usrc<=32 || *usrc>=127 || *usrc=='%' || url_IsReserved((char)*usrc)) {
+			sprintf(dest, "%%%02X", *(usrc++));
+			dest +=3;
 		} else {
 			*(dest++) = *(usrc++);
 		}
 	}
 
 	*dest='\0';
+	URL_STATS_ESCAPED((const char *)usrc - str, dest - begin_dest, start);
 
 	free(str);
 
@@ -856,8 +1701,9 @@ extern char *url_GetHostname(const char *url)
 			break;
 		}
 
-	// Make a copy of the hostname
-	char *hostname = url_Encode(link, 0, NULL);
+	// Make a copy of the hostname, already decoded by url_Normalize() (not
+	// with url_Encode(), that would turn spaces into '+')
+	char *hostname = url_EscapeIncludingReservedChars(link, 0, NULL);
 
 	// Free the cleaned url we created
 	free(clean);
@@ -870,6 +1716,50 @@ extern char *url_GetHostname(const char *url)
 
 
 
+/**
+ * Find the hostname part of a normalized or canonicalized URL, without
+ * allocating memory. As with url_GetHostname(), a leading "www." is skipped.
+ * @param  url      Pointer to a normalized or canonicalized URL.
+ * @param  len      Length of the URL. If 0, strlen() will be used.
+ * @param  host_len Pointer to a size_t where the length of the hostname
+ *                  will be stored.
+ * @return          Pointer to the beginning of the hostname in url, or NULL
+ *                  if error.
+ */
+extern const char *url_FindHostname(const char *url, size_t len, size_t *host_len)
+{
+	if(url==NULL || host_len==NULL)
+		return(NULL);
+
+	if(len==0)
+		len = strlen(url);
+	const char *end = url + len;
+
+	// Skip the scheme part
+	const char *host = url;
+	for(const char *p=url; p<end && *p!='/'; p++)
+		if(*p==':') {
+			if(end-p>=3 && p[1]=='/' && p[2]=='/')
+				host = p+3;
+			break;
+		}
+
+	// Skip leading "www." if any
+	if(end-host>=4 && host[0]=='w' && host[1]=='w' && host[2]=='w' && host[3]=='.')
+		host +=4;
+
+	// Find the end of the hostname
+	const char *p = host;
+	while(p<end && *p!='/' && *p!=':' && *p!='?')
+		p++;
+
+	*host_len = p - host;
+	return(host);
+}
+
+
+
+
 /**
  * Return the hostname part extracted from an url in a newly allocated string,
  * without skiping the www. header.
@@ -913,8 +1803,9 @@ extern char *url_GetHostnameWWW(const char *url)
 			break;
 		}
 
-	// Make a copy of the hostname
-	char *hostname = url_Encode(link, 0, NULL);
+	// Make a copy of the hostname, already decoded by url_Normalize() (not
+	// with url_Encode(), that would turn spaces into '+')
+	char *hostname = url_EscapeIncludingReservedChars(link, 0, NULL);
 
 	// Free the cleaned url we created
 	free(clean);
@@ -1025,6 +1916,9 @@ extern char *url_MakeAbsolute(const char *parent_url, const char *url)
 	if(parent_url==NULL || url==NULL)
 		return(NULL);
 
+	size_t url_len = strlen(url);
+	URL_PROBE_ENTRY(make_absolute, url, url_len);
+
 	// Save fragment if any
 	char *fragment = url_GetFragment(url);
 
@@ -1035,14 +1929,14 @@ extern char *url_MakeAbsolute(const char *parent_url, const char *url)
 
 		// Case where the relative URL is actually an absolute URL.
 		// Normalize to manage possible /./, // or /../ in path.
-		normalized_url = url_Normalize(url, strlen(url), &normalized_url_len);
+		normalized_url = url_Normalize(url, url_len, &normalized_url_len);
 
 	} else {
 
 		// Build absolute URL without fragment
 		size_t base_url_len=0;
 		char *base_url = url_GetBase(parent_url, 0, &base_url_len);
-		char *absolute_url = malloc(base_url_len + strlen(url) + 1);
+		char *absolute_url = malloc(base_url_len + url_len + 1);
 		if(url[0]=='/' && url[1]=='/') {
 			char *scheme = url_GetScheme(parent_url);
 			sprintf(absolute_url, "%s%s", scheme?scheme:"", url+2);
@@ -1065,12 +1959,15 @@ extern char *url_MakeAbsolute(const char *parent_url, const char *url)
 
 	// Restore saved fragment
 	if(fragment) {
-		char *absolute_url = malloc(normalized_url_len + strlen(fragment) + 2);
+		size_t fragment_len = strlen(fragment);
+		char *absolute_url = malloc(normalized_url_len + fragment_len + 2);
 		sprintf(absolute_url, "%s#%s", normalized_url, fragment);
 		free(fragment);
 		free(normalized_url);
+		URL_PROBE_RETURN(make_absolute, url_len, absolute_url, normalized_url_len + 1 + fragment_len);
 		return(absolute_url);
 	} else {
+		URL_PROBE_RETURN(make_absolute, url_len, normalized_url, normalized_url_len);
 		return(normalized_url);
 	}
 	
@@ -1135,4 +2032,182 @@ extern char *url_GetFragment(const char *url)
 
 
 
+/**
+ * Return the expressions looked up in Safe Browsing lists for a
+ * canonicalized URL : its host and up to 4 of its suffixes (not for IP
+ * addresses), each followed by the path with and without the query, and by
+ * up to 4 directories from the root. "http://a.b.c/1/2.html?p=1" gives
+ * "a.b.c/1/2.html?p=1", "a.b.c/1/2.html", "a.b.c/", "a.b.c/1/", then the
+ * same paths after "b.c".
+ * @param  url     Pointer to a canonicalized URL.
+ * @param  len     Length of the URL. If 0, strlen() will be used.
+ * @param  count   Pointer to a size_t where the number of expressions will
+ *                 be stored, at most URL_LOOKUP_EXPRESSIONS.
+ * @param  new_len If not NULL, pointer to a size_t where the size of the
+ *                 returned buffer will be stored.
+ * @return         Newly allocated buffer holding the NUL terminated
+ *                 expressions one after the other, or NULL if error (no
+ *                 host found). Use free() to deallocate the memory.
+ */
+extern char *url_GetLookupExpressions(const char *url, size_t len, size_t *count, size_t *new_len)
+{
+	if(url==NULL || count==NULL)
+		return(NULL);
 
+	if(len==0)
+		len = strlen(url);
+	const char *end = url + len;
+
+	// Skip the scheme part, which must be followed by "//"
+	const char *host = NULL;
+	for(const char *p=url; p<end && *p!='/'; p++)
+		if(*p==':') {
+			if(end-p>=3 && p[1]=='/' && p[2]=='/')
+				host = p+3;
+			break;
+		}
+	if(host==NULL)
+		return(NULL);
+
+	// The path ends at the query, the query at the fragment if any
+	const char *path = host;
+	while(path<end && *path!='/' && *path!='?' && *path!='#')
+		path++;
+	const char *query = path;
+	while(query<end && *query!='?' && *query!='#')
+		query++;
+	const char *query_end = query;
+	while(query_end<end && *query_end!='#')
+		query_end++;
+
+	// Host without its port, suffixes only for names
+	size_t host_len = path - host;
+	bool is_ip = host_len>0 && host[0]=='[';
+	if(!is_ip) {
+		for(size_t i=0; i<host_len; i++)
+			if(host[i]==':') {
+				host_len = i;
+				break;
+			}
+		is_ip = true;
+		for(size_t i=0; i<host_len && is_ip; i++)
+			is_ip = (host[i]>='0' && host[i]<='9') || host[i]=='.';
+	}
+	if(host_len==0)
+		return(NULL);
+
+	const char *hosts[URL_LOOKUP_HOSTS];
+	size_t hosts_len[URL_LOOKUP_HOSTS];
+	size_t host_count = 0;
+	hosts[host_count] = host;
+	hosts_len[host_count++] = host_len;
+	if(!is_ip) {
+		// dots[i] is followed by the last i+1 components, and the
+		// top-level domain alone is never looked up
+		const char *dots[URL_LOOKUP_HOSTS];
+		size_t dot_count = 0;
+		for(const char *p=host+host_len-1; p>host && dot_count<URL_LOOKUP_HOSTS; p--)
+			if(*p=='.')
+				dots[dot_count++] = p;
+		for(size_t i=dot_count; i>=2; i--) {
+			hosts[host_count] = dots[i-1] + 1;
+			hosts_len[host_count++] = host + host_len - (dots[i-1] + 1);
+		}
+	}
+
+	// Path with and without the query, then the first directories
+	size_t paths_len[URL_LOOKUP_PATHS];
+	bool with_query[URL_LOOKUP_PATHS];
+	size_t path_count = 0;
+	size_t path_len = query - path;
+	if(path_len==0) {
+		path = "/";
+		path_len = 1;
+	}
+	if(query_end > query) {
+		with_query[path_count] = true;
+		paths_len[path_count++] = path_len;
+	}
+	with_query[path_count] = false;
+	paths_len[path_count++] = path_len;
+	size_t prefix_count = 0;
+	for(size_t i=0; i<path_len && prefix_count<URL_LOOKUP_PATHS-2; i++)
+		if(path[i]=='/') {
+			prefix_count++;
+			if(i+1!=path_len) {
+				with_query[path_count] = false;
+				paths_len[path_count++] = i+1;
+			}
+		}
+
+	size_t query_len = query_end - query;
+	size_t size = 0;
+	for(size_t h=0; h<host_count; h++)
+		for(size_t p=0; p<path_count; p++)
+			size += hosts_len[h] + paths_len[p] + (with_query[p] ? query_len : 0) + 1;
+	char *expressions = malloc(size);
+	if(expressions==NULL)
+		return(NULL);
+
+	char *dest = expressions;
+	for(size_t h=0; h<host_count; h++)
+		for(size_t p=0; p<path_count; p++) {
+			memcpy(dest, hosts[h], hosts_len[h]);
+			dest += hosts_len[h];
+			memcpy(dest, path, paths_len[p]);
+			dest += paths_len[p];
+			if(with_query[p]) {
+				memcpy(dest, query, query_len);
+				dest += query_len;
+			}
+			*(dest++) = '\0';
+		}
+
+	*count = host_count * path_count;
+	if(new_len)
+		*new_len = size;
+	return(expressions);
+}
+
+
+/**
+ * Sum the statistics of all the threads.
+ * @param  stats Pointer to the structure to be filled.
+ * @return       true, or false if url.c was compiled without URL_STATS (and
+ *               stats is zeroed).
+ */
+extern bool url_GetStats(url_stats *stats)
+{
+	if(stats==NULL)
+		return(false);
+	memset(stats, 0, sizeof(url_stats));
+
+#ifdef URL_STATS
+	// url_stats is only made of counters
+	uint64_t *sum = (uint64_t *)stats;
+	for(url_stats_block *b = __atomic_load_n(&url_StatsBlocks, __ATOMIC_ACQUIRE); b; b = b->next) {
+		uint64_t *counters = (uint64_t *)&b->stats;
+		for(size_t i=0; i<sizeof(url_stats)/sizeof(uint64_t); i++)
+			sum[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+	}
+	return(true);
+#else
+	return(false);
+#endif
+}
+
+
+/**
+ * Reset the statistics of all the threads. Counts updated by other threads
+ * during the reset may be kept.
+ */
+extern void url_ResetStats(void)
+{
+#ifdef URL_STATS
+	for(url_stats_block *b = __atomic_load_n(&url_StatsBlocks, __ATOMIC_ACQUIRE); b; b = b->next) {
+		uint64_t *counters = (uint64_t *)&b->stats;
+		for(size_t i=0; i<sizeof(url_stats)/sizeof(uint64_t); i++)
+			__atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+	}
+#endif
+}
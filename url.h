@@ -1,6 +1,14 @@
 #ifndef _URL_H_
 #define _URL_H_
 
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Remove leading and trailing spaces, as well as tab (0x09), CR (0x0d), 
  * and LF (0x0a) characters from the URL. Returns cleaned URL in a newly 
@@ -51,7 +59,8 @@ extern char *url_Unescape(const char *string, size_t len, size_t *new_len);
  * Normalize an URL. The URL will be cleaned with url_RemoveTabCRLF(), then its 
  * fragments will be removed with url_RemoveFragment(). The URL will be unescaped
  * with url_Unescape() before being normalizes. Return a normalized URL in a 
- * newly allocated block of memory or NULL if error. 
+ * newly allocated block of memory or NULL if error. URLs with an opaque scheme
+ * (see url_IsOpaque()) are only cleaned, then unescaped.
  * @param  src     Pointer to string holding the URL to be normalized.
  * @param  len     Length of source string. If 0, strlen() will be called.
  * @param  new_len If not NULL, pointer to a size_t where the length of the new string will be stored.
@@ -60,6 +69,19 @@ extern char *url_Unescape(const char *string, size_t len, size_t *new_len);
  */
 extern char *url_Normalize(const char *src, const size_t len, size_t *new_len);
 
+/**
+ * Compute the exact length of the string returned by url_Escape(), or by
+ * url_EscapeIncludingReservedChars(), without allocating memory. Uses SSE2
+ * when available.
+ * @param  src         Pointer to the string to be percent-encoded.
+ * @param  len         Length of the string. If 0, strlen() will be used.
+ * @param  full_escape If true, reserved characters are counted as encoded,
+ *                     as url_EscapeIncludingReservedChars() does.
+ * @return             Length of the percent-encoded string, NUL character
+ *                     excluded.
+ */
+extern size_t url_EscapedLength(const char *src, size_t len, bool full_escape);
+
 /**
  * Percent-encode a string to be used as an URL. Return the encoded URL in a
  * newly allocated buffer of NULL if error. Reserved characters are not
@@ -102,6 +124,8 @@ extern char *url_Encode(const char *src, size_t len, size_t *new_len);
  * Canonicalize an URL as described in 
  * https://developers.google.com/safe-browsing/developers_guide_v3#Canonicalization.
  * Reserved characters "!*'();:@&=+$,/?#[]" are not encoded.
+ * URLs with an opaque scheme (see url_IsOpaque()) are only cleaned, in a
+ * single pass : they are not unescaped as url_Normalize() does.
  * Return canonicalized URL is a newly allocated buffer, or NULL if error.
  * @param  src     Pointer to source string holding the URL to be canonicalized.
  * @param  len     Length of source string. If 0, strlen() will be used.
@@ -114,7 +138,8 @@ extern char *url_Canonicalize(const char *src, size_t len, size_t *new_len);
 /**
  * Canonicalize an URL as described in 
  * https://developers.google.com/safe-browsing/developers_guide_v3#Canonicalization.
- * Reserved characters "!*'();:@&=+$,/?#[]" ARE encoded.
+ * Reserved characters "!*'();:@&=+$,/?#[]" ARE encoded, except in URLs with
+ * an opaque scheme, canonicalized as url_Canonicalize() does.
  * Return canonicalized URL is a newly allocated buffer, or NULL if error.
  * @param  src     Pointer to source string holding the URL to be canonicalized.
  * @param  len     Length of source string. If 0, strlen() will be used.
@@ -124,6 +149,126 @@ extern char *url_Canonicalize(const char *src, size_t len, size_t *new_len);
  */
 extern char *url_CanonicalizeWithFullEscape(const char *src, size_t len, size_t *new_len);
 
+/**
+ * Canonicalize an URL exactly like url_Canonicalize(), and compute the XXH64
+ * hash of the canonicalized URL while it is written. The hash is the same
+ * as the one url_Hash64() would return for the returned string.
+ * @param  src     Pointer to source string holding the URL to be canonicalized.
+ * @param  len     Length of source string. If 0, strlen() will be used.
+ * @param  new_len If not NULL, pointer to a size_t where the length of the new string will be stored.
+ * @param  seed    Seed of the hash.
+ * @param  hash    Pointer to an uint64_t where the hash will be stored.
+ * @return         Pointer to newly allocated string holding the canonicalized URL,
+ *                 or NULL if error. Must be freed with free().
+ */
+extern char *url_CanonicalizeAndHash(const char *src, size_t len, size_t *new_len, uint64_t seed, uint64_t *hash);
+
+/**
+ * Canonicalize an URL exactly like url_Canonicalize(), and compute a 128 bits
+ * hash of the canonicalized URL while it is written. hash[0] is the XXH64
+ * hash of the canonicalized URL with the given seed, hash[1] is its XXH64
+ * hash with the complemented seed (~seed). Both halves hash the same bytes
+ * with the same function, so they are not independent : collisions are
+ * rarer than with hash[0] alone, but not as rare as with a true 128 bits hash.
+ * @param  src     Pointer to source string holding the URL to be canonicalized.
+ * @param  len     Length of source string. If 0, strlen() will be used.
+ * @param  new_len If not NULL, pointer to a size_t where the length of the new string will be stored.
+ * @param  seed    Seed of the hash.
+ * @param  hash    Array of two uint64_t where the hash will be stored.
+ * @return         Pointer to newly allocated string holding the canonicalized URL,
+ *                 or NULL if error. Must be freed with free().
+ */
+extern char *url_CanonicalizeAndHash128(const char *src, size_t len, size_t *new_len, uint64_t seed, uint64_t hash[2]);
+
+/**
+ * Compute the XXH64 hash of a string, as computed by url_CanonicalizeAndHash().
+ * @param  string Pointer to the string to be hashed.
+ * @param  len    Length of the string. If 0, strlen() will be used.
+ * @param  seed   Seed of the hash.
+ * @return        XXH64 hash of the string.
+ */
+extern uint64_t url_Hash64(const char *string, size_t len, uint64_t seed);
+
+// Incremental XXH64 state, filled with url_Hash64Update()
+typedef struct {
+	uint64_t v[4];
+	uint64_t seed;
+	uint64_t total_len;
+	unsigned char tail[32];
+	size_t tail_len;
+} url_hash64_state;
+
+/**
+ * Start an incremental XXH64 hash.
+ * @param state Pointer to the state to be initialized.
+ * @param seed  Seed of the hash.
+ */
+extern void url_Hash64Start(url_hash64_state *state, uint64_t seed);
+
+/**
+ * Add bytes to an incremental XXH64 hash.
+ * @param state Hash state.
+ * @param bytes Pointer to the bytes.
+ * @param len   Number of bytes.
+ */
+extern void url_Hash64Update(url_hash64_state *state, const char *bytes, size_t len);
+
+/**
+ * Return the hash of all the bytes given so far, the same as url_Hash64()
+ * would return for them. The state is not changed.
+ * @param  state Hash state.
+ * @return       XXH64 hash.
+ */
+extern uint64_t url_Hash64Digest(const url_hash64_state *state);
+
+/*
+	URLs with an opaque scheme (data:, javascript:, mailto:, about:, blob:)
+	have no host nor hierarchical path, and can be huge (base64 images).
+	url_Normalize() and the url_Canonicalize*() functions recognize them
+	before anything else and only remove spaces, tab, CR, LF and the
+	fragment and lowercase the scheme. url_Normalize() then unescapes them,
+	the url_Canonicalize*() functions percent-encode bytes <= 32 or >= 127
+	instead : nothing is unescaped, and reserved characters are never encoded.
+	With url_CanonicalizeWithOpaquePolicy(), the url_canonicalizer and the
+	url_batch objects, the result can also be truncated or replaced by
+	"scheme:" followed by the 16 hexadecimal digits of its XXH64 hash (seed 0).
+*/
+
+// Length of the longest opaque scheme
+#define URL_OPAQUE_SCHEME_MAX 10
+
+#define URL_OPAQUE_PASSTHROUGH 0
+#define URL_OPAQUE_TRUNCATE    1
+#define URL_OPAQUE_HASH        2
+
+// Default length of truncated opaque URLs
+#define URL_OPAQUE_MAX_LEN 1024
+
+/**
+ * Check if an URL, once cleaned of leading spaces, tab, CR and LF, starts
+ * with an opaque scheme followed by ':'. Only the scheme is read.
+ * @param  url Pointer to the URL.
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     true if the URL has an opaque scheme, false otherwise.
+ */
+extern bool url_IsOpaque(const char *url, size_t len);
+
+/**
+ * Canonicalize an URL exactly like url_Canonicalize(), except for URLs with
+ * an opaque scheme, canonicalized following the given policy. The policy
+ * only applies to this call.
+ * @param  src     Pointer to source string holding the URL to be canonicalized.
+ * @param  len     Length of source string. If 0, strlen() will be used.
+ * @param  new_len If not NULL, pointer to a size_t where the length of the new string will be stored.
+ * @param  policy  URL_OPAQUE_PASSTHROUGH (as url_Canonicalize()), URL_OPAQUE_TRUNCATE
+ *                 or URL_OPAQUE_HASH.
+ * @param  max_len Maximum length of a canonicalized URL with the URL_OPAQUE_TRUNCATE
+ *                 policy, or 0 for URL_OPAQUE_MAX_LEN. Escape sequences are never cut.
+ * @return         Pointer to newly allocated string holding the canonicalized URL,
+ *                 or NULL if error. Must be freed with free().
+ */
+extern char *url_CanonicalizeWithOpaquePolicy(const char *src, size_t len, size_t *new_len, int policy, size_t max_len);
+
 /**
  * Parse a "key=value&key=value&key=value" string. You can use the default separator
  * characters (';' and '&') or provide your own list of separator characters. 
@@ -173,6 +318,18 @@ extern void url_Split(char *url, char **scheme, char **link, char **query);
  */
 extern char *url_GetHostname(const char *url);
 
+/**
+ * Find the hostname part of a normalized or canonicalized URL, without
+ * allocating memory. As with url_GetHostname(), a leading "www." is skipped.
+ * @param  url      Pointer to a normalized or canonicalized URL.
+ * @param  len      Length of the URL. If 0, strlen() will be used.
+ * @param  host_len Pointer to a size_t where the length of the hostname
+ *                  will be stored.
+ * @return          Pointer to the beginning of the hostname in url, or NULL
+ *                  if error.
+ */
+extern const char *url_FindHostname(const char *url, size_t len, size_t *host_len);
+
 /**
  * Return the hostname part extracted from an url in a newly allocated string,
  * without skiping the www. header.
@@ -256,5 +413,94 @@ extern const char *url_SkipWWW(const char *url_schemeless);
 extern char *url_GetFragment(const char *url);
 
 
+// Maximum number of expressions returned by url_GetLookupExpressions()
+#define URL_LOOKUP_HOSTS 5
+#define URL_LOOKUP_PATHS 6
+#define URL_LOOKUP_EXPRESSIONS (URL_LOOKUP_HOSTS * URL_LOOKUP_PATHS)
+
+/**
+ * Return the expressions looked up in Safe Browsing lists for a
+ * canonicalized URL : its host and up to 4 of its suffixes (not for IP
+ * addresses), each followed by the path with and without the query, and by
+ * up to 4 directories from the root. "http://a.b.c/1/2.html?p=1" gives
+ * "a.b.c/1/2.html?p=1", "a.b.c/1/2.html", "a.b.c/", "a.b.c/1/", then the
+ * same paths after "b.c".
+ * @param  url     Pointer to a canonicalized URL.
+ * @param  len     Length of the URL. If 0, strlen() will be used.
+ * @param  count   Pointer to a size_t where the number of expressions will
+ *                 be stored, at most URL_LOOKUP_EXPRESSIONS.
+ * @param  new_len If not NULL, pointer to a size_t where the size of the
+ *                 returned buffer will be stored.
+ * @return         Newly allocated buffer holding the NUL terminated
+ *                 expressions one after the other, or NULL if error (no
+ *                 host found). Use free() to deallocate the memory.
+ */
+extern char *url_GetLookupExpressions(const char *url, size_t len, size_t *count, size_t *new_len);
+
+
+/*
+	Statistics, only collected when url.c is compiled with -DURL_STATS :
+	otherwise the instrumentation is compiled out and url_GetStats() only
+	returns zeros. Each thread updates its own counters, without lock nor
+	atomic read-modify-write, and url_GetStats() sums the counters of all
+	the threads.
+*/
+
+// Functions counted in url_stats.functions
+#define URL_STATS_CANONICALIZE 0	// all the url_Canonicalize*() functions
+#define URL_STATS_NORMALIZE    1
+#define URL_STATS_UNESCAPE     2
+#define URL_STATS_ESCAPE       3	// url_Escape*(), url_Encode() and escaping while canonicalizing
+#define URL_STATS_FUNCTIONS    4
+
+// Stages of the canonicalization timed in url_stats.cycles
+#define URL_STATS_STAGE_CLEAN     0	// url_RemoveTabCRLF() and url_RemoveFragment()
+#define URL_STATS_STAGE_UNESCAPE  1
+#define URL_STATS_STAGE_NORMALIZE 2	// scheme, host and path rules
+#define URL_STATS_STAGE_ESCAPE    3
+#define URL_STATS_STAGE_OPAQUE    4	// URLs with an opaque scheme
+#define URL_STATS_STAGES          5
+
+// Buckets of the latency histograms : bucket b counts the durations of
+// 2^(b-1) to 2^b - 1 cycles, the last one the longer ones
+#define URL_STATS_BUCKETS 32
+
+// Buckets of the url_Unescape() depth histogram, the last one counting
+// the deeper ones
+#define URL_STATS_DEPTHS 8
+
+typedef struct {
+	struct {
+		uint64_t calls;
+		uint64_t bytes_in;
+		uint64_t bytes_out;
+	} functions[URL_STATS_FUNCTIONS];
+
+	uint64_t allocs;					// malloc() calls by url.c
+	uint64_t alloc_bytes;				// bytes requested by these calls
+	uint64_t escaped;					// bytes percent-encoded, out of functions[URL_STATS_ESCAPE].bytes_in
+	uint64_t unescape_depth[URL_STATS_DEPTHS];	// url_Unescape() calls by number of passes decoding something
+	uint64_t cycles[URL_STATS_STAGES][URL_STATS_BUCKETS];	// time stamp counter cycles, or nanoseconds
+														// when the processor has none
+} url_stats;
+
+/**
+ * Sum the statistics of all the threads.
+ * @param  stats Pointer to the structure to be filled.
+ * @return       true, or false if url.c was compiled without URL_STATS (and
+ *               stats is zeroed).
+ */
+extern bool url_GetStats(url_stats *stats);
+
+/**
+ * Reset the statistics of all the threads. Counts updated by other threads
+ * during the reset may be kept.
+ */
+extern void url_ResetStats(void);
+
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
\ No newline at end of file
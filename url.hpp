@@ -0,0 +1,334 @@
+#ifndef _URL_HPP_
+#define _URL_HPP_
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "url.h"
+
+/*
+	C++17 layer on top of url.h.
+
+	Functions take a std::string_view and write either into a buffer given
+	by the caller or into a std::pmr::string allocated from a memory
+	resource, instead of returning a malloc()ed string. Escaping and
+	unescaping are templates on a policy type, so that each mode gets its
+	own inlined loop. Results are the same as the ones of url.c : as there,
+	strings end at their first NUL character.
+
+	Functions writing into a buffer return the length of the result. If the
+	result and its NUL character do not fit in size bytes, they return a
+	length >= size and the content of the buffer is unspecified : call them
+	again with a buffer of at least the returned length + 1 bytes.
+*/
+
+namespace url {
+
+// Returned by the functions writing into a buffer if error
+constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+// Escaping of url_Escape() : reserved characters are not encoded
+struct escape_plain {
+	static constexpr bool escape(unsigned char c)
+	{
+		return(c<=32 || c>=127 || c=='#' || c=='%');
+	}
+};
+
+// Escaping of url_EscapeIncludingReservedChars()
+struct escape_reserved {
+	static constexpr bool escape(unsigned char c)
+	{
+		for(const char *r = "!*'();:@&=+$,/?#[]"; *r; r++)
+			if(c==static_cast<unsigned char>(*r))
+				return(true);
+		return(c<=32 || c>=127 || c=='%');
+	}
+};
+
+// Escaping of url_Encode() : as escape_reserved, spaces becoming '+'
+struct escape_form {
+	static constexpr bool space_as_plus = true;
+
+	static constexpr bool escape(unsigned char c)
+	{
+		return(c!=' ' && escape_reserved::escape(c));
+	}
+};
+
+// Unescaping of url_Unescape() : decode until nothing is left to decode
+struct unescape_all {
+	static constexpr bool repeat = true;
+};
+
+// A single decoding pass, "%2541" becomes "%41"
+struct unescape_once {
+	static constexpr bool repeat = false;
+};
+
+namespace detail {
+
+// Bytes encoded by an escape policy, computed at compile time
+template<class Policy>
+struct escape_table {
+	bool escaped[256];
+
+	constexpr escape_table() : escaped()
+	{
+		for(int c=0; c<256; c++)
+			escaped[c] = Policy::escape(static_cast<unsigned char>(c));
+	}
+};
+
+template<class Policy>
+inline constexpr escape_table<Policy> escape_table_v{};
+
+inline constexpr char hex_digits[] = "0123456789ABCDEF";
+
+// Whether an escape policy writes spaces as '+'
+template<class Policy, class = void>
+struct space_as_plus : std::false_type {};
+
+template<class Policy>
+struct space_as_plus<Policy, std::void_t<decltype(Policy::space_as_plus)>> : std::bool_constant<Policy::space_as_plus> {};
+
+constexpr int hex_value(unsigned char c)
+{
+	if(c>='0' && c<='9')
+		return(c-'0');
+	if(c>='a' && c<='f')
+		return(c-'a'+10);
+	if(c>='A' && c<='F')
+		return(c-'A'+10);
+	return(-1);
+}
+
+// Percent-encode src, up to its first NUL, and return the end of dest
+template<class Policy>
+constexpr char *escape_into(std::string_view src, char *dest)
+{
+	const auto &table = escape_table_v<Policy>;
+	for(unsigned char c : src) {
+		if(c=='\0')
+			break;
+		if constexpr (space_as_plus<Policy>::value)
+			if(c==' ') {
+				*(dest++) = '+';
+				continue;
+			}
+		if(table.escaped[c]) {
+			*(dest++) = '%';
+			*(dest++) = hex_digits[c >> 4];
+			*(dest++) = hex_digits[c & 15];
+		} else
+			*(dest++) = static_cast<char>(c);
+	}
+	return(dest);
+}
+
+// One decoding pass of len bytes of src, up to the first NUL, to dest,
+// which can be src. Return the length written.
+constexpr std::size_t decode_pass(const char *src, std::size_t len, char *dest)
+{
+	std::size_t out = 0;
+	for(std::size_t i=0; i<len && src[i]; i++) {
+		int high = -1, low = -1;
+		if(src[i]=='%' && len-i>2 && (high = hex_value(src[i+1]))!=-1 && (low = hex_value(src[i+2]))!=-1) {
+			dest[out++] = static_cast<char>(high*16 + low);
+			i +=2;
+		} else
+			dest[out++] = src[i];
+	}
+	return(out);
+}
+
+// Decode src to dest, which must hold src.size() bytes
+template<class Policy>
+constexpr std::size_t unescape_into(std::string_view src, char *dest)
+{
+	std::size_t len = decode_pass(src.data(), src.size(), dest);
+	if constexpr (Policy::repeat) {
+		std::size_t previous = src.size();
+		while(len!=previous) {
+			previous = len;
+			len = decode_pass(dest, len, dest);
+		}
+	}
+	return(len);
+}
+
+// Call url_Normalize() on src, skipping its leading spaces first so that
+// it does not read past the end of the view.
+inline char *normalize(std::string_view src, std::size_t *len)
+{
+	std::size_t skip = src.find_first_not_of(' ');
+	if(skip==std::string_view::npos)
+		return(nullptr);
+	src.remove_prefix(skip);
+	return(url_Normalize(src.data(), src.size(), len));
+}
+
+} // namespace detail
+
+
+/**
+ * Compute the length of a percent-encoded string.
+ * @param  src String to be percent-encoded.
+ * @return     Length of the percent-encoded string, NUL character excluded.
+ */
+template<class Policy = escape_plain>
+constexpr std::size_t escaped_length(std::string_view src)
+{
+	const auto &table = detail::escape_table_v<Policy>;
+	std::size_t len = 0;
+	for(unsigned char c : src) {
+		if(c=='\0')
+			break;
+		len += table.escaped[c] ? 3 : 1;
+	}
+	return(len);
+}
+
+/**
+ * Percent-encode a string into a buffer, as url_Escape() (escape_plain) or
+ * url_EscapeIncludingReservedChars() (escape_reserved) do.
+ * @param  src  String to be percent-encoded.
+ * @param  dest Buffer receiving the NUL terminated encoded string.
+ * @param  size Size of the buffer.
+ * @return      Length of the encoded string.
+ */
+template<class Policy = escape_plain>
+inline std::size_t escape(std::string_view src, char *dest, std::size_t size)
+{
+	std::size_t len = escaped_length<Policy>(src);
+	if(len >= size)
+		return(len);
+	*detail::escape_into<Policy>(src, dest) = '\0';
+	return(len);
+}
+
+/**
+ * Percent-encode a string.
+ * @param  src String to be percent-encoded.
+ * @param  mr  Memory resource of the returned string.
+ * @return     Encoded string.
+ */
+template<class Policy = escape_plain>
+inline std::pmr::string escape(std::string_view src, std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+{
+	std::pmr::string dest(escaped_length<Policy>(src), '\0', mr);
+	detail::escape_into<Policy>(src, dest.data());
+	return(dest);
+}
+
+/**
+ * Percent-decode a string into a buffer, as url_Unescape() (unescape_all)
+ * does, or only once (unescape_once).
+ * @param  src  String to be decoded.
+ * @param  dest Buffer receiving the NUL terminated decoded string. As the
+ *              decoded string is never longer, src.size() + 1 bytes are
+ *              always enough.
+ * @param  size Size of the buffer.
+ * @return      Length of the decoded string, or src.size() if size is not
+ *              more than src.size().
+ */
+template<class Policy = unescape_all>
+inline std::size_t unescape(std::string_view src, char *dest, std::size_t size)
+{
+	if(size <= src.size())
+		return(src.size());
+	std::size_t len = detail::unescape_into<Policy>(src, dest);
+	dest[len] = '\0';
+	return(len);
+}
+
+/**
+ * Percent-decode a string.
+ * @param  src String to be decoded.
+ * @param  mr  Memory resource of the returned string.
+ * @return     Decoded string.
+ */
+template<class Policy = unescape_all>
+inline std::pmr::string unescape(std::string_view src, std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+{
+	std::pmr::string dest(src.size(), '\0', mr);
+	dest.resize(detail::unescape_into<Policy>(src, dest.data()));
+	return(dest);
+}
+
+/**
+ * Canonicalize an URL into a buffer, as url_Canonicalize() (escape_plain)
+ * or url_CanonicalizeWithFullEscape() (escape_reserved) do. Escaping is
+ * done in the buffer, but url_Normalize() (url_Canonicalize() for opaque
+ * URLs) still allocates the normalized URL and its intermediate copies with
+ * malloc(), all freed before returning.
+ * @param  src  URL to be canonicalized.
+ * @param  dest Buffer receiving the NUL terminated canonicalized URL.
+ * @param  size Size of the buffer.
+ * @return      Length of the canonicalized URL, or npos if error.
+ */
+template<class Policy = escape_plain>
+inline std::size_t canonicalize(std::string_view src, char *dest, std::size_t size)
+{
+	// url_Normalize() unescapes opaque URLs, url_Canonicalize() keeps them as they are
+	std::size_t len;
+	bool opaque = url_IsOpaque(src.data(), src.size());
+	char *normalized = opaque ? url_Canonicalize(src.data(), src.size(), &len) : detail::normalize(src, &len);
+	if(normalized==nullptr)
+		return(npos);
+
+	std::size_t canonical_len = len;
+	if(opaque) {
+		if(len < size)
+			std::memcpy(dest, normalized, len+1);
+	} else
+		canonical_len = escape<Policy>(std::string_view(normalized, len), dest, size);
+	std::free(normalized);
+	return(canonical_len);
+}
+
+/**
+ * Canonicalize an URL.
+ * @param  src URL to be canonicalized.
+ * @param  mr  Memory resource of the returned string.
+ * @return     Canonicalized URL, or an empty string if error.
+ */
+template<class Policy = escape_plain>
+inline std::pmr::string canonicalize(std::string_view src, std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+{
+	std::size_t len;
+	bool opaque = url_IsOpaque(src.data(), src.size());
+	char *normalized = opaque ? url_Canonicalize(src.data(), src.size(), &len) : detail::normalize(src, &len);
+	if(normalized==nullptr)
+		return(std::pmr::string(mr));
+
+	std::pmr::string dest(mr);
+	if(opaque)
+		dest.assign(normalized, len);
+	else
+		dest = escape<Policy>(std::string_view(normalized, len), mr);
+	std::free(normalized);
+	return(dest);
+}
+
+/**
+ * Encode a string as url_Encode() does : decode it, then encode it again.
+ * @param  src String to be encoded.
+ * @param  mr  Memory resource of the returned string and of the decoded one.
+ * @return     Encoded string.
+ */
+template<class Unescape = unescape_all, class Escape = escape_form>
+inline std::pmr::string encode(std::string_view src, std::pmr::memory_resource *mr = std::pmr::get_default_resource())
+{
+	std::pmr::string decoded = unescape<Unescape>(src, mr);
+	return(escape<Escape>(decoded, mr));
+}
+
+} // namespace url
+
+#endif
@@ -0,0 +1,618 @@
+/*
+	Batch canonicalization of URLs into a single arena.
+
+	Entries only hold offsets in the arena, so that it can be grown with
+	realloc() while the batch is filled. A sharded batch has an arena per
+	shard, each with the list of the entries it holds. Entries also hold
+	the offset and length of the hostname in their URL : known from the
+	lanes for the simple URLs, found with url_FindHostname() in the output
+	of url_Canonicalize() for the others when a shard is to be chosen, and
+	only when asked for otherwise.
+
+	With SSE2, short URLs are canonicalized URL_BATCH_LANES at a time :
+	they are transposed so that each SSE2 register holds the byte at the
+	same position of every URL, then classified, lowercased and checked for
+	anything needing escaping, decoding or path normalization, all lanes at
+	once. Lanes found simple are written directly to the arena, the others
+	go through url_CanonicalizeWithOpaquePolicy(), with the policy of the
+	batch.
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#include "url.h"
+#include "url_batch.h"
+
+
+
+// Offset of the URLs which could not be canonicalized
+#define URL_BATCH_FAILED ((size_t)-1)
+
+// Hostname not searched yet, only needed to choose the shard
+#define URL_BATCH_NO_HOST ((size_t)-1)
+
+// URLs canonicalized at once, one per byte of a SSE2 register
+#define URL_BATCH_LANES 16
+
+// Length under which URLs go through the lanes
+#define URL_BATCH_SHORT 64
+
+// Groups of URLs not going through the lanes after a group without any
+// simple URL, so that inputs made of complex URLs do not pay for them
+#define URL_BATCH_SKIP 8
+
+typedef struct {
+	size_t offset;				// In the arena of its shard
+	size_t len;
+	uint32_t shard;
+	uint32_t host;				// Offset of the hostname in the URL
+	size_t host_len;
+} url_batch_entry;
+
+typedef struct {
+	char *data;
+	size_t data_len, data_cap;
+
+	size_t *indexes;			// Of the entries of the shard
+	size_t count, indexes_cap;
+} url_batch_shard;
+
+struct url_batch {
+	url_batch_shard *shards;
+	unsigned shard_count;
+
+	url_batch_entry *entries;
+	size_t count, entries_cap;
+
+	int opaque_policy;
+	size_t opaque_max;
+};
+
+
+
+/**
+ * Create a new, empty batch.
+ * @return Pointer to a new batch, to be freed with url_BatchFree(), or NULL
+ *         if error.
+ */
+extern url_batch *url_BatchNew(void)
+{
+	return(url_BatchNewSharded(1));
+}
+
+
+/**
+ * Create a new, empty batch, split into shards by hostname.
+ * @param  shards Number of shards, 1 being the same as url_BatchNew().
+ * @return        Pointer to a new batch, to be freed with url_BatchFree(), or
+ *                NULL if error.
+ */
+extern url_batch *url_BatchNewSharded(unsigned shards)
+{
+	if(shards==0)
+		return(NULL);
+	url_batch *b = calloc(1, sizeof(url_batch));
+	if(b==NULL)
+		return(NULL);
+	if((b->shards = calloc(shards, sizeof(url_batch_shard)))==NULL) {
+		free(b);
+		return(NULL);
+	}
+	b->shard_count = shards;
+	b->opaque_policy = URL_OPAQUE_PASSTHROUGH;
+	b->opaque_max = URL_OPAQUE_MAX_LEN;
+	return(b);
+}
+
+
+/**
+ * Free a batch and all its canonicalized URLs.
+ * @param b Pointer returned by url_BatchNew(), or NULL.
+ */
+extern void url_BatchFree(url_batch *b)
+{
+	if(b==NULL)
+		return;
+	for(unsigned i=0; i<b->shard_count; i++) {
+		free(b->shards[i].data);
+		free(b->shards[i].indexes);
+	}
+	free(b->shards);
+	free(b->entries);
+	free(b);
+}
+
+
+/**
+ * Remove all the URLs of a batch, keeping its memory for the next ones.
+ * @param b Batch.
+ */
+extern void url_BatchReset(url_batch *b)
+{
+	if(b==NULL)
+		return;
+	for(unsigned i=0; i<b->shard_count; i++) {
+		b->shards[i].data_len = 0;
+		b->shards[i].count = 0;
+	}
+	b->count = 0;
+}
+
+
+/**
+ * Choose how the URLs with an opaque scheme of the next url_CanonicalizeBatch()
+ * calls are canonicalized, as url_CanonicalizeWithOpaquePolicy() does.
+ * @param b       Batch.
+ * @param policy  URL_OPAQUE_PASSTHROUGH (default), URL_OPAQUE_TRUNCATE or
+ *                URL_OPAQUE_HASH.
+ * @param max_len Maximum length of a canonicalized URL with the
+ *                URL_OPAQUE_TRUNCATE policy, or 0 for URL_OPAQUE_MAX_LEN.
+ */
+extern void url_BatchSetOpaquePolicy(url_batch *b, int policy, size_t max_len)
+{
+	if(b==NULL)
+		return;
+	b->opaque_policy = policy;
+	b->opaque_max = max_len;
+}
+
+
+static bool url_BatchReserve(url_batch *b, size_t entries)
+{
+	if(b->count + entries > b->entries_cap) {
+		size_t cap = b->entries_cap ? b->entries_cap : 256;
+		while(cap < b->count + entries)
+			cap *= 2;
+		url_batch_entry *p = realloc(b->entries, cap * sizeof(url_batch_entry));
+		if(p==NULL)
+			return(false);
+		b->entries = p;
+		b->entries_cap = cap;
+	}
+	return(true);
+}
+
+
+static bool url_BatchShardReserve(url_batch_shard *shard, size_t bytes)
+{
+	if(shard->count == shard->indexes_cap) {
+		size_t cap = shard->indexes_cap ? shard->indexes_cap*2 : 256;
+		size_t *p = realloc(shard->indexes, cap * sizeof(size_t));
+		if(p==NULL)
+			return(false);
+		shard->indexes = p;
+		shard->indexes_cap = cap;
+	}
+	if(shard->data_len + bytes > shard->data_cap) {
+		size_t cap = shard->data_cap ? shard->data_cap : 16384;
+		while(cap < shard->data_len + bytes)
+			cap *= 2;
+		char *p = realloc(shard->data, cap);
+		if(p==NULL)
+			return(false);
+		shard->data = p;
+		shard->data_cap = cap;
+	}
+	return(true);
+}
+
+
+// Append an URL to a batch, its hostname being host_len bytes at offset
+// host, or a failed entry if canonical is NULL or if memory is missing for
+// the URL. Return 1 if the URL was appended, 0 if a failed entry was, -1 if
+// nothing could be.
+static int url_BatchAppend(url_batch *b, const char *canonical, size_t len, size_t host, size_t host_len)
+{
+	if(!url_BatchReserve(b, 1))
+		return(-1);
+	url_batch_entry *entry = &b->entries[b->count++];
+	entry->offset = URL_BATCH_FAILED;
+	entry->len = 0;
+	if(canonical==NULL)
+		return(0);
+	unsigned s = b->shard_count>1 ? url_BatchHostShard(canonical + host, host_len, b->shard_count) : 0;
+	url_batch_shard *shard = &b->shards[s];
+	if(!url_BatchShardReserve(shard, len+1))
+		return(0);
+	entry->offset = shard->data_len;
+	entry->len = len;
+	entry->shard = s;
+	entry->host = host;
+	entry->host_len = host_len;
+	memcpy(shard->data + shard->data_len, canonical, len);
+	shard->data[shard->data_len + len] = '\0';
+	shard->data_len += len+1;
+	shard->indexes[shard->count++] = b->count-1;
+	return(1);
+}
+
+
+#ifdef __SSE2__
+
+// Transpose 16 rows of 16 bytes : four perfect shuffles of the rows
+static void url_BatchTranspose(__m128i r[16])
+{
+	__m128i t[16];
+	for(int round=0; round<4; round++) {
+		for(int i=0; i<8; i++) {
+			t[2*i] = _mm_unpacklo_epi8(r[i], r[i+8]);
+			t[2*i+1] = _mm_unpackhi_epi8(r[i], r[i+8]);
+		}
+		memcpy(r, t, sizeof(t));
+	}
+}
+
+// Set the bytes of v between lo and hi (included) to 0xff, the others to 0
+static inline __m128i url_BatchInRange(__m128i v, char lo, char hi)
+{
+	__m128i d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+	return(_mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(hi-lo)), d));
+}
+
+// Return the length of a "http://" or "https://" prefix, in any case, or 0
+static size_t url_BatchScheme(const char *url, size_t len)
+{
+	size_t n = 0;
+	for( ; n<5 && n<len; n++)
+		if((url[n] | 0x20) != "https"[n])
+			break;
+	if(n==5 || (n==4 && len>4))
+		return(len>=n+3 && memcmp(url+n, "://", 3)==0 ? n+3 : 0);
+	return(0);
+}
+
+/**
+ * Canonicalize up to URL_BATCH_LANES URLs shorter than URL_BATCH_SHORT bytes
+ * at once. A lane is simple if its URL is "http://" or "https://", then a
+ * host not starting or ending with '.' and not only made of digits, then a
+ * path without "//" or "/." and a query, only made of bytes from 33 to 126
+ * except '%' and '#'. Its canonicalized form is then the URL with the scheme
+ * and host lowercased and '/' inserted after the host if missing.
+ * @param  urls      Pointers to the URLs, NULL for the lanes not to be
+ *                   handled.
+ * @param  lens      Lengths of the URLs.
+ * @param  out       Buffers receiving the NUL terminated simple URLs.
+ * @param  out_lens  Lengths of the simple URLs.
+ * @param  hosts     Offsets of the hostnames in the simple URLs, as
+ *                   url_FindHostname() finds them.
+ * @param  host_lens Lengths of the hostnames.
+ * @param  count     Number of lanes.
+ * @return           Bit mask of the simple lanes.
+ */
+static unsigned url_BatchLanes(const char * const *urls, const size_t *lens, char out[][URL_BATCH_SHORT+2], size_t *out_lens, size_t *hosts, size_t *host_lens, size_t count)
+{
+	__m128i rows[URL_BATCH_SHORT/16][16];
+	char lanes[16][URL_BATCH_SHORT];
+	char len_bytes[16] = {0}, host_bytes[16] = {0};
+	unsigned todo = 0;
+	size_t max_len = 0;
+
+	for(size_t l=0; l<16; l++) {
+		memset(lanes[l], 0, URL_BATCH_SHORT);
+		if(l<count && urls[l]) {
+			size_t scheme = url_BatchScheme(urls[l], lens[l]);
+			if(scheme) {
+				memcpy(lanes[l], urls[l], lens[l]);
+				len_bytes[l] = lens[l];
+				host_bytes[l] = scheme;
+				todo |= 1u << l;
+				if(lens[l] > max_len)
+					max_len = lens[l];
+			}
+		}
+	}
+	if(todo==0)
+		return(0);
+
+	// Byte p of each URL, one register per position. Positions up to
+	// max_len are read, so that hosts ending the URL are seen ending.
+	int blocks = max_len/16 + 1;
+	for(int block=0; block<blocks; block++) {
+		for(int l=0; l<16; l++)
+			rows[block][l] = _mm_loadu_si128((const __m128i *)(lanes[l] + block*16));
+		url_BatchTranspose(rows[block]);
+	}
+
+	const __m128i ones = _mm_set1_epi8(-1);
+	__m128i len_v = _mm_loadu_si128((const __m128i *)len_bytes);
+	__m128i host_v = _mm_loadu_si128((const __m128i *)host_bytes);
+	__m128i bad = _mm_setzero_si128(), host_done = bad, in_query = bad, nondigit = bad;
+	__m128i host_end = bad, prev = bad;
+
+	for(int p=0; p<=(int)max_len; p++) {
+		// Stop as soon as no lane is left simple
+		if(p%16==0 && (todo & ~(unsigned)_mm_movemask_epi8(bad))==0)
+			return(0);
+
+		__m128i c = rows[p/16][p%16];
+		__m128i pos = _mm_set1_epi8(p);
+		__m128i valid = _mm_cmpgt_epi8(len_v, pos);
+		__m128i in_scheme = _mm_cmpgt_epi8(host_v, pos);
+		__m128i host_start = _mm_cmpeq_epi8(host_v, pos);
+
+		// Bytes <= 32 or >= 127, '%' and '#'
+		__m128i escaped = _mm_or_si128(_mm_cmplt_epi8(c, _mm_set1_epi8(33)), _mm_cmpeq_epi8(c, _mm_set1_epi8(127)));
+		escaped = _mm_or_si128(escaped, _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('%')), _mm_cmpeq_epi8(c, _mm_set1_epi8('#'))));
+		bad = _mm_or_si128(bad, _mm_and_si128(valid, escaped));
+
+		// Host ends at '/', '?' or at the end of the URL
+		__m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+		__m128i question = _mm_cmpeq_epi8(c, _mm_set1_epi8('?'));
+		__m128i term = _mm_or_si128(_mm_andnot_si128(valid, ones), _mm_or_si128(slash, question));
+		__m128i in_host_part = _mm_andnot_si128(_mm_or_si128(in_scheme, host_done), ones);
+		__m128i ends = _mm_and_si128(in_host_part, term);
+		__m128i in_host = _mm_andnot_si128(term, in_host_part);
+		__m128i dot = _mm_cmpeq_epi8(c, _mm_set1_epi8('.'));
+		__m128i prev_dot = _mm_cmpeq_epi8(prev, _mm_set1_epi8('.'));
+
+		// Empty host, leading or trailing '.', only digits
+		__m128i wrong = _mm_or_si128(_mm_and_si128(ends, host_start), _mm_and_si128(in_host, _mm_and_si128(host_start, dot)));
+		wrong = _mm_or_si128(wrong, _mm_and_si128(ends, _mm_or_si128(prev_dot, _mm_andnot_si128(nondigit, ones))));
+		bad = _mm_or_si128(bad, wrong);
+		nondigit = _mm_or_si128(nondigit, _mm_andnot_si128(url_BatchInRange(c, '0', '9'), in_host));
+		host_end = _mm_or_si128(host_end, _mm_and_si128(ends, pos));
+		host_done = _mm_or_si128(host_done, ends);
+
+		// "//" and "/." in the path
+		__m128i in_path = _mm_and_si128(valid, _mm_andnot_si128(in_query, host_done));
+		__m128i prev_slash = _mm_cmpeq_epi8(prev, _mm_set1_epi8('/'));
+		bad = _mm_or_si128(bad, _mm_and_si128(in_path, _mm_and_si128(prev_slash, _mm_or_si128(slash, dot))));
+		in_query = _mm_or_si128(in_query, _mm_and_si128(in_path, question));
+
+		// Lowercase the scheme and the host
+		__m128i upper = _mm_and_si128(url_BatchInRange(c, 'A', 'Z'), _mm_or_si128(in_scheme, in_host));
+		rows[p/16][p%16] = _mm_add_epi8(c, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+		prev = c;
+	}
+
+	unsigned simple = todo & ~(unsigned)_mm_movemask_epi8(bad);
+	if(simple==0)
+		return(0);
+
+	for(int block=0; block<blocks; block++) {
+		url_BatchTranspose(rows[block]);
+		for(int l=0; l<16; l++)
+			_mm_storeu_si128((__m128i *)(lanes[l] + block*16), rows[block][l]);
+	}
+
+	char host_ends[16];
+	_mm_storeu_si128((__m128i *)host_ends, host_end);
+	for(size_t l=0; l<count; l++) {
+		if(!(simple & (1u << l)))
+			continue;
+		size_t len = lens[l], end = host_ends[l];
+		memcpy(out[l], lanes[l], end);
+		if(end==len || lanes[l][end]!='/')
+			out[l][end++] = '/';
+		memcpy(out[l] + end, lanes[l] + host_ends[l], len - host_ends[l]);
+		out_lens[l] = end + len - host_ends[l];
+		out[l][out_lens[l]] = '\0';
+
+		// Hostname without "www." and port
+		size_t host = host_bytes[l];
+		end = host_ends[l];
+		if(end-host>=4 && memcmp(out[l] + host, "www.", 4)==0)
+			host +=4;
+		const char *port = memchr(out[l] + host, ':', end-host);
+		hosts[l] = host;
+		host_lens[l] = (port ? (size_t)(port - out[l]) : end) - host;
+	}
+	return(simple);
+}
+
+#endif
+
+
+/**
+ * Canonicalize URLs, as url_Canonicalize() does, and append them to a batch.
+ * URLs with an opaque scheme follow the policy of the batch.
+ * @param  b     Batch.
+ * @param  urls  Array of pointers to the URLs.
+ * @param  lens  Array of the lengths of the URLs, or NULL. A length of 0
+ *               means strlen() will be used.
+ * @param  count Number of URLs.
+ * @return       Number of URLs successfully canonicalized. The others are
+ *               still appended, so that indexes in the batch follow the
+ *               input, but url_BatchGet() returns NULL for them.
+ */
+extern size_t url_CanonicalizeBatch(url_batch *b, const char * const *urls, const size_t *lens, size_t count)
+{
+	if(b==NULL || urls==NULL)
+		return(0);
+
+	size_t done = 0;
+	unsigned skip = 0;
+	for(size_t i=0; i<count; i+=URL_BATCH_LANES) {
+		size_t n = count-i < URL_BATCH_LANES ? count-i : URL_BATCH_LANES;
+		char out[URL_BATCH_LANES][URL_BATCH_SHORT+2];
+		size_t out_lens[URL_BATCH_LANES], hosts[URL_BATCH_LANES], host_lens[URL_BATCH_LANES];
+		unsigned simple = 0;
+
+#ifdef __SSE2__
+		if(skip)
+			skip--;
+		else {
+			const char *group[URL_BATCH_LANES];
+			size_t group_lens[URL_BATCH_LANES];
+			for(size_t l=0; l<n; l++) {
+				group[l] = urls[i+l];
+				group_lens[l] = 0;
+				if(group[l]) {
+					group_lens[l] = lens && lens[i+l] ? lens[i+l] : strlen(group[l]);
+					if(group_lens[l] >= URL_BATCH_SHORT)
+						group[l] = NULL;
+				}
+			}
+			simple = url_BatchLanes(group, group_lens, out, out_lens, hosts, host_lens, n);
+			if(simple==0)
+				skip = URL_BATCH_SKIP;
+		}
+#endif
+
+		for(size_t l=0; l<n; l++) {
+			int appended;
+			if(simple & (1u << l))
+				appended = url_BatchAppend(b, out[l], out_lens[l], hosts[l], host_lens[l]);
+			else {
+				size_t len = 0, host_len = 0;
+				char *canonical = urls[i+l] ? url_CanonicalizeWithOpaquePolicy(urls[i+l], lens ? lens[i+l] : 0, &len, b->opaque_policy, b->opaque_max) : NULL;
+				const char *host = NULL;
+				if(canonical && b->shard_count>1)
+					host = url_FindHostname(canonical, len, &host_len);
+				appended = url_BatchAppend(b, canonical, len, host ? host - canonical : 0, host ? host_len : URL_BATCH_NO_HOST);
+				free(canonical);
+			}
+			if(appended<0)
+				return(done);
+			done += appended;
+		}
+	}
+	return(done);
+}
+
+
+/**
+ * Return the number of URLs of a batch.
+ * @param  b Batch.
+ * @return   Number of URLs, including the ones which could not be
+ *           canonicalized.
+ */
+extern size_t url_BatchCount(const url_batch *b)
+{
+	return(b ? b->count : 0);
+}
+
+
+/**
+ * Return a canonicalized URL of a batch.
+ * @param  b     Batch.
+ * @param  index Index of the URL in the batch.
+ * @param  len   If not NULL, will receive the length of the URL.
+ * @return       Pointer to the NUL terminated canonicalized URL, owned by
+ *               the batch and valid until it is reset or freed, or NULL if
+ *               the URL could not be canonicalized.
+ */
+extern const char *url_BatchGet(const url_batch *b, size_t index, size_t *len)
+{
+	if(b==NULL || index>=b->count || b->entries[index].offset==URL_BATCH_FAILED)
+		return(NULL);
+	const url_batch_entry *entry = &b->entries[index];
+	if(len)
+		*len = entry->len;
+	return(b->shards[entry->shard].data + entry->offset);
+}
+
+
+/**
+ * Return the hostname of a canonicalized URL of a batch, as
+ * url_FindHostname() finds it, without searching for it again.
+ * @param  b     Batch.
+ * @param  index Index of the URL in the batch.
+ * @param  len   Will receive the length of the hostname.
+ * @return       Pointer to the hostname, inside the URL returned by
+ *               url_BatchGet() (so not NUL terminated), or NULL if the URL
+ *               could not be canonicalized.
+ */
+extern const char *url_BatchGetHost(const url_batch *b, size_t index, size_t *len)
+{
+	size_t url_len;
+	const char *url = url_BatchGet(b, index, &url_len);
+	if(url==NULL || len==NULL)
+		return(NULL);
+	if(b->entries[index].host_len==URL_BATCH_NO_HOST)
+		return(url_FindHostname(url, url_len, len));
+	*len = b->entries[index].host_len;
+	return(url + b->entries[index].host);
+}
+
+
+/**
+ * Return the shard of a hostname.
+ * @param  hostname Pointer to the hostname, as url_FindHostname() finds it.
+ * @param  len      Length of the hostname.
+ * @param  shards   Number of shards.
+ * @return          Shard, from 0 to shards-1.
+ */
+extern unsigned url_BatchHostShard(const char *hostname, size_t len, unsigned shards)
+{
+	if(hostname==NULL || shards<=1)
+		return(0);
+	return(url_Hash64(hostname, len, URL_BATCH_HOST_SEED) % shards);
+}
+
+
+/**
+ * Return the number of shards of a batch.
+ * @param  b Batch.
+ * @return   Number of shards, 1 if the batch was made by url_BatchNew().
+ */
+extern unsigned url_BatchShards(const url_batch *b)
+{
+	return(b ? b->shard_count : 0);
+}
+
+
+/**
+ * Return the number of URLs of a shard of a batch.
+ * @param  b     Batch.
+ * @param  shard Shard.
+ * @return       Number of URLs canonicalized in the shard.
+ */
+extern size_t url_BatchShardCount(const url_batch *b, unsigned shard)
+{
+	if(b==NULL || shard>=b->shard_count)
+		return(0);
+	return(b->shards[shard].count);
+}
+
+
+/**
+ * Return a canonicalized URL of a shard of a batch. URLs of a shard are in
+ * the order of the batch.
+ * @param  b           Batch.
+ * @param  shard       Shard.
+ * @param  index       Index of the URL in the shard.
+ * @param  len         If not NULL, will receive the length of the URL.
+ * @param  batch_index If not NULL, will receive the index of the URL in the
+ *                     batch, to be given to url_BatchGetHost().
+ * @return             Pointer to the NUL terminated canonicalized URL, or
+ *                     NULL if index is out of the shard.
+ */
+extern const char *url_BatchShardGet(const url_batch *b, unsigned shard, size_t index, size_t *len, size_t *batch_index)
+{
+	if(b==NULL || shard>=b->shard_count || index>=b->shards[shard].count)
+		return(NULL);
+	size_t entry = b->shards[shard].indexes[index];
+	if(batch_index)
+		*batch_index = entry;
+	return(url_BatchGet(b, entry, len));
+}
+
+
+/**
+ * Return the arena of a shard : its URLs one after the other, each one NUL
+ * terminated, to be handed to another thread or process at once.
+ * @param  b     Batch.
+ * @param  shard Shard.
+ * @param  len   Will receive the number of bytes of the arena.
+ * @return       Pointer to the arena, valid until the batch is changed, or
+ *               NULL if the shard is empty.
+ */
+extern const char *url_BatchShardData(const url_batch *b, unsigned shard, size_t *len)
+{
+	if(b==NULL || len==NULL || shard>=b->shard_count || b->shards[shard].count==0)
+		return(NULL);
+	*len = b->shards[shard].data_len;
+	return(b->shards[shard].data);
+}
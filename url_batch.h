@@ -0,0 +1,160 @@
+#ifndef _URL_BATCH_H_
+#define _URL_BATCH_H_
+
+#include <stddef.h>
+
+/*
+	Batch canonicalization of URLs.
+
+	The canonicalized URLs of a batch are stored one after the other, NUL
+	terminated, in a single arena owned by the batch, instead of one
+	allocation per URL. A batch can be reset and reused, keeping its
+	memory, so that a steady stream of batches does not allocate at all.
+
+	The hostname of each URL (as url_FindHostname() finds it : no "www.",
+	no port) is located while it is canonicalized. A batch can also be
+	split into shards by hostname, each shard having its own arena, so
+	that all the URLs of a host end up in the same shard, in input order.
+	The shard of a hostname only depends on it and on the number of
+	shards : url_Hash64(hostname, len, URL_BATCH_HOST_SEED) % shards.
+*/
+
+// Seed of the hash of the hostnames choosing their shard
+#define URL_BATCH_HOST_SEED 0
+
+typedef struct url_batch url_batch;
+
+
+/**
+ * Create a new, empty batch.
+ * @return Pointer to a new batch, to be freed with url_BatchFree(), or NULL
+ *         if error.
+ */
+extern url_batch *url_BatchNew(void);
+
+/**
+ * Create a new, empty batch, split into shards by hostname.
+ * @param  shards Number of shards, 1 being the same as url_BatchNew().
+ * @return        Pointer to a new batch, to be freed with url_BatchFree(), or
+ *                NULL if error.
+ */
+extern url_batch *url_BatchNewSharded(unsigned shards);
+
+/**
+ * Free a batch and all its canonicalized URLs.
+ * @param b Pointer returned by url_BatchNew(), or NULL.
+ */
+extern void url_BatchFree(url_batch *b);
+
+/**
+ * Remove all the URLs of a batch, keeping its memory for the next ones.
+ * @param b Batch.
+ */
+extern void url_BatchReset(url_batch *b);
+
+/**
+ * Choose how the URLs with an opaque scheme of the next url_CanonicalizeBatch()
+ * calls are canonicalized, as url_CanonicalizeWithOpaquePolicy() does.
+ * @param b       Batch.
+ * @param policy  URL_OPAQUE_PASSTHROUGH (default), URL_OPAQUE_TRUNCATE or
+ *                URL_OPAQUE_HASH.
+ * @param max_len Maximum length of a canonicalized URL with the
+ *                URL_OPAQUE_TRUNCATE policy, or 0 for URL_OPAQUE_MAX_LEN.
+ */
+extern void url_BatchSetOpaquePolicy(url_batch *b, int policy, size_t max_len);
+
+/**
+ * Canonicalize URLs, as url_Canonicalize() does, and append them to a batch.
+ * URLs with an opaque scheme follow the policy of the batch.
+ * @param  b     Batch.
+ * @param  urls  Array of pointers to the URLs.
+ * @param  lens  Array of the lengths of the URLs, or NULL. A length of 0
+ *               means strlen() will be used.
+ * @param  count Number of URLs.
+ * @return       Number of URLs successfully canonicalized. The others are
+ *               still appended, so that indexes in the batch follow the
+ *               input, but url_BatchGet() returns NULL for them.
+ */
+extern size_t url_CanonicalizeBatch(url_batch *b, const char * const *urls, const size_t *lens, size_t count);
+
+/**
+ * Return the number of URLs of a batch.
+ * @param  b Batch.
+ * @return   Number of URLs, including the ones which could not be
+ *           canonicalized.
+ */
+extern size_t url_BatchCount(const url_batch *b);
+
+/**
+ * Return a canonicalized URL of a batch.
+ * @param  b     Batch.
+ * @param  index Index of the URL in the batch.
+ * @param  len   If not NULL, will receive the length of the URL.
+ * @return       Pointer to the NUL terminated canonicalized URL, owned by
+ *               the batch and valid until it is reset or freed, or NULL if
+ *               the URL could not be canonicalized.
+ */
+extern const char *url_BatchGet(const url_batch *b, size_t index, size_t *len);
+
+/**
+ * Return the hostname of a canonicalized URL of a batch, as
+ * url_FindHostname() finds it, without searching for it again.
+ * @param  b     Batch.
+ * @param  index Index of the URL in the batch.
+ * @param  len   Will receive the length of the hostname.
+ * @return       Pointer to the hostname, inside the URL returned by
+ *               url_BatchGet() (so not NUL terminated), or NULL if the URL
+ *               could not be canonicalized.
+ */
+extern const char *url_BatchGetHost(const url_batch *b, size_t index, size_t *len);
+
+/**
+ * Return the shard of a hostname.
+ * @param  hostname Pointer to the hostname, as url_FindHostname() finds it.
+ * @param  len      Length of the hostname.
+ * @param  shards   Number of shards.
+ * @return          Shard, from 0 to shards-1.
+ */
+extern unsigned url_BatchHostShard(const char *hostname, size_t len, unsigned shards);
+
+/**
+ * Return the number of shards of a batch.
+ * @param  b Batch.
+ * @return   Number of shards, 1 if the batch was made by url_BatchNew().
+ */
+extern unsigned url_BatchShards(const url_batch *b);
+
+/**
+ * Return the number of URLs of a shard of a batch.
+ * @param  b     Batch.
+ * @param  shard Shard.
+ * @return       Number of URLs canonicalized in the shard.
+ */
+extern size_t url_BatchShardCount(const url_batch *b, unsigned shard);
+
+/**
+ * Return a canonicalized URL of a shard of a batch. URLs of a shard are in
+ * the order of the batch.
+ * @param  b           Batch.
+ * @param  shard       Shard.
+ * @param  index       Index of the URL in the shard.
+ * @param  len         If not NULL, will receive the length of the URL.
+ * @param  batch_index If not NULL, will receive the index of the URL in the
+ *                     batch, to be given to url_BatchGetHost().
+ * @return             Pointer to the NUL terminated canonicalized URL, or
+ *                     NULL if index is out of the shard.
+ */
+extern const char *url_BatchShardGet(const url_batch *b, unsigned shard, size_t index, size_t *len, size_t *batch_index);
+
+/**
+ * Return the arena of a shard : its URLs one after the other, each one NUL
+ * terminated, to be handed to another thread or process at once.
+ * @param  b     Batch.
+ * @param  shard Shard.
+ * @param  len   Will receive the number of bytes of the arena.
+ * @return       Pointer to the arena, valid until the batch is changed, or
+ *               NULL if the shard is empty.
+ */
+extern const char *url_BatchShardData(const url_batch *b, unsigned shard, size_t *len);
+
+#endif
@@ -0,0 +1,506 @@
+/*
+	Columnar files of canonicalized URLs.
+
+	The writer spools each per-URL section to its own temporary file and
+	interns schemes and hosts to get their dictionary identifiers. When
+	finishing, the dictionaries are written as sections too, and all the
+	sections are copied to the final file, each one starting on a page
+	boundary.
+
+	File layout :
+		"URLCOLS1"
+		uint32 0x01020304 (byte order), uint32 number of sections
+		uint64 number of URLs
+		uint64 offset, uint64 size of each section
+		sections, aligned on URL_COLUMNS_ALIGN bytes
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "url_intern.h"
+#include "url_columns.h"
+
+
+
+#define URL_COLUMNS_MAGIC "URLCOLS1"
+#define URL_COLUMNS_ORDER 0x01020304
+#define URL_COLUMNS_ALIGN 4096
+
+// Flags of each URL
+#define URL_COLUMNS_AUTHORITY 0x01	// "scheme://host", not "scheme:opaque"
+#define URL_COLUMNS_QUERY     0x02	// URL has a '?'
+
+enum {
+	URL_COLUMNS_FLAGS,				// uint8_t per URL
+	URL_COLUMNS_SCHEME_IDS,			// uint32_t per URL
+	URL_COLUMNS_SCHEME_OFFSETS,		// uint64_t per scheme, + 1
+	URL_COLUMNS_SCHEME_HEAP,
+	URL_COLUMNS_HOST_IDS,			// uint32_t per URL
+	URL_COLUMNS_HOST_DICT_OFFSETS,	// uint64_t per host, + 1
+	URL_COLUMNS_HOST_DICT_HEAP,
+	URL_COLUMNS_HOST_OFFSETS,		// uint64_t per URL, + 1
+	URL_COLUMNS_HOST_HEAP,
+	URL_COLUMNS_PATH_OFFSETS,
+	URL_COLUMNS_PATH_HEAP,
+	URL_COLUMNS_QUERY_OFFSETS,
+	URL_COLUMNS_QUERY_HEAP,
+	URL_COLUMNS_SECTIONS
+};
+
+#define URL_COLUMNS_HEADER (24 + 16*URL_COLUMNS_SECTIONS)
+
+struct url_columns_writer {
+	FILE *file;
+	FILE *spool[URL_COLUMNS_SECTIONS];
+	uint64_t pos[URL_COLUMNS_SECTIONS];
+	uint64_t rows;
+	url_intern *schemes;
+	url_intern *hosts;
+	bool failed;
+};
+
+struct url_columns {
+	const unsigned char *data;
+	size_t size;
+	uint64_t rows;
+	const unsigned char *section[URL_COLUMNS_SECTIONS];
+	uint64_t section_size[URL_COLUMNS_SECTIONS];
+	uint64_t scheme_count;
+	uint64_t host_count;
+};
+
+
+
+/**
+ * Start writing a columnar file. Columns are spooled to temporary files
+ * until url_ColumnsWriterFinish(), only the distinct schemes and hosts are
+ * kept in memory.
+ * @param  path Path of the file to be created.
+ * @return      Pointer to a writer, to be given to url_ColumnsWriterFinish(),
+ *              or NULL if error.
+ */
+extern url_columns_writer *url_ColumnsWriterNew(const char *path)
+{
+	if(path==NULL)
+		return(NULL);
+
+	url_columns_writer *w = calloc(1, sizeof(url_columns_writer));
+	if(w==NULL)
+		return(NULL);
+	w->file = fopen(path, "wb");
+	w->schemes = url_InternNew(1);
+	w->hosts = url_InternNew(1);
+	if(w->file==NULL || w->schemes==NULL || w->hosts==NULL)
+		goto bad;
+	for(int i=0; i<URL_COLUMNS_SECTIONS; i++) {
+		w->spool[i] = tmpfile();
+		if(w->spool[i]==NULL)
+			goto bad;
+	}
+	return(w);
+
+bad:
+	w->failed = true;
+	url_ColumnsWriterFinish(w);
+	return(NULL);
+}
+
+
+static void url_ColumnsSpool(url_columns_writer *w, int section, const void *data, size_t len)
+{
+	if(len && fwrite(data, 1, len, w->spool[section]) != len)
+		w->failed = true;
+	w->pos[section] += len;
+}
+
+
+static void url_ColumnsSpoolOffset(url_columns_writer *w, int section, uint64_t offset)
+{
+	url_ColumnsSpool(w, section, &offset, sizeof(offset));
+}
+
+
+static void url_ColumnsSpoolString(url_columns_writer *w, int offsets, int heap, const char *str, size_t len)
+{
+	url_ColumnsSpoolOffset(w, offsets, w->pos[heap]);
+	url_ColumnsSpool(w, heap, str, len);
+	url_ColumnsSpool(w, heap, "", 1);
+}
+
+
+// A length of 0 means strlen() for url_InternAdd() : empty strings are
+// interned as the single NUL character instead
+static uint32_t url_ColumnsIntern(url_intern *dict, const char *str, size_t len)
+{
+	return(len ? url_InternAdd(dict, str, len) : url_InternAdd(dict, "", 1));
+}
+
+
+/**
+ * Add a canonicalized URL to a columnar file.
+ * @param  w         Writer.
+ * @param  canonical Pointer to the URL, as returned by url_Canonicalize().
+ * @param  len       Length of the URL. If 0, strlen() will be used.
+ * @return           0, or -1 if error.
+ */
+extern int url_ColumnsWriterAdd(url_columns_writer *w, const char *canonical, size_t len)
+{
+	if(w==NULL || canonical==NULL || w->failed)
+		return(-1);
+	if(len==0)
+		len = strlen(canonical);
+	const char *end = canonical + len;
+
+	// Split "scheme://host/path?query"
+	const char *p = canonical;
+	while(p<end && *p!=':' && *p!='/' && *p!='?')
+		p++;
+	if(p==end || *p!=':')
+		return(-1);
+	const char *scheme = canonical;
+	size_t scheme_len = p - canonical;
+	p++;
+
+	uint8_t flags = 0;
+	const char *host = p;
+	if(end-p>=2 && p[0]=='/' && p[1]=='/') {
+		flags |= URL_COLUMNS_AUTHORITY;
+		host = p += 2;
+		while(p<end && *p!='/' && *p!='?')
+			p++;
+	}
+	size_t host_len = p - host;
+
+	const char *path = p;
+	while(p<end && *p!='?')
+		p++;
+	size_t path_len = p - path;
+
+	const char *query = p;
+	if(p<end) {
+		flags |= URL_COLUMNS_QUERY;
+		query++;
+	}
+	size_t query_len = end - query;
+
+	uint32_t scheme_id = url_ColumnsIntern(w->schemes, scheme, scheme_len);
+	uint32_t host_id = url_ColumnsIntern(w->hosts, host, host_len);
+	if(scheme_id==URL_INTERN_NONE || host_id==URL_INTERN_NONE) {
+		w->failed = true;
+		return(-1);
+	}
+
+	url_ColumnsSpool(w, URL_COLUMNS_FLAGS, &flags, 1);
+	url_ColumnsSpool(w, URL_COLUMNS_SCHEME_IDS, &scheme_id, sizeof(scheme_id));
+	url_ColumnsSpool(w, URL_COLUMNS_HOST_IDS, &host_id, sizeof(host_id));
+	url_ColumnsSpoolString(w, URL_COLUMNS_HOST_OFFSETS, URL_COLUMNS_HOST_HEAP, host, host_len);
+	url_ColumnsSpoolString(w, URL_COLUMNS_PATH_OFFSETS, URL_COLUMNS_PATH_HEAP, path, path_len);
+	url_ColumnsSpoolString(w, URL_COLUMNS_QUERY_OFFSETS, URL_COLUMNS_QUERY_HEAP, query, query_len);
+	w->rows++;
+	return(w->failed ? -1 : 0);
+}
+
+
+/**
+ * Add all the URLs of a batch to a columnar file, skipping the ones which
+ * could not be canonicalized.
+ * @param  w Writer.
+ * @param  b Batch filled by url_CanonicalizeBatch().
+ * @return   0, or -1 if error.
+ */
+extern int url_ColumnsWriterAddBatch(url_columns_writer *w, const url_batch *b)
+{
+	if(w==NULL || b==NULL)
+		return(-1);
+	for(size_t i=0; i<url_BatchCount(b); i++) {
+		size_t len;
+		const char *canonical = url_BatchGet(b, i, &len);
+		if(canonical && url_ColumnsWriterAdd(w, canonical, len) && w->failed)
+			return(-1);
+	}
+	return(0);
+}
+
+
+// Write the strings of an interning dictionary as an offsets section and
+// a heap section
+static void url_ColumnsSpoolDictionary(url_columns_writer *w, const url_intern *dict, int offsets, int heap)
+{
+	uint32_t count = url_InternCount(dict);
+	for(uint32_t id=0; id<count; id++) {
+		const char *str = url_InternGet(dict, id, NULL);
+		if(str==NULL) {
+			w->failed = true;
+			return;
+		}
+		url_ColumnsSpoolString(w, offsets, heap, str, strlen(str));
+	}
+	url_ColumnsSpoolOffset(w, offsets, w->pos[heap]);
+}
+
+
+/**
+ * Write the dictionaries and all the columns, close the file and free the
+ * writer.
+ * @param  w Writer returned by url_ColumnsWriterNew().
+ * @return   0, or -1 if error (including a previous error while adding URLs).
+ */
+extern int url_ColumnsWriterFinish(url_columns_writer *w)
+{
+	if(w==NULL)
+		return(-1);
+
+	if(!w->failed) {
+		url_ColumnsSpoolOffset(w, URL_COLUMNS_HOST_OFFSETS, w->pos[URL_COLUMNS_HOST_HEAP]);
+		url_ColumnsSpoolOffset(w, URL_COLUMNS_PATH_OFFSETS, w->pos[URL_COLUMNS_PATH_HEAP]);
+		url_ColumnsSpoolOffset(w, URL_COLUMNS_QUERY_OFFSETS, w->pos[URL_COLUMNS_QUERY_HEAP]);
+		url_ColumnsSpoolDictionary(w, w->schemes, URL_COLUMNS_SCHEME_OFFSETS, URL_COLUMNS_SCHEME_HEAP);
+		url_ColumnsSpoolDictionary(w, w->hosts, URL_COLUMNS_HOST_DICT_OFFSETS, URL_COLUMNS_HOST_DICT_HEAP);
+	}
+
+	unsigned char header[URL_COLUMNS_HEADER] = { 0 };
+	memcpy(header, URL_COLUMNS_MAGIC, 8);
+	uint32_t order = URL_COLUMNS_ORDER, sections = URL_COLUMNS_SECTIONS;
+	memcpy(header+8, &order, 4);
+	memcpy(header+12, &sections, 4);
+	memcpy(header+16, &w->rows, 8);
+
+	// Copy each spooled section to the file, on a page boundary
+	uint64_t pos = URL_COLUMNS_HEADER;
+	if(!w->failed && fwrite(header, 1, sizeof(header), w->file) != sizeof(header))
+		w->failed = true;
+	for(int i=0; i<URL_COLUMNS_SECTIONS && !w->failed; i++) {
+		static const char zeros[URL_COLUMNS_ALIGN];
+		size_t padding = (URL_COLUMNS_ALIGN - pos % URL_COLUMNS_ALIGN) % URL_COLUMNS_ALIGN;
+		if(padding && fwrite(zeros, 1, padding, w->file) != padding)
+			w->failed = true;
+		pos += padding;
+		memcpy(header + 24 + 16*i, &pos, 8);
+		memcpy(header + 32 + 16*i, &w->pos[i], 8);
+
+		char buf[65536];
+		size_t n;
+		if(fflush(w->spool[i]) || fseek(w->spool[i], 0, SEEK_SET))
+			w->failed = true;
+		while(!w->failed && (n = fread(buf, 1, sizeof(buf), w->spool[i])) > 0)
+			if(fwrite(buf, 1, n, w->file) != n)
+				w->failed = true;
+		if(ferror(w->spool[i]))
+			w->failed = true;
+		pos += w->pos[i];
+	}
+	if(!w->failed && (fseek(w->file, 0, SEEK_SET) || fwrite(header, 1, sizeof(header), w->file) != sizeof(header)))
+		w->failed = true;
+
+	if(w->file && fclose(w->file))
+		w->failed = true;
+	for(int i=0; i<URL_COLUMNS_SECTIONS; i++)
+		if(w->spool[i])
+			fclose(w->spool[i]);
+	url_InternFree(w->schemes);
+	url_InternFree(w->hosts);
+	int ret = w->failed ? -1 : 0;
+	free(w);
+	return(ret);
+}
+
+
+// Check that an offsets section describes count strings of a heap section
+static bool url_ColumnsCheckHeap(const url_columns *c, int offsets, int heap, uint64_t count)
+{
+	if(c->section_size[offsets] != 8*(count+1))
+		return(false);
+	const uint64_t *o = (const uint64_t *)c->section[offsets];
+	return(o[0]==0 && o[count]==c->section_size[heap]);
+}
+
+
+/**
+ * Open a columnar file, mapping it in memory.
+ * @param  path Path of the file.
+ * @return      Pointer to the columns, to be freed with url_ColumnsClose(),
+ *              or NULL if error.
+ */
+extern url_columns *url_ColumnsOpen(const char *path)
+{
+	if(path==NULL)
+		return(NULL);
+
+	int fd = open(path, O_RDONLY);
+	if(fd<0)
+		return(NULL);
+	struct stat st;
+	if(fstat(fd, &st) || st.st_size < URL_COLUMNS_HEADER) {
+		close(fd);
+		return(NULL);
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(data==MAP_FAILED)
+		return(NULL);
+
+	url_columns *c = calloc(1, sizeof(url_columns));
+	if(c==NULL)
+		goto bad;
+	c->data = data;
+	c->size = st.st_size;
+
+	uint32_t order, sections;
+	memcpy(&order, c->data+8, 4);
+	memcpy(&sections, c->data+12, 4);
+	memcpy(&c->rows, c->data+16, 8);
+	if(memcmp(c->data, URL_COLUMNS_MAGIC, 8) || order!=URL_COLUMNS_ORDER || sections!=URL_COLUMNS_SECTIONS)
+		goto bad;
+
+	for(int i=0; i<URL_COLUMNS_SECTIONS; i++) {
+		uint64_t offset, size;
+		memcpy(&offset, c->data + 24 + 16*i, 8);
+		memcpy(&size, c->data + 32 + 16*i, 8);
+		if(offset % URL_COLUMNS_ALIGN || offset > c->size || size > c->size - offset)
+			goto bad;
+		c->section[i] = c->data + offset;
+		c->section_size[i] = size;
+	}
+
+	c->scheme_count = c->section_size[URL_COLUMNS_SCHEME_OFFSETS] / 8 - 1;
+	c->host_count = c->section_size[URL_COLUMNS_HOST_DICT_OFFSETS] / 8 - 1;
+	if(c->section_size[URL_COLUMNS_FLAGS] != c->rows
+	|| c->section_size[URL_COLUMNS_SCHEME_IDS] != 4*c->rows
+	|| c->section_size[URL_COLUMNS_HOST_IDS] != 4*c->rows
+	|| c->section_size[URL_COLUMNS_SCHEME_OFFSETS] < 8
+	|| c->section_size[URL_COLUMNS_HOST_DICT_OFFSETS] < 8
+	|| c->host_count >= URL_INTERN_NONE
+	|| !url_ColumnsCheckHeap(c, URL_COLUMNS_SCHEME_OFFSETS, URL_COLUMNS_SCHEME_HEAP, c->scheme_count)
+	|| !url_ColumnsCheckHeap(c, URL_COLUMNS_HOST_DICT_OFFSETS, URL_COLUMNS_HOST_DICT_HEAP, c->host_count)
+	|| !url_ColumnsCheckHeap(c, URL_COLUMNS_HOST_OFFSETS, URL_COLUMNS_HOST_HEAP, c->rows)
+	|| !url_ColumnsCheckHeap(c, URL_COLUMNS_PATH_OFFSETS, URL_COLUMNS_PATH_HEAP, c->rows)
+	|| !url_ColumnsCheckHeap(c, URL_COLUMNS_QUERY_OFFSETS, URL_COLUMNS_QUERY_HEAP, c->rows))
+		goto bad;
+
+	return(c);
+
+bad:
+	munmap(data, st.st_size);
+	free(c);
+	return(NULL);
+}
+
+
+/**
+ * Close a columnar file.
+ * @param c Pointer returned by url_ColumnsOpen(), or NULL.
+ */
+extern void url_ColumnsClose(url_columns *c)
+{
+	if(c==NULL)
+		return;
+	munmap((void *)c->data, c->size);
+	free(c);
+}
+
+
+/**
+ * Return the number of URLs of a columnar file.
+ * @param  c Columns.
+ * @return   Number of URLs.
+ */
+extern uint64_t url_ColumnsCount(const url_columns *c)
+{
+	return(c ? c->rows : 0);
+}
+
+
+static const char *url_ColumnsHeapValue(const url_columns *c, int offsets, int heap, uint64_t index, size_t *len)
+{
+	const uint64_t *o = (const uint64_t *)c->section[offsets];
+	if(o[index] >= o[index+1] || o[index+1] > c->section_size[heap])
+		return(NULL);
+	if(len)
+		*len = o[index+1] - o[index] - 1;
+	return((const char *)c->section[heap] + o[index]);
+}
+
+
+/**
+ * Return one part of an URL of a columnar file.
+ * @param  c      Columns.
+ * @param  column URL_COLUMN_SCHEME, URL_COLUMN_HOST, URL_COLUMN_PATH or
+ *                URL_COLUMN_QUERY.
+ * @param  row    Index of the URL in the file.
+ * @param  len    If not NULL, will receive the length of the value.
+ * @return        Pointer to the NUL terminated value, inside the mapped file,
+ *                or NULL if error or if the URL has no query.
+ */
+extern const char *url_ColumnsGet(const url_columns *c, int column, uint64_t row, size_t *len)
+{
+	if(c==NULL || row>=c->rows)
+		return(NULL);
+
+	switch(column) {
+		case URL_COLUMN_SCHEME: {
+			uint32_t id = ((const uint32_t *)c->section[URL_COLUMNS_SCHEME_IDS])[row];
+			if(id >= c->scheme_count)
+				return(NULL);
+			return(url_ColumnsHeapValue(c, URL_COLUMNS_SCHEME_OFFSETS, URL_COLUMNS_SCHEME_HEAP, id, len));
+		}
+		case URL_COLUMN_HOST:
+			return(url_ColumnsHeapValue(c, URL_COLUMNS_HOST_OFFSETS, URL_COLUMNS_HOST_HEAP, row, len));
+		case URL_COLUMN_PATH:
+			return(url_ColumnsHeapValue(c, URL_COLUMNS_PATH_OFFSETS, URL_COLUMNS_PATH_HEAP, row, len));
+		case URL_COLUMN_QUERY:
+			if(!(c->section[URL_COLUMNS_FLAGS][row] & URL_COLUMNS_QUERY))
+				return(NULL);
+			return(url_ColumnsHeapValue(c, URL_COLUMNS_QUERY_OFFSETS, URL_COLUMNS_QUERY_HEAP, row, len));
+	}
+	return(NULL);
+}
+
+
+/**
+ * Return the dictionary-encoded host column, to be read directly.
+ * @param  c Columns.
+ * @return   Array of url_ColumnsCount() host identifiers, inside the mapped
+ *           file.
+ */
+extern const uint32_t *url_ColumnsHostIds(const url_columns *c)
+{
+	return(c ? (const uint32_t *)c->section[URL_COLUMNS_HOST_IDS] : NULL);
+}
+
+
+/**
+ * Return the number of distinct hosts of a columnar file.
+ * @param  c Columns.
+ * @return   Number of distinct hosts.
+ */
+extern uint32_t url_ColumnsHostCount(const url_columns *c)
+{
+	return(c ? (uint32_t)c->host_count : 0);
+}
+
+
+/**
+ * Return the host having a given identifier.
+ * @param  c   Columns.
+ * @param  id  Identifier read from url_ColumnsHostIds().
+ * @param  len If not NULL, will receive the length of the host.
+ * @return     Pointer to the NUL terminated host, inside the mapped file,
+ *             or NULL if id is unknown.
+ */
+extern const char *url_ColumnsHostName(const url_columns *c, uint32_t id, size_t *len)
+{
+	if(c==NULL || id >= c->host_count)
+		return(NULL);
+	return(url_ColumnsHeapValue(c, URL_COLUMNS_HOST_DICT_OFFSETS, URL_COLUMNS_HOST_DICT_HEAP, id, len));
+}
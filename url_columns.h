@@ -0,0 +1,130 @@
+#ifndef _URL_COLUMNS_H_
+#define _URL_COLUMNS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "url_batch.h"
+
+/*
+	Columnar files of canonicalized URLs, already split in scheme, host,
+	path and query, so that analytics jobs do not have to split them again
+	with url_Split() or url_GetHostname().
+
+	Each column is stored in its own page aligned sections of the file :
+	a string heap (NUL terminated values, one after the other) with an
+	array of offsets. Hosts are also dictionary-encoded : an array of 32
+	bits identifiers, one per URL, and the list of distinct hosts, so that
+	a per-host aggregation over a mapped file only reads the pages of the
+	identifiers. Schemes are only dictionary-encoded.
+
+	The host is everything between "//" and the path, port included
+	("www.example.com:8080"), the path starts with '/' and the query is
+	what follows the first '?'. Integers are stored in the byte order of
+	the machine writing the file, which is checked when opening it.
+*/
+
+#define URL_COLUMN_SCHEME 0
+#define URL_COLUMN_HOST   1
+#define URL_COLUMN_PATH   2
+#define URL_COLUMN_QUERY  3
+
+typedef struct url_columns_writer url_columns_writer;
+typedef struct url_columns url_columns;
+
+
+/**
+ * Start writing a columnar file. Columns are spooled to temporary files
+ * until url_ColumnsWriterFinish(), only the distinct schemes and hosts are
+ * kept in memory.
+ * @param  path Path of the file to be created.
+ * @return      Pointer to a writer, to be given to url_ColumnsWriterFinish(),
+ *              or NULL if error.
+ */
+extern url_columns_writer *url_ColumnsWriterNew(const char *path);
+
+/**
+ * Add a canonicalized URL to a columnar file.
+ * @param  w         Writer.
+ * @param  canonical Pointer to the URL, as returned by url_Canonicalize().
+ * @param  len       Length of the URL. If 0, strlen() will be used.
+ * @return           0, or -1 if error.
+ */
+extern int url_ColumnsWriterAdd(url_columns_writer *w, const char *canonical, size_t len);
+
+/**
+ * Add all the URLs of a batch to a columnar file, skipping the ones which
+ * could not be canonicalized.
+ * @param  w Writer.
+ * @param  b Batch filled by url_CanonicalizeBatch().
+ * @return   0, or -1 if error.
+ */
+extern int url_ColumnsWriterAddBatch(url_columns_writer *w, const url_batch *b);
+
+/**
+ * Write the dictionaries and all the columns, close the file and free the
+ * writer.
+ * @param  w Writer returned by url_ColumnsWriterNew().
+ * @return   0, or -1 if error (including a previous error while adding URLs).
+ */
+extern int url_ColumnsWriterFinish(url_columns_writer *w);
+
+/**
+ * Open a columnar file, mapping it in memory.
+ * @param  path Path of the file.
+ * @return      Pointer to the columns, to be freed with url_ColumnsClose(),
+ *              or NULL if error.
+ */
+extern url_columns *url_ColumnsOpen(const char *path);
+
+/**
+ * Close a columnar file.
+ * @param c Pointer returned by url_ColumnsOpen(), or NULL.
+ */
+extern void url_ColumnsClose(url_columns *c);
+
+/**
+ * Return the number of URLs of a columnar file.
+ * @param  c Columns.
+ * @return   Number of URLs.
+ */
+extern uint64_t url_ColumnsCount(const url_columns *c);
+
+/**
+ * Return one part of an URL of a columnar file.
+ * @param  c      Columns.
+ * @param  column URL_COLUMN_SCHEME, URL_COLUMN_HOST, URL_COLUMN_PATH or
+ *                URL_COLUMN_QUERY.
+ * @param  row    Index of the URL in the file.
+ * @param  len    If not NULL, will receive the length of the value.
+ * @return        Pointer to the NUL terminated value, inside the mapped file,
+ *                or NULL if error or if the URL has no query.
+ */
+extern const char *url_ColumnsGet(const url_columns *c, int column, uint64_t row, size_t *len);
+
+/**
+ * Return the dictionary-encoded host column, to be read directly.
+ * @param  c Columns.
+ * @return   Array of url_ColumnsCount() host identifiers, inside the mapped
+ *           file.
+ */
+extern const uint32_t *url_ColumnsHostIds(const url_columns *c);
+
+/**
+ * Return the number of distinct hosts of a columnar file.
+ * @param  c Columns.
+ * @return   Number of distinct hosts.
+ */
+extern uint32_t url_ColumnsHostCount(const url_columns *c);
+
+/**
+ * Return the host having a given identifier.
+ * @param  c   Columns.
+ * @param  id  Identifier read from url_ColumnsHostIds().
+ * @param  len If not NULL, will receive the length of the host.
+ * @return     Pointer to the NUL terminated host, inside the mapped file,
+ *             or NULL if id is unknown.
+ */
+extern const char *url_ColumnsHostName(const url_columns *c, uint32_t id, size_t *len);
+
+#endif
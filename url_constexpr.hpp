@@ -0,0 +1,451 @@
+#ifndef _URL_CONSTEXPR_HPP_
+#define _URL_CONSTEXPR_HPP_
+
+#include <array>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "url.hpp"
+
+/*
+	C++20 constexpr port of the normalization and escaping of url.c, so that
+	hardcoded URLs can be canonicalized by the compiler :
+
+		using namespace url::literals;
+		static constexpr auto blocked = "http://www.GOOgle.com/"_canonical;
+		// blocked.view() is "http://www.google.com/", blocked.prefix holds
+		// the first bytes of its SHA-256
+
+	url::constant::normalize() and url::constant::canonicalize() give the
+	same results as url_Normalize() and url_Canonicalize(), quirks
+	included, and can also be called at run time. URLs with an opaque scheme
+	are canonicalized with the default URL_OPAQUE_PASSTHROUGH policy : the
+	truncating and hashing policies are only given per call to
+	url_CanonicalizeWithOpaquePolicy(), or to a url_canonicalizer or a
+	url_batch. As in url.c, strings end at their first NUL character and
+	numeric hosts are read as an unsigned long.
+*/
+
+namespace url {
+
+// Number of bytes of the SHA-256 kept by url::canonical()
+constexpr std::size_t sha256_prefix_len = 4;
+
+namespace constant {
+
+namespace detail {
+
+constexpr char lowercase(char c)
+{
+	return(c>='A' && c<='Z' ? c-'A'+'a' : c);
+}
+
+// Same as url_OpaqueSchemeLength()
+constexpr std::size_t opaque_scheme_length(std::string_view src)
+{
+	constexpr std::string_view schemes[] = { "about", "blob", "data", "javascript", "mailto" };
+
+	std::size_t i = 0;
+	while(i<src.size() && src[i]==' ')
+		i++;
+
+	char scheme[URL_OPAQUE_SCHEME_MAX] = {};
+	std::size_t n = 0;
+	for( ; i<src.size(); i++) {
+		char c = src[i];
+		if(c=='\t' || c=='\r' || c=='\n')
+			continue;
+		if(c==':')
+			break;
+		c = lowercase(c);
+		if(c<'a' || c>'z' || n==URL_OPAQUE_SCHEME_MAX)
+			return(0);
+		scheme[n++] = c;
+	}
+	if(i==src.size())
+		return(0);
+
+	for(std::string_view name : schemes)
+		if(name==std::string_view(scheme, n))
+			return(n);
+	return(0);
+}
+
+// Same as url_OpaqueCopy() without limit
+constexpr void opaque_copy(std::string_view src, std::string &dest)
+{
+	constexpr char hex[] = "0123456789ABCDEF";
+	std::size_t i = 0, end = src.size();
+
+	while(i<end && src[i]==' ')
+		i++;
+	while(end>i && src[end-1]==' ')
+		end--;
+
+	for( ; i<end && src[i]!=':'; i++)
+		if(src[i]!='\t' && src[i]!='\r' && src[i]!='\n')
+			dest.push_back(lowercase(src[i]));
+
+	for( ; i<end; i++) {
+		unsigned char c = static_cast<unsigned char>(src[i]);
+		if(c=='\0' || c=='#')
+			break;
+		if(c=='\t' || c=='\r' || c=='\n')
+			continue;
+		if(c<=32 || c>=127) {
+			dest.push_back('%');
+			dest.push_back(hex[c >> 4]);
+			dest.push_back(hex[c & 15]);
+		} else
+			dest.push_back(static_cast<char>(c));
+	}
+}
+
+// Same as url_RemoveTabCRLF(), url_RemoveFragment() and url_Unescape()
+constexpr bool clean(std::string_view src, std::string &dest)
+{
+	std::size_t i = 0, end = src.size();
+	while(i<end && src[i] && src[i]==' ')
+		i++;
+	while(end>i && src[end-1]==' ')
+		end--;
+
+	std::string cleaned;
+	for( ; i<end; i++)
+		if(src[i]!='\r' && src[i]!='\n' && src[i]!='\t')
+			cleaned.push_back(src[i]);
+	if(cleaned.empty() || cleaned[0]=='\0')
+		return(false);
+
+	std::size_t len = 0;
+	while(len<cleaned.size() && cleaned[len] && cleaned[len]!='#')
+		len++;
+
+	dest.assign(len, '\0');
+	dest.resize(url::detail::unescape_into<unescape_all>(std::string_view(cleaned.data(), len), dest.data()));
+	return(true);
+}
+
+// Same as the conversion of strtoul() : digits, saturated to ULONG_MAX
+constexpr unsigned long parse_number(const std::string &s, std::size_t i)
+{
+	unsigned long n = 0;
+	bool overflow = false;
+	for( ; i<s.size() && s[i]>='0' && s[i]<='9'; i++) {
+		unsigned long digit = s[i]-'0';
+		if(n > (ULONG_MAX - digit)/10)
+			overflow = true;
+		else
+			n = n*10 + digit;
+	}
+	return(overflow ? ULONG_MAX : n);
+}
+
+constexpr void append_number(std::string &dest, std::ptrdiff_t &out, unsigned n)
+{
+	char digits[3];
+	int count = 0;
+	do {
+		digits[count++] = '0' + n%10;
+		n /= 10;
+	} while(n);
+	while(count)
+		dest[out++] = digits[--count];
+}
+
+} // namespace detail
+
+
+/**
+ * Normalize an URL as url_Normalize() does.
+ * @param  src  URL to be normalized.
+ * @param  dest String receiving the normalized URL.
+ * @return      true, or false if error (dest is then unspecified).
+ */
+constexpr bool normalize(std::string_view src, std::string &dest)
+{
+	dest.clear();
+	if(detail::opaque_scheme_length(src)) {
+		std::string cleaned;
+		detail::opaque_copy(src, cleaned);
+		dest.assign(cleaned.size(), '\0');
+		dest.resize(url::detail::unescape_into<unescape_all>(cleaned, dest.data()));
+		return(true);
+	}
+
+	std::string s;
+	if(!detail::clean(src, s))
+		return(false);
+
+	// Characters after the end read as NUL, as in the C string
+	auto at = [&s](std::ptrdiff_t i) { return(i < static_cast<std::ptrdiff_t>(s.size()) ? s[i] : '\0'); };
+
+	dest.assign(s.size()+1+8+12+15, '\0');
+	std::ptrdiff_t in = 0, out = 0;
+
+	std::ptrdiff_t end_of_scheme = 0;
+	while(at(end_of_scheme)!='\0' && at(end_of_scheme)!=':')
+		end_of_scheme++;
+	if(at(end_of_scheme)==':' && at(end_of_scheme+1)=='/' && at(end_of_scheme+2)=='/') {
+		for( ; in<end_of_scheme; in++)
+			dest[out++] = detail::lowercase(s[in]);
+		for(int i=0; i<3; i++)
+			dest[out++] = s[in++];
+	} else {
+		for(char c : std::string_view("http://"))
+			dest[out++] = c;
+	}
+
+	while(at(in)=='/')
+		in++;
+
+	std::ptrdiff_t begin_hostname = in;
+	while(at(in) && at(in)!='/' && at(in)!='?')
+		in++;
+	std::ptrdiff_t end_hostname = in-1;
+
+	while(at(begin_hostname)=='.')
+		begin_hostname++;
+	while(end_hostname-begin_hostname>0 && s[end_hostname]=='.')
+		end_hostname--;
+
+	bool hostname_is_number = true;
+	for(std::ptrdiff_t i=begin_hostname; i<=end_hostname; i++)
+		if(s[i]<'0' || s[i]>'9') {
+			hostname_is_number = false;
+			break;
+		}
+
+	if(hostname_is_number) {
+		std::uint32_t ip = static_cast<std::uint32_t>(detail::parse_number(s, begin_hostname));
+		for(int shift=24; shift>=0; shift -=8) {
+			detail::append_number(dest, out, (ip >> shift) & 255);
+			if(shift)
+				dest[out++] = '.';
+		}
+	} else {
+		for( ; begin_hostname<=end_hostname; begin_hostname++)
+			dest[out++] = detail::lowercase(s[begin_hostname]);
+	}
+
+	if(dest[out-1]!='/')
+		dest[out++] = '/';
+
+	std::ptrdiff_t after_hostname = out;
+	bool in_query = false;
+	while(at(in)) {
+		if(in_query) {
+			dest[out++] = s[in++];
+		} else if(s[in]=='?') {
+			dest[out++] = s[in++];
+			in_query = true;
+		} else if(s[in]=='/') {
+			if(at(in+1)=='.' && at(in+2)=='/') {
+				dest[out++] = '/';
+				in +=2;
+			} else if(at(in+1)=='.' && at(in+2)=='.' && (at(in+3)=='/' || at(in+3)=='\0')) {
+				in +=3;
+				if(dest[out-1]=='/')
+					out--;
+				do {
+					out--;
+				} while(out-after_hostname>=0 && dest[out]!='/');
+				out++;
+			} else
+				dest[out++] = s[in++];
+			if(dest[out-1]=='/' && dest[out-2]=='/')
+				out--;
+		} else
+			dest[out++] = s[in++];
+	}
+	dest.resize(out);
+	return(true);
+}
+
+/**
+ * Canonicalize an URL as url_Canonicalize() (escape_plain) or
+ * url_CanonicalizeWithFullEscape() (escape_reserved) do.
+ * @param  src  URL to be canonicalized.
+ * @param  dest String receiving the canonicalized URL.
+ * @return      true, or false if error (dest is then unspecified).
+ */
+template<class Policy = escape_plain>
+constexpr bool canonicalize(std::string_view src, std::string &dest)
+{
+	// Opaque URLs are only cleaned, not unescaped as normalize() does
+	if(detail::opaque_scheme_length(src)) {
+		dest.clear();
+		detail::opaque_copy(src, dest);
+		return(true);
+	}
+	std::string normalized;
+	if(!normalize(src, normalized))
+		return(false);
+	dest.assign(url::escaped_length<Policy>(normalized), '\0');
+	url::detail::escape_into<Policy>(normalized, dest.data());
+	return(true);
+}
+
+/**
+ * Compute the SHA-256 of a string.
+ * @param  src String to be hashed.
+ * @return     The 32 bytes of the hash.
+ */
+constexpr std::array<unsigned char, 32> sha256(std::string_view src)
+{
+	constexpr std::uint32_t k[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+	std::uint32_t h[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	auto rotr = [](std::uint32_t x, int n) { return((x >> n) | (x << (32-n))); };
+
+	// Message, 0x80, zeros and the length in bits, in blocks of 64 bytes
+	std::size_t blocks = (src.size() + 9 + 63) / 64;
+	std::uint64_t bits = static_cast<std::uint64_t>(src.size()) * 8;
+	auto byte = [&](std::size_t i) -> std::uint32_t {
+		if(i < src.size())
+			return(static_cast<unsigned char>(src[i]));
+		if(i == src.size())
+			return(0x80);
+		if(i >= blocks*64 - 8)
+			return((bits >> (8*(blocks*64 - 1 - i))) & 255);
+		return(0);
+	};
+
+	for(std::size_t block=0; block<blocks; block++) {
+		std::uint32_t w[64] = {};
+		for(int i=0; i<16; i++) {
+			std::size_t p = block*64 + i*4;
+			w[i] = byte(p) << 24 | byte(p+1) << 16 | byte(p+2) << 8 | byte(p+3);
+		}
+		for(int i=16; i<64; i++) {
+			std::uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+			std::uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+			w[i] = w[i-16] + s0 + w[i-7] + s1;
+		}
+
+		std::uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+		for(int i=0; i<64; i++) {
+			std::uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+			std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			hh = g; g = f; f = e; e = d + t1;
+			d = c; c = b; b = a; a = t1 + t2;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+		h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+	}
+
+	std::array<unsigned char, 32> digest = {};
+	for(int i=0; i<32; i++)
+		digest[i] = (h[i/4] >> (24 - 8*(i%4))) & 255;
+	return(digest);
+}
+
+/**
+ * Return the expression of a canonicalized URL hashed by Safe Browsing
+ * lookups : the URL without its scheme and "://", or the whole URL if it
+ * has an opaque scheme.
+ * @param  canonical Canonicalized URL.
+ * @return           View inside canonical.
+ */
+constexpr std::string_view expression(std::string_view canonical)
+{
+	std::size_t scheme = canonical.find("://");
+	return(scheme==std::string_view::npos ? canonical : canonical.substr(scheme+3));
+}
+
+template<class Policy>
+constexpr std::size_t canonical_length(std::string_view src)
+{
+	std::string canonical;
+	return(canonicalize<Policy>(src, canonical) ? canonical.size() : npos);
+}
+
+} // namespace constant
+
+
+// URL literal, usable as a template argument
+template<std::size_t N>
+struct fixed_string {
+	char data[N] = {};
+
+	consteval fixed_string(const char (&s)[N])
+	{
+		for(std::size_t i=0; i<N; i++)
+			data[i] = s[i];
+	}
+
+	constexpr std::string_view view() const
+	{
+		return(std::string_view(data, N-1));
+	}
+};
+
+// Canonicalized URL computed by the compiler, N counting its NUL character
+template<std::size_t N>
+struct canonical_url {
+	char url[N] = {};
+	std::array<unsigned char, sha256_prefix_len> prefix = {};
+
+	constexpr std::string_view view() const
+	{
+		return(std::string_view(url, N-1));
+	}
+
+	constexpr const char *c_str() const
+	{
+		return(url);
+	}
+};
+
+/**
+ * Canonicalize an URL literal at compile time. An URL which cannot be
+ * canonicalized does not compile.
+ * @return Canonicalized URL and the first sha256_prefix_len bytes of the
+ *         SHA-256 of its url::constant::expression().
+ */
+template<fixed_string S, class Policy = escape_plain>
+consteval auto canonical()
+{
+	constexpr std::size_t len = constant::canonical_length<Policy>(S.view());
+	static_assert(len!=npos, "URL cannot be canonicalized");
+
+	canonical_url<len+1> result;
+	std::string canonical;
+	constant::canonicalize<Policy>(S.view(), canonical);
+	for(std::size_t i=0; i<len; i++)
+		result.url[i] = canonical[i];
+	std::array<unsigned char, 32> digest = constant::sha256(constant::expression(canonical));
+	for(std::size_t i=0; i<sha256_prefix_len; i++)
+		result.prefix[i] = digest[i];
+	return(result);
+}
+
+namespace literals {
+
+/**
+ * "http://www.GOOgle.com/"_canonical is url::canonical<"http://www.GOOgle.com/">().
+ */
+template<fixed_string S>
+consteval auto operator""_canonical()
+{
+	return(canonical<S>());
+}
+
+} // namespace literals
+
+} // namespace url
+
+#endif
@@ -0,0 +1,389 @@
+/*
+	Streaming deduplication and distinct counting of canonicalized URLs.
+
+	Fingerprints are kept in an open-addressing table with linear probing,
+	a zero fingerprint marking an empty slot. The table doubles when it is
+	3/4 full. HyperLogLog registers are indexed by the high bits of the
+	fingerprint and hold the position of the first set bit of the others.
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "url.h"
+#include "url_dedupe.h"
+
+
+
+typedef struct {
+	uint64_t hash;
+	uint64_t count;
+	char *host;
+	uint8_t *registers;
+} url_dedupe_host;
+
+struct url_dedupe {
+	int flags;
+
+	// Exact mode : fingerprints table, 1 or 2 uint64_t per slot
+	uint64_t *slots;
+	size_t slot_count;
+	size_t used;
+
+	// HyperLogLog mode
+	unsigned precision;
+	uint8_t *registers;
+
+	// Per host counts
+	url_dedupe_host *hosts;
+	size_t host_slot_count;
+	size_t host_used;
+};
+
+
+
+static inline int url_DedupeWidth(const url_dedupe *d)
+{
+	return((d->flags & URL_DEDUPE_FINGERPRINT128) ? 2 : 1);
+}
+
+
+/**
+ * Create a new deduplication table.
+ * @param  flags     Combination of URL_DEDUPE_FINGERPRINT128, URL_DEDUPE_HLL
+ *                   and URL_DEDUPE_PER_HOST, or 0.
+ * @param  precision Base 2 logarithm of the number of HyperLogLog registers,
+ *                   between 4 and 18, or 0 for URL_DEDUPE_HLL_PRECISION.
+ *                   Ignored in exact mode.
+ * @return           Pointer to a new table, to be freed with url_DedupeFree(),
+ *                   or NULL if error.
+ */
+extern url_dedupe *url_DedupeNew(int flags, unsigned precision)
+{
+	if(precision==0)
+		precision = URL_DEDUPE_HLL_PRECISION;
+	if(precision<4 || precision>18)
+		return(NULL);
+
+	url_dedupe *d = calloc(1, sizeof(url_dedupe));
+	if(d==NULL)
+		return(NULL);
+	d->flags = flags;
+	d->precision = precision;
+
+	if(flags & URL_DEDUPE_HLL) {
+		d->registers = calloc((size_t)1 << precision, 1);
+		if(d->registers==NULL)
+			goto bad;
+	} else {
+		d->slot_count = 1024;
+		d->slots = calloc(d->slot_count * url_DedupeWidth(d), sizeof(uint64_t));
+		if(d->slots==NULL)
+			goto bad;
+	}
+
+	if(flags & URL_DEDUPE_PER_HOST) {
+		d->host_slot_count = 256;
+		d->hosts = calloc(d->host_slot_count, sizeof(url_dedupe_host));
+		if(d->hosts==NULL)
+			goto bad;
+	}
+
+	return(d);
+
+bad:
+	url_DedupeFree(d);
+	return(NULL);
+}
+
+
+/**
+ * Free a deduplication table.
+ * @param d Pointer returned by url_DedupeNew(), or NULL.
+ */
+extern void url_DedupeFree(url_dedupe *d)
+{
+	if(d==NULL)
+		return;
+	if(d->hosts) {
+		for(size_t i=0; i<d->host_slot_count; i++) {
+			free(d->hosts[i].host);
+			free(d->hosts[i].registers);
+		}
+		free(d->hosts);
+	}
+	free(d->slots);
+	free(d->registers);
+	free(d);
+}
+
+
+// Insert a fingerprint in a table known to have room for it.
+// Return true if it was not already there.
+static bool url_DedupeInsert(uint64_t *slots, size_t slot_count, int width, const uint64_t *fp)
+{
+	size_t mask = slot_count - 1;
+	for(size_t i = fp[0] & mask; ; i = (i+1) & mask) {
+		uint64_t *slot = slots + i*width;
+		if(slot[0]==0) {
+			// Nothing is ever removed, so the first empty slot ends the search
+			memcpy(slot, fp, width*sizeof(uint64_t));
+			return(true);
+		}
+		if(slot[0]==fp[0] && (width==1 || slot[1]==fp[1]))
+			return(false);
+	}
+}
+
+
+static bool url_DedupeGrow(url_dedupe *d)
+{
+	int width = url_DedupeWidth(d);
+	size_t slot_count = 2*d->slot_count;
+	uint64_t *slots = calloc(slot_count * width, sizeof(uint64_t));
+	if(slots==NULL)
+		return(false);
+	for(size_t i=0; i<d->slot_count; i++)
+		if(d->slots[i*width])
+			url_DedupeInsert(slots, slot_count, width, d->slots + i*width);
+	free(d->slots);
+	d->slots = slots;
+	d->slot_count = slot_count;
+	return(true);
+}
+
+
+// Update a HyperLogLog sketch. Return true if a register changed.
+static inline bool url_DedupeHllAdd(uint8_t *registers, unsigned precision, uint64_t hash)
+{
+	size_t index = hash >> (64 - precision);
+	uint64_t rest = (hash << precision) | ((uint64_t)1 << (precision-1));
+	uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+	if(registers[index] < rank) {
+		registers[index] = rank;
+		return(true);
+	}
+	return(false);
+}
+
+
+static uint64_t url_DedupeHllEstimate(const uint8_t *registers, unsigned precision)
+{
+	size_t m = (size_t)1 << precision;
+	double alpha;
+	switch(m) {
+		case 16: alpha = 0.673; break;
+		case 32: alpha = 0.697; break;
+		case 64: alpha = 0.709; break;
+		default: alpha = 0.7213 / (1.0 + 1.079/m);
+	}
+
+	double sum = 0;
+	size_t zeros = 0;
+	for(size_t i=0; i<m; i++) {
+		sum += ldexp(1.0, -registers[i]);
+		if(registers[i]==0)
+			zeros++;
+	}
+
+	double estimate = alpha * m * m / sum;
+	// Small range correction : linear counting
+	if(estimate <= 2.5*m && zeros>0)
+		estimate = m * log((double)m / zeros);
+	return((uint64_t)(estimate + 0.5));
+}
+
+
+static url_dedupe_host *url_DedupeFindHost(url_dedupe *d, const char *host, size_t host_len)
+{
+	if(d->host_used+1 > d->host_slot_count/2) {
+		size_t count = 2*d->host_slot_count;
+		url_dedupe_host *hosts = calloc(count, sizeof(url_dedupe_host));
+		if(hosts==NULL)
+			return(NULL);
+		for(size_t i=0; i<d->host_slot_count; i++) {
+			if(d->hosts[i].host==NULL)
+				continue;
+			size_t j = d->hosts[i].hash & (count-1);
+			while(hosts[j].host)
+				j = (j+1) & (count-1);
+			hosts[j] = d->hosts[i];
+		}
+		free(d->hosts);
+		d->hosts = hosts;
+		d->host_slot_count = count;
+	}
+
+	uint64_t hash = url_Hash64(host, host_len, 0);
+	size_t mask = d->host_slot_count - 1;
+	size_t i = hash & mask;
+	for( ; d->hosts[i].host; i = (i+1) & mask)
+		if(d->hosts[i].hash==hash && strncmp(d->hosts[i].host, host, host_len)==0 && d->hosts[i].host[host_len]=='\0')
+			return(&d->hosts[i]);
+
+	url_dedupe_host *entry = &d->hosts[i];
+	entry->host = malloc(host_len+1);
+	if(entry->host==NULL)
+		return(NULL);
+	memcpy(entry->host, host, host_len);
+	entry->host[host_len] = '\0';
+	entry->hash = hash;
+	entry->count = 0;
+	entry->registers = NULL;
+	if(d->flags & URL_DEDUPE_HLL) {
+		entry->registers = calloc((size_t)1 << URL_DEDUPE_HOST_PRECISION, 1);
+		if(entry->registers==NULL) {
+			free(entry->host);
+			entry->host = NULL;
+			return(NULL);
+		}
+	}
+	d->host_used++;
+	return(entry);
+}
+
+
+/**
+ * Add an URL already canonicalized with url_CanonicalizeAndHash128() to a
+ * deduplication table.
+ * @param  d         Deduplication table.
+ * @param  canonical Pointer to the canonicalized URL. Only used to find the
+ *                   host when counting per host, can be NULL otherwise.
+ * @param  len       Length of the canonicalized URL. If 0, strlen() will be used.
+ * @param  hash      Hash computed by url_CanonicalizeAndHash128() with a seed
+ *                   of 0.
+ * @return           Same as url_DedupeAdd().
+ */
+extern int url_DedupeAddHashed(url_dedupe *d, const char *canonical, size_t len, const uint64_t hash[2])
+{
+	if(d==NULL || hash==NULL)
+		return(-1);
+
+	// The host is found first, so that a failure leaves the table as it was
+	url_dedupe_host *entry = NULL;
+	if((d->flags & URL_DEDUPE_PER_HOST) && canonical) {
+		size_t host_len;
+		const char *host = url_FindHostname(canonical, len, &host_len);
+		entry = host ? url_DedupeFindHost(d, host, host_len) : NULL;
+		if(entry==NULL)
+			return(-1);
+	}
+
+	bool added;
+	if(d->flags & URL_DEDUPE_HLL) {
+		added = url_DedupeHllAdd(d->registers, d->precision, hash[0]);
+	} else {
+		// Zero marks empty slots
+		uint64_t fp[2] = { hash[0] ? hash[0] : 1, hash[1] };
+		if(4*(d->used+1) > 3*d->slot_count && !url_DedupeGrow(d))
+			return(-1);
+		added = url_DedupeInsert(d->slots, d->slot_count, url_DedupeWidth(d), fp);
+		if(added)
+			d->used++;
+	}
+
+	if(entry) {
+		if(entry->registers)
+			url_DedupeHllAdd(entry->registers, URL_DEDUPE_HOST_PRECISION, hash[0]);
+		else if(added)
+			entry->count++;
+	}
+
+	return(added ? 1 : 0);
+}
+
+
+/**
+ * Canonicalize an URL and add it to a deduplication table.
+ * @param  d   Deduplication table.
+ * @param  url Pointer to the URL.
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     1 if the URL was never seen before, 0 if it was (in HyperLogLog
+ *             mode : 1 if the estimate changed, 0 if the URL was probably
+ *             seen before), -1 if error.
+ */
+extern int url_DedupeAdd(url_dedupe *d, const char *url, size_t len)
+{
+	if(d==NULL || url==NULL)
+		return(-1);
+
+	uint64_t hash[2];
+	size_t canonical_len;
+	char *canonical = url_CanonicalizeAndHash128(url, len, &canonical_len, 0, hash);
+	if(canonical==NULL)
+		return(-1);
+
+	int ret = url_DedupeAddHashed(d, canonical, canonical_len, hash);
+	free(canonical);
+	return(ret);
+}
+
+
+/**
+ * Return the number of distinct URLs added to a deduplication table, or
+ * its estimate in HyperLogLog mode.
+ * @param  d Deduplication table.
+ * @return   Number of distinct URLs.
+ */
+extern uint64_t url_DedupeCount(const url_dedupe *d)
+{
+	if(d==NULL)
+		return(0);
+	if(d->flags & URL_DEDUPE_HLL)
+		return(url_DedupeHllEstimate(d->registers, d->precision));
+	return(d->used);
+}
+
+
+/**
+ * Call a function for each host, with the number (or the estimate) of
+ * distinct URLs seen for this host. Requires URL_DEDUPE_PER_HOST.
+ * @param d        Deduplication table.
+ * @param callback Function to be called.
+ * @param ctx      Pointer given to the callback.
+ */
+extern void url_DedupeForEachHost(const url_dedupe *d, url_dedupe_host_callback callback, void *ctx)
+{
+	if(d==NULL || d->hosts==NULL || callback==NULL)
+		return;
+	for(size_t i=0; i<d->host_slot_count; i++) {
+		const url_dedupe_host *entry = &d->hosts[i];
+		if(entry->host==NULL)
+			continue;
+		uint64_t count = entry->registers
+			? url_DedupeHllEstimate(entry->registers, URL_DEDUPE_HOST_PRECISION)
+			: entry->count;
+		callback(ctx, entry->host, count);
+	}
+}
+
+
+/**
+ * Return the number of bytes used by a deduplication table.
+ * @param  d Deduplication table.
+ * @return   Memory footprint in bytes.
+ */
+extern size_t url_DedupeSize(const url_dedupe *d)
+{
+	if(d==NULL)
+		return(0);
+	size_t size = sizeof(url_dedupe);
+	size += d->slot_count * url_DedupeWidth(d) * sizeof(uint64_t);
+	if(d->registers)
+		size += (size_t)1 << d->precision;
+	size += d->host_slot_count * sizeof(url_dedupe_host);
+	for(size_t i=0; i<d->host_slot_count; i++)
+		if(d->hosts[i].host) {
+			size += strlen(d->hosts[i].host) + 1;
+			if(d->hosts[i].registers)
+				size += (size_t)1 << URL_DEDUPE_HOST_PRECISION;
+		}
+	return(size);
+}
@@ -0,0 +1,111 @@
+#ifndef _URL_DEDUPE_H_
+#define _URL_DEDUPE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	Streaming deduplication and distinct counting of canonicalized URLs.
+
+	In exact mode, only the XXH64 fingerprints of the canonicalized URLs
+	are stored (8 or 16 bytes each) in an open-addressing table. In
+	HyperLogLog mode, memory is bounded and only an estimate of the number
+	of distinct URLs is available.
+*/
+
+// Store 128 bits fingerprints instead of 64 bits ones. They are made of two
+// XXH64 hashes of the URL, seeds 0 and ~0 (see url_CanonicalizeAndHash128()),
+// not of a true 128 bits hash : the two halves are not independent.
+#define URL_DEDUPE_FINGERPRINT128 0x01
+
+// Estimate distinct counts with HyperLogLog sketches instead of storing
+// fingerprints
+#define URL_DEDUPE_HLL            0x02
+
+// Also count distinct URLs per host
+#define URL_DEDUPE_PER_HOST       0x04
+
+// Default HyperLogLog precision : 2^14 registers, about 0.8% error
+#define URL_DEDUPE_HLL_PRECISION  14
+
+// HyperLogLog precision of the per host sketches : 2^8 registers, about 6.5% error
+#define URL_DEDUPE_HOST_PRECISION 8
+
+typedef struct url_dedupe url_dedupe;
+
+/**
+ * Function called by url_DedupeForEachHost() for each host.
+ * @param ctx   Pointer given to url_DedupeForEachHost().
+ * @param host  Hostname, as found in the canonicalized URLs, without "www.".
+ * @param count Number of distinct URLs seen for this host.
+ */
+typedef void (*url_dedupe_host_callback)(void *ctx, const char *host, uint64_t count);
+
+
+/**
+ * Create a new deduplication table.
+ * @param  flags     Combination of URL_DEDUPE_FINGERPRINT128, URL_DEDUPE_HLL
+ *                   and URL_DEDUPE_PER_HOST, or 0.
+ * @param  precision Base 2 logarithm of the number of HyperLogLog registers,
+ *                   between 4 and 18, or 0 for URL_DEDUPE_HLL_PRECISION.
+ *                   Ignored in exact mode.
+ * @return           Pointer to a new table, to be freed with url_DedupeFree(),
+ *                   or NULL if error.
+ */
+extern url_dedupe *url_DedupeNew(int flags, unsigned precision);
+
+/**
+ * Free a deduplication table.
+ * @param d Pointer returned by url_DedupeNew(), or NULL.
+ */
+extern void url_DedupeFree(url_dedupe *d);
+
+/**
+ * Canonicalize an URL and add it to a deduplication table.
+ * @param  d   Deduplication table.
+ * @param  url Pointer to the URL.
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     1 if the URL was never seen before, 0 if it was (in HyperLogLog
+ *             mode : 1 if the estimate changed, 0 if the URL was probably
+ *             seen before), -1 if error.
+ */
+extern int url_DedupeAdd(url_dedupe *d, const char *url, size_t len);
+
+/**
+ * Add an URL already canonicalized with url_CanonicalizeAndHash128() to a
+ * deduplication table.
+ * @param  d         Deduplication table.
+ * @param  canonical Pointer to the canonicalized URL. Only used to find the
+ *                   host when counting per host, can be NULL otherwise.
+ * @param  len       Length of the canonicalized URL. If 0, strlen() will be used.
+ * @param  hash      Hash computed by url_CanonicalizeAndHash128() with a seed
+ *                   of 0.
+ * @return           Same as url_DedupeAdd().
+ */
+extern int url_DedupeAddHashed(url_dedupe *d, const char *canonical, size_t len, const uint64_t hash[2]);
+
+/**
+ * Return the number of distinct URLs added to a deduplication table, or
+ * its estimate in HyperLogLog mode.
+ * @param  d Deduplication table.
+ * @return   Number of distinct URLs.
+ */
+extern uint64_t url_DedupeCount(const url_dedupe *d);
+
+/**
+ * Call a function for each host, with the number (or the estimate) of
+ * distinct URLs seen for this host. Requires URL_DEDUPE_PER_HOST.
+ * @param d        Deduplication table.
+ * @param callback Function to be called.
+ * @param ctx      Pointer given to the callback.
+ */
+extern void url_DedupeForEachHost(const url_dedupe *d, url_dedupe_host_callback callback, void *ctx);
+
+/**
+ * Return the number of bytes used by a deduplication table.
+ * @param  d Deduplication table.
+ * @return   Memory footprint in bytes.
+ */
+extern size_t url_DedupeSize(const url_dedupe *d);
+
+#endif
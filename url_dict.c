@@ -0,0 +1,582 @@
+/*
+	Sorted, front-coded dictionary files.
+
+	The builder writes blocks sequentially through stdio, keeping only the
+	previous string and the offsets of the blocks in memory, then appends
+	the index and rewrites the header. The reader maps the whole file and
+	never copies it : url_DictFind() walks a block comparing the key with
+	the decoded strings incrementally, using the shared prefix lengths, so
+	it does not even need to rebuild them.
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "url_dict.h"
+
+
+
+#define URL_DICT_MAGIC "URLDICT1"
+#define URL_DICT_HEADER 40
+
+struct url_dict_builder {
+	FILE *file;
+	unsigned block_size;
+	uint64_t count;
+	uint64_t pos;
+	bool failed;
+
+	char *prev;
+	size_t prev_len, prev_cap;
+
+	uint64_t *offsets;
+	size_t block_count, offsets_cap;
+};
+
+struct url_dict {
+	const unsigned char *data;
+	size_t size;
+	unsigned block_size;
+	uint64_t count;
+	uint64_t block_count;
+	uint64_t index_offset;
+};
+
+struct url_dict_cursor {
+	const url_dict *dict;
+	char *prefix;
+	size_t prefix_len;
+	uint64_t block;
+	bool done;
+
+	// Strings of the current block, NUL terminated, one after the other
+	char *data;
+	size_t data_len, data_cap;
+	size_t *offsets;
+	unsigned n, i;
+};
+
+
+
+static void url_DictWrite64(unsigned char *p, uint64_t value)
+{
+	for(int i=0; i<8; i++)
+		p[i] = (unsigned char)(value >> (8*i));
+}
+
+
+static uint64_t url_DictRead64(const unsigned char *p)
+{
+	uint64_t value = 0;
+	for(int i=7; i>=0; i--)
+		value = (value << 8) | p[i];
+	return(value);
+}
+
+
+static void url_DictWriteVarint(url_dict_builder *b, uint64_t value)
+{
+	unsigned char buf[10];
+	int n = 0;
+	while(value >= 0x80) {
+		buf[n++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	buf[n++] = (unsigned char)value;
+	if(fwrite(buf, 1, n, b->file) != (size_t)n)
+		b->failed = true;
+	b->pos += n;
+}
+
+
+static void url_DictWriteBytes(url_dict_builder *b, const void *data, size_t len)
+{
+	if(len && fwrite(data, 1, len, b->file) != len)
+		b->failed = true;
+	b->pos += len;
+}
+
+
+static bool url_DictReadVarint(const unsigned char **p, const unsigned char *end, uint64_t *value)
+{
+	*value = 0;
+	for(int shift=0; shift<64; shift+=7) {
+		if(*p >= end)
+			return(false);
+		unsigned char byte = *(*p)++;
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if(byte < 0x80)
+			return(true);
+	}
+	return(false);
+}
+
+
+/**
+ * Start writing a dictionary file.
+ * @param  path       Path of the file to be created.
+ * @param  block_size Number of strings per block, or 0 for URL_DICT_BLOCK.
+ *                    Larger blocks make smaller files and slower lookups.
+ * @return            Pointer to a builder, to be given to
+ *                    url_DictBuilderFinish(), or NULL if error.
+ */
+extern url_dict_builder *url_DictBuilderNew(const char *path, unsigned block_size)
+{
+	if(path==NULL)
+		return(NULL);
+	if(block_size==0)
+		block_size = URL_DICT_BLOCK;
+
+	url_dict_builder *b = calloc(1, sizeof(url_dict_builder));
+	if(b==NULL)
+		return(NULL);
+	b->block_size = block_size;
+	b->file = fopen(path, "wb");
+	if(b->file==NULL) {
+		free(b);
+		return(NULL);
+	}
+
+	// The header is rewritten by url_DictBuilderFinish()
+	unsigned char header[URL_DICT_HEADER] = { 0 };
+	url_DictWriteBytes(b, header, sizeof(header));
+	return(b);
+}
+
+
+/**
+ * Add a string to a dictionary file. Strings must be added in increasing
+ * memcmp() order. A string equal to the previous one is ignored.
+ * @param  b   Builder.
+ * @param  str Pointer to the string, usually returned by url_Canonicalize().
+ * @param  len Length of the string. If 0, strlen() will be used.
+ * @return     0, or -1 if error or if str is lower than the previous string.
+ */
+extern int url_DictBuilderAdd(url_dict_builder *b, const char *str, size_t len)
+{
+	if(b==NULL || str==NULL || b->failed)
+		return(-1);
+	if(len==0)
+		len = strlen(str);
+
+	size_t shared = 0;
+	if(b->count) {
+		size_t min = len < b->prev_len ? len : b->prev_len;
+		while(shared<min && str[shared]==b->prev[shared])
+			shared++;
+		if(shared==min) {
+			if(len==b->prev_len)
+				return(0);
+			if(len<b->prev_len)
+				return(-1);
+		} else if((unsigned char)str[shared] < (unsigned char)b->prev[shared]) {
+			return(-1);
+		}
+	}
+
+	if(b->count % b->block_size == 0) {
+		if(b->block_count==b->offsets_cap) {
+			size_t cap = b->offsets_cap ? 2*b->offsets_cap : 1024;
+			uint64_t *offsets = realloc(b->offsets, cap * sizeof(uint64_t));
+			if(offsets==NULL)
+				goto bad;
+			b->offsets = offsets;
+			b->offsets_cap = cap;
+		}
+		b->offsets[b->block_count++] = b->pos;
+		url_DictWriteVarint(b, len);
+		url_DictWriteBytes(b, str, len);
+	} else {
+		url_DictWriteVarint(b, shared);
+		url_DictWriteVarint(b, len - shared);
+		url_DictWriteBytes(b, str + shared, len - shared);
+	}
+
+	if(len > b->prev_cap) {
+		char *prev = realloc(b->prev, len);
+		if(prev==NULL)
+			goto bad;
+		b->prev = prev;
+		b->prev_cap = len;
+	}
+	memcpy(b->prev + shared, str + shared, len - shared);
+	b->prev_len = len;
+	b->count++;
+	return(b->failed ? -1 : 0);
+
+bad:
+	b->failed = true;
+	return(-1);
+}
+
+
+/**
+ * Write the index of a dictionary file, close it and free the builder.
+ * @param  b Builder returned by url_DictBuilderNew().
+ * @return   0, or -1 if error (including a previous error of
+ *           url_DictBuilderAdd()).
+ */
+extern int url_DictBuilderFinish(url_dict_builder *b)
+{
+	if(b==NULL)
+		return(-1);
+
+	uint64_t index_offset = b->pos;
+	for(size_t i=0; i<b->block_count; i++) {
+		unsigned char offset[8];
+		url_DictWrite64(offset, b->offsets[i]);
+		url_DictWriteBytes(b, offset, sizeof(offset));
+	}
+
+	unsigned char header[URL_DICT_HEADER] = { 0 };
+	memcpy(header, URL_DICT_MAGIC, 8);
+	header[8] = (unsigned char)b->block_size;
+	header[9] = (unsigned char)(b->block_size >> 8);
+	header[10] = (unsigned char)(b->block_size >> 16);
+	header[11] = (unsigned char)(b->block_size >> 24);
+	url_DictWrite64(header+16, b->count);
+	url_DictWrite64(header+24, b->block_count);
+	url_DictWrite64(header+32, index_offset);
+	if(fseek(b->file, 0, SEEK_SET) || fwrite(header, 1, sizeof(header), b->file) != sizeof(header))
+		b->failed = true;
+
+	if(fclose(b->file))
+		b->failed = true;
+	int ret = b->failed ? -1 : 0;
+	free(b->prev);
+	free(b->offsets);
+	free(b);
+	return(ret);
+}
+
+
+/**
+ * Open a dictionary file, mapping it in memory.
+ * @param  path Path of the file.
+ * @return      Pointer to the dictionary, to be freed with url_DictClose(),
+ *              or NULL if error.
+ */
+extern url_dict *url_DictOpen(const char *path)
+{
+	if(path==NULL)
+		return(NULL);
+
+	int fd = open(path, O_RDONLY);
+	if(fd<0)
+		return(NULL);
+	struct stat st;
+	if(fstat(fd, &st) || st.st_size < URL_DICT_HEADER) {
+		close(fd);
+		return(NULL);
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(data==MAP_FAILED)
+		return(NULL);
+
+	url_dict *d = calloc(1, sizeof(url_dict));
+	if(d==NULL)
+		goto bad;
+	d->data = data;
+	d->size = st.st_size;
+	if(memcmp(d->data, URL_DICT_MAGIC, 8))
+		goto bad;
+	d->block_size = (unsigned)d->data[8] | (unsigned)d->data[9] << 8 | (unsigned)d->data[10] << 16 | (unsigned)d->data[11] << 24;
+	d->count = url_DictRead64(d->data+16);
+	d->block_count = url_DictRead64(d->data+24);
+	d->index_offset = url_DictRead64(d->data+32);
+
+	if(d->block_size==0 || d->index_offset < URL_DICT_HEADER || d->index_offset > d->size
+	|| d->block_count > (d->size - d->index_offset) / 8
+	|| d->block_count != (d->count + d->block_size - 1) / d->block_size)
+		goto bad;
+	for(uint64_t i=0; i<d->block_count; i++) {
+		uint64_t offset = url_DictRead64(d->data + d->index_offset + 8*i);
+		if(offset < URL_DICT_HEADER || offset >= d->index_offset)
+			goto bad;
+	}
+
+	return(d);
+
+bad:
+	munmap(data, st.st_size);
+	free(d);
+	return(NULL);
+}
+
+
+/**
+ * Close a dictionary file.
+ * @param d Pointer returned by url_DictOpen(), or NULL.
+ */
+extern void url_DictClose(url_dict *d)
+{
+	if(d==NULL)
+		return;
+	munmap((void *)d->data, d->size);
+	free(d);
+}
+
+
+/**
+ * Return the number of strings of a dictionary.
+ * @param  d Dictionary.
+ * @return   Number of strings.
+ */
+extern uint64_t url_DictCount(const url_dict *d)
+{
+	return(d ? d->count : 0);
+}
+
+
+// Get the bounds of a block and its number of strings
+static void url_DictBlock(const url_dict *d, uint64_t block, const unsigned char **start, const unsigned char **end, unsigned *n)
+{
+	*start = d->data + url_DictRead64(d->data + d->index_offset + 8*block);
+	*end = d->data + (block+1 < d->block_count ? url_DictRead64(d->data + d->index_offset + 8*(block+1)) : d->index_offset);
+	if(*end < *start)
+		*end = *start;
+	uint64_t left = d->count - block * d->block_size;
+	*n = left < d->block_size ? (unsigned)left : d->block_size;
+}
+
+
+static int url_DictCompare(const unsigned char *a, size_t alen, const char *b, size_t blen)
+{
+	int cmp = memcmp(a, b, alen < blen ? alen : blen);
+	if(cmp)
+		return(cmp);
+	return(alen < blen ? -1 : alen > blen);
+}
+
+
+// Return the last block whose first string is lower or equal to str, or -1
+static int64_t url_DictSearch(const url_dict *d, const char *str, size_t len)
+{
+	int64_t lo = 0, hi = (int64_t)d->block_count - 1, found = -1;
+	while(lo<=hi) {
+		int64_t mid = lo + (hi-lo)/2;
+		const unsigned char *p, *end;
+		unsigned n;
+		url_DictBlock(d, mid, &p, &end, &n);
+		uint64_t first_len;
+		if(!url_DictReadVarint(&p, end, &first_len) || first_len > (uint64_t)(end-p))
+			return(-1);
+		if(url_DictCompare(p, first_len, str, len) <= 0) {
+			found = mid;
+			lo = mid+1;
+		} else {
+			hi = mid-1;
+		}
+	}
+	return(found);
+}
+
+
+/**
+ * Find a string in a dictionary, without memory allocation.
+ * @param  d   Dictionary.
+ * @param  str Pointer to the string.
+ * @param  len Length of the string. If 0, strlen() will be used.
+ * @return     Rank of the string in the dictionary (starting at 0), or -1
+ *             if not found.
+ */
+extern int64_t url_DictFind(const url_dict *d, const char *str, size_t len)
+{
+	if(d==NULL || str==NULL)
+		return(-1);
+	if(len==0)
+		len = strlen(str);
+
+	int64_t block = url_DictSearch(d, str, len);
+	if(block<0)
+		return(-1);
+
+	const unsigned char *p, *end;
+	unsigned n;
+	url_DictBlock(d, block, &p, &end, &n);
+
+	// Strings before the key : matched is the length of their common prefix
+	// with the key. A string sharing more than that with the previous one
+	// is also lower than the key, a string sharing less is greater.
+	size_t matched = 0;
+	for(unsigned i=0; i<n; i++) {
+		uint64_t shared = 0, suffix_len;
+		if(i>0 && !url_DictReadVarint(&p, end, &shared))
+			return(-1);
+		if(!url_DictReadVarint(&p, end, &suffix_len) || suffix_len > (uint64_t)(end-p))
+			return(-1);
+		const unsigned char *suffix = p;
+		p += suffix_len;
+
+		if(shared > matched)
+			continue;
+		if(shared < matched)
+			return(-1);
+
+		size_t l = 0;
+		while(l<suffix_len && matched+l<len && suffix[l]==(unsigned char)str[matched+l])
+			l++;
+		if(l==suffix_len && matched+l==len)
+			return((int64_t)(block * d->block_size + i));
+		if(matched+l==len || (l<suffix_len && suffix[l] > (unsigned char)str[matched+l]))
+			return(-1);
+		matched += l;
+	}
+	return(-1);
+}
+
+
+static inline size_t url_DictCursorLen(const url_dict_cursor *c, unsigned i)
+{
+	return((i+1 < c->n ? c->offsets[i+1] : c->data_len) - c->offsets[i] - 1);
+}
+
+
+// Decode all the strings of the current block of a cursor
+static bool url_DictDecodeBlock(url_dict_cursor *c)
+{
+	const url_dict *d = c->dict;
+	if(c->block >= d->block_count)
+		return(false);
+
+	const unsigned char *p, *end;
+	url_DictBlock(d, c->block, &p, &end, &c->n);
+	c->data_len = 0;
+	c->i = 0;
+	size_t prev_len = 0;
+	for(unsigned i=0; i<c->n; i++) {
+		uint64_t shared = 0, suffix_len;
+		if(i>0 && !url_DictReadVarint(&p, end, &shared))
+			return(false);
+		if(!url_DictReadVarint(&p, end, &suffix_len) || suffix_len > (uint64_t)(end-p) || shared > prev_len)
+			return(false);
+
+		size_t need = c->data_len + shared + suffix_len + 1;
+		if(need > c->data_cap) {
+			size_t cap = 2*need;
+			char *data = realloc(c->data, cap);
+			if(data==NULL)
+				return(false);
+			c->data = data;
+			c->data_cap = cap;
+		}
+		char *str = c->data + c->data_len;
+		if(i>0)
+			memcpy(str, c->data + c->offsets[i-1], shared);
+		memcpy(str + shared, p, suffix_len);
+		str[shared + suffix_len] = '\0';
+		p += suffix_len;
+
+		c->offsets[i] = c->data_len;
+		prev_len = shared + suffix_len;
+		c->data_len += prev_len + 1;
+	}
+	return(true);
+}
+
+
+/**
+ * Start a sequential scan of the strings beginning with a prefix. Strings
+ * are decoded one block at a time.
+ * @param  d      Dictionary.
+ * @param  prefix Pointer to the prefix, such as "http://example.com/", or
+ *                NULL to scan the whole dictionary.
+ * @param  len    Length of the prefix. If 0, strlen() will be used.
+ * @return        Pointer to a cursor, to be freed with url_DictCursorFree(),
+ *                or NULL if error.
+ */
+extern url_dict_cursor *url_DictScan(const url_dict *d, const char *prefix, size_t len)
+{
+	if(d==NULL)
+		return(NULL);
+	if(prefix==NULL)
+		prefix = "";
+	if(len==0)
+		len = strlen(prefix);
+
+	url_dict_cursor *c = calloc(1, sizeof(url_dict_cursor));
+	if(c==NULL)
+		return(NULL);
+	c->dict = d;
+	c->prefix = malloc(len+1);
+	c->offsets = malloc(d->block_size * sizeof(size_t));
+	if(c->prefix==NULL || c->offsets==NULL) {
+		url_DictCursorFree(c);
+		return(NULL);
+	}
+	memcpy(c->prefix, prefix, len);
+	c->prefix_len = len;
+
+	int64_t block = url_DictSearch(d, prefix, len);
+	c->block = block<0 ? 0 : (uint64_t)block;
+	if(!url_DictDecodeBlock(c)) {
+		c->done = true;
+		return(c);
+	}
+
+	// Skip the strings lower than the prefix
+	while(c->i < c->n && url_DictCompare((unsigned char *)c->data + c->offsets[c->i], url_DictCursorLen(c, c->i), prefix, len) < 0)
+		c->i++;
+	return(c);
+}
+
+
+/**
+ * Return the next string of a scan.
+ * @param  c   Cursor returned by url_DictScan().
+ * @param  len If not NULL, will receive the length of the string.
+ * @return     Pointer to the NUL terminated string, valid until the next
+ *             call, or NULL at the end of the scan.
+ */
+extern const char *url_DictNext(url_dict_cursor *c, size_t *len)
+{
+	if(c==NULL || c->done)
+		return(NULL);
+
+	if(c->i == c->n) {
+		c->block++;
+		if(!url_DictDecodeBlock(c)) {
+			c->done = true;
+			return(NULL);
+		}
+	}
+
+	const char *str = c->data + c->offsets[c->i];
+	size_t str_len = url_DictCursorLen(c, c->i);
+	if(str_len < c->prefix_len || memcmp(str, c->prefix, c->prefix_len)) {
+		// Strings are sorted : no other string can have the prefix
+		c->done = true;
+		return(NULL);
+	}
+
+	c->i++;
+	if(len)
+		*len = str_len;
+	return(str);
+}
+
+
+/**
+ * Free a cursor.
+ * @param c Pointer returned by url_DictScan(), or NULL.
+ */
+extern void url_DictCursorFree(url_dict_cursor *c)
+{
+	if(c==NULL)
+		return;
+	free(c->prefix);
+	free(c->offsets);
+	free(c->data);
+	free(c);
+}
@@ -0,0 +1,124 @@
+#ifndef _URL_DICT_H_
+#define _URL_DICT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	Sorted, front-coded dictionary files of canonicalized URLs, to be
+	shipped between services and queried in place.
+
+	Strings are sorted (by memcmp()) and grouped in blocks. The first string
+	of a block is stored in full, the following ones as the length of the
+	prefix they share with the previous string and the remaining suffix.
+	Canonicalized URLs sharing their scheme and host, this usually makes the
+	file several times smaller than the text list. A sparse index holds the
+	offset of each block, so that lookups are made by binary search on the
+	first string of the blocks of the mmapped file, then by decoding one
+	block.
+
+	File layout, integers being little-endian :
+		"URLDICT1"
+		uint32 strings per block, uint32 0
+		uint64 number of strings, uint64 number of blocks
+		uint64 offset of the index
+		blocks : varint length, string, then for each following string
+		         varint shared prefix length, varint suffix length, suffix
+		index  : uint64 offset of each block
+*/
+
+// Default number of strings per block
+#define URL_DICT_BLOCK 32
+
+typedef struct url_dict_builder url_dict_builder;
+typedef struct url_dict url_dict;
+typedef struct url_dict_cursor url_dict_cursor;
+
+
+/**
+ * Start writing a dictionary file.
+ * @param  path       Path of the file to be created.
+ * @param  block_size Number of strings per block, or 0 for URL_DICT_BLOCK.
+ *                    Larger blocks make smaller files and slower lookups.
+ * @return            Pointer to a builder, to be given to
+ *                    url_DictBuilderFinish(), or NULL if error.
+ */
+extern url_dict_builder *url_DictBuilderNew(const char *path, unsigned block_size);
+
+/**
+ * Add a string to a dictionary file. Strings must be added in increasing
+ * memcmp() order. A string equal to the previous one is ignored.
+ * @param  b   Builder.
+ * @param  str Pointer to the string, usually returned by url_Canonicalize().
+ * @param  len Length of the string. If 0, strlen() will be used.
+ * @return     0, or -1 if error or if str is lower than the previous string.
+ */
+extern int url_DictBuilderAdd(url_dict_builder *b, const char *str, size_t len);
+
+/**
+ * Write the index of a dictionary file, close it and free the builder.
+ * @param  b Builder returned by url_DictBuilderNew().
+ * @return   0, or -1 if error (including a previous error of
+ *           url_DictBuilderAdd()).
+ */
+extern int url_DictBuilderFinish(url_dict_builder *b);
+
+/**
+ * Open a dictionary file, mapping it in memory.
+ * @param  path Path of the file.
+ * @return      Pointer to the dictionary, to be freed with url_DictClose(),
+ *              or NULL if error.
+ */
+extern url_dict *url_DictOpen(const char *path);
+
+/**
+ * Close a dictionary file.
+ * @param d Pointer returned by url_DictOpen(), or NULL.
+ */
+extern void url_DictClose(url_dict *d);
+
+/**
+ * Return the number of strings of a dictionary.
+ * @param  d Dictionary.
+ * @return   Number of strings.
+ */
+extern uint64_t url_DictCount(const url_dict *d);
+
+/**
+ * Find a string in a dictionary, without memory allocation.
+ * @param  d   Dictionary.
+ * @param  str Pointer to the string.
+ * @param  len Length of the string. If 0, strlen() will be used.
+ * @return     Rank of the string in the dictionary (starting at 0), or -1
+ *             if not found.
+ */
+extern int64_t url_DictFind(const url_dict *d, const char *str, size_t len);
+
+/**
+ * Start a sequential scan of the strings beginning with a prefix. Strings
+ * are decoded one block at a time.
+ * @param  d      Dictionary.
+ * @param  prefix Pointer to the prefix, such as "http://example.com/", or
+ *                NULL to scan the whole dictionary.
+ * @param  len    Length of the prefix. If 0, strlen() will be used.
+ * @return        Pointer to a cursor, to be freed with url_DictCursorFree(),
+ *                or NULL if error.
+ */
+extern url_dict_cursor *url_DictScan(const url_dict *d, const char *prefix, size_t len);
+
+/**
+ * Return the next string of a scan.
+ * @param  c   Cursor returned by url_DictScan().
+ * @param  len If not NULL, will receive the length of the string.
+ * @return     Pointer to the NUL terminated string, valid until the next
+ *             call, or NULL at the end of the scan.
+ */
+extern const char *url_DictNext(url_dict_cursor *c, size_t *len);
+
+/**
+ * Free a cursor.
+ * @param c Pointer returned by url_DictScan(), or NULL.
+ */
+extern void url_DictCursorFree(url_dict_cursor *c);
+
+#endif
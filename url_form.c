@@ -0,0 +1,353 @@
+/*
+	Streaming application/x-www-form-urlencoded decoder, and encoder.
+
+	The decoder keeps the decoded key and the decoded value of the current
+	pair in two buffers of max_pair + 1 bytes. Between chunks, only
+	whether the value has started and an incomplete "%X" escape are kept.
+	Runs of bytes other than '%', '&' and '=' are found 16 at a time with
+	SSE2, and copied at once, turning '+' into spaces on the way.
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#include "url.h"
+#include "url_form.h"
+
+
+
+struct url_form {
+	url_form_callback callback;
+	void *ctx;
+	size_t max;
+	char *key;
+	size_t key_len;
+	char *value;
+	size_t value_len;
+	int flags;
+	bool started;				// Bytes of the pair were read
+	bool in_value;				// Its '=' was read
+	int percent;				// Bytes of an escape read, '%' included
+	char hex;					// Its first digit
+	bool failed;
+};
+
+
+
+static inline int url_FormHex(char c)
+{
+	if(c>='0' && c<='9')
+		return(c-'0');
+	if(c>='a' && c<='f')
+		return(c-'a'+10);
+	if(c>='A' && c<='F')
+		return(c-'A'+10);
+	return(-1);
+}
+
+
+// First '%', '&' or '=' in [p, end), or end
+static const char *url_FormScan(const char *p, const char *end)
+{
+#ifdef __SSE2__
+	const __m128i percent = _mm_set1_epi8('%'), amp = _mm_set1_epi8('&'), equal = _mm_set1_epi8('=');
+	for( ; end-p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i found = _mm_or_si128(_mm_cmpeq_epi8(v, percent),
+			_mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, equal)));
+		int mask = _mm_movemask_epi8(found);
+		if(mask)
+			return(p + __builtin_ctz(mask));
+	}
+#endif
+	for( ; p<end; p++)
+		if(*p=='%' || *p=='&' || *p=='=')
+			return(p);
+	return(end);
+}
+
+
+// Copy bytes, '+' becoming a space
+static void url_FormCopy(char *dest, const char *src, size_t len)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i plus = _mm_set1_epi8('+'), space = _mm_set1_epi8(' ');
+	for( ; len-i >= 16; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i is_plus = _mm_cmpeq_epi8(v, plus);
+		v = _mm_or_si128(_mm_andnot_si128(is_plus, v), _mm_and_si128(is_plus, space));
+		_mm_storeu_si128((__m128i *)(dest + i), v);
+	}
+#endif
+	for( ; i<len; i++)
+		dest[i] = src[i]=='+' ? ' ' : src[i];
+}
+
+
+// Give the value read so far, more of it following if partial
+static void url_FormEmit(url_form *f, bool partial)
+{
+	if(f->failed)
+		return;
+	f->key[f->key_len] = '\0';
+	f->value[f->value_len] = '\0';
+	if(f->callback(f->ctx, f->key, f->key_len, f->value, f->value_len, f->flags | (partial ? URL_FORM_PARTIAL : 0)))
+		f->failed = true;
+	f->value_len = 0;
+}
+
+
+// Append bytes to the key or to the value, '+' becoming a space unless
+// the bytes are already decoded
+static void url_FormPut(url_form *f, const char *bytes, size_t len, bool decoded)
+{
+	f->started = true;
+	if(!f->in_value) {
+		size_t room = f->max - f->key_len;
+		if(len > room) {
+			len = room;
+			f->flags |= URL_FORM_TRUNCATED;
+		}
+		if(decoded)
+			memcpy(f->key + f->key_len, bytes, len);
+		else
+			url_FormCopy(f->key + f->key_len, bytes, len);
+		f->key_len += len;
+		return;
+	}
+	while(len) {
+		if(f->value_len == f->max) {
+			url_FormEmit(f, true);
+			// The callback asked to stop
+			if(f->failed)
+				return;
+		}
+		size_t room = f->max - f->value_len;
+		size_t n = len < room ? len : room;
+		if(decoded)
+			memcpy(f->value + f->value_len, bytes, n);
+		else
+			url_FormCopy(f->value + f->value_len, bytes, n);
+		f->value_len += n;
+		bytes += n;
+		len -= n;
+	}
+}
+
+
+// Bytes of an escape that did not complete are kept as they are
+static void url_FormFlushPercent(url_form *f)
+{
+	char bytes[2] = { '%', f->hex };
+	if(f->percent)
+		url_FormPut(f, bytes, f->percent, true);
+	f->percent = 0;
+}
+
+
+static void url_FormEndPair(url_form *f)
+{
+	url_FormFlushPercent(f);
+	if(f->started)
+		url_FormEmit(f, false);
+	f->key_len = 0;
+	f->value_len = 0;
+	f->flags = 0;
+	f->started = false;
+	f->in_value = false;
+}
+
+
+/**
+ * Create a new form decoder, reusable for any number of bodies.
+ * @param  max_pair Longest key, and longest part of a value, or 0 for
+ *                  URL_FORM_MAX_PAIR. The decoder allocates about twice
+ *                  this size.
+ * @param  callback Function called for each pair.
+ * @param  ctx      Pointer given to the callback.
+ * @return          Pointer to a new decoder, to be freed with
+ *                  url_FormFree(), or NULL if error.
+ */
+extern url_form *url_FormNew(size_t max_pair, url_form_callback callback, void *ctx)
+{
+	if(callback==NULL)
+		return(NULL);
+	if(max_pair==0)
+		max_pair = URL_FORM_MAX_PAIR;
+
+	url_form *f = calloc(1, sizeof(url_form));
+	if(f==NULL)
+		return(NULL);
+	f->key = malloc(max_pair + 1);
+	f->value = malloc(max_pair + 1);
+	if(f->key==NULL || f->value==NULL) {
+		url_FormFree(f);
+		return(NULL);
+	}
+	f->max = max_pair;
+	f->callback = callback;
+	f->ctx = ctx;
+	return(f);
+}
+
+
+/**
+ * Free a form decoder.
+ * @param f Pointer returned by url_FormNew(), or NULL.
+ */
+extern void url_FormFree(url_form *f)
+{
+	if(f==NULL)
+		return;
+	free(f->key);
+	free(f->value);
+	free(f);
+}
+
+
+/**
+ * Decode the next chunk of a body, calling the callback for each pair
+ * ended in it.
+ * @param  f    Decoder.
+ * @param  body Pointer to the chunk.
+ * @param  len  Length of the chunk.
+ * @return      0, or -1 if error or if the callback asked to stop (the rest
+ *              of the body is then ignored until url_FormFinish()).
+ */
+extern int url_FormFeed(url_form *f, const char *body, size_t len)
+{
+	if(f==NULL || (body==NULL && len))
+		return(-1);
+
+	const char *p = body, *end = body + len;
+	while(p<end && !f->failed) {
+		// End of an escape, possibly started in a previous chunk
+		if(f->percent) {
+			int digit = url_FormHex(*p);
+			if(digit==-1)
+				url_FormFlushPercent(f);
+			else if(f->percent==1) {
+				f->hex = *(p++);
+				f->percent = 2;
+			} else {
+				char c = url_FormHex(f->hex)*16 + digit;
+				url_FormPut(f, &c, 1, true);
+				f->percent = 0;
+				p++;
+			}
+			continue;
+		}
+
+		const char *special = url_FormScan(p, end);
+		if(special > p)
+			url_FormPut(f, p, special-p, false);
+		if(special==end)
+			break;
+		p = special+1;
+		switch(*special) {
+			case '%':
+				f->percent = 1;
+				break;
+			case '=':
+				// Only the first one separates the key from the value
+				if(f->in_value)
+					url_FormPut(f, "=", 1, true);
+				else {
+					f->started = true;
+					f->in_value = true;
+				}
+				break;
+			case '&':
+				url_FormEndPair(f);
+				break;
+		}
+	}
+	return(f->failed ? -1 : 0);
+}
+
+
+/**
+ * End a body, calling the callback for its last pair, and get ready for the
+ * next one.
+ * @param  f Decoder.
+ * @return   0, or -1 if error or if the callback asked to stop.
+ */
+extern int url_FormFinish(url_form *f)
+{
+	if(f==NULL)
+		return(-1);
+	url_FormEndPair(f);
+	bool failed = f->failed;
+	f->failed = false;
+	return(failed ? -1 : 0);
+}
+
+
+// Bytes url_FormEncode() keeps as they are
+static inline bool url_FormKept(unsigned char c)
+{
+	return((c>='a' && c<='z') || (c>='A' && c<='Z') || (c>='0' && c<='9') || c=='*' || c=='-' || c=='.' || c=='_');
+}
+
+
+/**
+ * Encode a key or a value to be put in an application/x-www-form-urlencoded
+ * body. Single pass : '%' is encoded as any other byte. Spaces become '+',
+ * and all bytes but ASCII letters, digits and "*-._" are percent-encoded.
+ * @param  src     Pointer to the string to be encoded.
+ * @param  len     Length of the string. If 0, strlen() will be used.
+ * @param  new_len If not NULL, pointer to a size_t where the length of the
+ *                 encoded string will be stored.
+ * @return         Pointer to a newly allocated string holding the encoded
+ *                 string, or NULL if error. Must be freed with free().
+ */
+extern char *url_FormEncode(const char *src, size_t len, size_t *new_len)
+{
+	static const char hex_digits[] = "0123456789ABCDEF";
+
+	if(src==NULL)
+		return(NULL);
+	if(len==0)
+		len = strlen(src);
+
+	const unsigned char *usrc = (const unsigned char *)src, *end = usrc + len;
+
+	// Exact length : 3 bytes for each percent-encoded byte, 1 for the others
+	size_t encoded = 0;
+	for(const unsigned char *p=usrc; p<end; p++)
+		if(!url_FormKept(*p) && *p!=' ')
+			encoded++;
+
+	char *dest = malloc(len + 2*encoded + 1);
+	if(dest==NULL)
+		return(NULL);
+	char *begin_dest = dest;
+
+	for( ; usrc<end; usrc++) {
+		unsigned char c = *usrc;
+		if(url_FormKept(c))
+			*(dest++) = c;
+		else if(c==' ')
+			*(dest++) = '+';
+		else {
+			*(dest++) = '%';
+			*(dest++) = hex_digits[c >> 4];
+			*(dest++) = hex_digits[c & 15];
+		}
+	}
+	*dest = '\0';
+
+	if(new_len)
+		*new_len = dest - begin_dest;
+	return(begin_dest);
+}
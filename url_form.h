@@ -0,0 +1,98 @@
+#ifndef _URL_FORM_H_
+#define _URL_FORM_H_
+
+#include <stddef.h>
+
+/*
+	Decoding and encoding of application/x-www-form-urlencoded bodies, as
+	the URL standard defines them.
+
+	Unlike url_Unescape(), decoding is a single pass ("%2541" gives "%41"),
+	'+' gives a space, and a '%' not followed by two hexadecimal digits is
+	kept as it is. The body is given in chunks of any size, split anywhere,
+	and each key / value pair is given to a callback as soon as its '&' (or
+	the end of the body) is read. Bytes without meaning are found with SSE2
+	when available and copied as runs.
+
+	Memory is bounded whatever the size of the body : a value longer than
+	the pair limit is given to the callback in several parts, flagged with
+	URL_FORM_PARTIAL but the last one, and a key longer than the limit is
+	truncated, flagged with URL_FORM_TRUNCATED.
+*/
+
+// Default longest key, and longest part of a value, given to the callback
+#define URL_FORM_MAX_PAIR (64*1024)
+
+// Flags given to the callback
+#define URL_FORM_PARTIAL 1			// More of the value follows, same key
+#define URL_FORM_TRUNCATED 2		// The key was longer than the limit
+
+typedef struct url_form url_form;
+
+/**
+ * Function called for each decoded key / value pair, in order.
+ * @param  ctx       Pointer given to url_FormNew().
+ * @param  key       Pointer to the NUL terminated decoded key, valid until
+ *                   the function returns.
+ * @param  key_len   Length of the key.
+ * @param  value     Pointer to the NUL terminated decoded value (or part of
+ *                   it), valid until the function returns. Empty for a pair
+ *                   without '='.
+ * @param  value_len Length of the value.
+ * @param  flags     URL_FORM_PARTIAL and URL_FORM_TRUNCATED, or 0.
+ * @return           0 to continue, anything else to stop decoding.
+ */
+typedef int (*url_form_callback)(void *ctx, const char *key, size_t key_len, const char *value, size_t value_len, int flags);
+
+
+/**
+ * Create a new form decoder, reusable for any number of bodies.
+ * @param  max_pair Longest key, and longest part of a value, or 0 for
+ *                  URL_FORM_MAX_PAIR. The decoder allocates about twice
+ *                  this size.
+ * @param  callback Function called for each pair.
+ * @param  ctx      Pointer given to the callback.
+ * @return          Pointer to a new decoder, to be freed with
+ *                  url_FormFree(), or NULL if error.
+ */
+extern url_form *url_FormNew(size_t max_pair, url_form_callback callback, void *ctx);
+
+/**
+ * Free a form decoder.
+ * @param f Pointer returned by url_FormNew(), or NULL.
+ */
+extern void url_FormFree(url_form *f);
+
+/**
+ * Decode the next chunk of a body, calling the callback for each pair
+ * ended in it.
+ * @param  f    Decoder.
+ * @param  body Pointer to the chunk.
+ * @param  len  Length of the chunk.
+ * @return      0, or -1 if error or if the callback asked to stop (the rest
+ *              of the body is then ignored until url_FormFinish()).
+ */
+extern int url_FormFeed(url_form *f, const char *body, size_t len);
+
+/**
+ * End a body, calling the callback for its last pair, and get ready for the
+ * next one.
+ * @param  f Decoder.
+ * @return   0, or -1 if error or if the callback asked to stop.
+ */
+extern int url_FormFinish(url_form *f);
+
+/**
+ * Encode a key or a value to be put in an application/x-www-form-urlencoded
+ * body. Single pass : '%' is encoded as any other byte. Spaces become '+',
+ * and all bytes but ASCII letters, digits and "*-._" are percent-encoded.
+ * @param  src     Pointer to the string to be encoded.
+ * @param  len     Length of the string. If 0, strlen() will be used.
+ * @param  new_len If not NULL, pointer to a size_t where the length of the
+ *                 encoded string will be stored.
+ * @return         Pointer to a newly allocated string holding the encoded
+ *                 string, or NULL if error. Must be freed with free().
+ */
+extern char *url_FormEncode(const char *src, size_t len, size_t *new_len);
+
+#endif
@@ -0,0 +1,781 @@
+/*
+	Link extraction from HTML pages given in chunks.
+
+	The scanner is a state machine close to the tokenizer of the HTML
+	standard, reduced to what is needed to find attributes : its state,
+	the current tag and attribute names and the value being read are kept
+	between chunks. Values of the attributes of interest are decoded into a
+	buffer, then appended to the links of the page. Other values are only
+	skipped.
+
+	Links are only resolved once the page is done, as a <base href> applies
+	to the whole page. The scheme, origin and directory of the base are
+	computed once, so that resolving a link is a copy of the right prefix
+	followed by the link, canonicalized afterwards with all the others by
+	url_CanonicalizeBatch().
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
+
+#include "url.h"
+#include "url_batch.h"
+#include "url_html.h"
+
+
+
+// Longest tag or attribute name told apart, longer ones match nothing
+#define URL_HTML_NAME 16
+
+// Longest entity, "&" and ";" excluded
+#define URL_HTML_ENTITY 12
+
+// States of the scanner
+enum {
+	URL_HTML_DATA,				// Text
+	URL_HTML_TAG_OPEN,			// After '<'
+	URL_HTML_MARKUP,			// After "<!"
+	URL_HTML_COMMENT,			// After "<!--"
+	URL_HTML_BOGUS,				// Skipped until '>'
+	URL_HTML_TAG_NAME,
+	URL_HTML_BEFORE_ATTR,
+	URL_HTML_ATTR_NAME,
+	URL_HTML_AFTER_ATTR_NAME,
+	URL_HTML_BEFORE_VALUE,
+	URL_HTML_VALUE,
+	URL_HTML_ENTITY_REF,		// After '&' in a value
+	URL_HTML_RAW,				// Content of a raw text element
+	URL_HTML_RAW_END			// After '<' in a raw text element
+};
+
+// What an attribute value is for
+enum {
+	URL_HTML_SKIP,
+	URL_HTML_LINK,
+	URL_HTML_BASE,
+	URL_HTML_EQUIV,
+	URL_HTML_CONTENT
+};
+
+// Elements whose content is not parsed
+static const char *url_HtmlRawTags[] = { "script", "style", "textarea", "title", "xmp" };
+
+typedef struct {
+	char *data;
+	size_t len, cap;
+} url_html_buffer;
+
+struct url_html {
+	char *page;
+	url_html_buffer links;			// Decoded values, one after the other
+	size_t *offsets, *lens;
+	size_t count, cap;
+	url_html_buffer base_href;
+	bool has_base;
+	url_html_buffer absolute;		// Resolved links
+	const char **ptrs;
+	size_t ptrs_cap;
+	url_batch *urls;
+	bool failed;					// Memory allocation failed
+
+	// Scanner
+	int state;
+	char tag[URL_HTML_NAME];
+	size_t tag_len;
+	char attr[URL_HTML_NAME];
+	size_t attr_len;
+	int kind;
+	char quote;						// Quote of the value, or '\0'
+	bool too_long;
+	url_html_buffer value;
+	char entity[URL_HTML_ENTITY];
+	size_t entity_len;
+	size_t markup;					// Dashes after "<!"
+	size_t dashes;					// Dashes before the end of a comment
+	int raw;						// Index in url_HtmlRawTags
+	size_t raw_matched;				// Bytes of "/name" matched
+	bool refresh;					// <meta http-equiv="refresh">
+	url_html_buffer content;
+	bool has_content;
+};
+
+
+
+static bool url_HtmlAppend(url_html_buffer *b, const char *bytes, size_t len)
+{
+	if(b->len + len + 1 > b->cap) {
+		size_t cap = b->cap ? b->cap : 256;
+		while(cap < b->len + len + 1)
+			cap *= 2;
+		char *data = realloc(b->data, cap);
+		if(data==NULL)
+			return(false);
+		b->data = data;
+		b->cap = cap;
+	}
+	memcpy(b->data + b->len, bytes, len);
+	b->len += len;
+	b->data[b->len] = '\0';
+	return(true);
+}
+
+static inline bool url_HtmlSpace(char c)
+{
+	return(c==' ' || c=='\t' || c=='\n' || c=='\r' || c=='\f');
+}
+
+static inline char url_HtmlLower(char c)
+{
+	return(c>='A' && c<='Z' ? c+32 : c);
+}
+
+static inline bool url_HtmlAlnum(char c)
+{
+	return((c>='0' && c<='9') || (c>='a' && c<='z') || (c>='A' && c<='Z'));
+}
+
+// First a or b in [p, end), or end
+static const char *url_HtmlFind2(const char *p, const char *end, char a, char b)
+{
+#ifdef __SSE2__
+	__m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+	for( ; end-p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+		if(mask)
+			return(p + __builtin_ctz(mask));
+	}
+#endif
+	for( ; p<end; p++)
+		if(*p==a || *p==b)
+			return(p);
+	return(end);
+}
+
+static inline bool url_HtmlIs(const char *name, size_t len, const char *s)
+{
+	return(len==strlen(s) && memcmp(name, s, len)==0);
+}
+
+
+static void url_HtmlAddLink(url_html *h, const char *link, size_t len)
+{
+	if(h->count == h->cap) {
+		size_t cap = h->cap ? h->cap*2 : 64;
+		size_t *offsets = realloc(h->offsets, cap * sizeof(size_t));
+		if(offsets)
+			h->offsets = offsets;
+		size_t *lens = realloc(h->lens, cap * sizeof(size_t));
+		if(lens)
+			h->lens = lens;
+		if(offsets==NULL || lens==NULL) {
+			h->failed = true;
+			return;
+		}
+		h->cap = cap;
+	}
+	size_t offset = h->links.len;
+	if(!url_HtmlAppend(&h->links, link, len) || !url_HtmlAppend(&h->links, "", 1)) {
+		h->failed = true;
+		return;
+	}
+	h->offsets[h->count] = offset;
+	h->lens[h->count++] = len;
+}
+
+
+static void url_HtmlValueAppend(url_html *h, const char *bytes, size_t len)
+{
+	if(h->too_long || h->value.len + len > URL_HTML_MAX_VALUE)
+		h->too_long = true;
+	else if(!url_HtmlAppend(&h->value, bytes, len))
+		h->failed = true;
+}
+
+
+static int url_HtmlKind(const url_html *h)
+{
+	const char *attr = h->attr;
+	size_t len = h->attr_len;
+	if(url_HtmlIs(h->tag, h->tag_len, "meta")) {
+		if(url_HtmlIs(attr, len, "http-equiv"))
+			return(URL_HTML_EQUIV);
+		if(url_HtmlIs(attr, len, "content"))
+			return(URL_HTML_CONTENT);
+		return(URL_HTML_SKIP);
+	}
+	if(url_HtmlIs(attr, len, "href"))
+		return(url_HtmlIs(h->tag, h->tag_len, "base") ? URL_HTML_BASE : URL_HTML_LINK);
+	if(url_HtmlIs(attr, len, "src") || url_HtmlIs(attr, len, "action") || url_HtmlIs(attr, len, "formaction"))
+		return(URL_HTML_LINK);
+	return(URL_HTML_SKIP);
+}
+
+
+static void url_HtmlEndValue(url_html *h)
+{
+	if(h->too_long)
+		return;
+	switch(h->kind) {
+		case URL_HTML_LINK:
+			url_HtmlAddLink(h, h->value.data, h->value.len);
+			break;
+		case URL_HTML_BASE:
+			// Only the first one counts
+			if(!h->has_base) {
+				h->has_base = true;
+				h->base_href.len = 0;
+				if(!url_HtmlAppend(&h->base_href, h->value.data, h->value.len))
+					h->failed = true;
+			}
+			break;
+		case URL_HTML_EQUIV: {
+			const char *p = h->value.data, *end = p + h->value.len;
+			while(p<end && url_HtmlSpace(*p))
+				p++;
+			while(end>p && url_HtmlSpace(end[-1]))
+				end--;
+			h->refresh = end-p==7 && strncasecmp(p, "refresh", 7)==0;
+			break;
+		}
+		case URL_HTML_CONTENT:
+			h->content.len = 0;
+			h->has_content = url_HtmlAppend(&h->content, h->value.data, h->value.len);
+			break;
+	}
+}
+
+
+// URL of a meta refresh, as "5; URL='page.html'"
+static void url_HtmlRefresh(url_html *h)
+{
+	char *string = h->content.data;
+	while(string) {
+		char *key, *value;
+		string = url_ParseNextKeyValuePair(string, &key, &value, ";,");
+		if(key && value && strcasecmp(key, "url")==0) {
+			url_HtmlAddLink(h, value, strlen(value));
+			break;
+		}
+	}
+}
+
+
+// '>' of a start tag
+static void url_HtmlEndTag(url_html *h)
+{
+	if(h->refresh && h->has_content && url_HtmlIs(h->tag, h->tag_len, "meta"))
+		url_HtmlRefresh(h);
+	h->state = URL_HTML_DATA;
+	for(size_t i=0; i<sizeof(url_HtmlRawTags)/sizeof(url_HtmlRawTags[0]); i++)
+		if(url_HtmlIs(h->tag, h->tag_len, url_HtmlRawTags[i])) {
+			h->raw = i;
+			h->state = URL_HTML_RAW;
+		}
+}
+
+
+static size_t url_HtmlUTF8(uint32_t c, char *out)
+{
+	if(c==0 || c>0x10FFFF || (c>=0xD800 && c<=0xDFFF))
+		c = 0xFFFD;
+	if(c < 0x80) {
+		out[0] = c;
+		return(1);
+	}
+	if(c < 0x800) {
+		out[0] = 0xC0 | (c >> 6);
+		out[1] = 0x80 | (c & 0x3F);
+		return(2);
+	}
+	if(c < 0x10000) {
+		out[0] = 0xE0 | (c >> 12);
+		out[1] = 0x80 | ((c >> 6) & 0x3F);
+		out[2] = 0x80 | (c & 0x3F);
+		return(3);
+	}
+	out[0] = 0xF0 | (c >> 18);
+	out[1] = 0x80 | ((c >> 12) & 0x3F);
+	out[2] = 0x80 | ((c >> 6) & 0x3F);
+	out[3] = 0x80 | (c & 0x3F);
+	return(4);
+}
+
+
+// Decode the entity read, ended by next (';' if terminated). Return false
+// if it is not one, to be kept as it is.
+static bool url_HtmlDecodeEntity(url_html *h, char next)
+{
+	static const struct { const char *name; uint32_t c; } named[] = {
+		{ "amp", '&' }, { "lt", '<' }, { "gt", '>' }, { "quot", '"' }, { "apos", '\'' }, { "nbsp", 0xA0 }
+	};
+	const char *e = h->entity;
+	size_t len = h->entity_len;
+	char utf8[4];
+
+	if(len>=2 && e[0]=='#') {
+		bool hex = e[1]=='x' || e[1]=='X';
+		size_t i = hex ? 2 : 1;
+		if(i==len)
+			return(false);
+		uint32_t c = 0;
+		for( ; i<len; i++) {
+			int digit;
+			if(e[i]>='0' && e[i]<='9')
+				digit = e[i]-'0';
+			else if(hex && url_HtmlLower(e[i])>='a' && url_HtmlLower(e[i])<='f')
+				digit = url_HtmlLower(e[i])-'a'+10;
+			else
+				return(false);
+			c = c > 0x110000 ? c : c*(hex ? 16 : 10) + digit;
+		}
+		url_HtmlValueAppend(h, utf8, url_HtmlUTF8(c, utf8));
+		return(true);
+	}
+
+	// In attributes, "&amp=" is not decoded without its ';'
+	if(next!=';' && next=='=')
+		return(false);
+	for(size_t i=0; i<sizeof(named)/sizeof(named[0]); i++)
+		if(url_HtmlIs(e, len, named[i].name)) {
+			url_HtmlValueAppend(h, utf8, url_HtmlUTF8(named[i].c, utf8));
+			return(true);
+		}
+	return(false);
+}
+
+
+/**
+ * Create a new link extractor, reusable for any number of pages.
+ * @return Pointer to a new extractor, to be freed with url_HtmlFree(), or
+ *         NULL if error.
+ */
+extern url_html *url_HtmlNew(void)
+{
+	url_html *h = calloc(1, sizeof(url_html));
+	if(h==NULL)
+		return(NULL);
+	if((h->urls = url_BatchNew())==NULL) {
+		free(h);
+		return(NULL);
+	}
+	return(h);
+}
+
+
+/**
+ * Free a link extractor and its URLs.
+ * @param h Pointer returned by url_HtmlNew(), or NULL.
+ */
+extern void url_HtmlFree(url_html *h)
+{
+	if(h==NULL)
+		return;
+	free(h->page);
+	free(h->links.data);
+	free(h->offsets);
+	free(h->lens);
+	free(h->base_href.data);
+	free(h->absolute.data);
+	free(h->ptrs);
+	free(h->value.data);
+	free(h->content.data);
+	url_BatchFree(h->urls);
+	free(h);
+}
+
+
+/**
+ * Start a new page, forgetting the links of the previous one.
+ * @param  h        Extractor.
+ * @param  page_url Absolute URL of the page (http:// or https://).
+ * @param  len      Length of the URL. If 0, strlen() will be used.
+ * @return          0, or -1 if error.
+ */
+extern int url_HtmlBegin(url_html *h, const char *page_url, size_t len)
+{
+	if(h==NULL || page_url==NULL)
+		return(-1);
+	if(len==0)
+		len = strlen(page_url);
+
+	free(h->page);
+	if((h->page = malloc(len+1))==NULL)
+		return(-1);
+	memcpy(h->page, page_url, len);
+	h->page[len] = '\0';
+	if(!url_IsAbsolute(h->page))
+		return(-1);
+
+	h->links.len = 0;
+	h->count = 0;
+	h->has_base = false;
+	h->failed = false;
+	h->state = URL_HTML_DATA;
+	url_BatchReset(h->urls);
+	return(0);
+}
+
+
+/**
+ * Parse the next chunk of the page. Tags, attributes and entities can be
+ * split between chunks.
+ * @param  h    Extractor.
+ * @param  html Pointer to the chunk.
+ * @param  len  Length of the chunk.
+ * @return      0, or -1 if error.
+ */
+extern int url_HtmlFeed(url_html *h, const char *html, size_t len)
+{
+	if(h==NULL || html==NULL || h->page==NULL)
+		return(-1);
+
+	const char *p = html, *end = html + len;
+	while(p < end) {
+		char c = *p;
+		switch(h->state) {
+
+			case URL_HTML_DATA: {
+				const char *lt = memchr(p, '<', end-p);
+				if(lt==NULL)
+					return(h->failed ? -1 : 0);
+				p = lt+1;
+				h->state = URL_HTML_TAG_OPEN;
+				break;
+			}
+
+			case URL_HTML_TAG_OPEN:
+				if(c=='!') {
+					h->markup = 0;
+					h->state = URL_HTML_MARKUP;
+					p++;
+				} else if(c=='/' || c=='?') {
+					h->state = URL_HTML_BOGUS;
+					p++;
+				} else if((c>='a' && c<='z') || (c>='A' && c<='Z')) {
+					h->tag_len = 0;
+					h->refresh = false;
+					h->has_content = false;
+					h->state = URL_HTML_TAG_NAME;
+				} else
+					h->state = URL_HTML_DATA;
+				break;
+
+			case URL_HTML_MARKUP:
+				if(c=='-') {
+					p++;
+					if(++h->markup == 2) {
+						h->dashes = 0;
+						h->state = URL_HTML_COMMENT;
+					}
+				} else
+					h->state = URL_HTML_BOGUS;
+				break;
+
+			case URL_HTML_COMMENT: {
+				// "-->", the dashes possibly in a previous chunk
+				const char *gt = memchr(p, '>', end-p);
+				const char *q = gt ? gt : end;
+				size_t dashes = 0;
+				while(q-dashes>p && q[-1-(ptrdiff_t)dashes]=='-')
+					dashes++;
+				if(q-dashes==p)
+					dashes += h->dashes;
+				if(gt==NULL) {
+					h->dashes = dashes;
+					p = end;
+				} else {
+					h->dashes = 0;
+					p = gt+1;
+					if(dashes>=2)
+						h->state = URL_HTML_DATA;
+				}
+				break;
+			}
+
+			case URL_HTML_BOGUS: {
+				const char *gt = memchr(p, '>', end-p);
+				if(gt==NULL)
+					return(h->failed ? -1 : 0);
+				p = gt+1;
+				h->state = URL_HTML_DATA;
+				break;
+			}
+
+			case URL_HTML_TAG_NAME:
+				p++;
+				if(url_HtmlSpace(c) || c=='/')
+					h->state = URL_HTML_BEFORE_ATTR;
+				else if(c=='>')
+					url_HtmlEndTag(h);
+				else if(h->tag_len < URL_HTML_NAME)
+					h->tag[h->tag_len++] = url_HtmlLower(c);
+				break;
+
+			case URL_HTML_BEFORE_ATTR:
+				if(c=='>') {
+					p++;
+					url_HtmlEndTag(h);
+				} else if(url_HtmlSpace(c) || c=='/' || c=='"' || c=='\'')
+					p++;
+				else {
+					h->attr_len = 0;
+					h->state = URL_HTML_ATTR_NAME;
+				}
+				break;
+
+			case URL_HTML_ATTR_NAME:
+				p++;
+				if(url_HtmlSpace(c))
+					h->state = URL_HTML_AFTER_ATTR_NAME;
+				else if(c=='=')
+					h->state = URL_HTML_BEFORE_VALUE;
+				else if(c=='/')
+					h->state = URL_HTML_BEFORE_ATTR;
+				else if(c=='>')
+					url_HtmlEndTag(h);
+				else if(h->attr_len < URL_HTML_NAME)
+					h->attr[h->attr_len++] = url_HtmlLower(c);
+				break;
+
+			case URL_HTML_AFTER_ATTR_NAME:
+				if(url_HtmlSpace(c))
+					p++;
+				else if(c=='=') {
+					p++;
+					h->state = URL_HTML_BEFORE_VALUE;
+				} else
+					h->state = URL_HTML_BEFORE_ATTR;
+				break;
+
+			case URL_HTML_BEFORE_VALUE:
+				if(url_HtmlSpace(c)) {
+					p++;
+					break;
+				}
+				if(c=='>') {
+					p++;
+					url_HtmlEndTag(h);
+					break;
+				}
+				h->quote = c=='"' || c=='\'' ? c : '\0';
+				if(h->quote)
+					p++;
+				h->kind = url_HtmlKind(h);
+				h->value.len = 0;
+				h->too_long = false;
+				h->state = URL_HTML_VALUE;
+				break;
+
+			case URL_HTML_VALUE:
+				if(h->quote) {
+					// Values skipped are only searched for their quote
+					const char *q = h->kind==URL_HTML_SKIP
+						? memchr(p, h->quote, end-p)
+						: url_HtmlFind2(p, end, h->quote, '&');
+					if(q==NULL)
+						q = end;
+					if(h->kind!=URL_HTML_SKIP)
+						url_HtmlValueAppend(h, p, q-p);
+					p = q;
+					if(p==end)
+						break;
+					p++;
+					if(*q=='&') {
+						h->entity_len = 0;
+						h->state = URL_HTML_ENTITY_REF;
+					} else {
+						url_HtmlEndValue(h);
+						h->state = URL_HTML_BEFORE_ATTR;
+					}
+				} else {
+					if(url_HtmlSpace(c) || c=='>') {
+						url_HtmlEndValue(h);
+						h->state = URL_HTML_BEFORE_ATTR;
+						break;
+					}
+					p++;
+					if(c=='&' && h->kind!=URL_HTML_SKIP) {
+						h->entity_len = 0;
+						h->state = URL_HTML_ENTITY_REF;
+					} else if(h->kind!=URL_HTML_SKIP)
+						url_HtmlValueAppend(h, &c, 1);
+				}
+				break;
+
+			case URL_HTML_ENTITY_REF:
+				if((url_HtmlAlnum(c) || (c=='#' && h->entity_len==0)) && h->entity_len < URL_HTML_ENTITY) {
+					h->entity[h->entity_len++] = c;
+					p++;
+					break;
+				}
+				if(url_HtmlDecodeEntity(h, c)) {
+					if(c==';')
+						p++;
+				} else {
+					url_HtmlValueAppend(h, "&", 1);
+					url_HtmlValueAppend(h, h->entity, h->entity_len);
+				}
+				h->state = URL_HTML_VALUE;
+				break;
+
+			case URL_HTML_RAW: {
+				const char *lt = memchr(p, '<', end-p);
+				if(lt==NULL)
+					return(h->failed ? -1 : 0);
+				p = lt+1;
+				h->raw_matched = 0;
+				h->state = URL_HTML_RAW_END;
+				break;
+			}
+
+			case URL_HTML_RAW_END: {
+				const char *name = url_HtmlRawTags[h->raw];
+				size_t name_len = strlen(name);
+				if(h->raw_matched == name_len+1) {
+					if(url_HtmlSpace(c) || c=='/' || c=='>')
+						h->state = URL_HTML_BOGUS;
+					else
+						h->state = URL_HTML_RAW;
+				} else if(h->raw_matched==0 ? c=='/' : url_HtmlLower(c)==name[h->raw_matched-1]) {
+					h->raw_matched++;
+					p++;
+				} else
+					h->state = URL_HTML_RAW;
+				break;
+			}
+		}
+	}
+	return(h->failed ? -1 : 0);
+}
+
+
+/**
+ * Resolve and canonicalize the links of the page.
+ * @param  h Extractor.
+ * @return   Pointer to the batch of the absolute canonicalized links, in
+ *           the order of the page, owned by the extractor and valid until
+ *           the next page, or NULL if error.
+ */
+extern url_batch *url_HtmlFinish(url_html *h)
+{
+	if(h==NULL || h->page==NULL || h->failed)
+		return(NULL);
+
+	// The base, normalized once for all the links
+	char *base_url = NULL;
+	if(h->has_base) {
+		const char *href = h->base_href.data;
+		while(url_HtmlSpace(*href))
+			href++;
+		if(*href)
+			base_url = url_MakeAbsolute(h->page, href);
+	}
+	const char *base = base_url ? base_url : h->page;
+	char *scheme = url_GetScheme(base);
+	char *hostname = url_GetHostnameWWW(base);
+	size_t directory_len = 0;
+	char *directory = url_GetBase(base, 0, &directory_len);
+	url_batch *result = NULL;
+	if(scheme==NULL || hostname==NULL || directory==NULL)
+		goto end;
+	size_t scheme_len = strlen(scheme), hostname_len = strlen(hostname);
+
+	// Offsets first, as the buffer can move
+	size_t count = 0;
+	h->absolute.len = 0;
+	for(size_t i=0; i<h->count; i++) {
+		const char *link = h->links.data + h->offsets[i];
+		size_t len = h->lens[i];
+		while(len && (unsigned char)*link<=' ') {
+			link++;
+			len--;
+		}
+		while(len && (unsigned char)link[len-1]<=' ')
+			len--;
+		if(len==0)
+			continue;
+
+		// Another scheme than http:// or https://
+		size_t colon = 0;
+		while(colon<len && link[colon]!=':' && link[colon]!='/' && link[colon]!='?' && link[colon]!='#')
+			colon++;
+		bool absolute = url_IsAbsolute(link);
+		if(!absolute && colon<len && link[colon]==':')
+			continue;
+
+		size_t offset = h->absolute.len;
+		bool appended;
+		if(absolute)
+			appended = true;
+		else if(link[0]=='/' && len>1 && link[1]=='/') {
+			appended = url_HtmlAppend(&h->absolute, scheme, scheme_len);
+			link +=2;
+			len -=2;
+		} else if(link[0]=='/')
+			appended = url_HtmlAppend(&h->absolute, scheme, scheme_len) && url_HtmlAppend(&h->absolute, hostname, hostname_len);
+		else
+			appended = url_HtmlAppend(&h->absolute, directory, directory_len);
+		if(!appended || !url_HtmlAppend(&h->absolute, link, len))
+			goto end;
+
+		// Reuse offsets for the resolved links
+		h->offsets[count] = offset;
+		h->lens[count++] = h->absolute.len - offset;
+	}
+
+	if(count > h->ptrs_cap) {
+		const char **ptrs = realloc(h->ptrs, count * sizeof(char *));
+		if(ptrs==NULL)
+			goto end;
+		h->ptrs = ptrs;
+		h->ptrs_cap = count;
+	}
+	for(size_t i=0; i<count; i++)
+		h->ptrs[i] = h->absolute.data + h->offsets[i];
+
+	url_BatchReset(h->urls);
+	url_CanonicalizeBatch(h->urls, h->ptrs, h->lens, count);
+	result = h->urls;
+
+end:
+	h->count = 0;
+	free(base_url);
+	free(scheme);
+	free(hostname);
+	free(directory);
+	return(result);
+}
+
+
+/**
+ * Extract the links of a whole page, calling url_HtmlBegin(),
+ * url_HtmlFeed() and url_HtmlFinish().
+ * @param  h        Extractor.
+ * @param  page_url Absolute URL of the page.
+ * @param  html     Pointer to the page.
+ * @param  len      Length of the page. If 0, strlen() will be used.
+ * @return          Pointer to the batch of the links, as url_HtmlFinish()
+ *                  returns it, or NULL if error.
+ */
+extern url_batch *url_HtmlExtract(url_html *h, const char *page_url, const char *html, size_t len)
+{
+	if(html==NULL)
+		return(NULL);
+	if(len==0)
+		len = strlen(html);
+	if(url_HtmlBegin(h, page_url, 0) || url_HtmlFeed(h, html, len))
+		return(NULL);
+	return(url_HtmlFinish(h));
+}
@@ -0,0 +1,84 @@
+#ifndef _URL_HTML_H_
+#define _URL_HTML_H_
+
+#include <stddef.h>
+
+#include "url_batch.h"
+
+/*
+	Extraction of the links of HTML pages, without building a DOM.
+
+	Pages can be given in chunks, as they are read. Only tags and attributes
+	are parsed : text is skipped with memchr(), as are comments and the
+	content of script, style, textarea, title and xmp elements. The values
+	of href, src, action and formaction attributes, and the URL of meta
+	refresh tags, are collected with their HTML entities decoded (quoted
+	values are scanned with SSE2 when available).
+
+	Once the page is done, the base of the page (its URL, or the first
+	<base href>) is normalized once, and each link is resolved against it
+	as url_MakeAbsolute() does, then canonicalized into a url_batch, packed
+	in a single arena. Links with another scheme than http and https
+	(javascript:, mailto:, data:, etc.) and empty links are skipped.
+*/
+
+// Longest attribute value kept, longer ones are skipped
+#define URL_HTML_MAX_VALUE (64*1024)
+
+typedef struct url_html url_html;
+
+
+/**
+ * Create a new link extractor, reusable for any number of pages.
+ * @return Pointer to a new extractor, to be freed with url_HtmlFree(), or
+ *         NULL if error.
+ */
+extern url_html *url_HtmlNew(void);
+
+/**
+ * Free a link extractor and its URLs.
+ * @param h Pointer returned by url_HtmlNew(), or NULL.
+ */
+extern void url_HtmlFree(url_html *h);
+
+/**
+ * Start a new page, forgetting the links of the previous one.
+ * @param  h        Extractor.
+ * @param  page_url Absolute URL of the page (http:// or https://).
+ * @param  len      Length of the URL. If 0, strlen() will be used.
+ * @return          0, or -1 if error.
+ */
+extern int url_HtmlBegin(url_html *h, const char *page_url, size_t len);
+
+/**
+ * Parse the next chunk of the page. Tags, attributes and entities can be
+ * split between chunks.
+ * @param  h    Extractor.
+ * @param  html Pointer to the chunk.
+ * @param  len  Length of the chunk.
+ * @return      0, or -1 if error.
+ */
+extern int url_HtmlFeed(url_html *h, const char *html, size_t len);
+
+/**
+ * Resolve and canonicalize the links of the page.
+ * @param  h Extractor.
+ * @return   Pointer to the batch of the absolute canonicalized links, in
+ *           the order of the page, owned by the extractor and valid until
+ *           the next page, or NULL if error.
+ */
+extern url_batch *url_HtmlFinish(url_html *h);
+
+/**
+ * Extract the links of a whole page, calling url_HtmlBegin(),
+ * url_HtmlFeed() and url_HtmlFinish().
+ * @param  h        Extractor.
+ * @param  page_url Absolute URL of the page.
+ * @param  html     Pointer to the page.
+ * @param  len      Length of the page. If 0, strlen() will be used.
+ * @return          Pointer to the batch of the links, as url_HtmlFinish()
+ *                  returns it, or NULL if error.
+ */
+extern url_batch *url_HtmlExtract(url_html *h, const char *page_url, const char *html, size_t len);
+
+#endif
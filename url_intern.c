@@ -0,0 +1,404 @@
+/*
+	Interning dictionary with dense identifiers.
+
+	Strings are copied in per-shard arenas made of blocks that are never
+	moved nor freed before the dictionary. Identifiers are given by a
+	global counter, and the identifier -> string directory is made of
+	segments of growing sizes (URL_INTERN_SEGMENT << k entries for segment
+	k), so that entries never move either.
+
+	Each shard has an open-addressing table of 64 bits slots, holding the
+	high half of the hash of the string and its identifier + 1 (0 marks an
+	empty slot). Writers hold the shard lock. When a table is 3/4 full, a
+	larger copy is published atomically and the old one is kept until the
+	dictionary is freed, since readers may still be walking it. Readers
+	load the table and the slots with acquire semantics, and writers fill
+	the directory entry before publishing the slot, so a reader finding a
+	slot always finds its string.
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "url.h"
+#include "url_intern.h"
+
+
+
+#define URL_INTERN_SEGMENT 1024
+#define URL_INTERN_SEGMENTS 24
+#define URL_INTERN_BLOCK 65536
+
+typedef struct {
+	size_t len;
+	const char *str;
+} url_intern_entry;
+
+typedef struct url_intern_table {
+	struct url_intern_table *retired;
+	size_t mask;
+	size_t used;
+	uint64_t slots[];
+} url_intern_table;
+
+typedef struct url_intern_block {
+	struct url_intern_block *next;
+	size_t used;
+	size_t size;
+	char data[];
+} url_intern_block;
+
+typedef struct {
+	pthread_mutex_t lock;
+	url_intern_table *table;
+	url_intern_block *blocks;
+	size_t bytes;
+} url_intern_shard;
+
+struct url_intern {
+	unsigned shard_count;
+	url_intern_shard *shards;
+	uint64_t next_id;
+	url_intern_entry *segments[URL_INTERN_SEGMENTS];
+};
+
+
+
+/**
+ * Create a new interning dictionary.
+ * @param  shards Number of independently locked shards, rounded up to a
+ *                power of 2, or 0 for URL_INTERN_SHARDS.
+ * @return        Pointer to a new dictionary, to be freed with
+ *                url_InternFree(), or NULL if error.
+ */
+extern url_intern *url_InternNew(unsigned shards)
+{
+	if(shards==0)
+		shards = URL_INTERN_SHARDS;
+	if(shards>65536)
+		return(NULL);
+
+	url_intern *d = calloc(1, sizeof(url_intern));
+	if(d==NULL)
+		return(NULL);
+	for(d->shard_count=1; d->shard_count<shards; d->shard_count*=2)
+		;
+	d->shards = calloc(d->shard_count, sizeof(url_intern_shard));
+	if(d->shards==NULL)
+		goto bad;
+
+	for(unsigned i=0; i<d->shard_count; i++) {
+		url_intern_shard *shard = &d->shards[i];
+		shard->table = calloc(1, sizeof(url_intern_table) + 256*sizeof(uint64_t));
+		if(shard->table==NULL)
+			goto bad;
+		shard->table->mask = 255;
+		pthread_mutex_init(&shard->lock, NULL);
+	}
+
+	return(d);
+
+bad:
+	url_InternFree(d);
+	return(NULL);
+}
+
+
+/**
+ * Free an interning dictionary, and all the strings it holds.
+ * @param d Pointer returned by url_InternNew(), or NULL.
+ */
+extern void url_InternFree(url_intern *d)
+{
+	if(d==NULL)
+		return;
+	if(d->shards) {
+		for(unsigned i=0; i<d->shard_count; i++) {
+			url_intern_shard *shard = &d->shards[i];
+			if(shard->table==NULL)
+				continue;
+			pthread_mutex_destroy(&shard->lock);
+			for(url_intern_table *table = shard->table, *next; table; table = next) {
+				next = table->retired;
+				free(table);
+			}
+			for(url_intern_block *block = shard->blocks, *next; block; block = next) {
+				next = block->next;
+				free(block);
+			}
+		}
+		free(d->shards);
+	}
+	for(int i=0; i<URL_INTERN_SEGMENTS; i++)
+		free(d->segments[i]);
+	free(d);
+}
+
+
+// Find the directory entry of an identifier. Segment k starts at
+// identifier URL_INTERN_SEGMENT * (2^k - 1).
+static inline url_intern_entry *url_InternEntry(const url_intern *d, uint64_t id, int *segment, size_t *offset)
+{
+	uint64_t x = id / URL_INTERN_SEGMENT + 1;
+	int k = 63 - __builtin_clzll(x);
+	*segment = k;
+	*offset = id - (uint64_t)URL_INTERN_SEGMENT * (((uint64_t)1 << k) - 1);
+	url_intern_entry *entries = __atomic_load_n(&d->segments[k], __ATOMIC_ACQUIRE);
+	return(entries ? &entries[*offset] : NULL);
+}
+
+
+static inline url_intern_shard *url_InternShard(const url_intern *d, uint64_t hash)
+{
+	return(&d->shards[(hash >> 32) & (d->shard_count-1)]);
+}
+
+
+static uint32_t url_InternLookup(const url_intern *d, const url_intern_table *table, const char *str, size_t len, uint64_t hash)
+{
+	uint64_t tag = hash >> 32;
+	for(size_t i = hash & table->mask; ; i = (i+1) & table->mask) {
+		uint64_t slot = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE);
+		if(slot==0)
+			return(URL_INTERN_NONE);
+		if((slot >> 32) != tag)
+			continue;
+		uint32_t id = (uint32_t)slot - 1;
+		size_t entry_len;
+		const char *entry_str = url_InternGet(d, id, &entry_len);
+		if(entry_str && entry_len==len && memcmp(entry_str, str, len)==0)
+			return(id);
+	}
+}
+
+
+static void url_InternPut(url_intern_table *table, uint64_t hash, uint64_t slot)
+{
+	size_t i = hash & table->mask;
+	while(table->slots[i])
+		i = (i+1) & table->mask;
+	__atomic_store_n(&table->slots[i], slot, __ATOMIC_RELEASE);
+	table->used++;
+}
+
+
+// Called with the shard lock held
+static bool url_InternGrow(const url_intern *d, url_intern_shard *shard)
+{
+	url_intern_table *old = shard->table;
+	size_t size = 2*(old->mask+1);
+	url_intern_table *table = calloc(1, sizeof(url_intern_table) + size*sizeof(uint64_t));
+	if(table==NULL)
+		return(false);
+	table->mask = size-1;
+	table->retired = old;
+
+	// Slots only keep the high half of the hash : get it back from the string
+	for(size_t i=0; i<=old->mask; i++) {
+		uint64_t slot = old->slots[i];
+		if(slot==0)
+			continue;
+		size_t len;
+		const char *str = url_InternGet(d, (uint32_t)slot - 1, &len);
+		url_InternPut(table, url_Hash64(str, len, 0), slot);
+	}
+
+	__atomic_add_fetch(&shard->bytes, size*sizeof(uint64_t), __ATOMIC_RELAXED);
+	__atomic_store_n(&shard->table, table, __ATOMIC_RELEASE);
+	return(true);
+}
+
+
+// Called with the shard lock held
+static char *url_InternCopy(url_intern_shard *shard, const char *str, size_t len)
+{
+	url_intern_block *block = shard->blocks;
+	if(block==NULL || block->size - block->used < len+1) {
+		size_t size = len+1 > URL_INTERN_BLOCK ? len+1 : URL_INTERN_BLOCK;
+		block = malloc(sizeof(url_intern_block) + size);
+		if(block==NULL)
+			return(NULL);
+		block->size = size;
+		block->used = 0;
+		block->next = shard->blocks;
+		shard->blocks = block;
+		__atomic_add_fetch(&shard->bytes, sizeof(url_intern_block) + size, __ATOMIC_RELAXED);
+	}
+	char *copy = block->data + block->used;
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	block->used += len+1;
+	return(copy);
+}
+
+
+/**
+ * Return the identifier of a string, adding it to the dictionary if needed.
+ * Identifiers are given in insertion order, starting at 0. Can be called
+ * concurrently from several threads.
+ * @param  d   Interning dictionary.
+ * @param  str Pointer to the string, usually returned by url_Canonicalize()
+ *             or url_GetHostname().
+ * @param  len Length of the string. If 0, strlen() will be used.
+ * @return     Identifier of the string, or URL_INTERN_NONE if error.
+ */
+extern uint32_t url_InternAdd(url_intern *d, const char *str, size_t len)
+{
+	if(d==NULL || str==NULL)
+		return(URL_INTERN_NONE);
+	if(len==0)
+		len = strlen(str);
+
+	uint64_t hash = url_Hash64(str, len, 0);
+	url_intern_shard *shard = url_InternShard(d, hash);
+	uint32_t id = url_InternLookup(d, __atomic_load_n(&shard->table, __ATOMIC_ACQUIRE), str, len, hash);
+	if(id!=URL_INTERN_NONE)
+		return(id);
+
+	pthread_mutex_lock(&shard->lock);
+
+	// Another thread may have added it meanwhile
+	id = url_InternLookup(d, shard->table, str, len, hash);
+	if(id!=URL_INTERN_NONE)
+		goto end;
+
+	if(4*(shard->table->used+1) > 3*(shard->table->mask+1) && !url_InternGrow(d, shard))
+		goto end;
+
+	char *copy = url_InternCopy(shard, str, len);
+	if(copy==NULL)
+		goto end;
+
+	// An identifier lost because of an error leaves a hole : url_InternGet()
+	// returns NULL for it
+	uint64_t next = __atomic_fetch_add(&d->next_id, 1, __ATOMIC_RELAXED);
+	if(next >= URL_INTERN_NONE)
+		goto end;
+
+	int segment;
+	size_t offset;
+	url_intern_entry *entry = url_InternEntry(d, next, &segment, &offset);
+	if(entry==NULL) {
+		url_intern_entry *entries = calloc((size_t)URL_INTERN_SEGMENT << segment, sizeof(url_intern_entry));
+		if(entries==NULL)
+			goto end;
+		url_intern_entry *expected = NULL;
+		if(__atomic_compare_exchange_n(&d->segments[segment], &expected, entries, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			expected = entries;
+		else
+			free(entries);
+		entry = &expected[offset];
+	}
+	entry->len = len;
+	__atomic_store_n(&entry->str, copy, __ATOMIC_RELEASE);
+
+	url_InternPut(shard->table, hash, (hash >> 32) << 32 | (next+1));
+	id = (uint32_t)next;
+
+end:
+	pthread_mutex_unlock(&shard->lock);
+	return(id);
+}
+
+
+/**
+ * Return the identifier of the hostname of a canonicalized URL, as found by
+ * url_FindHostname(), adding it to the dictionary if needed.
+ * @param  d   Interning dictionary.
+ * @param  url Pointer to the canonicalized URL.
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     Identifier of the hostname, or URL_INTERN_NONE if error.
+ */
+extern uint32_t url_InternAddHost(url_intern *d, const char *url, size_t len)
+{
+	size_t host_len;
+	const char *host = url_FindHostname(url, len, &host_len);
+	if(host==NULL || host_len==0)
+		return(URL_INTERN_NONE);
+	return(url_InternAdd(d, host, host_len));
+}
+
+
+/**
+ * Return the identifier of a string already in the dictionary. Does not lock.
+ * @param  d   Interning dictionary.
+ * @param  str Pointer to the string.
+ * @param  len Length of the string. If 0, strlen() will be used.
+ * @return     Identifier of the string, or URL_INTERN_NONE if not found.
+ */
+extern uint32_t url_InternFind(const url_intern *d, const char *str, size_t len)
+{
+	if(d==NULL || str==NULL)
+		return(URL_INTERN_NONE);
+	if(len==0)
+		len = strlen(str);
+
+	uint64_t hash = url_Hash64(str, len, 0);
+	url_intern_shard *shard = url_InternShard(d, hash);
+	return(url_InternLookup(d, __atomic_load_n(&shard->table, __ATOMIC_ACQUIRE), str, len, hash));
+}
+
+
+/**
+ * Return the string having a given identifier. Does not lock.
+ * @param  d   Interning dictionary.
+ * @param  id  Identifier returned by url_InternAdd().
+ * @param  len If not NULL, will receive the length of the string.
+ * @return     Pointer to the NUL terminated string, owned by the dictionary,
+ *             or NULL if id is unknown.
+ */
+extern const char *url_InternGet(const url_intern *d, uint32_t id, size_t *len)
+{
+	if(d==NULL || id==URL_INTERN_NONE)
+		return(NULL);
+
+	int segment;
+	size_t offset;
+	url_intern_entry *entry = url_InternEntry(d, id, &segment, &offset);
+	if(entry==NULL)
+		return(NULL);
+	const char *str = __atomic_load_n(&entry->str, __ATOMIC_ACQUIRE);
+	if(str && len)
+		*len = entry->len;
+	return(str);
+}
+
+
+/**
+ * Return the number of identifiers given so far.
+ * @param  d Interning dictionary.
+ * @return   Number of strings in the dictionary.
+ */
+extern uint32_t url_InternCount(const url_intern *d)
+{
+	if(d==NULL)
+		return(0);
+	uint64_t count = __atomic_load_n(&d->next_id, __ATOMIC_RELAXED);
+	return(count < URL_INTERN_NONE ? (uint32_t)count : URL_INTERN_NONE);
+}
+
+
+/**
+ * Return the number of bytes used by an interning dictionary.
+ * @param  d Interning dictionary.
+ * @return   Memory footprint in bytes.
+ */
+extern size_t url_InternSize(const url_intern *d)
+{
+	if(d==NULL)
+		return(0);
+	size_t size = sizeof(url_intern) + d->shard_count * sizeof(url_intern_shard);
+	for(unsigned i=0; i<d->shard_count; i++)
+		size += __atomic_load_n(&d->shards[i].bytes, __ATOMIC_RELAXED) + sizeof(url_intern_table) + 256*sizeof(uint64_t);
+	for(int i=0; i<URL_INTERN_SEGMENTS; i++)
+		if(__atomic_load_n(&d->segments[i], __ATOMIC_RELAXED))
+			size += ((size_t)URL_INTERN_SEGMENT << i) * sizeof(url_intern_entry);
+	return(size);
+}
@@ -0,0 +1,98 @@
+#ifndef _URL_INTERN_H_
+#define _URL_INTERN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	Interning dictionary mapping canonicalized URLs or hostnames to dense
+	integer identifiers (0, 1, 2...), so that link graphs and crawl
+	frontiers can store and compare 32 bits integers instead of strings.
+
+	Each distinct string is stored once, in an append-only arena, and is
+	never moved : pointers returned by url_InternGet() stay valid until the
+	dictionary is freed. Lookups (url_InternFind(), url_InternGet()) take no
+	lock. Insertions lock one of several shards, chosen by the hash of the
+	string, so that threads inserting different strings rarely wait.
+*/
+
+// Returned instead of an identifier when a string is not found, or if error
+#define URL_INTERN_NONE UINT32_MAX
+
+// Default number of shards
+#define URL_INTERN_SHARDS 16
+
+typedef struct url_intern url_intern;
+
+
+/**
+ * Create a new interning dictionary.
+ * @param  shards Number of independently locked shards, rounded up to a
+ *                power of 2, or 0 for URL_INTERN_SHARDS.
+ * @return        Pointer to a new dictionary, to be freed with
+ *                url_InternFree(), or NULL if error.
+ */
+extern url_intern *url_InternNew(unsigned shards);
+
+/**
+ * Free an interning dictionary, and all the strings it holds.
+ * @param d Pointer returned by url_InternNew(), or NULL.
+ */
+extern void url_InternFree(url_intern *d);
+
+/**
+ * Return the identifier of a string, adding it to the dictionary if needed.
+ * Identifiers are given in insertion order, starting at 0. Can be called
+ * concurrently from several threads.
+ * @param  d   Interning dictionary.
+ * @param  str Pointer to the string, usually returned by url_Canonicalize()
+ *             or url_GetHostname().
+ * @param  len Length of the string. If 0, strlen() will be used.
+ * @return     Identifier of the string, or URL_INTERN_NONE if error.
+ */
+extern uint32_t url_InternAdd(url_intern *d, const char *str, size_t len);
+
+/**
+ * Return the identifier of the hostname of a canonicalized URL, as found by
+ * url_FindHostname(), adding it to the dictionary if needed.
+ * @param  d   Interning dictionary.
+ * @param  url Pointer to the canonicalized URL.
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     Identifier of the hostname, or URL_INTERN_NONE if error.
+ */
+extern uint32_t url_InternAddHost(url_intern *d, const char *url, size_t len);
+
+/**
+ * Return the identifier of a string already in the dictionary. Does not lock.
+ * @param  d   Interning dictionary.
+ * @param  str Pointer to the string.
+ * @param  len Length of the string. If 0, strlen() will be used.
+ * @return     Identifier of the string, or URL_INTERN_NONE if not found.
+ */
+extern uint32_t url_InternFind(const url_intern *d, const char *str, size_t len);
+
+/**
+ * Return the string having a given identifier. Does not lock.
+ * @param  d   Interning dictionary.
+ * @param  id  Identifier returned by url_InternAdd().
+ * @param  len If not NULL, will receive the length of the string.
+ * @return     Pointer to the NUL terminated string, owned by the dictionary,
+ *             or NULL if id is unknown.
+ */
+extern const char *url_InternGet(const url_intern *d, uint32_t id, size_t *len);
+
+/**
+ * Return the number of identifiers given so far.
+ * @param  d Interning dictionary.
+ * @return   Number of strings in the dictionary.
+ */
+extern uint32_t url_InternCount(const url_intern *d);
+
+/**
+ * Return the number of bytes used by an interning dictionary.
+ * @param  d Interning dictionary.
+ * @return   Memory footprint in bytes.
+ */
+extern size_t url_InternSize(const url_intern *d);
+
+#endif
@@ -0,0 +1,703 @@
+/*
+	Pipeline of stages linked by bounded lock-free rings.
+
+	A ring only holds pointers to batches. Multiple producers / multiple
+	consumers rings give each cell a sequence number telling whether it can
+	be written or read at a given position (D. Vyukov's bounded queue).
+	Single producer / single consumer rings only share a head and a tail,
+	each side caching the index of the other one.
+
+	Rings are never full of batches alone : the pipeline holds depth
+	batches per stage, plus depth, and the first stage input ring and the
+	free ring can hold all of them. End markers are pushed after the last
+	batch, one per thread of the next stage, by the last thread of a stage
+	to see its own.
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "url.h"
+#include "url_batch.h"
+#include "url_pipeline.h"
+
+
+
+// Size of the blocks of the arena of a batch
+#define URL_PIPELINE_BLOCK (64*1024)
+
+// Waits spinning, then yielding, before sleeping
+#define URL_PIPELINE_SPINS 64
+#define URL_PIPELINE_YIELDS 64
+#define URL_PIPELINE_SLEEP_NS 20000
+
+// Marker following the last batch
+static char url_PipelineEndMarker;
+#define URL_PIPELINE_END ((void *)&url_PipelineEndMarker)
+
+typedef struct {
+	size_t sequence;
+	void *item;
+} url_ring_cell;
+
+typedef struct {
+	url_ring_cell *cells;
+	size_t mask;
+	bool spsc;
+	char pad0[64];
+	size_t head;			// Next position written
+	size_t cached_tail;		// Producer copy of tail, single producer only
+	char pad1[64];
+	size_t tail;			// Next position read
+	size_t cached_head;		// Consumer copy of head, single consumer only
+	char pad2[64];
+	size_t max_depth;
+} url_ring;
+
+typedef struct url_pipeline_block {
+	struct url_pipeline_block *next;
+	size_t used, size;		// used is a multiple of 16
+} url_pipeline_block;
+
+// Offset of the data in a block, kept on 16 bytes
+#define URL_PIPELINE_BLOCK_DATA ((sizeof(url_pipeline_block) + 15) & ~(size_t)15)
+
+struct url_pipeline_batch {
+	uint64_t sequence;
+	char *lines;
+	size_t lines_len, lines_cap;
+	size_t *offsets, *lens;
+	const char **ptrs;
+	size_t count;
+	url_batch *urls;
+	url_pipeline_block *blocks, *block;
+	void *data;
+};
+
+typedef struct {
+	url_pipeline *p;
+	int index;
+	const char *name;
+	url_pipeline_function function;
+	void *ctx;
+	unsigned threads;
+	unsigned running;
+	url_pipeline_stats stats;
+} url_pipeline_stage;
+
+struct url_pipeline {
+	size_t batch_size, depth;
+	url_pipeline_stage stages[URL_PIPELINE_STAGES];
+	int stage_count;
+
+	// rings[i] feeds stage i, rings[stage_count] is the free ring
+	url_ring rings[URL_PIPELINE_STAGES+1];
+	url_pipeline_batch *batches;
+	size_t batch_count;
+	url_pipeline_batch *current;
+	uint64_t sequence;
+
+	pthread_t *threads;
+	unsigned thread_count;
+	url_pipeline_stats push_stats;
+	int failed;
+	bool started, finished;
+};
+
+
+
+static uint64_t url_PipelineNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec);
+}
+
+static void url_PipelineBackoff(unsigned *spins)
+{
+	if(*spins < URL_PIPELINE_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	} else if(*spins < URL_PIPELINE_SPINS + URL_PIPELINE_YIELDS)
+		sched_yield();
+	else {
+		struct timespec ts = { 0, URL_PIPELINE_SLEEP_NS };
+		nanosleep(&ts, NULL);
+		return;
+	}
+	(*spins)++;
+}
+
+static inline void url_PipelineAdd(uint64_t *counter, uint64_t n)
+{
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+
+static bool url_RingInit(url_ring *r, size_t capacity, bool spsc)
+{
+	// With a single cell, a full cell would look free to the next producer
+	size_t size = 2;
+	while(size < capacity)
+		size *= 2;
+	if((r->cells = calloc(size, sizeof(url_ring_cell)))==NULL)
+		return(false);
+	for(size_t i=0; i<size; i++)
+		r->cells[i].sequence = i;
+	r->mask = size-1;
+	r->spsc = spsc;
+	return(true);
+}
+
+static bool url_RingTryPush(url_ring *r, void *item)
+{
+	size_t pos;
+	if(r->spsc) {
+		pos = r->head;
+		if(pos - r->cached_tail > r->mask) {
+			r->cached_tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+			if(pos - r->cached_tail > r->mask)
+				return(false);
+		}
+		r->cells[pos & r->mask].item = item;
+		__atomic_store_n(&r->head, pos+1, __ATOMIC_RELEASE);
+	} else {
+		url_ring_cell *cell;
+		pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+		for(;;) {
+			cell = &r->cells[pos & r->mask];
+			intptr_t diff = (intptr_t)__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (intptr_t)pos;
+			if(diff==0) {
+				if(__atomic_compare_exchange_n(&r->head, &pos, pos+1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+					break;
+			} else if(diff<0)
+				return(false);
+			else
+				pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+		}
+		cell->item = item;
+		__atomic_store_n(&cell->sequence, pos+1, __ATOMIC_RELEASE);
+	}
+
+	// Approximate, only for the statistics
+	size_t depth = pos+1 - __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	if(depth > __atomic_load_n(&r->max_depth, __ATOMIC_RELAXED))
+		__atomic_store_n(&r->max_depth, depth, __ATOMIC_RELAXED);
+	return(true);
+}
+
+static bool url_RingTryPop(url_ring *r, void **item)
+{
+	size_t pos;
+	if(r->spsc) {
+		pos = r->tail;
+		if(pos==r->cached_head) {
+			r->cached_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+			if(pos==r->cached_head)
+				return(false);
+		}
+		*item = r->cells[pos & r->mask].item;
+		__atomic_store_n(&r->tail, pos+1, __ATOMIC_RELEASE);
+	} else {
+		url_ring_cell *cell;
+		pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+		for(;;) {
+			cell = &r->cells[pos & r->mask];
+			intptr_t diff = (intptr_t)__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (intptr_t)(pos+1);
+			if(diff==0) {
+				if(__atomic_compare_exchange_n(&r->tail, &pos, pos+1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+					break;
+			} else if(diff<0)
+				return(false);
+			else
+				pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+		}
+		*item = cell->item;
+		__atomic_store_n(&cell->sequence, pos + r->mask + 1, __ATOMIC_RELEASE);
+	}
+	return(true);
+}
+
+static size_t url_RingDepth(const url_ring *r)
+{
+	size_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+	size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	return(head > tail ? head - tail : 0);
+}
+
+// Push an item, waiting for room. Return the time waited, in ns.
+static uint64_t url_RingPush(url_ring *r, void *item)
+{
+	if(url_RingTryPush(r, item))
+		return(0);
+	uint64_t start = url_PipelineNow();
+	unsigned spins = 0;
+	while(!url_RingTryPush(r, item))
+		url_PipelineBackoff(&spins);
+	return(url_PipelineNow() - start);
+}
+
+// Pop an item, waiting for one. Return the time waited, in ns.
+static uint64_t url_RingPop(url_ring *r, void **item)
+{
+	if(url_RingTryPop(r, item))
+		return(0);
+	uint64_t start = url_PipelineNow();
+	unsigned spins = 0;
+	while(!url_RingTryPop(r, item))
+		url_PipelineBackoff(&spins);
+	return(url_PipelineNow() - start);
+}
+
+
+static void url_PipelineBatchReset(url_pipeline_batch *b)
+{
+	b->lines_len = 0;
+	b->count = 0;
+	b->data = NULL;
+	url_BatchReset(b->urls);
+	for(url_pipeline_block *block = b->blocks; block; block = block->next)
+		block->used = 0;
+	b->block = b->blocks;
+}
+
+
+static void *url_PipelineWorker(void *arg)
+{
+	url_pipeline_stage *stage = arg;
+	url_pipeline *p = stage->p;
+	url_ring *in = &p->rings[stage->index];
+	url_ring *out = &p->rings[stage->index+1];
+
+	for(;;) {
+		void *item;
+		url_PipelineAdd(&stage->stats.starved_ns, url_RingPop(in, &item));
+		if(item==URL_PIPELINE_END)
+			break;
+
+		url_pipeline_batch *b = item;
+		if(!__atomic_load_n(&p->failed, __ATOMIC_RELAXED)) {
+			uint64_t start = url_PipelineNow();
+			if(stage->function(stage->ctx, b))
+				__atomic_store_n(&p->failed, 1, __ATOMIC_RELAXED);
+			url_PipelineAdd(&stage->stats.busy_ns, url_PipelineNow() - start);
+		}
+		url_PipelineAdd(&stage->stats.batches, 1);
+		url_PipelineAdd(&stage->stats.lines, b->count);
+
+		if(stage->index == p->stage_count-1)
+			url_PipelineBatchReset(b);
+		url_PipelineAdd(&stage->stats.blocked_ns, url_RingPush(out, b));
+	}
+
+	// The last thread of the stage tells the next one
+	if(__atomic_sub_fetch(&stage->running, 1, __ATOMIC_ACQ_REL)==0 && stage->index < p->stage_count-1) {
+		for(unsigned i=0; i<p->stages[stage->index+1].threads; i++)
+			url_PipelineAdd(&stage->stats.blocked_ns, url_RingPush(out, URL_PIPELINE_END));
+	}
+	return(NULL);
+}
+
+
+/**
+ * Create a new pipeline, without any stage.
+ * @param  batch_size Number of lines of a batch, or 0 for URL_PIPELINE_BATCH.
+ * @param  depth      Capacity of the rings between stages, in batches, or 0
+ *                    for URL_PIPELINE_DEPTH. Rounded up to a power of 2. The
+ *                    pipeline holds depth batches per stage, plus depth.
+ * @return            Pointer to a new pipeline, to be freed with
+ *                    url_PipelineFree(), or NULL if error.
+ */
+extern url_pipeline *url_PipelineNew(size_t batch_size, size_t depth)
+{
+	url_pipeline *p = calloc(1, sizeof(url_pipeline));
+	if(p==NULL)
+		return(NULL);
+	p->batch_size = batch_size ? batch_size : URL_PIPELINE_BATCH;
+	p->depth = 1;
+	while(p->depth < (depth ? depth : URL_PIPELINE_DEPTH))
+		p->depth *= 2;
+	p->push_stats.name = "push";
+	p->push_stats.threads = 1;
+	return(p);
+}
+
+
+/**
+ * Add a stage after the ones already added. Must be called before
+ * url_PipelineStart().
+ * @param  p        Pipeline.
+ * @param  name     Name of the stage, for the statistics. Not copied.
+ * @param  function Function of the stage.
+ * @param  ctx      Pointer given to the function.
+ * @param  threads  Number of threads running the stage, at least 1. With
+ *                  more than one, batches may leave the stage out of order.
+ * @return          0, or -1 if error.
+ */
+extern int url_PipelineAddStage(url_pipeline *p, const char *name, url_pipeline_function function, void *ctx, unsigned threads)
+{
+	if(p==NULL || function==NULL || threads==0 || p->started || p->stage_count==URL_PIPELINE_STAGES)
+		return(-1);
+	url_pipeline_stage *stage = &p->stages[p->stage_count];
+	stage->p = p;
+	stage->index = p->stage_count++;
+	stage->name = name ? name : "";
+	stage->function = function;
+	stage->ctx = ctx;
+	stage->threads = threads;
+	stage->stats.name = stage->name;
+	stage->stats.threads = threads;
+	return(0);
+}
+
+
+/**
+ * Start the threads of the stages.
+ * @param  p Pipeline with at least one stage.
+ * @return   0, or -1 if error.
+ */
+extern int url_PipelineStart(url_pipeline *p)
+{
+	if(p==NULL || p->stage_count==0 || p->started)
+		return(-1);
+
+	// Rings : the producer of ring i is stage i-1 (or url_PipelinePush()),
+	// the free ring is consumed by url_PipelinePush()
+	p->batch_count = p->depth * (p->stage_count + 1);
+	for(int i=0; i<=p->stage_count; i++) {
+		unsigned producers = i ? p->stages[i-1].threads : 1;
+		unsigned consumers = i<p->stage_count ? p->stages[i].threads : 1;
+		size_t capacity = i==0 || i==p->stage_count ? p->batch_count : p->depth;
+		if(!url_RingInit(&p->rings[i], capacity, producers==1 && consumers==1))
+			return(-1);
+	}
+
+	if((p->batches = calloc(p->batch_count, sizeof(url_pipeline_batch)))==NULL)
+		return(-1);
+	for(size_t i=0; i<p->batch_count; i++) {
+		url_pipeline_batch *b = &p->batches[i];
+		b->offsets = malloc(p->batch_size * sizeof(size_t));
+		b->lens = malloc(p->batch_size * sizeof(size_t));
+		b->ptrs = malloc(p->batch_size * sizeof(char *));
+		b->urls = url_BatchNew();
+		if(b->offsets==NULL || b->lens==NULL || b->ptrs==NULL || b->urls==NULL)
+			return(-1);
+		url_RingTryPush(&p->rings[p->stage_count], b);
+	}
+	p->rings[p->stage_count].max_depth = 0;
+
+	unsigned threads = 0;
+	for(int i=0; i<p->stage_count; i++)
+		threads += p->stages[i].threads;
+	if((p->threads = calloc(threads, sizeof(pthread_t)))==NULL)
+		return(-1);
+	p->started = true;
+	for(int i=0; i<p->stage_count; i++) {
+		url_pipeline_stage *stage = &p->stages[i];
+		for(unsigned t=0; t<stage->threads; t++) {
+			__atomic_add_fetch(&stage->running, 1, __ATOMIC_RELAXED);
+			if(pthread_create(&p->threads[p->thread_count], NULL, url_PipelineWorker, stage)) {
+				// Only the threads created will get end markers
+				__atomic_sub_fetch(&stage->running, 1, __ATOMIC_RELAXED);
+				stage->threads = stage->stats.threads = t;
+				for(int j=i+1; j<p->stage_count; j++)
+					p->stages[j].threads = p->stages[j].stats.threads = 0;
+				p->failed = 1;
+				return(-1);
+			}
+			p->thread_count++;
+		}
+	}
+	return(0);
+}
+
+
+// Send the current batch to the first stage
+static void url_PipelineSend(url_pipeline *p)
+{
+	url_pipeline_batch *b = p->current;
+	for(size_t i=0; i<b->count; i++)
+		b->ptrs[i] = b->lines + b->offsets[i];
+	b->sequence = p->sequence++;
+	url_PipelineAdd(&p->push_stats.batches, 1);
+	url_PipelineAdd(&p->push_stats.lines, b->count);
+	url_PipelineAdd(&p->push_stats.blocked_ns, url_RingPush(&p->rings[0], b));
+	p->current = NULL;
+}
+
+
+/**
+ * Add a line to the batch being filled, and send the batch to the first
+ * stage when full. Waits for a free batch if all are in the stages. Must
+ * always be called from the same thread.
+ * @param  p    Started pipeline.
+ * @param  line Pointer to the line, usually an URL.
+ * @param  len  Length of the line. If 0, strlen() will be used.
+ * @return      0, or -1 if error (including an error of a stage).
+ */
+extern int url_PipelinePush(url_pipeline *p, const char *line, size_t len)
+{
+	if(p==NULL || line==NULL || !p->started || p->finished || __atomic_load_n(&p->failed, __ATOMIC_RELAXED))
+		return(-1);
+	if(len==0)
+		len = strlen(line);
+
+	if(p->current==NULL) {
+		void *item;
+		url_PipelineAdd(&p->push_stats.starved_ns, url_RingPop(&p->rings[p->stage_count], &item));
+		p->current = item;
+	}
+
+	url_pipeline_batch *b = p->current;
+	if(b->lines_len + len + 1 > b->lines_cap) {
+		size_t cap = b->lines_cap ? b->lines_cap : 64*1024;
+		while(cap < b->lines_len + len + 1)
+			cap *= 2;
+		char *lines = realloc(b->lines, cap);
+		if(lines==NULL)
+			return(-1);
+		b->lines = lines;
+		b->lines_cap = cap;
+	}
+	memcpy(b->lines + b->lines_len, line, len);
+	b->lines[b->lines_len + len] = '\0';
+	b->offsets[b->count] = b->lines_len;
+	b->lens[b->count++] = len;
+	b->lines_len += len + 1;
+
+	if(b->count == p->batch_size)
+		url_PipelineSend(p);
+	return(0);
+}
+
+
+/**
+ * Send the last batch, wait until all the batches went through all the
+ * stages and stop the threads. Must be called from the thread calling
+ * url_PipelinePush().
+ * @param  p Started pipeline.
+ * @return   0, or -1 if error (including an error of a stage).
+ */
+extern int url_PipelineFinish(url_pipeline *p)
+{
+	if(p==NULL || !p->started || p->finished)
+		return(-1);
+	p->finished = true;
+
+	if(p->current && p->current->count)
+		url_PipelineSend(p);
+	for(unsigned i=0; i<p->stages[0].threads; i++)
+		url_RingPush(&p->rings[0], URL_PIPELINE_END);
+	for(unsigned i=0; i<p->thread_count; i++)
+		pthread_join(p->threads[i], NULL);
+	p->thread_count = 0;
+	return(p->failed ? -1 : 0);
+}
+
+
+/**
+ * Free a pipeline, after url_PipelineFinish() if it was started.
+ * @param p Pointer returned by url_PipelineNew(), or NULL.
+ */
+extern void url_PipelineFree(url_pipeline *p)
+{
+	if(p==NULL)
+		return;
+
+	// Threads left by a failed url_PipelineStart()
+	if(p->thread_count) {
+		for(unsigned i=0; i<p->stages[0].threads; i++)
+			url_RingPush(&p->rings[0], URL_PIPELINE_END);
+		for(unsigned i=0; i<p->thread_count; i++)
+			pthread_join(p->threads[i], NULL);
+	}
+
+	for(size_t i=0; p->batches && i<p->batch_count; i++) {
+		url_pipeline_batch *b = &p->batches[i];
+		free(b->lines);
+		free(b->offsets);
+		free(b->lens);
+		free(b->ptrs);
+		url_BatchFree(b->urls);
+		while(b->blocks) {
+			url_pipeline_block *next = b->blocks->next;
+			free(b->blocks);
+			b->blocks = next;
+		}
+	}
+	for(int i=0; i<=p->stage_count; i++)
+		free(p->rings[i].cells);
+	free(p->batches);
+	free(p->threads);
+	free(p);
+}
+
+
+/**
+ * Read the statistics of a pipeline, while it runs or after.
+ * @param  p     Pipeline.
+ * @param  stats Array receiving the statistics of url_PipelinePush(), as
+ *               stats[0], then of each stage. Depths of stats[0] are the
+ *               free batches.
+ * @param  max   Size of the array.
+ * @return       Number of statistics available, that is the number of
+ *               stages + 1, even if larger than max.
+ */
+extern int url_PipelineGetStats(const url_pipeline *p, url_pipeline_stats *stats, int max)
+{
+	if(p==NULL)
+		return(0);
+
+	for(int i=0; i<=p->stage_count && i<max; i++) {
+		const url_pipeline_stats *from = i ? &p->stages[i-1].stats : &p->push_stats;
+		const url_ring *ring = &p->rings[i ? i-1 : p->stage_count];
+		stats[i].name = from->name;
+		stats[i].threads = from->threads;
+		stats[i].batches = __atomic_load_n(&from->batches, __ATOMIC_RELAXED);
+		stats[i].lines = __atomic_load_n(&from->lines, __ATOMIC_RELAXED);
+		stats[i].busy_ns = __atomic_load_n(&from->busy_ns, __ATOMIC_RELAXED);
+		stats[i].starved_ns = __atomic_load_n(&from->starved_ns, __ATOMIC_RELAXED);
+		stats[i].blocked_ns = __atomic_load_n(&from->blocked_ns, __ATOMIC_RELAXED);
+		stats[i].depth = p->started ? url_RingDepth(ring) : 0;
+		stats[i].max_depth = __atomic_load_n(&ring->max_depth, __ATOMIC_RELAXED);
+	}
+	return(p->stage_count + 1);
+}
+
+
+/**
+ * Stage function canonicalizing the lines of a batch into its url_batch,
+ * with url_CanonicalizeBatch().
+ * @param  ctx   Unused.
+ * @param  batch Batch.
+ * @return       0.
+ */
+extern int url_PipelineCanonicalize(void *ctx, url_pipeline_batch *batch)
+{
+	(void)ctx;
+	url_CanonicalizeBatch(batch->urls, batch->ptrs, batch->lens, batch->count);
+	return(0);
+}
+
+
+/**
+ * Return the number of lines of a batch.
+ * @param  batch Batch.
+ * @return       Number of lines.
+ */
+extern size_t url_PipelineBatchCount(const url_pipeline_batch *batch)
+{
+	return(batch ? batch->count : 0);
+}
+
+
+/**
+ * Return a line of a batch.
+ * @param  batch Batch.
+ * @param  index Index of the line in the batch.
+ * @param  len   If not NULL, will receive the length of the line.
+ * @return       Pointer to the NUL terminated line, owned by the batch, or
+ *               NULL if index is out of range.
+ */
+extern const char *url_PipelineBatchLine(const url_pipeline_batch *batch, size_t index, size_t *len)
+{
+	if(batch==NULL || index>=batch->count)
+		return(NULL);
+	if(len)
+		*len = batch->lens[index];
+	return(batch->ptrs[index]);
+}
+
+
+/**
+ * Return the canonicalized URLs of a batch, filled by
+ * url_PipelineCanonicalize(). Indexes follow the lines.
+ * @param  batch Batch.
+ * @return       Pointer to the url_batch, owned by the batch.
+ */
+extern url_batch *url_PipelineBatchURLs(url_pipeline_batch *batch)
+{
+	return(batch ? batch->urls : NULL);
+}
+
+
+/**
+ * Return the index of a batch in the input : 0 for the first lines given
+ * to url_PipelinePush(), then 1, etc.
+ * @param  batch Batch.
+ * @return       Sequence number of the batch.
+ */
+extern uint64_t url_PipelineBatchSequence(const url_pipeline_batch *batch)
+{
+	return(batch ? batch->sequence : 0);
+}
+
+
+/**
+ * Allocate memory in the arena of a batch, for data handed from one stage
+ * to the next ones. It is freed once the batch went through the last stage.
+ * @param  batch Batch.
+ * @param  size  Number of bytes.
+ * @return       Pointer to memory aligned on 16 bytes, or NULL if error.
+ */
+extern void *url_PipelineBatchAlloc(url_pipeline_batch *batch, size_t size)
+{
+	if(batch==NULL)
+		return(NULL);
+	size = (size + 15) & ~(size_t)15;
+
+	// Blocks are kept when the batch is recycled : look for one with room
+	url_pipeline_block *block = batch->block;
+	while(block && block->size - block->used < size)
+		block = block->next;
+	if(block==NULL) {
+		size_t block_size = size > URL_PIPELINE_BLOCK ? size : URL_PIPELINE_BLOCK;
+		void *memory;
+		if(posix_memalign(&memory, 16, URL_PIPELINE_BLOCK_DATA + block_size))
+			return(NULL);
+		block = memory;
+		block->used = 0;
+		block->size = block_size;
+		block->next = batch->blocks;
+		batch->blocks = block;
+	}
+	batch->block = block;
+	void *ptr = (char *)block + URL_PIPELINE_BLOCK_DATA + block->used;
+	block->used += size;
+	return(ptr);
+}
+
+
+/**
+ * Set the data of a batch, usually allocated with url_PipelineBatchAlloc(),
+ * for the next stages. It is reset to NULL once the batch went through the
+ * last stage.
+ * @param batch Batch.
+ * @param data  Pointer returned by url_PipelineBatchData() in next stages.
+ */
+extern void url_PipelineBatchSetData(url_pipeline_batch *batch, void *data)
+{
+	if(batch)
+		batch->data = data;
+}
+
+
+/**
+ * Return the data set by a previous stage with url_PipelineBatchSetData().
+ * @param  batch Batch.
+ * @return       Pointer given to url_PipelineBatchSetData(), or NULL.
+ */
+extern void *url_PipelineBatchData(const url_pipeline_batch *batch)
+{
+	return(batch ? batch->data : NULL);
+}
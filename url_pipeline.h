@@ -0,0 +1,198 @@
+#ifndef _URL_PIPELINE_H_
+#define _URL_PIPELINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "url_batch.h"
+
+/*
+	Pipeline of stages processing batches of URLs, each stage in its own
+	threads, for example canonicalize, hash, match and write.
+
+	Lines given to url_PipelinePush() are copied into the arena of a batch.
+	Full batches then go from one stage to the next through bounded lock-free
+	rings : single producer / single consumer rings between stages running
+	in one thread, multiple producers / multiple consumers rings otherwise.
+	Only handles to the batches move between stages, never the URLs. Each
+	batch also holds a url_batch, filled by url_PipelineCanonicalize(), and
+	an arena where stages can allocate what they hand to the next ones.
+
+	The number of batches is fixed : once the last stage is done with a
+	batch, it goes back to url_PipelinePush(), which waits for one when all
+	are in use. A stalled stage thus stops the input instead of growing
+	queues. The time each stage waits for its input or for room in its
+	output ring is counted, so that depth and threads can be tuned.
+*/
+
+// Default number of lines of a batch
+#define URL_PIPELINE_BATCH 1024
+
+// Default capacity of the rings between stages, in batches
+#define URL_PIPELINE_DEPTH 4
+
+// Maximum number of stages
+#define URL_PIPELINE_STAGES 16
+
+typedef struct url_pipeline url_pipeline;
+typedef struct url_pipeline_batch url_pipeline_batch;
+
+/**
+ * Function of a stage, called for each batch by the threads of the stage.
+ * @param  ctx   Pointer given to url_PipelineAddStage().
+ * @param  batch Batch to be processed.
+ * @return       0, or -1 if error. After an error, batches still go through
+ *               the stages but no function is called anymore.
+ */
+typedef int (*url_pipeline_function)(void *ctx, url_pipeline_batch *batch);
+
+typedef struct {
+	const char *name;		// Name given to url_PipelineAddStage(), or "push"
+	unsigned threads;
+	uint64_t batches;		// Batches processed
+	uint64_t lines;			// Lines of these batches
+	uint64_t busy_ns;		// Time spent in the function of the stage
+	uint64_t starved_ns;	// Time spent waiting for a batch
+	uint64_t blocked_ns;	// Time spent waiting for room in the next ring
+	size_t depth;			// Batches waiting for the stage now
+	size_t max_depth;		// Highest number of batches waiting for the stage
+} url_pipeline_stats;
+
+
+/**
+ * Create a new pipeline, without any stage.
+ * @param  batch_size Number of lines of a batch, or 0 for URL_PIPELINE_BATCH.
+ * @param  depth      Capacity of the rings between stages, in batches, or 0
+ *                    for URL_PIPELINE_DEPTH. Rounded up to a power of 2. The
+ *                    pipeline holds depth batches per stage, plus depth.
+ * @return            Pointer to a new pipeline, to be freed with
+ *                    url_PipelineFree(), or NULL if error.
+ */
+extern url_pipeline *url_PipelineNew(size_t batch_size, size_t depth);
+
+/**
+ * Add a stage after the ones already added. Must be called before
+ * url_PipelineStart().
+ * @param  p        Pipeline.
+ * @param  name     Name of the stage, for the statistics. Not copied.
+ * @param  function Function of the stage.
+ * @param  ctx      Pointer given to the function.
+ * @param  threads  Number of threads running the stage, at least 1. With
+ *                  more than one, batches may leave the stage out of order.
+ * @return          0, or -1 if error.
+ */
+extern int url_PipelineAddStage(url_pipeline *p, const char *name, url_pipeline_function function, void *ctx, unsigned threads);
+
+/**
+ * Start the threads of the stages.
+ * @param  p Pipeline with at least one stage.
+ * @return   0, or -1 if error.
+ */
+extern int url_PipelineStart(url_pipeline *p);
+
+/**
+ * Add a line to the batch being filled, and send the batch to the first
+ * stage when full. Waits for a free batch if all are in the stages. Must
+ * always be called from the same thread.
+ * @param  p    Started pipeline.
+ * @param  line Pointer to the line, usually an URL.
+ * @param  len  Length of the line. If 0, strlen() will be used.
+ * @return      0, or -1 if error (including an error of a stage).
+ */
+extern int url_PipelinePush(url_pipeline *p, const char *line, size_t len);
+
+/**
+ * Send the last batch, wait until all the batches went through all the
+ * stages and stop the threads. Must be called from the thread calling
+ * url_PipelinePush().
+ * @param  p Started pipeline.
+ * @return   0, or -1 if error (including an error of a stage).
+ */
+extern int url_PipelineFinish(url_pipeline *p);
+
+/**
+ * Free a pipeline, after url_PipelineFinish() if it was started.
+ * @param p Pointer returned by url_PipelineNew(), or NULL.
+ */
+extern void url_PipelineFree(url_pipeline *p);
+
+/**
+ * Read the statistics of a pipeline, while it runs or after.
+ * @param  p     Pipeline.
+ * @param  stats Array receiving the statistics of url_PipelinePush(), as
+ *               stats[0], then of each stage. Depths of stats[0] are the
+ *               free batches.
+ * @param  max   Size of the array.
+ * @return       Number of statistics available, that is the number of
+ *               stages + 1, even if larger than max.
+ */
+extern int url_PipelineGetStats(const url_pipeline *p, url_pipeline_stats *stats, int max);
+
+/**
+ * Stage function canonicalizing the lines of a batch into its url_batch,
+ * with url_CanonicalizeBatch().
+ * @param  ctx   Unused.
+ * @param  batch Batch.
+ * @return       0.
+ */
+extern int url_PipelineCanonicalize(void *ctx, url_pipeline_batch *batch);
+
+/**
+ * Return the number of lines of a batch.
+ * @param  batch Batch.
+ * @return       Number of lines.
+ */
+extern size_t url_PipelineBatchCount(const url_pipeline_batch *batch);
+
+/**
+ * Return a line of a batch.
+ * @param  batch Batch.
+ * @param  index Index of the line in the batch.
+ * @param  len   If not NULL, will receive the length of the line.
+ * @return       Pointer to the NUL terminated line, owned by the batch, or
+ *               NULL if index is out of range.
+ */
+extern const char *url_PipelineBatchLine(const url_pipeline_batch *batch, size_t index, size_t *len);
+
+/**
+ * Return the canonicalized URLs of a batch, filled by
+ * url_PipelineCanonicalize(). Indexes follow the lines.
+ * @param  batch Batch.
+ * @return       Pointer to the url_batch, owned by the batch.
+ */
+extern url_batch *url_PipelineBatchURLs(url_pipeline_batch *batch);
+
+/**
+ * Return the index of a batch in the input : 0 for the first lines given
+ * to url_PipelinePush(), then 1, etc.
+ * @param  batch Batch.
+ * @return       Sequence number of the batch.
+ */
+extern uint64_t url_PipelineBatchSequence(const url_pipeline_batch *batch);
+
+/**
+ * Allocate memory in the arena of a batch, for data handed from one stage
+ * to the next ones. It is freed once the batch went through the last stage.
+ * @param  batch Batch.
+ * @param  size  Number of bytes.
+ * @return       Pointer to memory aligned on 16 bytes, or NULL if error.
+ */
+extern void *url_PipelineBatchAlloc(url_pipeline_batch *batch, size_t size);
+
+/**
+ * Set the data of a batch, usually allocated with url_PipelineBatchAlloc(),
+ * for the next stages. It is reset to NULL once the batch went through the
+ * last stage.
+ * @param batch Batch.
+ * @param data  Pointer returned by url_PipelineBatchData() in next stages.
+ */
+extern void url_PipelineBatchSetData(url_pipeline_batch *batch, void *data);
+
+/**
+ * Return the data set by a previous stage with url_PipelineBatchSetData().
+ * @param  batch Batch.
+ * @return       Pointer given to url_PipelineBatchSetData(), or NULL.
+ */
+extern void *url_PipelineBatchData(const url_pipeline_batch *batch);
+
+#endif
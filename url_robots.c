@@ -0,0 +1,709 @@
+/*
+	Compiled robots.txt rules and their per-host cache.
+
+	Compiling parses the file line by line, keeps the rules of the groups
+	of the user agent (or of the "*" groups), and brings each path to the
+	form of url_Canonicalize() : every part between '*' wildcards is
+	percent-decoded then escaped as url_Escape() does.
+
+	Rules without wildcard are sorted and deduplicated (Allow winning), and
+	each one gets the index of the longest other rule that is a prefix of
+	it. Every rule between a prefix P of a path and the path itself in the
+	sorted table starts with P, so the longest rule that is a prefix of a
+	path is found walking these links from the last rule not greater than
+	the path. Rules with wildcards are sorted by decreasing length and
+	matched as globs, greedily.
+
+	The cache is a chained hash table of hosts, plus a list from the most
+	to the least recently used one, under a single lock.
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "url.h"
+#include "url_robots.h"
+
+
+
+typedef struct {
+	uint32_t offset;
+	uint32_t len;
+	int32_t parent;				// Longest shorter rule that is a prefix, or -1
+	bool allow;
+} url_robots_prefix;
+
+typedef struct {
+	uint32_t offset;
+	uint32_t len;				// Length of the pattern, wildcards included
+	uint32_t literal;			// Length before the first '*', checked first
+	bool allow;
+} url_robots_wildcard;
+
+struct url_robots_rules {
+	char *patterns;
+	url_robots_prefix *prefixes;
+	size_t prefix_count;
+	url_robots_wildcard *wildcards;
+	size_t wildcard_count;
+};
+
+// Rule being compiled
+typedef struct {
+	char *pattern;
+	size_t len;
+	bool allow;
+} url_robots_rule;
+
+typedef struct {
+	url_robots_rule *rules;
+	size_t count, cap;
+} url_robots_list;
+
+typedef struct url_robots_host {
+	struct url_robots_host *next;			// In its bucket
+	struct url_robots_host *newer, *older;
+	url_robots_rules *rules;
+	uint64_t hash;
+	size_t len;
+	char hostname[];
+} url_robots_host;
+
+struct url_robots {
+	pthread_mutex_t lock;
+	char *agent;
+	size_t max_hosts, count, mask;
+	url_robots_host **buckets;
+	url_robots_host *newest, *oldest;
+};
+
+
+
+// Path of a rule, in the form of url_Canonicalize(), or NULL if error
+static char *url_RobotsPattern(const char *value, size_t len, size_t *new_len)
+{
+	bool anchored = len && value[len-1]=='$';
+	if(anchored)
+		len--;
+
+	// Worst case : every byte escaped, plus a leading '/' and the '$'
+	char *pattern = malloc(3*len + 3);
+	if(pattern==NULL)
+		return(NULL);
+	size_t out = 0;
+	if(len==0 || (value[0]!='/' && value[0]!='*'))
+		pattern[out++] = '/';
+
+	const char *end = value + len;
+	for(const char *part=value; ; ) {
+		const char *star = memchr(part, '*', end-part);
+		const char *part_end = star ? star : end;
+		if(part_end > part) {
+			// url_Unescape() reads up to the NUL
+			char *copy = malloc(part_end-part + 1);
+			char *unescaped = NULL, *escaped = NULL;
+			if(copy) {
+				memcpy(copy, part, part_end-part);
+				copy[part_end-part] = '\0';
+				unescaped = url_Unescape(copy, part_end-part, NULL);
+			}
+			if(unescaped)
+				escaped = url_Escape(unescaped, 0, NULL);
+			free(copy);
+			free(unescaped);
+			if(escaped==NULL) {
+				free(pattern);
+				return(NULL);
+			}
+			// At most 3 bytes per byte of the part once escaped
+			size_t escaped_len = strlen(escaped);
+			memcpy(pattern + out, escaped, escaped_len);
+			out += escaped_len;
+			free(escaped);
+		}
+		if(star==NULL)
+			break;
+		pattern[out++] = '*';
+		part = star+1;
+	}
+	if(anchored)
+		pattern[out++] = '$';
+	pattern[out] = '\0';
+	*new_len = out;
+	return(pattern);
+}
+
+
+static bool url_RobotsListAdd(url_robots_list *list, const char *value, size_t len, bool allow)
+{
+	if(list->count == list->cap) {
+		size_t cap = list->cap ? list->cap*2 : 16;
+		url_robots_rule *rules = realloc(list->rules, cap * sizeof(url_robots_rule));
+		if(rules==NULL)
+			return(false);
+		list->rules = rules;
+		list->cap = cap;
+	}
+	url_robots_rule *rule = &list->rules[list->count];
+	if((rule->pattern = url_RobotsPattern(value, len, &rule->len))==NULL)
+		return(false);
+	rule->allow = allow;
+	list->count++;
+	return(true);
+}
+
+
+static void url_RobotsListFree(url_robots_list *list)
+{
+	for(size_t i=0; i<list->count; i++)
+		free(list->rules[i].pattern);
+	free(list->rules);
+}
+
+
+static int url_RobotsCompare(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+	if(cmp)
+		return(cmp);
+	return(a_len < b_len ? -1 : a_len > b_len);
+}
+
+static int url_RobotsComparePrefix(const void *a, const void *b)
+{
+	const url_robots_rule *ra = a, *rb = b;
+	return(url_RobotsCompare(ra->pattern, ra->len, rb->pattern, rb->len));
+}
+
+static int url_RobotsCompareWildcard(const void *a, const void *b)
+{
+	const url_robots_rule *ra = a, *rb = b;
+	return(ra->len < rb->len ? 1 : ra->len > rb->len ? -1 : 0);
+}
+
+
+// First occurrence of needle in [p, p+len), or NULL
+static const char *url_RobotsFind(const char *p, size_t len, const char *needle, size_t needle_len)
+{
+	if(needle_len==0)
+		return(p);
+	const char *end = p + len;
+	while((size_t)(end-p) >= needle_len) {
+		const char *c = memchr(p, needle[0], end-p - needle_len + 1);
+		if(c==NULL)
+			return(NULL);
+		if(memcmp(c, needle, needle_len)==0)
+			return(c);
+		p = c+1;
+	}
+	return(NULL);
+}
+
+
+// Match a pattern with '*' and an optional final '$'
+static bool url_RobotsGlob(const char *pattern, size_t pattern_len, const char *path, size_t len)
+{
+	bool anchored = pattern_len && pattern[pattern_len-1]=='$';
+	if(anchored)
+		pattern_len--;
+	const char *pattern_end = pattern + pattern_len, *end = path + len;
+
+	// The first part is a prefix
+	const char *star = memchr(pattern, '*', pattern_len);
+	size_t part = (star ? star : pattern_end) - pattern;
+	if(part > len || memcmp(pattern, path, part))
+		return(false);
+	if(star==NULL)
+		return(!anchored || part==len);
+
+	// Then each part as soon as possible, the last one at the end if anchored
+	const char *p = path + part;
+	for(pattern = star+1; ; pattern = star+1) {
+		star = memchr(pattern, '*', pattern_end-pattern);
+		part = (star ? star : pattern_end) - pattern;
+		if(star==NULL && anchored)
+			return(part <= (size_t)(end-p) && memcmp(end-part, pattern, part)==0);
+		const char *found = url_RobotsFind(p, end-p, pattern, part);
+		if(found==NULL)
+			return(false);
+		if(star==NULL)
+			return(true);
+		p = found + part;
+	}
+}
+
+
+// Whether the product token of a User-agent line names the agent
+static bool url_RobotsAgent(const char *value, size_t len, const char *agent, size_t agent_len)
+{
+	size_t token = 0;
+	while(token<len && value[token]!='/' && value[token]!=' ' && value[token]!='\t')
+		token++;
+	return(token==agent_len && strncasecmp(value, agent, token)==0);
+}
+
+
+static url_robots_rules *url_RobotsBuild(url_robots_list *list)
+{
+	url_robots_rules *rules = calloc(1, sizeof(url_robots_rules));
+	if(rules==NULL)
+		return(NULL);
+
+	// Prefix rules first, then rules with wildcards
+	size_t prefix_count = 0, size = 0;
+	for(size_t i=0; i<list->count; i++) {
+		url_robots_rule rule = list->rules[i];
+		size += rule.len;
+		if(memchr(rule.pattern, '*', rule.len)==NULL && rule.pattern[rule.len-1]!='$') {
+			list->rules[i] = list->rules[prefix_count];
+			list->rules[prefix_count++] = rule;
+		}
+	}
+	if(list->count) {
+		qsort(list->rules, prefix_count, sizeof(url_robots_rule), url_RobotsComparePrefix);
+		qsort(list->rules + prefix_count, list->count - prefix_count, sizeof(url_robots_rule), url_RobotsCompareWildcard);
+	}
+
+	if(size >= UINT32_MAX)
+		goto bad;
+	rules->patterns = malloc(size + 1);
+	rules->prefixes = malloc((prefix_count + 1) * sizeof(url_robots_prefix));
+	rules->wildcards = malloc((list->count - prefix_count + 1) * sizeof(url_robots_wildcard));
+	int32_t *chain = malloc((prefix_count + 1) * sizeof(int32_t));
+	if(rules->patterns==NULL || rules->prefixes==NULL || rules->wildcards==NULL || chain==NULL) {
+		free(chain);
+		goto bad;
+	}
+
+	size_t offset = 0, depth = 0;
+	for(size_t i=0; i<prefix_count; i++) {
+		url_robots_rule *rule = &list->rules[i];
+		url_robots_prefix *last = rules->prefix_count ? &rules->prefixes[rules->prefix_count-1] : NULL;
+		if(last && last->len==rule->len && memcmp(rules->patterns + last->offset, rule->pattern, rule->len)==0) {
+			last->allow |= rule->allow;
+			continue;
+		}
+
+		// Chain of the rules that are prefixes of this one, longest last
+		while(depth) {
+			const url_robots_prefix *top = &rules->prefixes[chain[depth-1]];
+			if(top->len <= rule->len && memcmp(rules->patterns + top->offset, rule->pattern, top->len)==0)
+				break;
+			depth--;
+		}
+		url_robots_prefix *prefix = &rules->prefixes[rules->prefix_count];
+		prefix->offset = offset;
+		prefix->len = rule->len;
+		prefix->parent = depth ? chain[depth-1] : -1;
+		prefix->allow = rule->allow;
+		chain[depth++] = rules->prefix_count++;
+		memcpy(rules->patterns + offset, rule->pattern, rule->len);
+		offset += rule->len;
+	}
+	free(chain);
+
+	for(size_t i=prefix_count; i<list->count; i++) {
+		url_robots_rule *rule = &list->rules[i];
+		url_robots_wildcard *wildcard = &rules->wildcards[rules->wildcard_count++];
+		wildcard->offset = offset;
+		wildcard->len = rule->len;
+		wildcard->literal = strcspn(rule->pattern, "*$");
+		wildcard->allow = rule->allow;
+		memcpy(rules->patterns + offset, rule->pattern, rule->len);
+		offset += rule->len;
+	}
+	rules->patterns[offset] = '\0';
+	return(rules);
+
+bad:
+	url_RobotsRulesFree(rules);
+	return(NULL);
+}
+
+
+/**
+ * Compile the rules of a robots.txt file for a user agent.
+ * @param  robots_txt Pointer to the content of the robots.txt file.
+ * @param  len        Length of the content. If 0, strlen() will be used.
+ * @param  agent      User agent, as "MyBot" or "MyBot/1.0". Its product
+ *                    token is compared to User-agent lines, ignoring case.
+ * @return            Pointer to the compiled rules, to be freed with
+ *                    url_RobotsRulesFree(), or NULL if error.
+ */
+extern url_robots_rules *url_RobotsCompile(const char *robots_txt, size_t len, const char *agent)
+{
+	if(robots_txt==NULL || agent==NULL)
+		return(NULL);
+	if(len==0)
+		len = strlen(robots_txt);
+	size_t agent_len = 0;
+	while(agent[agent_len] && agent[agent_len]!='/' && agent[agent_len]!=' ')
+		agent_len++;
+
+	// Rules of the groups of the agent, and of the "*" groups
+	url_robots_list own = { NULL, 0, 0 }, any = { NULL, 0, 0 };
+	bool own_group = false, any_group = false, own_seen = false, in_rules = true;
+	url_robots_rules *rules = NULL;
+
+	const char *p = robots_txt, *end = robots_txt + len;
+	if(len>=3 && memcmp(p, "\xEF\xBB\xBF", 3)==0)
+		p +=3;
+	while(p < end) {
+		const char *line = p;
+		while(p<end && *p!='\n' && *p!='\r')
+			p++;
+		const char *line_end = p;
+		if(p<end)
+			p++;
+
+		const char *comment = memchr(line, '#', line_end-line);
+		if(comment)
+			line_end = comment;
+		const char *colon = memchr(line, ':', line_end-line);
+		if(colon==NULL)
+			continue;
+		const char *key = line, *key_end = colon, *value = colon+1, *value_end = line_end;
+		while(key<key_end && (*key==' ' || *key=='\t'))
+			key++;
+		while(key_end>key && (key_end[-1]==' ' || key_end[-1]=='\t'))
+			key_end--;
+		while(value<value_end && (*value==' ' || *value=='\t'))
+			value++;
+		while(value_end>value && (value_end[-1]==' ' || value_end[-1]=='\t'))
+			value_end--;
+		size_t key_len = key_end - key, value_len = value_end - value;
+
+		if(key_len==10 && strncasecmp(key, "user-agent", 10)==0) {
+			// A User-agent line after rules starts a new group
+			if(in_rules)
+				own_group = any_group = false;
+			in_rules = false;
+			if(value_len==1 && value[0]=='*')
+				any_group = true;
+			else if(url_RobotsAgent(value, value_len, agent, agent_len))
+				own_group = own_seen = true;
+		} else if((key_len==5 && strncasecmp(key, "allow", 5)==0) || (key_len==8 && strncasecmp(key, "disallow", 8)==0)) {
+			in_rules = true;
+			bool allow = key_len==5;
+			// An empty rule matches nothing
+			if(value_len==0)
+				continue;
+			if(own_group && !url_RobotsListAdd(&own, value, value_len, allow))
+				goto end;
+			if(any_group && !url_RobotsListAdd(&any, value, value_len, allow))
+				goto end;
+		}
+	}
+	rules = url_RobotsBuild(own_seen ? &own : &any);
+
+end:
+	url_RobotsListFree(&own);
+	url_RobotsListFree(&any);
+	return(rules);
+}
+
+
+/**
+ * Free compiled rules.
+ * @param rules Pointer returned by url_RobotsCompile(), or NULL.
+ */
+extern void url_RobotsRulesFree(url_robots_rules *rules)
+{
+	if(rules==NULL)
+		return;
+	free(rules->patterns);
+	free(rules->prefixes);
+	free(rules->wildcards);
+	free(rules);
+}
+
+
+/**
+ * Match a canonical URL against compiled rules.
+ * @param  rules Compiled rules.
+ * @param  url   URL, as returned by url_Canonicalize().
+ * @param  len   Length of the URL. If 0, strlen() will be used.
+ * @return       URL_ROBOTS_ALLOWED or URL_ROBOTS_DISALLOWED.
+ */
+extern int url_RobotsRulesMatch(const url_robots_rules *rules, const char *url, size_t len)
+{
+	if(rules==NULL || url==NULL)
+		return(URL_ROBOTS_ALLOWED);
+	if(len==0)
+		len = strlen(url);
+
+	// Path and query, after the scheme and the host
+	const char *end = url + len, *path = url;
+	for(const char *p=url; p<end && *p!='/'; p++)
+		if(*p==':') {
+			if(end-p>=3 && p[1]=='/' && p[2]=='/')
+				path = p+3;
+			break;
+		}
+	while(path<end && *path!='/')
+		path++;
+	if(path==end)
+		path = "/", end = path+1;
+	size_t path_len = end - path;
+	if(path_len==11 && memcmp(path, "/robots.txt", 11)==0)
+		return(URL_ROBOTS_ALLOWED);
+
+	// Last prefix rule not greater than the path, then the rules it extends
+	const url_robots_prefix *prefixes = rules->prefixes;
+	bool found = false, allow = true;
+	size_t best = 0, low = 0, high = rules->prefix_count;
+	while(low < high) {
+		size_t middle = low + (high-low)/2;
+		if(url_RobotsCompare(rules->patterns + prefixes[middle].offset, prefixes[middle].len, path, path_len) <= 0)
+			low = middle+1;
+		else
+			high = middle;
+	}
+	for(int32_t i = (int32_t)low-1; i>=0; i = prefixes[i].parent)
+		if(prefixes[i].len <= path_len && memcmp(rules->patterns + prefixes[i].offset, path, prefixes[i].len)==0) {
+			found = true;
+			best = prefixes[i].len;
+			allow = prefixes[i].allow;
+			break;
+		}
+
+	// Rules with wildcards, as long as they can beat the best match
+	for(size_t i=0; i<rules->wildcard_count; i++) {
+		const url_robots_wildcard *w = &rules->wildcards[i];
+		if(found && w->len < best)
+			break;
+		const char *pattern = rules->patterns + w->offset;
+		if(w->literal > path_len || memcmp(pattern, path, w->literal) || !url_RobotsGlob(pattern, w->len, path, path_len))
+			continue;
+		if(!found || w->len > best) {
+			found = true;
+			best = w->len;
+			allow = w->allow;
+		} else
+			allow |= w->allow;
+	}
+	return(allow ? URL_ROBOTS_ALLOWED : URL_ROBOTS_DISALLOWED);
+}
+
+
+/**
+ * Return the number of rules compiled.
+ * @param  rules Compiled rules.
+ * @return       Number of distinct rules.
+ */
+extern size_t url_RobotsRulesCount(const url_robots_rules *rules)
+{
+	return(rules ? rules->prefix_count + rules->wildcard_count : 0);
+}
+
+
+/**
+ * Create a cache of compiled robots.txt rules.
+ * @param  agent User agent given to url_RobotsCompile().
+ * @param  hosts Maximum number of hosts kept, or 0 for URL_ROBOTS_HOSTS.
+ * @return       Pointer to a new cache, to be freed with url_RobotsFree(), or
+ *               NULL if error.
+ */
+extern url_robots *url_RobotsNew(const char *agent, size_t hosts)
+{
+	if(agent==NULL)
+		return(NULL);
+	if(hosts==0)
+		hosts = URL_ROBOTS_HOSTS;
+	size_t buckets = 16;
+	while(buckets < hosts)
+		buckets *= 2;
+
+	url_robots *r = calloc(1, sizeof(url_robots));
+	if(r==NULL)
+		return(NULL);
+	r->agent = strdup(agent);
+	r->buckets = calloc(buckets, sizeof(url_robots_host *));
+	if(r->agent==NULL || r->buckets==NULL) {
+		free(r->agent);
+		free(r->buckets);
+		free(r);
+		return(NULL);
+	}
+	r->max_hosts = hosts;
+	r->mask = buckets-1;
+	pthread_mutex_init(&r->lock, NULL);
+	return(r);
+}
+
+
+/**
+ * Free a cache and the rules it holds.
+ * @param r Pointer returned by url_RobotsNew(), or NULL.
+ */
+extern void url_RobotsFree(url_robots *r)
+{
+	if(r==NULL)
+		return;
+	for(url_robots_host *host=r->newest, *older; host; host=older) {
+		older = host->older;
+		url_RobotsRulesFree(host->rules);
+		free(host);
+	}
+	pthread_mutex_destroy(&r->lock);
+	free(r->buckets);
+	free(r->agent);
+	free(r);
+}
+
+
+static url_robots_host *url_RobotsLookup(url_robots *r, const char *hostname, size_t len, uint64_t hash)
+{
+	for(url_robots_host *host=r->buckets[hash & r->mask]; host; host=host->next)
+		if(host->hash==hash && host->len==len && memcmp(host->hostname, hostname, len)==0)
+			return(host);
+	return(NULL);
+}
+
+
+static void url_RobotsUnlink(url_robots *r, url_robots_host *host)
+{
+	if(host->newer)
+		host->newer->older = host->older;
+	else
+		r->newest = host->older;
+	if(host->older)
+		host->older->newer = host->newer;
+	else
+		r->oldest = host->newer;
+}
+
+
+static void url_RobotsPushNewest(url_robots *r, url_robots_host *host)
+{
+	host->newer = NULL;
+	host->older = r->newest;
+	if(r->newest)
+		r->newest->newer = host;
+	else
+		r->oldest = host;
+	r->newest = host;
+}
+
+
+/**
+ * Compile the robots.txt file of a host and keep its rules, replacing the
+ * previous ones of the host and dropping the least recently used host when
+ * the cache is full.
+ * @param  r          Cache.
+ * @param  hostname   Hostname, as returned by url_GetHostname().
+ * @param  robots_txt Pointer to the content of the robots.txt file. An
+ *                    empty file allows everything.
+ * @param  len        Length of the content. If 0, strlen() will be used.
+ * @return            0, or -1 if error.
+ */
+extern int url_RobotsAdd(url_robots *r, const char *hostname, const char *robots_txt, size_t len)
+{
+	if(r==NULL || hostname==NULL || robots_txt==NULL)
+		return(-1);
+
+	// Compiled out of the lock
+	url_robots_rules *rules = url_RobotsCompile(robots_txt, len, r->agent);
+	size_t host_len = strlen(hostname);
+	url_robots_host *host = malloc(sizeof(url_robots_host) + host_len + 1);
+	if(rules==NULL || host==NULL) {
+		url_RobotsRulesFree(rules);
+		free(host);
+		return(-1);
+	}
+	for(size_t i=0; i<host_len; i++)
+		host->hostname[i] = hostname[i]>='A' && hostname[i]<='Z' ? hostname[i]+32 : hostname[i];
+	host->hostname[host_len] = '\0';
+	host->len = host_len;
+	host->hash = url_Hash64(host->hostname, host_len, 0);
+	host->rules = rules;
+
+	url_robots_host *dropped = NULL;
+	pthread_mutex_lock(&r->lock);
+	url_robots_host *previous = url_RobotsLookup(r, host->hostname, host_len, host->hash);
+	if(previous) {
+		// Keep the entry, its previous rules go with the new one
+		host->rules = previous->rules;
+		previous->rules = rules;
+		url_RobotsUnlink(r, previous);
+		url_RobotsPushNewest(r, previous);
+		dropped = host;
+	} else {
+		if(r->count == r->max_hosts) {
+			dropped = r->oldest;
+			url_RobotsUnlink(r, dropped);
+			url_robots_host **link = &r->buckets[dropped->hash & r->mask];
+			while(*link != dropped)
+				link = &(*link)->next;
+			*link = dropped->next;
+			r->count--;
+		}
+		host->next = r->buckets[host->hash & r->mask];
+		r->buckets[host->hash & r->mask] = host;
+		url_RobotsPushNewest(r, host);
+		r->count++;
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	if(dropped) {
+		url_RobotsRulesFree(dropped->rules);
+		free(dropped);
+	}
+	return(0);
+}
+
+
+/**
+ * Match a canonical URL against the rules of its host, found with
+ * url_GetHostname().
+ * @param  r   Cache.
+ * @param  url URL, as returned by url_Canonicalize().
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     URL_ROBOTS_ALLOWED, URL_ROBOTS_DISALLOWED, or
+ *             URL_ROBOTS_UNKNOWN if the rules of the host are not in the
+ *             cache (its robots.txt is to be fetched and given to
+ *             url_RobotsAdd()), or -1 if error : r or url is NULL, or the
+ *             URL has no hostname.
+ */
+extern int url_RobotsCheck(url_robots *r, const char *url, size_t len)
+{
+	if(r==NULL || url==NULL)
+		return(-1);
+	if(len==0)
+		len = strlen(url);
+
+	// Same key as the hostname given to url_RobotsAdd(), which may be
+	// escaped ("user%40host" for an URL with userinfo)
+	char *copy = strndup(url, len);
+	char *hostname = copy ? url_GetHostname(copy) : NULL;
+	free(copy);
+	if(hostname==NULL)
+		return(-1);
+	size_t host_len = strlen(hostname);
+	for(size_t i=0; i<host_len; i++)
+		if(hostname[i]>='A' && hostname[i]<='Z')
+			hostname[i] += 32;
+	uint64_t hash = url_Hash64(hostname, host_len, 0);
+
+	int result = URL_ROBOTS_UNKNOWN;
+	pthread_mutex_lock(&r->lock);
+	url_robots_host *host = url_RobotsLookup(r, hostname, host_len, hash);
+	if(host) {
+		if(host!=r->newest) {
+			url_RobotsUnlink(r, host);
+			url_RobotsPushNewest(r, host);
+		}
+		result = url_RobotsRulesMatch(host->rules, url, len);
+	}
+	pthread_mutex_unlock(&r->lock);
+	free(hostname);
+	return(result);
+}
@@ -0,0 +1,116 @@
+#ifndef _URL_ROBOTS_H_
+#define _URL_ROBOTS_H_
+
+#include <stddef.h>
+
+/*
+	Compiled robots.txt rules, matched against the output of
+	url_Canonicalize().
+
+	The Allow and Disallow rules of the group of a user agent (or of the
+	"*" group when no group names it) are compiled once. Their paths are
+	brought to the form url_Canonicalize() gives, so that they can be
+	compared byte for byte with the path and query of canonical URLs. Rules
+	without wildcard go into a table sorted by path, where each rule links
+	to the longest other rule that is a prefix of it : the longest prefix
+	of a path is found by one binary search then a few links. Rules with
+	'*' or a final '$' are matched afterwards, longest first, only while
+	they are longer than the best match so far.
+
+	As RFC 9309 says, the longest matching rule wins, Allow winning when an
+	Allow and a Disallow rule have the same length. A path no rule matches,
+	and /robots.txt itself, are allowed.
+
+	A url_robots holds the compiled rules of a bounded number of hosts,
+	dropping the least recently used ones, keyed by hostname as
+	url_GetHostname() returns it.
+*/
+
+#define URL_ROBOTS_DISALLOWED 0
+#define URL_ROBOTS_ALLOWED 1
+#define URL_ROBOTS_UNKNOWN 2		// No rules known for the host
+
+// Default number of hosts kept
+#define URL_ROBOTS_HOSTS 1024
+
+typedef struct url_robots_rules url_robots_rules;
+typedef struct url_robots url_robots;
+
+
+/**
+ * Compile the rules of a robots.txt file for a user agent.
+ * @param  robots_txt Pointer to the content of the robots.txt file.
+ * @param  len        Length of the content. If 0, strlen() will be used.
+ * @param  agent      User agent, as "MyBot" or "MyBot/1.0". Its product
+ *                    token is compared to User-agent lines, ignoring case.
+ * @return            Pointer to the compiled rules, to be freed with
+ *                    url_RobotsRulesFree(), or NULL if error.
+ */
+extern url_robots_rules *url_RobotsCompile(const char *robots_txt, size_t len, const char *agent);
+
+/**
+ * Free compiled rules.
+ * @param rules Pointer returned by url_RobotsCompile(), or NULL.
+ */
+extern void url_RobotsRulesFree(url_robots_rules *rules);
+
+/**
+ * Match a canonical URL against compiled rules.
+ * @param  rules Compiled rules.
+ * @param  url   URL, as returned by url_Canonicalize().
+ * @param  len   Length of the URL. If 0, strlen() will be used.
+ * @return       URL_ROBOTS_ALLOWED or URL_ROBOTS_DISALLOWED.
+ */
+extern int url_RobotsRulesMatch(const url_robots_rules *rules, const char *url, size_t len);
+
+/**
+ * Return the number of rules compiled.
+ * @param  rules Compiled rules.
+ * @return       Number of distinct rules.
+ */
+extern size_t url_RobotsRulesCount(const url_robots_rules *rules);
+
+
+/**
+ * Create a cache of compiled robots.txt rules.
+ * @param  agent User agent given to url_RobotsCompile().
+ * @param  hosts Maximum number of hosts kept, or 0 for URL_ROBOTS_HOSTS.
+ * @return       Pointer to a new cache, to be freed with url_RobotsFree(), or
+ *               NULL if error.
+ */
+extern url_robots *url_RobotsNew(const char *agent, size_t hosts);
+
+/**
+ * Free a cache and the rules it holds.
+ * @param r Pointer returned by url_RobotsNew(), or NULL.
+ */
+extern void url_RobotsFree(url_robots *r);
+
+/**
+ * Compile the robots.txt file of a host and keep its rules, replacing the
+ * previous ones of the host and dropping the least recently used host when
+ * the cache is full.
+ * @param  r          Cache.
+ * @param  hostname   Hostname, as returned by url_GetHostname().
+ * @param  robots_txt Pointer to the content of the robots.txt file. An
+ *                    empty file allows everything.
+ * @param  len        Length of the content. If 0, strlen() will be used.
+ * @return            0, or -1 if error.
+ */
+extern int url_RobotsAdd(url_robots *r, const char *hostname, const char *robots_txt, size_t len);
+
+/**
+ * Match a canonical URL against the rules of its host, found with
+ * url_GetHostname().
+ * @param  r   Cache.
+ * @param  url URL, as returned by url_Canonicalize().
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     URL_ROBOTS_ALLOWED, URL_ROBOTS_DISALLOWED, or
+ *             URL_ROBOTS_UNKNOWN if the rules of the host are not in the
+ *             cache (its robots.txt is to be fetched and given to
+ *             url_RobotsAdd()), or -1 if error : r or url is NULL, or the
+ *             URL has no hostname.
+ */
+extern int url_RobotsCheck(url_robots *r, const char *url, size_t len);
+
+#endif
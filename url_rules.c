@@ -0,0 +1,600 @@
+/*
+	Compiled host suffix / path prefix rule matcher.
+
+	Every rule is turned into a key made of its reversed host followed by
+	its path ("example.com/ads" gives "moc.elpmaxe/ads"). Keys are sorted
+	and a radix trie is built from them in a single recursive pass. The trie
+	is stored in flat arrays : nodes, edges (sorted by their first byte for
+	each node) and a pool holding the edge labels.
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "url_rules.h"
+
+
+
+#define LOWERCASE(x) ((x)>='A' && (x)<='Z' ? (x)-'A'+'a' : (x))
+
+#define URL_RULES_NONE UINT32_MAX
+
+
+typedef struct {
+	uint32_t first_edge;
+	uint32_t edge_count;
+	uint32_t rule;
+} url_rules_node;
+
+struct url_rules {
+	url_rules_node *nodes;
+	uint32_t node_count, node_cap;
+
+	// Edges, stored as separate arrays so that looking up the first
+	// bytes of the edges of a node only touches edge_first
+	unsigned char *edge_first;
+	uint32_t *edge_label;
+	uint32_t *edge_length;
+	uint32_t *edge_child;
+	uint32_t edge_count, edge_cap;
+
+	char *labels;
+	size_t labels_len, labels_cap;
+};
+
+struct url_ruleset {
+	url_rules *current;
+	unsigned epoch;
+	unsigned long readers[2];
+	pthread_mutex_t lock;
+};
+
+typedef struct {
+	char *key;
+	size_t len;
+	uint32_t id;
+} url_rules_key;
+
+// Position in the trie : on a node if edge is URL_RULES_NONE, else
+// after the first offset bytes of an edge label.
+typedef struct {
+	uint32_t node;
+	uint32_t edge;
+	uint32_t offset;
+} url_rules_cursor;
+
+
+
+/**
+ * Build the key of a rule : reversed lowercase host followed by the path.
+ * @param  rule Rule to be converted.
+ * @param  key  Pointer to a url_rules_key to be filled.
+ * @return      1 if a key was built, 0 if the rule was ignored, -1 if error.
+ */
+static int url_RulesMakeKey(const char *rule, url_rules_key *key)
+{
+	// Skip the scheme part if any
+	const char *scheme_end = strstr(rule, "://");
+	if(scheme_end && strcspn(rule, "/") > (size_t)(scheme_end - rule))
+		rule = scheme_end + 3;
+
+	// Skip leading dots
+	while(*rule=='.')
+		rule++;
+
+	// Find the end of the host, ignoring trailing dots and port
+	size_t host_len = strcspn(rule, "/:?");
+	const char *path = rule + host_len;
+	while(host_len>0 && rule[host_len-1]=='.')
+		host_len--;
+	if(host_len==0)
+		return(0);
+	if(*path==':')
+		path += strcspn(path, "/?");
+
+	size_t path_len = strlen(path);
+	bool add_slash = (*path!='/');
+
+	key->len = host_len + path_len + (add_slash ? 1 : 0);
+	key->key = malloc(key->len);
+	if(key->key==NULL)
+		return(-1);
+
+	char *dest = key->key;
+	for(size_t i=host_len; i>0; i--)
+		*(dest++) = LOWERCASE(rule[i-1]);
+	if(add_slash)
+		*(dest++) = '/';
+	memcpy(dest, path, path_len);
+
+	return(1);
+}
+
+
+static int url_RulesCompareKeys(const void *a, const void *b)
+{
+	const url_rules_key *ka = a, *kb = b;
+	size_t len = ka->len < kb->len ? ka->len : kb->len;
+	int cmp = memcmp(ka->key, kb->key, len);
+	if(cmp)
+		return(cmp);
+	if(ka->len != kb->len)
+		return(ka->len < kb->len ? -1 : 1);
+	return(ka->id < kb->id ? -1 : (ka->id > kb->id ? 1 : 0));
+}
+
+
+static bool url_RulesGrow(void **array, uint32_t *cap, uint32_t needed, size_t item_size)
+{
+	if(needed <= *cap)
+		return(true);
+	size_t new_cap = *cap ? *cap : 64;
+	while(new_cap < needed)
+		new_cap *= 2;
+	if(new_cap > UINT32_MAX)
+		return(false);
+	void *p = realloc(*array, new_cap * item_size);
+	if(p==NULL)
+		return(false);
+	*array = p;
+	*cap = (uint32_t)new_cap;
+	return(true);
+}
+
+
+static bool url_RulesReserveEdges(url_rules *r, uint32_t count)
+{
+	if((uint64_t)r->edge_count + count > UINT32_MAX)
+		return(false);
+	uint32_t needed = r->edge_count + count;
+	if(needed <= r->edge_cap)
+		return(true);
+
+	// All edge arrays share the same capacity
+	uint32_t cap = r->edge_cap;
+	if(!url_RulesGrow((void **)&r->edge_label, &cap, needed, sizeof(uint32_t)))
+		return(false);
+	cap = r->edge_cap;
+	if(!url_RulesGrow((void **)&r->edge_length, &cap, needed, sizeof(uint32_t)))
+		return(false);
+	cap = r->edge_cap;
+	if(!url_RulesGrow((void **)&r->edge_child, &cap, needed, sizeof(uint32_t)))
+		return(false);
+	cap = r->edge_cap;
+	if(!url_RulesGrow((void **)&r->edge_first, &cap, needed, sizeof(unsigned char)))
+		return(false);
+	r->edge_cap = cap;
+	return(true);
+}
+
+
+/**
+ * Build the trie node for keys[lo..hi), all sharing their first depth bytes.
+ * @return Index of the new node, or URL_RULES_NONE if error.
+ */
+static uint32_t url_RulesBuild(url_rules *r, const url_rules_key *keys, size_t lo, size_t hi, size_t depth)
+{
+	if(!url_RulesGrow((void **)&r->nodes, &r->node_cap, r->node_count+1, sizeof(url_rules_node)))
+		return(URL_RULES_NONE);
+	uint32_t node = r->node_count++;
+	r->nodes[node].rule = URL_RULES_NONE;
+	r->nodes[node].first_edge = 0;
+	r->nodes[node].edge_count = 0;
+
+	// Keys ending here are sorted first, lowest identifier first
+	if(keys[lo].len == depth) {
+		r->nodes[node].rule = keys[lo].id;
+		while(lo<hi && keys[lo].len==depth)
+			lo++;
+	}
+
+	// Count children, so that edges of this node are contiguous
+	uint32_t children = 0;
+	for(size_t i=lo; i<hi; children++) {
+		unsigned char c = keys[i].key[depth];
+		while(i<hi && (unsigned char)keys[i].key[depth]==c)
+			i++;
+	}
+	if(!url_RulesReserveEdges(r, children))
+		return(URL_RULES_NONE);
+	uint32_t edge = r->edge_count;
+	r->nodes[node].first_edge = edge;
+	r->nodes[node].edge_count = children;
+	r->edge_count += children;
+
+	for(size_t i=lo; i<hi; edge++) {
+		unsigned char c = keys[i].key[depth];
+		size_t j = i;
+		while(j<hi && (unsigned char)keys[j].key[depth]==c)
+			j++;
+
+		// Keys are sorted, so the common prefix of the group is the
+		// common prefix of its first and last keys
+		const url_rules_key *first = &keys[i], *last = &keys[j-1];
+		size_t end = depth;
+		size_t max = first->len < last->len ? first->len : last->len;
+		while(end<max && first->key[end]==last->key[end])
+			end++;
+
+		size_t label_len = end - depth;
+		if(r->labels_len + label_len > UINT32_MAX)
+			return(URL_RULES_NONE);
+		if(r->labels_len + label_len > r->labels_cap) {
+			size_t cap = r->labels_cap ? r->labels_cap : 4096;
+			while(cap < r->labels_len + label_len)
+				cap *= 2;
+			char *p = realloc(r->labels, cap);
+			if(p==NULL)
+				return(URL_RULES_NONE);
+			r->labels = p;
+			r->labels_cap = cap;
+		}
+		memcpy(r->labels + r->labels_len, first->key + depth, label_len);
+
+		r->edge_first[edge] = c;
+		r->edge_label[edge] = (uint32_t)r->labels_len;
+		r->edge_length[edge] = (uint32_t)label_len;
+		r->labels_len += label_len;
+
+		uint32_t child = url_RulesBuild(r, keys, i, j, end);
+		if(child==URL_RULES_NONE)
+			return(URL_RULES_NONE);
+		r->edge_child[edge] = child;
+
+		i = j;
+	}
+
+	return(node);
+}
+
+
+/**
+ * Compile a list of rules. Rule i gets the identifier i, which is what
+ * url_RulesMatch() returns. Rules with an empty host are ignored. When the
+ * same rule is given several times, the lowest identifier is kept.
+ * This function only reads its arguments, so it can safely be called from
+ * a background thread while another compiled rule list is in use.
+ * @param  rules Array of NUL terminated rules.
+ * @param  count Number of rules in the array.
+ * @return       Pointer to the compiled rules, to be freed with
+ *               url_RulesFree(), or NULL if error.
+ */
+extern url_rules *url_RulesCompile(const char * const *rules, size_t count)
+{
+	if(rules==NULL && count>0)
+		return(NULL);
+	if(count >= URL_RULES_NONE)
+		return(NULL);
+
+	url_rules *r = calloc(1, sizeof(url_rules));
+	if(r==NULL)
+		return(NULL);
+
+	url_rules_key *keys = malloc((count ? count : 1) * sizeof(url_rules_key));
+	if(keys==NULL) {
+		free(r);
+		return(NULL);
+	}
+
+	size_t key_count = 0;
+	for(size_t i=0; i<count; i++) {
+		if(rules[i]==NULL)
+			continue;
+		keys[key_count].id = (uint32_t)i;
+		int ret = url_RulesMakeKey(rules[i], &keys[key_count]);
+		if(ret<0)
+			goto bad;
+		key_count += ret;
+	}
+
+	qsort(keys, key_count, sizeof(url_rules_key), url_RulesCompareKeys);
+
+	if(key_count>0) {
+		if(url_RulesBuild(r, keys, 0, key_count, 0)==URL_RULES_NONE)
+			goto bad;
+	} else {
+		// Empty trie : a single node without edges
+		if(!url_RulesGrow((void **)&r->nodes, &r->node_cap, 1, sizeof(url_rules_node)))
+			goto bad;
+		r->nodes[0].first_edge = 0;
+		r->nodes[0].edge_count = 0;
+		r->nodes[0].rule = URL_RULES_NONE;
+		r->node_count = 1;
+	}
+
+	for(size_t i=0; i<key_count; i++)
+		free(keys[i].key);
+	free(keys);
+	return(r);
+
+bad:
+	for(size_t i=0; i<key_count; i++)
+		free(keys[i].key);
+	free(keys);
+	url_RulesFree(r);
+	return(NULL);
+}
+
+
+/**
+ * Free compiled rules.
+ * @param rules Pointer returned by url_RulesCompile(), or NULL.
+ */
+extern void url_RulesFree(url_rules *rules)
+{
+	if(rules==NULL)
+		return;
+	free(rules->nodes);
+	free(rules->edge_first);
+	free(rules->edge_label);
+	free(rules->edge_length);
+	free(rules->edge_child);
+	free(rules->labels);
+	free(rules);
+}
+
+
+/**
+ * Return the number of bytes used by compiled rules.
+ * @param  rules Compiled rules.
+ * @return       Memory footprint in bytes.
+ */
+extern size_t url_RulesSize(const url_rules *rules)
+{
+	if(rules==NULL)
+		return(0);
+	return(	  sizeof(url_rules)
+			+ (size_t)rules->node_cap * sizeof(url_rules_node)
+			+ (size_t)rules->edge_cap * (sizeof(unsigned char) + 3*sizeof(uint32_t))
+			+ rules->labels_cap);
+}
+
+
+// Advance a cursor by one byte. Return false if the trie has no such path.
+static inline bool url_RulesStep(const url_rules *r, url_rules_cursor *cur, unsigned char c)
+{
+	if(cur->edge==URL_RULES_NONE) {
+		// On a node : binary search the edge starting with c
+		const url_rules_node *node = &r->nodes[cur->node];
+		uint32_t lo = node->first_edge, hi = node->first_edge + node->edge_count;
+		while(lo<hi) {
+			uint32_t mid = lo + (hi-lo)/2;
+			if(r->edge_first[mid] < c)
+				lo = mid+1;
+			else
+				hi = mid;
+		}
+		if(lo==node->first_edge+node->edge_count || r->edge_first[lo]!=c)
+			return(false);
+		cur->edge = lo;
+		cur->offset = 1;
+	} else {
+		if((unsigned char)r->labels[r->edge_label[cur->edge] + cur->offset] != c)
+			return(false);
+		cur->offset++;
+	}
+
+	if(cur->offset == r->edge_length[cur->edge]) {
+		cur->node = r->edge_child[cur->edge];
+		cur->edge = URL_RULES_NONE;
+		cur->offset = 0;
+	}
+	return(true);
+}
+
+
+static inline uint32_t url_RulesTerminal(const url_rules *r, const url_rules_cursor *cur)
+{
+	return(cur->edge==URL_RULES_NONE ? r->nodes[cur->node].rule : URL_RULES_NONE);
+}
+
+
+// Match the path part of an URL from a cursor positionned after a reversed host
+static uint32_t url_RulesMatchPath(const url_rules *r, url_rules_cursor cur, const char *path, const char *end)
+{
+	uint32_t found = URL_RULES_NONE;
+
+	// Rule paths always start with '/'
+	if(!url_RulesStep(r, &cur, '/'))
+		return(URL_RULES_NONE);
+	if(path<end && *path=='/')
+		path++;
+
+	for(;;) {
+		uint32_t rule = url_RulesTerminal(r, &cur);
+		if(rule!=URL_RULES_NONE)
+			found = rule;
+		if(path==end || !url_RulesStep(r, &cur, (unsigned char)*path))
+			break;
+		path++;
+	}
+	return(found);
+}
+
+
+/**
+ * Match a canonical URL against compiled rules. When several rules match,
+ * the one with the longest host is chosen, then the one with the longest
+ * path.
+ * @param  rules Compiled rules.
+ * @param  url   URL, as returned by url_Canonicalize().
+ * @param  len   Length of the URL. If 0, strlen() will be used.
+ * @return       Identifier of the matching rule, or URL_RULES_NO_MATCH.
+ */
+extern long url_RulesMatch(const url_rules *rules, const char *url, size_t len)
+{
+	if(rules==NULL || url==NULL)
+		return(URL_RULES_NO_MATCH);
+
+	if(len==0)
+		len = strlen(url);
+	const char *end = url + len;
+
+	// Skip the scheme part
+	const char *host = url;
+	for(const char *p=url; p<end && *p!='/'; p++)
+		if(*p==':') {
+			if(end-p>=3 && p[1]=='/' && p[2]=='/')
+				host = p+3;
+			break;
+		}
+
+	// Find the end of the host, then the path after the port if any
+	const char *host_end = host;
+	while(host_end<end && *host_end!='/' && *host_end!=':' && *host_end!='?')
+		host_end++;
+	const char *path = host_end;
+	while(path<end && *path!='/' && *path!='?')
+		path++;
+
+	// Walk the host backwards, trying the path rules at each label boundary
+	uint32_t found = URL_RULES_NONE;
+	url_rules_cursor cur = { 0, URL_RULES_NONE, 0 };
+	for(const char *p=host_end; p>host; ) {
+		p--;
+		if(!url_RulesStep(rules, &cur, (unsigned char)LOWERCASE(*p)))
+			break;
+		if(p==host || *(p-1)=='.') {
+			uint32_t rule = url_RulesMatchPath(rules, cur, path, end);
+			if(rule!=URL_RULES_NONE)
+				found = rule;
+		}
+	}
+
+	return(found==URL_RULES_NONE ? URL_RULES_NO_MATCH : (long)found);
+}
+
+
+
+/**
+ * Create a holder for compiled rules, allowing the rules to be replaced
+ * while other threads are matching URLs against them.
+ * @param  rules Initial compiled rules, owned by the ruleset from now on.
+ *               Can be NULL.
+ * @return       Pointer to a new ruleset, to be freed with url_RulesetFree(),
+ *               or NULL if error.
+ */
+extern url_ruleset *url_RulesetNew(url_rules *rules)
+{
+	url_ruleset *set = calloc(1, sizeof(url_ruleset));
+	if(set==NULL)
+		return(NULL);
+	if(pthread_mutex_init(&set->lock, NULL)) {
+		free(set);
+		return(NULL);
+	}
+	set->current = rules;
+	return(set);
+}
+
+
+/**
+ * Free a ruleset and the compiled rules it holds. No other thread may use
+ * the ruleset anymore.
+ * @param set Pointer returned by url_RulesetNew(), or NULL.
+ */
+extern void url_RulesetFree(url_ruleset *set)
+{
+	if(set==NULL)
+		return;
+	url_RulesFree(set->current);
+	pthread_mutex_destroy(&set->lock);
+	free(set);
+}
+
+
+// Wait for the readers counted in the slot of the current epoch, then
+// move to the next epoch.
+static void url_RulesetFlip(url_ruleset *set)
+{
+	unsigned epoch = __atomic_fetch_add(&set->epoch, 1, __ATOMIC_SEQ_CST);
+	while(__atomic_load_n(&set->readers[epoch & 1], __ATOMIC_SEQ_CST) != 0)
+		sched_yield();
+}
+
+
+/**
+ * Atomically replace the compiled rules held by a ruleset. Readers that
+ * started before the swap keep using the previous rules, which are freed
+ * once the last of them has called url_RulesetRelease().
+ * @param set   Ruleset.
+ * @param rules New compiled rules, owned by the ruleset from now on.
+ */
+extern void url_RulesetSwap(url_ruleset *set, url_rules *rules)
+{
+	if(set==NULL)
+		return;
+
+	pthread_mutex_lock(&set->lock);
+	url_rules *old = __atomic_exchange_n(&set->current, rules, __ATOMIC_SEQ_CST);
+
+	// A reader holding the old rules registered itself in either slot
+	// before the exchange. Readers arriving late in a slot we are waiting
+	// for only read an epoch that was current before the flip, so both
+	// waits terminate even under a constant flow of new readers.
+	url_RulesetFlip(set);
+	url_RulesetFlip(set);
+	pthread_mutex_unlock(&set->lock);
+
+	url_RulesFree(old);
+}
+
+
+/**
+ * Get the current compiled rules of a ruleset. The rules stay valid until
+ * url_RulesetRelease() is called with the same token. Never blocks.
+ * @param  set   Ruleset.
+ * @param  token Pointer to an unsigned int to be given back to
+ *               url_RulesetRelease().
+ * @return       Current compiled rules, possibly NULL.
+ */
+extern const url_rules *url_RulesetAcquire(url_ruleset *set, unsigned *token)
+{
+	if(set==NULL || token==NULL)
+		return(NULL);
+	*token = __atomic_load_n(&set->epoch, __ATOMIC_SEQ_CST) & 1;
+	__atomic_add_fetch(&set->readers[*token], 1, __ATOMIC_SEQ_CST);
+	return(__atomic_load_n(&set->current, __ATOMIC_SEQ_CST));
+}
+
+
+/**
+ * Release compiled rules obtained with url_RulesetAcquire().
+ * @param set   Ruleset.
+ * @param token Token set by url_RulesetAcquire().
+ */
+extern void url_RulesetRelease(url_ruleset *set, unsigned token)
+{
+	if(set==NULL)
+		return;
+	__atomic_sub_fetch(&set->readers[token & 1], 1, __ATOMIC_SEQ_CST);
+}
+
+
+/**
+ * Match a canonical URL against the current rules of a ruleset.
+ * Same as url_RulesMatch() between url_RulesetAcquire() and
+ * url_RulesetRelease().
+ * @param  set Ruleset.
+ * @param  url URL, as returned by url_Canonicalize().
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     Identifier of the matching rule, or URL_RULES_NO_MATCH.
+ */
+extern long url_RulesetMatch(url_ruleset *set, const char *url, size_t len)
+{
+	unsigned token;
+	const url_rules *rules = url_RulesetAcquire(set, &token);
+	if(set==NULL)
+		return(URL_RULES_NO_MATCH);
+	long found = url_RulesMatch(rules, url, len);
+	url_RulesetRelease(set, token);
+	return(found);
+}
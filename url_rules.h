@@ -0,0 +1,122 @@
+#ifndef _URL_RULES_H_
+#define _URL_RULES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	Compiled matcher for "host suffix + optional path prefix" rules, to be
+	used against the output of url_Canonicalize().
+
+	A rule is written "example.com" or "example.com/some/path". An optional
+	"scheme://" part is ignored, the host part is lowercased and a leading
+	'.' is ignored. A rule host matches the URL host itself and any of its
+	subdomains ("example.com" matches "a.example.com" but not
+	"badexample.com"). The path part, if any, is matched as a prefix of
+	everything following the host (and port) in the canonical URL, query
+	included.
+
+	Rules are compiled into a radix trie over the reversed host followed by
+	the path, stored in flat arrays. Matching walks the URL host backwards
+	once, and walks the path once for each host suffix having rules.
+*/
+
+#define URL_RULES_NO_MATCH (-1L)
+
+typedef struct url_rules url_rules;
+typedef struct url_ruleset url_ruleset;
+
+
+/**
+ * Compile a list of rules. Rule i gets the identifier i, which is what
+ * url_RulesMatch() returns. Rules with an empty host are ignored. When the
+ * same rule is given several times, the lowest identifier is kept.
+ * This function only reads its arguments, so it can safely be called from
+ * a background thread while another compiled rule list is in use.
+ * @param  rules Array of NUL terminated rules.
+ * @param  count Number of rules in the array.
+ * @return       Pointer to the compiled rules, to be freed with
+ *               url_RulesFree(), or NULL if error.
+ */
+extern url_rules *url_RulesCompile(const char * const *rules, size_t count);
+
+/**
+ * Free compiled rules.
+ * @param rules Pointer returned by url_RulesCompile(), or NULL.
+ */
+extern void url_RulesFree(url_rules *rules);
+
+/**
+ * Match a canonical URL against compiled rules. When several rules match,
+ * the one with the longest host is chosen, then the one with the longest
+ * path.
+ * @param  rules Compiled rules.
+ * @param  url   URL, as returned by url_Canonicalize().
+ * @param  len   Length of the URL. If 0, strlen() will be used.
+ * @return       Identifier of the matching rule, or URL_RULES_NO_MATCH.
+ */
+extern long url_RulesMatch(const url_rules *rules, const char *url, size_t len);
+
+/**
+ * Return the number of bytes used by compiled rules.
+ * @param  rules Compiled rules.
+ * @return       Memory footprint in bytes.
+ */
+extern size_t url_RulesSize(const url_rules *rules);
+
+
+/**
+ * Create a holder for compiled rules, allowing the rules to be replaced
+ * while other threads are matching URLs against them.
+ * @param  rules Initial compiled rules, owned by the ruleset from now on.
+ *               Can be NULL.
+ * @return       Pointer to a new ruleset, to be freed with url_RulesetFree(),
+ *               or NULL if error.
+ */
+extern url_ruleset *url_RulesetNew(url_rules *rules);
+
+/**
+ * Free a ruleset and the compiled rules it holds. No other thread may use
+ * the ruleset anymore.
+ * @param set Pointer returned by url_RulesetNew(), or NULL.
+ */
+extern void url_RulesetFree(url_ruleset *set);
+
+/**
+ * Atomically replace the compiled rules held by a ruleset. Readers that
+ * started before the swap keep using the previous rules, which are freed
+ * once the last of them has called url_RulesetRelease().
+ * @param set   Ruleset.
+ * @param rules New compiled rules, owned by the ruleset from now on.
+ */
+extern void url_RulesetSwap(url_ruleset *set, url_rules *rules);
+
+/**
+ * Get the current compiled rules of a ruleset. The rules stay valid until
+ * url_RulesetRelease() is called with the same token. Never blocks.
+ * @param  set   Ruleset.
+ * @param  token Pointer to an unsigned int to be given back to
+ *               url_RulesetRelease().
+ * @return       Current compiled rules, possibly NULL.
+ */
+extern const url_rules *url_RulesetAcquire(url_ruleset *set, unsigned *token);
+
+/**
+ * Release compiled rules obtained with url_RulesetAcquire().
+ * @param set   Ruleset.
+ * @param token Token set by url_RulesetAcquire().
+ */
+extern void url_RulesetRelease(url_ruleset *set, unsigned token);
+
+/**
+ * Match a canonical URL against the current rules of a ruleset.
+ * Same as url_RulesMatch() between url_RulesetAcquire() and
+ * url_RulesetRelease().
+ * @param  set Ruleset.
+ * @param  url URL, as returned by url_Canonicalize().
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     Identifier of the matching rule, or URL_RULES_NO_MATCH.
+ */
+extern long url_RulesetMatch(url_ruleset *set, const char *url, size_t len);
+
+#endif
@@ -0,0 +1,733 @@
+/*
+	Shared memory rings between clients and a canonicalization worker.
+
+	Layout of the memfd, each part aligned on a cache line :
+
+		header       sizes, position of the next request, of the first one
+		             not answered, futex of the worker
+		requests     clients * depth slots, each with a sequence number
+		             telling whether it can be written or read for a given
+		             position (D. Vyukov's bounded queue)
+		responses    per client : owner, position of the request being
+		             written, position of the next response, futex of the
+		             client, then depth slots
+
+	Producers claim a position of the request ring by incrementing its head,
+	as the ring can hold all the pending requests. They only have to wait
+	for a slot when the worker has answered its previous request but not
+	released it yet.
+
+	Clients may die at any time. Each one keeps in its queue the process id
+	owning it, a generation incremented at each attach and copied into the
+	requests, and the position it is writing, stored before claiming it.
+	When a position stays claimed but not written while no live client is
+	writing it, the worker releases it without answer. The queue of a dead
+	client is attached again once the worker is past its requests.
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "url.h"
+#include "url_batch.h"
+#include "url_shm.h"
+
+
+
+#define URL_SHM_MAGIC 0x3230686d736c7275ULL	// "urlshm02"
+
+// Requests canonicalized at once by the worker
+#define URL_SHM_BATCH 256
+
+// Bounds of the spins before sleeping, in iterations
+#define URL_SHM_SPINS_MIN 16
+#define URL_SHM_SPINS_MAX 16384
+
+// Longest sleep, to notice url_ShmStop() and dead clients
+#define URL_SHM_SLEEP_NS 100000000
+
+// Sleep of a client waiting for the worker to be past the requests of a
+// dead client
+#define URL_SHM_ATTACH_SLEEP_NS 1000000
+
+#define URL_SHM_ALIGN(n) (((n) + 63) & ~(size_t)63)
+
+typedef struct {
+	uint64_t magic;
+	uint64_t size;
+	uint32_t clients, depth, slots, slot_size;
+	uint32_t stop;
+	char pad0[64];
+	uint64_t head;			// Next position of the request ring
+	char pad1[64];
+	uint64_t served;		// Requests before it were answered or released
+	uint32_t futex;			// Incremented to wake the worker
+	uint32_t waiting;		// The worker sleeps
+	char pad2[64];
+} url_shm_header;
+
+typedef struct {
+	uint64_t sequence;
+	uint64_t tag;
+	uint32_t client;
+	uint32_t generation;
+	uint32_t len;
+	char data[];
+} url_shm_request;
+
+typedef struct {
+	uint32_t owner;			// Process id of the attached client, or 0
+	uint32_t generation;	// Incremented at each attach
+	uint64_t writing;		// Position of the request being written + 1, or 0
+	char pad0[64];
+	uint64_t head;			// Next position written by the worker
+	uint32_t futex;			// Incremented to wake the client
+	uint32_t waiting;		// The client sleeps
+	char pad1[64];
+} url_shm_queue;
+
+typedef struct {
+	uint64_t tag;
+	uint32_t status;
+	uint32_t len;
+	char data[];
+} url_shm_response;
+
+// Where the parts of the memfd are
+typedef struct {
+	size_t request_stride;
+	size_t requests;
+	size_t response_stride;
+	size_t queue_size;
+	size_t queues;
+	size_t size;
+} url_shm_layout;
+
+// Sizes are kept out of the shared memory, which clients can write
+struct url_shm {
+	int fd;
+	char *base;
+	url_shm_layout layout;
+	uint32_t clients, depth, slots, slot_size;
+	url_shm_header *header;
+	url_batch *batch;
+	const char *urls[URL_SHM_BATCH];
+	size_t lens[URL_SHM_BATCH];
+	bool *touched;
+	uint32_t *touched_list;
+	unsigned spins;
+};
+
+struct url_shm_client {
+	char *base;
+	url_shm_layout layout;
+	uint32_t clients, depth, slots, slot_size;	// Copied once, as in struct url_shm
+	url_shm_header *header;
+	url_shm_queue *queue;
+	uint32_t index;
+	uint32_t generation;
+	uint64_t tail;			// Next response read
+	unsigned pending;		// Requests sent, responses not released
+	bool reading;			// The response at tail-1 is not released
+	unsigned spins;
+};
+
+
+
+static void url_ShmLayout(url_shm_layout *l, uint32_t clients, uint32_t depth, uint32_t slots, uint32_t slot_size)
+{
+	l->request_stride = URL_SHM_ALIGN(sizeof(url_shm_request) + slot_size);
+	l->requests = URL_SHM_ALIGN(sizeof(url_shm_header));
+	l->response_stride = URL_SHM_ALIGN(sizeof(url_shm_response) + slot_size);
+	l->queue_size = URL_SHM_ALIGN(sizeof(url_shm_queue)) + depth * l->response_stride;
+	l->queues = l->requests + slots * l->request_stride;
+	l->size = l->queues + clients * l->queue_size;
+}
+
+static inline url_shm_request *url_ShmRequest(char *base, const url_shm_layout *l, uint32_t slots, uint64_t pos)
+{
+	return((url_shm_request *)(base + l->requests + (pos & (slots-1)) * l->request_stride));
+}
+
+static inline url_shm_queue *url_ShmQueue(char *base, const url_shm_layout *l, uint32_t client)
+{
+	return((url_shm_queue *)(base + l->queues + client * l->queue_size));
+}
+
+static inline url_shm_response *url_ShmResponse(url_shm_queue *q, const url_shm_layout *l, uint32_t depth, uint64_t pos)
+{
+	return((url_shm_response *)((char *)q + URL_SHM_ALIGN(sizeof(url_shm_queue)) + (pos & (depth-1)) * l->response_stride));
+}
+
+static inline void url_ShmPause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+
+// Initial spins : none on a single CPU, where spinning only delays the
+// other side
+static unsigned url_ShmSpins(void)
+{
+	return(sysconf(_SC_NPROCESSORS_ONLN) > 1 ? URL_SHM_SPINS_MIN : 0);
+}
+
+
+// Wake the other side if it sleeps, after publishing
+static void url_ShmWake(uint32_t *futex, uint32_t *waiting)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(waiting, __ATOMIC_RELAXED)) {
+		__atomic_fetch_add(futex, 1, __ATOMIC_RELEASE);
+		syscall(SYS_futex, futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+}
+
+
+// Whether the process of a client is alive. Clients and worker must share
+// a PID namespace.
+static bool url_ShmAlive(uint32_t pid)
+{
+	return(pid!=0 && (kill((pid_t)pid, 0)==0 || errno!=ESRCH));
+}
+
+
+// Wait until *p is not value anymore : spin, then sleep on the futex, only
+// once if asked. Return 1 once it changed, 0 if it did not during the
+// single sleep, or -1 if stopped.
+static int url_ShmWait(const uint64_t *p, uint64_t value, uint32_t *futex, uint32_t *waiting, const uint32_t *stop, unsigned *spins, bool once)
+{
+	for(unsigned i=0; i<*spins; i++) {
+		if(__atomic_load_n(p, __ATOMIC_ACQUIRE) != value) {
+			if(*spins < URL_SHM_SPINS_MAX)
+				*spins *= 2;
+			return(1);
+		}
+		url_ShmPause();
+	}
+	if(*spins > URL_SHM_SPINS_MIN)
+		*spins /= 2;
+
+	int done = 1;
+	for(bool slept=false; ; slept=true) {
+		uint32_t seq = __atomic_load_n(futex, __ATOMIC_ACQUIRE);
+		__atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(__atomic_load_n(p, __ATOMIC_ACQUIRE) != value)
+			break;
+		if(__atomic_load_n(stop, __ATOMIC_RELAXED)) {
+			done = -1;
+			break;
+		}
+		if(once && slept) {
+			done = 0;
+			break;
+		}
+		struct timespec timeout = { 0, URL_SHM_SLEEP_NS };
+		syscall(SYS_futex, futex, FUTEX_WAIT, seq, &timeout, NULL, 0);
+	}
+	__atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+	return(done);
+}
+
+
+// Release a position claimed but not written, if only dead clients were
+// writing it. Return true if released.
+static bool url_ShmSkip(url_shm *s, uint64_t pos)
+{
+	bool dead = false;
+	for(uint32_t i=0; i<s->clients; i++) {
+		url_shm_queue *q = url_ShmQueue(s->base, &s->layout, i);
+		if(__atomic_load_n(&q->writing, __ATOMIC_SEQ_CST) != pos+1)
+			continue;
+		if(url_ShmAlive(__atomic_load_n(&q->owner, __ATOMIC_RELAXED)))
+			return(false);
+		dead = true;
+	}
+	url_shm_request *r = url_ShmRequest(s->base, &s->layout, s->slots, pos);
+	uint64_t expected = pos;
+	return(dead && __atomic_compare_exchange_n(&r->sequence, &expected, pos + s->slots, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+}
+
+
+/**
+ * Create the shared memory of a worker.
+ * @param  clients   Maximum number of clients attached at once, or 0 for
+ *                   URL_SHM_CLIENTS.
+ * @param  depth     Maximum number of pending requests of a client, or 0 for
+ *                   URL_SHM_DEPTH. Rounded up to a power of 2.
+ * @param  slot_size Size of a slot, or 0 for URL_SHM_SLOT_SIZE.
+ * @return           Pointer to the worker side, to be freed with
+ *                   url_ShmFree(), or NULL if error.
+ */
+extern url_shm *url_ShmNew(unsigned clients, unsigned depth, size_t slot_size)
+{
+	if(clients==0)
+		clients = URL_SHM_CLIENTS;
+	if(depth==0)
+		depth = URL_SHM_DEPTH;
+	if(slot_size==0)
+		slot_size = URL_SHM_SLOT_SIZE;
+	if(clients > 65536 || depth > 65536 || (uint64_t)clients * depth > (1<<24) || slot_size < 16 || slot_size > 1024*1024)
+		return(NULL);
+
+	uint32_t depth2 = 1, slots = 1;
+	while(depth2 < depth)
+		depth2 *= 2;
+	while(slots < clients * depth2)
+		slots *= 2;
+	if(slots < 2)
+		slots = 2;
+
+	url_shm *s = calloc(1, sizeof(url_shm));
+	if(s==NULL)
+		return(NULL);
+	s->fd = -1;
+	s->spins = url_ShmSpins();
+	s->clients = clients;
+	s->depth = depth2;
+	s->slots = slots;
+	s->slot_size = slot_size;
+	url_ShmLayout(&s->layout, clients, depth2, slots, slot_size);
+
+	s->batch = url_BatchNew();
+	s->touched = calloc(clients, sizeof(bool));
+	s->touched_list = malloc(clients * sizeof(uint32_t));
+	if(s->batch==NULL || s->touched==NULL || s->touched_list==NULL)
+		goto bad;
+
+	// Pages are only allocated when first written
+	if((s->fd = memfd_create("url_shm", MFD_CLOEXEC)) < 0 || ftruncate(s->fd, s->layout.size))
+		goto bad;
+	s->base = mmap(NULL, s->layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+	if(s->base==MAP_FAILED) {
+		s->base = NULL;
+		goto bad;
+	}
+
+	s->header = (url_shm_header *)s->base;
+	s->header->size = s->layout.size;
+	s->header->clients = clients;
+	s->header->depth = depth2;
+	s->header->slots = slots;
+	s->header->slot_size = slot_size;
+	for(uint32_t i=0; i<slots; i++)
+		url_ShmRequest(s->base, &s->layout, slots, i)->sequence = i;
+	__atomic_store_n(&s->header->magic, URL_SHM_MAGIC, __ATOMIC_RELEASE);
+	return(s);
+
+bad:
+	url_ShmFree(s);
+	return(NULL);
+}
+
+
+/**
+ * Return the file descriptor of the shared memory, to be given to clients.
+ * @param  s Worker side.
+ * @return   File descriptor, closed by url_ShmFree().
+ */
+extern int url_ShmFd(const url_shm *s)
+{
+	return(s ? s->fd : -1);
+}
+
+
+/**
+ * Canonicalize the requests of the clients until url_ShmStop() is called.
+ * @param  s Worker side.
+ * @return   0, or -1 if error.
+ */
+extern int url_ShmServe(url_shm *s)
+{
+	if(s==NULL)
+		return(-1);
+
+	url_shm_header *h = s->header;
+	const url_shm_layout *l = &s->layout;
+	uint32_t slots = s->slots, depth = s->depth, slot_size = s->slot_size;
+	uint64_t pos = 0;
+
+	while(!__atomic_load_n(&h->stop, __ATOMIC_RELAXED)) {
+		// Take the requests written, in order
+		size_t count = 0;
+		url_shm_request *requests[URL_SHM_BATCH];
+		while(count < URL_SHM_BATCH) {
+			url_shm_request *r = url_ShmRequest(s->base, l, slots, pos + count);
+			if(__atomic_load_n(&r->sequence, __ATOMIC_ACQUIRE) != pos + count + 1)
+				break;
+			// Lengths come from other processes, read once
+			uint32_t len = __atomic_load_n(&r->len, __ATOMIC_RELAXED);
+			if(len >= slot_size)
+				len = slot_size-1;
+			r->data[len] = '\0';
+			requests[count] = r;
+			s->urls[count] = r->data;
+			s->lens[count++] = len;
+		}
+		if(count==0) {
+			// Claimed but still not written after a sleep : maybe by a client
+			// which died
+			url_shm_request *r = url_ShmRequest(s->base, l, slots, pos);
+			if(url_ShmWait(&r->sequence, pos, &h->futex, &h->waiting, &h->stop, &s->spins, true)==0
+			&& __atomic_load_n(&h->head, __ATOMIC_SEQ_CST) != pos && url_ShmSkip(s, pos))
+				__atomic_store_n(&h->served, ++pos, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		// Canonicalized where the clients wrote them
+		url_BatchReset(s->batch);
+		url_CanonicalizeBatch(s->batch, s->urls, s->lens, count);
+
+		size_t touched = 0;
+		for(size_t i=0; i<count; i++) {
+			url_shm_request *r = requests[i];
+			uint32_t client = __atomic_load_n(&r->client, __ATOMIC_RELAXED);
+			if(client >= s->clients)
+				continue;
+			url_shm_queue *q = url_ShmQueue(s->base, l, client);
+			// Requests of a client which died, whose queue was attached again
+			if(__atomic_load_n(&r->generation, __ATOMIC_RELAXED) != __atomic_load_n(&q->generation, __ATOMIC_ACQUIRE))
+				continue;
+			uint64_t head = q->head;
+			url_shm_response *response = url_ShmResponse(q, l, depth, head);
+			size_t len;
+			const char *canonical = url_BatchGet(s->batch, i, &len);
+			response->tag = r->tag;
+			if(canonical==NULL) {
+				response->status = URL_SHM_FAILED;
+				len = 0;
+			} else if(len >= slot_size) {
+				response->status = URL_SHM_TOO_LONG;
+				len = 0;
+			} else {
+				response->status = URL_SHM_OK;
+				memcpy(response->data, canonical, len);
+			}
+			response->data[len] = '\0';
+			response->len = len;
+			__atomic_store_n(&q->head, head+1, __ATOMIC_RELEASE);
+			if(!s->touched[client]) {
+				s->touched[client] = true;
+				s->touched_list[touched++] = client;
+			}
+		}
+
+		// Only now can producers overwrite the requests
+		for(size_t i=0; i<count; i++)
+			__atomic_store_n(&requests[i]->sequence, pos + i + slots, __ATOMIC_RELEASE);
+		pos += count;
+		__atomic_store_n(&h->served, pos, __ATOMIC_RELEASE);
+
+		for(size_t i=0; i<touched; i++) {
+			url_shm_queue *q = url_ShmQueue(s->base, l, s->touched_list[i]);
+			s->touched[s->touched_list[i]] = false;
+			url_ShmWake(&q->futex, &q->waiting);
+		}
+	}
+	return(0);
+}
+
+
+/**
+ * Make url_ShmServe() return, and the clients waiting for a response fail.
+ * Can be called from any thread or from a signal handler.
+ * @param s Worker side.
+ */
+extern void url_ShmStop(url_shm *s)
+{
+	if(s==NULL || s->header==NULL)
+		return;
+	__atomic_store_n(&s->header->stop, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->header->futex, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &s->header->futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+	for(uint32_t i=0; i<s->clients; i++) {
+		url_shm_queue *q = url_ShmQueue(s->base, &s->layout, i);
+		__atomic_fetch_add(&q->futex, 1, __ATOMIC_RELEASE);
+		syscall(SYS_futex, &q->futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+}
+
+
+/**
+ * Free the worker side. Clients keep their mapping until they detach.
+ * @param s Pointer returned by url_ShmNew(), or NULL.
+ */
+extern void url_ShmFree(url_shm *s)
+{
+	if(s==NULL)
+		return;
+	if(s->base)
+		munmap(s->base, s->layout.size);
+	if(s->fd >= 0)
+		close(s->fd);
+	url_BatchFree(s->batch);
+	free(s->touched);
+	free(s->touched_list);
+	free(s);
+}
+
+
+/**
+ * Attach a client to the shared memory of a worker.
+ * @param  fd File descriptor returned by url_ShmFd() in the worker. It is
+ *            not closed, and can be closed once attached.
+ * @return    Pointer to the client, to be freed with url_ShmDetach(), or NULL
+ *            if error (including all the clients already attached). The
+ *            queue of a dead client is taken once the worker is past its
+ *            requests, which may take a sleep of the worker.
+ */
+extern url_shm_client *url_ShmAttach(int fd)
+{
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) || (size_t)st.st_size < sizeof(url_shm_header))
+		return(NULL);
+
+	url_shm_client *c = calloc(1, sizeof(url_shm_client));
+	if(c==NULL)
+		return(NULL);
+	c->spins = url_ShmSpins();
+	c->base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(c->base==MAP_FAILED)
+		goto bad;
+
+	// Check the sizes before trusting the offsets they give. Only the
+	// private copies are used afterwards, whatever the header becomes
+	url_shm_header *h = c->header = (url_shm_header *)c->base;
+	if(__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE)!=URL_SHM_MAGIC)
+		goto unmap;
+	c->clients = __atomic_load_n(&h->clients, __ATOMIC_RELAXED);
+	c->depth = __atomic_load_n(&h->depth, __ATOMIC_RELAXED);
+	c->slots = __atomic_load_n(&h->slots, __ATOMIC_RELAXED);
+	c->slot_size = __atomic_load_n(&h->slot_size, __ATOMIC_RELAXED);
+	if(c->clients==0 || c->depth==0 || (c->depth & (c->depth-1)) || c->slots==0 || (c->slots & (c->slots-1))
+		|| c->slots < (uint64_t)c->clients * c->depth || c->slot_size==0)
+		goto unmap;
+	url_ShmLayout(&c->layout, c->clients, c->depth, c->slots, c->slot_size);
+	if(c->layout.size != (uint64_t)st.st_size)
+		goto unmap;
+
+	// Take a free queue, or the queue of a dead client unless it claimed a
+	// position the worker has not released yet
+	uint32_t pid = (uint32_t)getpid(), owner;
+	for(c->index=0; c->index<c->clients; c->index++) {
+		c->queue = url_ShmQueue(c->base, &c->layout, c->index);
+		owner = __atomic_load_n(&c->queue->owner, __ATOMIC_ACQUIRE);
+		uint64_t writing = __atomic_load_n(&c->queue->writing, __ATOMIC_SEQ_CST);
+		bool claimed = writing > __atomic_load_n(&h->served, __ATOMIC_ACQUIRE) && writing <= __atomic_load_n(&h->head, __ATOMIC_SEQ_CST);
+		if(owner!=0 && (url_ShmAlive(owner) || claimed))
+			continue;
+		if(__atomic_compare_exchange_n(&c->queue->owner, &owner, pid, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			break;
+	}
+	if(c->index==c->clients)
+		goto unmap;
+	c->generation = __atomic_add_fetch(&c->queue->generation, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&c->queue->writing, 0, __ATOMIC_RELEASE);
+
+	// The worker may still answer the requests of a dead client, read
+	// the generation before it changed : wait for it to be past them
+	if(owner!=0) {
+		uint64_t head = __atomic_load_n(&h->head, __ATOMIC_SEQ_CST);
+		while(__atomic_load_n(&h->served, __ATOMIC_ACQUIRE) < head) {
+			if(__atomic_load_n(&h->stop, __ATOMIC_RELAXED)) {
+				__atomic_store_n(&c->queue->owner, 0, __ATOMIC_RELEASE);
+				goto unmap;
+			}
+			struct timespec delay = { 0, URL_SHM_ATTACH_SLEEP_NS };
+			nanosleep(&delay, NULL);
+		}
+	}
+	c->tail = __atomic_load_n(&c->queue->head, __ATOMIC_ACQUIRE);
+	return(c);
+
+unmap:
+	munmap(c->base, st.st_size);
+bad:
+	free(c);
+	return(NULL);
+}
+
+
+// The response returned by the last url_ShmReceive() can be overwritten
+static inline void url_ShmRelease(url_shm_client *c)
+{
+	if(c->reading) {
+		c->reading = false;
+		c->pending--;
+	}
+}
+
+
+/**
+ * Wait for the pending responses of a client and detach it.
+ * @param c Pointer returned by url_ShmAttach(), or NULL.
+ */
+extern void url_ShmDetach(url_shm_client *c)
+{
+	if(c==NULL)
+		return;
+	url_ShmRelease(c);
+	while(c->pending && url_ShmReceive(c, NULL, NULL, NULL)!=-1)
+		url_ShmRelease(c);
+	__atomic_store_n(&c->queue->owner, 0, __ATOMIC_RELEASE);
+	munmap(c->base, c->layout.size);
+	free(c);
+}
+
+
+/**
+ * Send an URL to the worker, without waiting for its canonicalized form.
+ * @param  c   Client.
+ * @param  url Pointer to the URL.
+ * @param  len Length of the URL, less than the slot size. If 0, strlen()
+ *             will be used.
+ * @param  tag Value returned with the response.
+ * @return     0, or -1 if error (URL too long, or depth requests pending :
+ *             call url_ShmReceive() first).
+ */
+extern int url_ShmSubmit(url_shm_client *c, const char *url, size_t len, uint64_t tag)
+{
+	if(c==NULL || url==NULL)
+		return(-1);
+	url_ShmRelease(c);
+
+	url_shm_header *h = c->header;
+	if(len==0)
+		len = strlen(url);
+	if(len >= c->slot_size || c->pending == c->depth)
+		return(-1);
+
+	// The position is stored before being claimed, so that the worker can
+	// release it if this process dies before writing it
+	url_shm_queue *q = c->queue;
+	uint64_t pos = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+	do
+		__atomic_store_n(&q->writing, pos+1, __ATOMIC_SEQ_CST);
+	while(!__atomic_compare_exchange_n(&h->head, &pos, pos+1, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	url_shm_request *r = url_ShmRequest(c->base, &c->layout, c->slots, pos);
+	while(__atomic_load_n(&r->sequence, __ATOMIC_ACQUIRE) != pos) {
+		if(__atomic_load_n(&h->stop, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&q->writing, 0, __ATOMIC_RELEASE);
+			return(-1);
+		}
+		url_ShmPause();
+	}
+	memcpy(r->data, url, len);
+	r->data[len] = '\0';
+	r->len = len;
+	r->tag = tag;
+	r->client = c->index;
+	r->generation = c->generation;
+	__atomic_store_n(&r->sequence, pos+1, __ATOMIC_RELEASE);
+	__atomic_store_n(&q->writing, 0, __ATOMIC_RELEASE);
+	c->pending++;
+
+	url_ShmWake(&h->futex, &h->waiting);
+	return(0);
+}
+
+
+/**
+ * Wait for the response to the oldest pending request of a client.
+ * Responses come in the order of the requests.
+ * @param  c   Client.
+ * @param  tag If not NULL, will receive the tag given to url_ShmSubmit().
+ * @param  url Will receive a pointer to the NUL terminated canonicalized
+ *             URL, in the shared memory, valid until the next call on c.
+ * @param  len If not NULL, will receive the length of the URL.
+ * @return     URL_SHM_OK, URL_SHM_FAILED, URL_SHM_TOO_LONG, or -1 if error
+ *             (no request pending, or the worker stopped).
+ */
+extern int url_ShmReceive(url_shm_client *c, uint64_t *tag, const char **url, size_t *len)
+{
+	if(c==NULL)
+		return(-1);
+	url_ShmRelease(c);
+	if(c->pending==0)
+		return(-1);
+
+	url_shm_queue *q = c->queue;
+	if(url_ShmWait(&q->head, c->tail, &q->futex, &q->waiting, &c->header->stop, &c->spins, false) < 0)
+		return(-1);
+
+	url_shm_response *response = url_ShmResponse(q, &c->layout, c->depth, c->tail++);
+	c->reading = true;
+
+	// Read once and kept in the slot, whatever was written there
+	uint32_t response_len = __atomic_load_n(&response->len, __ATOMIC_RELAXED);
+	if(response_len >= c->slot_size)
+		response_len = c->slot_size - 1;
+	response->data[response_len] = '\0';
+	if(tag)
+		*tag = response->tag;
+	if(url)
+		*url = response->data;
+	if(len)
+		*len = response_len;
+	return(response->status);
+}
+
+
+/**
+ * Canonicalize an URL through the worker, as url_Canonicalize() does. URLs
+ * too long for a slot are canonicalized by the calling process.
+ * @param  c       Client, without pending request.
+ * @param  src     Pointer to the URL.
+ * @param  len     Length of the URL. If 0, strlen() will be used.
+ * @param  new_len If not NULL, pointer to a size_t where the length of the
+ *                 canonicalized URL will be stored.
+ * @return         Newly allocated string holding the canonicalized URL, or
+ *                 NULL if error. Use free() to deallocate the memory.
+ */
+extern char *url_ShmCanonicalize(url_shm_client *c, const char *src, size_t len, size_t *new_len)
+{
+	if(c==NULL || src==NULL)
+		return(NULL);
+	url_ShmRelease(c);
+	if(c->pending)
+		return(NULL);
+
+	if(len==0)
+		len = strlen(src);
+	if(len >= c->slot_size)
+		return(url_Canonicalize(src, len, new_len));
+	if(url_ShmSubmit(c, src, len, 0))
+		return(NULL);
+
+	const char *canonical;
+	size_t canonical_len;
+	switch(url_ShmReceive(c, NULL, &canonical, &canonical_len)) {
+		case URL_SHM_OK:
+			break;
+		case URL_SHM_TOO_LONG:
+			return(url_Canonicalize(src, len, new_len));
+		default:
+			return(NULL);
+	}
+
+	char *dest = malloc(canonical_len + 1);
+	if(dest==NULL)
+		return(NULL);
+	memcpy(dest, canonical, canonical_len + 1);
+	if(new_len)
+		*new_len = canonical_len;
+	return(dest);
+}
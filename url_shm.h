@@ -0,0 +1,144 @@
+#ifndef _URL_SHM_H_
+#define _URL_SHM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	Canonicalization by a worker process through shared memory.
+
+	The worker creates a memfd holding a ring of requests and a ring of
+	responses per client, and hands its file descriptor to the client
+	processes : inherited through fork(), or sent over a Unix socket with
+	SCM_RIGHTS, as exec() closes it. Clients write raw URLs into the slots
+	of the request ring, multiple producers / single consumer. The worker
+	canonicalizes them in place with url_CanonicalizeBatch() and writes the
+	results into the single producer / single consumer response ring of each
+	client. No URL goes through the kernel.
+
+	Each side spins a while when the other is late, then sleeps on a futex
+	in the shared memory, only woken by the other side when it sleeps. The
+	time spun adapts to whether the last waits ended while spinning.
+
+	Each client has at most depth requests pending, so the request ring,
+	holding depth requests per client, is never full. A client must be used
+	by a single thread at a time.
+
+	Clients which die, even while writing a request, do not block the
+	worker nor the other clients, and their queues can be attached again.
+	Clients and worker must share a PID namespace.
+*/
+
+// Default number of clients
+#define URL_SHM_CLIENTS 16
+
+// Default number of pending requests per client
+#define URL_SHM_DEPTH 256
+
+// Default size of a slot : longest URL + 1, longest canonicalized URL + 1
+#define URL_SHM_SLOT_SIZE 2048
+
+// Status of the responses
+#define URL_SHM_OK 0
+#define URL_SHM_FAILED 1		// The URL could not be canonicalized
+#define URL_SHM_TOO_LONG 2		// The canonicalized URL does not fit in a slot
+
+typedef struct url_shm url_shm;
+typedef struct url_shm_client url_shm_client;
+
+
+/**
+ * Create the shared memory of a worker.
+ * @param  clients   Maximum number of clients attached at once, or 0 for
+ *                   URL_SHM_CLIENTS.
+ * @param  depth     Maximum number of pending requests of a client, or 0 for
+ *                   URL_SHM_DEPTH. Rounded up to a power of 2.
+ * @param  slot_size Size of a slot, or 0 for URL_SHM_SLOT_SIZE.
+ * @return           Pointer to the worker side, to be freed with
+ *                   url_ShmFree(), or NULL if error.
+ */
+extern url_shm *url_ShmNew(unsigned clients, unsigned depth, size_t slot_size);
+
+/**
+ * Return the file descriptor of the shared memory, to be given to clients.
+ * @param  s Worker side.
+ * @return   File descriptor, closed by url_ShmFree().
+ */
+extern int url_ShmFd(const url_shm *s);
+
+/**
+ * Canonicalize the requests of the clients until url_ShmStop() is called.
+ * @param  s Worker side.
+ * @return   0, or -1 if error.
+ */
+extern int url_ShmServe(url_shm *s);
+
+/**
+ * Make url_ShmServe() return, and the clients waiting for a response fail.
+ * Can be called from any thread or from a signal handler.
+ * @param s Worker side.
+ */
+extern void url_ShmStop(url_shm *s);
+
+/**
+ * Free the worker side. Clients keep their mapping until they detach.
+ * @param s Pointer returned by url_ShmNew(), or NULL.
+ */
+extern void url_ShmFree(url_shm *s);
+
+/**
+ * Attach a client to the shared memory of a worker.
+ * @param  fd File descriptor returned by url_ShmFd() in the worker. It is
+ *            not closed, and can be closed once attached.
+ * @return    Pointer to the client, to be freed with url_ShmDetach(), or NULL
+ *            if error (including all the clients already attached). The
+ *            queue of a dead client is taken once the worker is past its
+ *            requests, which may take a sleep of the worker.
+ */
+extern url_shm_client *url_ShmAttach(int fd);
+
+/**
+ * Wait for the pending responses of a client and detach it.
+ * @param c Pointer returned by url_ShmAttach(), or NULL.
+ */
+extern void url_ShmDetach(url_shm_client *c);
+
+/**
+ * Send an URL to the worker, without waiting for its canonicalized form.
+ * @param  c   Client.
+ * @param  url Pointer to the URL.
+ * @param  len Length of the URL, less than the slot size. If 0, strlen()
+ *             will be used.
+ * @param  tag Value returned with the response.
+ * @return     0, or -1 if error (URL too long, or depth requests pending :
+ *             call url_ShmReceive() first).
+ */
+extern int url_ShmSubmit(url_shm_client *c, const char *url, size_t len, uint64_t tag);
+
+/**
+ * Wait for the response to the oldest pending request of a client.
+ * Responses come in the order of the requests.
+ * @param  c   Client.
+ * @param  tag If not NULL, will receive the tag given to url_ShmSubmit().
+ * @param  url Will receive a pointer to the NUL terminated canonicalized
+ *             URL, in the shared memory, valid until the next call on c.
+ * @param  len If not NULL, will receive the length of the URL.
+ * @return     URL_SHM_OK, URL_SHM_FAILED, URL_SHM_TOO_LONG, or -1 if error
+ *             (no request pending, or the worker stopped).
+ */
+extern int url_ShmReceive(url_shm_client *c, uint64_t *tag, const char **url, size_t *len);
+
+/**
+ * Canonicalize an URL through the worker, as url_Canonicalize() does. URLs
+ * too long for a slot are canonicalized by the calling process.
+ * @param  c       Client, without pending request.
+ * @param  src     Pointer to the URL.
+ * @param  len     Length of the URL. If 0, strlen() will be used.
+ * @param  new_len If not NULL, pointer to a size_t where the length of the
+ *                 canonicalized URL will be stored.
+ * @return         Newly allocated string holding the canonicalized URL, or
+ *                 NULL if error. Use free() to deallocate the memory.
+ */
+extern char *url_ShmCanonicalize(url_shm_client *c, const char *src, size_t len, size_t *new_len);
+
+#endif
@@ -0,0 +1,828 @@
+/*
+	External sort and unique of canonicalized URLs.
+
+	The calling thread appends raw URLs to the current buffer. Full buffers
+	go to a queue served by the worker threads, and come back to the free
+	list once spilled, so that at most threads + 1 buffers exist. A run
+	file is a sequence of records : varint shared prefix length, varint
+	suffix length, suffix. Spilled runs are of level 0, and merging
+	URL_SORT_FANIN runs of a level gives one run of the next level.
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "url.h"
+#include "url_sort.h"
+
+
+
+// Below this number of URLs, the radix sort falls back to an insertion sort
+#define URL_SORT_INSERTION 32
+
+typedef struct {
+	const char *str;
+	size_t len;
+} url_sort_entry;
+
+// Entries of a buffer hold offsets in raw, which may move when growing
+typedef struct {
+	size_t offset;
+	size_t len;
+} url_sort_raw;
+
+typedef struct {
+	char *raw;
+	size_t raw_len, raw_cap;
+	url_sort_raw *entries;
+	size_t count, entries_cap;
+} url_sort_buffer;
+
+typedef struct {
+	FILE *file;
+	char *prev;
+	size_t prev_len, prev_cap;
+	bool failed;
+} url_sort_writer;
+
+typedef struct {
+	FILE *file;
+	char *str;
+	size_t len, cap;
+} url_sort_reader;
+
+typedef struct {
+	FILE *file;
+	unsigned level;
+} url_sort_run;
+
+struct url_sorter {
+	char *tmp_dir;
+	size_t buffer_size;
+	unsigned threads;
+	pthread_t *workers;
+	unsigned started;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	url_sort_buffer *buffers;
+	url_sort_buffer **todo;
+	unsigned todo_count;
+	url_sort_buffer **free;
+	unsigned free_count;
+	unsigned busy;
+	bool stop;
+	bool failed;
+	bool finished;
+	bool merging;				// A thread is merging runs while adding
+	url_sort_buffer *current;
+
+	url_sort_run *runs;
+	size_t run_count, run_cap;
+};
+
+
+
+static FILE *url_SortTempFile(const char *dir)
+{
+	size_t len = strlen(dir);
+	char *path = malloc(len + 16);
+	if(path==NULL)
+		return(NULL);
+	sprintf(path, "%s/urlsortXXXXXX", dir);
+	int fd = mkstemp(path);
+	if(fd<0) {
+		free(path);
+		return(NULL);
+	}
+	unlink(path);
+	free(path);
+	FILE *file = fdopen(fd, "w+");
+	if(file==NULL)
+		close(fd);
+	return(file);
+}
+
+
+static void url_SortWriteVarint(url_sort_writer *w, uint64_t value)
+{
+	while(value >= 0x80) {
+		if(putc((int)(value | 0x80) & 0xff, w->file)==EOF)
+			w->failed = true;
+		value >>= 7;
+	}
+	if(putc((int)value, w->file)==EOF)
+		w->failed = true;
+}
+
+
+// Append a string to a run, unless it is equal to the previous one
+static void url_SortWrite(url_sort_writer *w, const char *str, size_t len)
+{
+	size_t shared = 0;
+	size_t min = len < w->prev_len ? len : w->prev_len;
+	while(shared<min && str[shared]==w->prev[shared])
+		shared++;
+	if(shared==len && len==w->prev_len && w->prev)
+		return;
+
+	url_SortWriteVarint(w, shared);
+	url_SortWriteVarint(w, len - shared);
+	if(len>shared && fwrite(str + shared, 1, len - shared, w->file) != len - shared)
+		w->failed = true;
+
+	if(len+1 > w->prev_cap) {
+		char *prev = realloc(w->prev, 2*(len+1));
+		if(prev==NULL) {
+			w->failed = true;
+			return;
+		}
+		w->prev = prev;
+		w->prev_cap = 2*(len+1);
+	}
+	memcpy(w->prev + shared, str + shared, len - shared);
+	w->prev_len = len;
+}
+
+
+static bool url_SortReadVarint(FILE *file, uint64_t *value, bool *eof)
+{
+	*value = 0;
+	for(int shift=0; shift<64; shift+=7) {
+		int c = getc(file);
+		if(c==EOF) {
+			*eof = shift==0 && !ferror(file);
+			return(false);
+		}
+		*value |= (uint64_t)(c & 0x7f) << shift;
+		if(c < 0x80)
+			return(true);
+	}
+	*eof = false;
+	return(false);
+}
+
+
+// Read the next string of a run. Return 1, 0 at the end of the run, or -1.
+static int url_SortReaderNext(url_sort_reader *r)
+{
+	uint64_t shared, suffix_len;
+	bool eof;
+	if(!url_SortReadVarint(r->file, &shared, &eof))
+		return(eof ? 0 : -1);
+	if(!url_SortReadVarint(r->file, &suffix_len, &eof) || shared > r->len)
+		return(-1);
+
+	size_t len = shared + suffix_len;
+	if(len+1 > r->cap) {
+		char *str = realloc(r->str, 2*(len+1));
+		if(str==NULL)
+			return(-1);
+		r->str = str;
+		r->cap = 2*(len+1);
+	}
+	if(suffix_len && fread(r->str + shared, 1, suffix_len, r->file) != suffix_len)
+		return(-1);
+	r->str[len] = '\0';
+	r->len = len;
+	return(1);
+}
+
+
+static inline int url_SortCompare(const char *a, size_t alen, const char *b, size_t blen)
+{
+	int cmp = memcmp(a, b, alen < blen ? alen : blen);
+	if(cmp)
+		return(cmp);
+	return(alen < blen ? -1 : alen > blen);
+}
+
+
+static void url_SortInsertion(url_sort_entry *e, size_t n, size_t depth)
+{
+	for(size_t i=1; i<n; i++) {
+		url_sort_entry x = e[i];
+		size_t j = i;
+		while(j>0 && url_SortCompare(e[j-1].str + depth, e[j-1].len - depth, x.str + depth, x.len - depth) > 0) {
+			e[j] = e[j-1];
+			j--;
+		}
+		e[j] = x;
+	}
+}
+
+
+// Most significant byte first radix sort of strings sharing their first
+// depth bytes. Bucket 0 holds the strings ending at depth. Only the
+// smaller buckets are sorted recursively, so the recursion depth stays
+// logarithmic.
+static void url_SortRadix(url_sort_entry *e, url_sort_entry *tmp, size_t n, size_t depth)
+{
+	for(;;) {
+		if(n < URL_SORT_INSERTION) {
+			url_SortInsertion(e, n, depth);
+			return;
+		}
+
+		size_t count[257] = { 0 };
+		for(size_t i=0; i<n; i++)
+			count[depth < e[i].len ? (unsigned char)e[i].str[depth] + 1 : 0]++;
+
+		size_t start[257], sum = 0, largest = 1;
+		bool single = false;
+		for(int c=0; c<257; c++) {
+			start[c] = sum;
+			sum += count[c];
+			if(count[c]==n)
+				single = true;
+			if(c>0 && count[c] > count[largest])
+				largest = c;
+		}
+		if(single) {
+			// Common byte : go on with the next one, without moving anything
+			if(count[0]==n)
+				return;
+			depth++;
+			continue;
+		}
+
+		size_t pos[257];
+		memcpy(pos, start, sizeof(pos));
+		for(size_t i=0; i<n; i++)
+			tmp[pos[depth < e[i].len ? (unsigned char)e[i].str[depth] + 1 : 0]++] = e[i];
+		memcpy(e, tmp, n * sizeof(url_sort_entry));
+
+		for(int c=1; c<257; c++)
+			if(c!=(int)largest && count[c]>1)
+				url_SortRadix(e + start[c], tmp, count[c], depth+1);
+		e += start[largest];
+		n = count[largest];
+		depth++;
+	}
+}
+
+
+// Canonicalize, sort and spill a buffer. Return the run file, or NULL.
+static FILE *url_SortSpill(const url_sorter *s, url_sort_buffer *b)
+{
+	url_sort_writer w = { 0 };
+	url_sort_entry *entries = malloc(b->count * sizeof(url_sort_entry) + 1);
+	url_sort_entry *tmp = malloc(b->count * sizeof(url_sort_entry) + 1);
+	char *canonical = NULL;
+	size_t canonical_len = 0, canonical_cap = 0, n = 0;
+	if(entries==NULL || tmp==NULL)
+		goto bad;
+
+	// Entries first hold offsets in the canonical arena, which may move
+	for(size_t i=0; i<b->count; i++) {
+		size_t len;
+		char *str = url_Canonicalize(b->raw + b->entries[i].offset, b->entries[i].len, &len);
+		if(str==NULL)
+			continue;
+		if(canonical_len + len > canonical_cap) {
+			size_t cap = canonical_cap ? canonical_cap : b->raw_len + 1;
+			while(cap < canonical_len + len)
+				cap *= 2;
+			char *p = realloc(canonical, cap);
+			if(p==NULL) {
+				free(str);
+				goto bad;
+			}
+			canonical = p;
+			canonical_cap = cap;
+		}
+		memcpy(canonical + canonical_len, str, len);
+		entries[n].str = (const char *)(uintptr_t)canonical_len;
+		entries[n].len = len;
+		canonical_len += len;
+		n++;
+		free(str);
+	}
+	for(size_t i=0; i<n; i++)
+		entries[i].str = canonical + (uintptr_t)entries[i].str;
+
+	url_SortRadix(entries, tmp, n, 0);
+
+	w.file = url_SortTempFile(s->tmp_dir);
+	if(w.file==NULL)
+		goto bad;
+	for(size_t i=0; i<n && !w.failed; i++)
+		url_SortWrite(&w, entries[i].str, entries[i].len);
+	if(w.failed || fflush(w.file) || fseek(w.file, 0, SEEK_SET))
+		goto bad;
+
+	free(w.prev);
+	free(entries);
+	free(tmp);
+	free(canonical);
+	return(w.file);
+
+bad:
+	if(w.file)
+		fclose(w.file);
+	free(w.prev);
+	free(entries);
+	free(tmp);
+	free(canonical);
+	return(NULL);
+}
+
+
+typedef struct {
+	url_sort_reader *readers;
+	size_t *heap;
+	size_t n;
+} url_sort_merge;
+
+
+static inline bool url_SortLess(const url_sort_merge *m, size_t a, size_t b)
+{
+	const url_sort_reader *ra = &m->readers[m->heap[a]], *rb = &m->readers[m->heap[b]];
+	return(url_SortCompare(ra->str, ra->len, rb->str, rb->len) < 0);
+}
+
+
+static void url_SortHeapDown(url_sort_merge *m, size_t pos)
+{
+	for(;;) {
+		size_t smallest = pos, left = 2*pos+1, right = 2*pos+2;
+		if(left<m->n && url_SortLess(m, left, smallest))
+			smallest = left;
+		if(right<m->n && url_SortLess(m, right, smallest))
+			smallest = right;
+		if(smallest==pos)
+			return;
+		size_t tmp = m->heap[pos];
+		m->heap[pos] = m->heap[smallest];
+		m->heap[smallest] = tmp;
+		pos = smallest;
+	}
+}
+
+
+// k-way merge of runs, calling emit for each distinct string.
+// Return the number of distinct strings, or -1 if error.
+static int64_t url_SortMerge(const url_sort_run *runs, size_t count, url_sort_callback emit, void *ctx)
+{
+	url_sort_merge m = { 0 };
+	char *last = NULL;
+	size_t last_len = 0, last_cap = 0;
+	int64_t distinct = 0;
+
+	m.readers = calloc(count, sizeof(url_sort_reader));
+	m.heap = malloc(count * sizeof(size_t) + 1);
+	if(m.readers==NULL || m.heap==NULL)
+		goto bad;
+	for(size_t i=0; i<count; i++) {
+		m.readers[i].file = runs[i].file;
+		int ret = url_SortReaderNext(&m.readers[i]);
+		if(ret<0)
+			goto bad;
+		if(ret)
+			m.heap[m.n++] = i;
+	}
+	for(size_t i=m.n/2; i-->0; )
+		url_SortHeapDown(&m, i);
+
+	while(m.n) {
+		url_sort_reader *r = &m.readers[m.heap[0]];
+		if(distinct==0 || r->len!=last_len || memcmp(r->str, last, last_len)) {
+			if(emit(ctx, r->str, r->len))
+				break;
+			distinct++;
+			if(r->len+1 > last_cap) {
+				char *p = realloc(last, 2*(r->len+1));
+				if(p==NULL)
+					goto bad;
+				last = p;
+				last_cap = 2*(r->len+1);
+			}
+			memcpy(last, r->str, r->len);
+			last_len = r->len;
+		}
+
+		int ret = url_SortReaderNext(r);
+		if(ret<0)
+			goto bad;
+		if(ret==0)
+			m.heap[0] = m.heap[--m.n];
+		url_SortHeapDown(&m, 0);
+	}
+
+	for(size_t i=0; i<count; i++)
+		free(m.readers[i].str);
+	free(m.readers);
+	free(m.heap);
+	free(last);
+	return(distinct);
+
+bad:
+	if(m.readers)
+		for(size_t i=0; i<count; i++)
+			free(m.readers[i].str);
+	free(m.readers);
+	free(m.heap);
+	free(last);
+	return(-1);
+}
+
+
+static int url_SortEmitToRun(void *ctx, const char *str, size_t len)
+{
+	url_sort_writer *w = ctx;
+	url_SortWrite(w, str, len);
+	return(w->failed ? -1 : 0);
+}
+
+
+// Called with the lock held
+static bool url_SortAddRun(url_sorter *s, FILE *file, unsigned level)
+{
+	if(s->run_count==s->run_cap) {
+		size_t cap = s->run_cap ? 2*s->run_cap : 64;
+		url_sort_run *runs = realloc(s->runs, cap * sizeof(url_sort_run));
+		if(runs==NULL)
+			return(false);
+		s->runs = runs;
+		s->run_cap = cap;
+	}
+	s->runs[s->run_count].file = file;
+	s->runs[s->run_count].level = level;
+	s->run_count++;
+	return(true);
+}
+
+
+// Merge runs into a new one. Return its file, or NULL.
+static FILE *url_SortMergeRuns(const url_sorter *s, const url_sort_run *runs, size_t count)
+{
+	url_sort_writer w = { 0 };
+	w.file = url_SortTempFile(s->tmp_dir);
+	if(w.file==NULL
+	|| url_SortMerge(runs, count, url_SortEmitToRun, &w) < 0
+	|| w.failed || fflush(w.file) || fseek(w.file, 0, SEEK_SET)) {
+		if(w.file)
+			fclose(w.file);
+		w.file = NULL;
+	}
+	free(w.prev);
+	return(w.file);
+}
+
+
+// Merge URL_SORT_FANIN runs of the same level into one of the next level,
+// as long as a level has that many, so that the number of open run files
+// only grows with the logarithm of the input size. One thread at a time
+// merges, the others go on spilling unless too many runs wait already.
+static void url_SortCompact(url_sorter *s)
+{
+	pthread_mutex_lock(&s->lock);
+	for(;;) {
+		while(s->merging && s->run_count >= 2*URL_SORT_FANIN && !s->failed)
+			pthread_cond_wait(&s->cond, &s->lock);
+		if(s->merging || s->failed)
+			break;
+
+		size_t counts[64] = { 0 };
+		unsigned level = 64;
+		for(size_t i=0; i<s->run_count && level==64; i++)
+			if(s->runs[i].level<64 && ++counts[s->runs[i].level]==URL_SORT_FANIN)
+				level = s->runs[i].level;
+		if(level==64)
+			break;
+
+		// Take the runs of the level out of the list
+		url_sort_run group[URL_SORT_FANIN];
+		size_t n = 0, kept = 0;
+		for(size_t i=0; i<s->run_count; i++) {
+			if(s->runs[i].level==level && n<URL_SORT_FANIN)
+				group[n++] = s->runs[i];
+			else
+				s->runs[kept++] = s->runs[i];
+		}
+		s->run_count = kept;
+		s->merging = true;
+		pthread_mutex_unlock(&s->lock);
+
+		FILE *merged = url_SortMergeRuns(s, group, n);
+		for(size_t i=0; i<n; i++)
+			fclose(group[i].file);
+
+		pthread_mutex_lock(&s->lock);
+		s->merging = false;
+		pthread_cond_broadcast(&s->cond);
+		if(merged==NULL || !url_SortAddRun(s, merged, level+1)) {
+			if(merged)
+				fclose(merged);
+			__atomic_store_n(&s->failed, true, __ATOMIC_RELAXED);
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+
+// Spill a buffer, put it back in the free list, and merge runs if enough
+// were spilled
+static void url_SortProcess(url_sorter *s, url_sort_buffer *b)
+{
+	FILE *run = b->count ? url_SortSpill(s, b) : NULL;
+
+	pthread_mutex_lock(&s->lock);
+	if(b->count && (run==NULL || !url_SortAddRun(s, run, 0))) {
+		if(run)
+			fclose(run);
+		__atomic_store_n(&s->failed, true, __ATOMIC_RELAXED);
+	}
+	b->raw_len = 0;
+	b->count = 0;
+	s->free[s->free_count++] = b;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+
+	url_SortCompact(s);
+}
+
+
+static void *url_SortWorker(void *arg)
+{
+	url_sorter *s = arg;
+	for(;;) {
+		pthread_mutex_lock(&s->lock);
+		while(s->todo_count==0 && !s->stop)
+			pthread_cond_wait(&s->cond, &s->lock);
+		if(s->todo_count==0) {
+			pthread_mutex_unlock(&s->lock);
+			return(NULL);
+		}
+		url_sort_buffer *b = s->todo[--s->todo_count];
+		s->busy++;
+		pthread_mutex_unlock(&s->lock);
+
+		url_SortProcess(s, b);
+
+		pthread_mutex_lock(&s->lock);
+		s->busy--;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+	}
+}
+
+
+/**
+ * Create a new external sorter.
+ * @param  tmp_dir Directory of the temporary run files, or NULL for "/tmp".
+ *                 Files are deleted as soon as they are created, so nothing
+ *                 is left behind if the process dies.
+ * @param  memory  Memory used to buffer URLs, or 0 for URL_SORT_MEMORY.
+ *                 Canonicalization and sorting of a buffer need about as
+ *                 much again.
+ * @param  threads Number of worker threads, or 0 to do everything in the
+ *                 calling thread.
+ * @return         Pointer to a new sorter, to be freed with url_SorterFree(),
+ *                 or NULL if error.
+ */
+extern url_sorter *url_SorterNew(const char *tmp_dir, size_t memory, unsigned threads)
+{
+	if(tmp_dir==NULL)
+		tmp_dir = "/tmp";
+	if(memory==0)
+		memory = URL_SORT_MEMORY;
+	if(threads>1024)
+		return(NULL);
+
+	url_sorter *s = calloc(1, sizeof(url_sorter));
+	if(s==NULL)
+		return(NULL);
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	s->threads = threads;
+
+	unsigned buffer_count = threads + 1;
+	s->buffer_size = memory / buffer_count;
+	if(s->buffer_size < 4096)
+		s->buffer_size = 4096;
+
+	s->tmp_dir = strdup(tmp_dir);
+	s->buffers = calloc(buffer_count, sizeof(url_sort_buffer));
+	s->todo = calloc(buffer_count, sizeof(url_sort_buffer *));
+	s->free = calloc(buffer_count, sizeof(url_sort_buffer *));
+	s->workers = calloc(threads + 1, sizeof(pthread_t));
+	if(s->tmp_dir==NULL || s->buffers==NULL || s->todo==NULL || s->free==NULL || s->workers==NULL)
+		goto bad;
+	for(unsigned i=0; i<buffer_count; i++)
+		s->free[s->free_count++] = &s->buffers[i];
+
+	for( ; s->started<threads; s->started++)
+		if(pthread_create(&s->workers[s->started], NULL, url_SortWorker, s))
+			goto bad;
+
+	return(s);
+
+bad:
+	url_SorterFree(s);
+	return(NULL);
+}
+
+
+/**
+ * Add an URL to be canonicalized and sorted.
+ * @param  s   Sorter.
+ * @param  url Pointer to the URL.
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     0, or -1 if error.
+ */
+extern int url_SorterAdd(url_sorter *s, const char *url, size_t len)
+{
+	if(s==NULL || url==NULL || s->finished)
+		return(-1);
+	if(len==0)
+		len = strlen(url);
+
+	if(s->current==NULL) {
+		pthread_mutex_lock(&s->lock);
+		while(s->free_count==0)
+			pthread_cond_wait(&s->cond, &s->lock);
+		s->current = s->free[--s->free_count];
+		bool failed = s->failed;
+		pthread_mutex_unlock(&s->lock);
+		if(failed)
+			return(-1);
+	}
+
+	url_sort_buffer *b = s->current;
+	if(b->raw_len + len > b->raw_cap) {
+		size_t cap = b->raw_len + len > s->buffer_size ? b->raw_len + len : s->buffer_size;
+		char *raw = realloc(b->raw, cap);
+		if(raw==NULL)
+			return(-1);
+		b->raw = raw;
+		b->raw_cap = cap;
+	}
+	if(b->count==b->entries_cap) {
+		size_t cap = b->entries_cap ? 2*b->entries_cap : 4096;
+		url_sort_raw *entries = realloc(b->entries, cap * sizeof(url_sort_raw));
+		if(entries==NULL)
+			return(-1);
+		b->entries = entries;
+		b->entries_cap = cap;
+	}
+	memcpy(b->raw + b->raw_len, url, len);
+	b->entries[b->count].offset = b->raw_len;
+	b->entries[b->count].len = len;
+	b->raw_len += len;
+	b->count++;
+
+	// Entries and their array count in the memory budget too
+	if(b->raw_len + b->count * sizeof(url_sort_raw) >= s->buffer_size) {
+		s->current = NULL;
+		if(s->threads==0) {
+			url_SortProcess(s, b);
+		} else {
+			pthread_mutex_lock(&s->lock);
+			s->todo[s->todo_count++] = b;
+			pthread_cond_signal(&s->cond);
+			pthread_mutex_unlock(&s->lock);
+		}
+	}
+	return(__atomic_load_n(&s->failed, __ATOMIC_RELAXED) ? -1 : 0);
+}
+
+
+typedef struct {
+	url_sorter *s;
+	url_sort_run *merged;
+	size_t groups;
+	size_t next;
+} url_sort_pass;
+
+
+// Merge groups of URL_SORT_FANIN runs, taking the next group until none is left
+static void *url_SortMergeWorker(void *arg)
+{
+	url_sort_pass *pass = arg;
+	url_sorter *s = pass->s;
+	for(;;) {
+		size_t g = __atomic_fetch_add(&pass->next, 1, __ATOMIC_RELAXED);
+		if(g >= pass->groups)
+			return(NULL);
+		size_t first = g * URL_SORT_FANIN;
+		size_t count = s->run_count - first < URL_SORT_FANIN ? s->run_count - first : URL_SORT_FANIN;
+
+		pass->merged[g].file = url_SortMergeRuns(s, s->runs + first, count);
+		pass->merged[g].level = 0;
+		if(pass->merged[g].file==NULL)
+			__atomic_store_n(&s->failed, true, __ATOMIC_RELAXED);
+	}
+}
+
+
+/**
+ * Merge all the URLs added so far and call a function for each distinct
+ * canonicalized URL, in memcmp() order. URLs which could not be
+ * canonicalized are ignored. Can only be called once.
+ * @param  s        Sorter.
+ * @param  callback Function to be called.
+ * @param  ctx      Pointer given to the callback.
+ * @return          Number of distinct URLs given to the callback, or -1 if
+ *                  error.
+ */
+extern int64_t url_SorterFinish(url_sorter *s, url_sort_callback callback, void *ctx)
+{
+	if(s==NULL || callback==NULL || s->finished)
+		return(-1);
+	s->finished = true;
+
+	// Spill the last buffer and wait for the workers
+	if(s->current) {
+		url_sort_buffer *b = s->current;
+		s->current = NULL;
+		url_SortProcess(s, b);
+	}
+	pthread_mutex_lock(&s->lock);
+	while(s->todo_count || s->busy)
+		pthread_cond_wait(&s->cond, &s->lock);
+	s->stop = true;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	for( ; s->started>0; s->started--)
+		pthread_join(s->workers[s->started-1], NULL);
+	if(s->failed)
+		return(-1);
+
+	// Merge passes, one thread per group up to the number of workers
+	while(s->run_count > URL_SORT_FANIN) {
+		url_sort_pass pass = { s, NULL, (s->run_count + URL_SORT_FANIN - 1) / URL_SORT_FANIN, 0 };
+		pass.merged = calloc(pass.groups, sizeof(url_sort_run));
+		if(pass.merged==NULL)
+			return(-1);
+		unsigned threads = s->threads < pass.groups ? s->threads : (unsigned)pass.groups;
+		unsigned started;
+		for(started=0; started<threads; started++)
+			if(pthread_create(&s->workers[started], NULL, url_SortMergeWorker, &pass))
+				break;
+		url_SortMergeWorker(&pass);
+		while(started>0)
+			pthread_join(s->workers[--started], NULL);
+
+		for(size_t i=0; i<s->run_count; i++)
+			fclose(s->runs[i].file);
+		memcpy(s->runs, pass.merged, pass.groups * sizeof(url_sort_run));
+		s->run_count = pass.groups;
+		free(pass.merged);
+		if(s->failed) {
+			// Failed groups left NULL runs
+			size_t n = 0;
+			for(size_t i=0; i<s->run_count; i++)
+				if(s->runs[i].file)
+					s->runs[n++] = s->runs[i];
+			s->run_count = n;
+			return(-1);
+		}
+	}
+
+	return(url_SortMerge(s->runs, s->run_count, callback, ctx));
+}
+
+
+/**
+ * Free a sorter and its temporary files.
+ * @param s Pointer returned by url_SorterNew(), or NULL.
+ */
+extern void url_SorterFree(url_sorter *s)
+{
+	if(s==NULL)
+		return;
+
+	pthread_mutex_lock(&s->lock);
+	s->stop = true;
+	s->todo_count = 0;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	for( ; s->started>0; s->started--)
+		pthread_join(s->workers[s->started-1], NULL);
+
+	if(s->buffers)
+		for(unsigned i=0; i<=s->threads; i++) {
+			free(s->buffers[i].raw);
+			free(s->buffers[i].entries);
+		}
+	for(size_t i=0; i<s->run_count; i++)
+		fclose(s->runs[i].file);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+	free(s->runs);
+	free(s->buffers);
+	free(s->todo);
+	free(s->free);
+	free(s->workers);
+	free(s->tmp_dir);
+	free(s);
+}
@@ -0,0 +1,86 @@
+#ifndef _URL_SORT_H_
+#define _URL_SORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	External sort and unique of canonicalized URLs, for data sets bigger
+	than the memory.
+
+	URLs are collected in fixed size buffers. Each full buffer is handed to
+	a worker thread which canonicalizes its URLs, sorts them with a most
+	significant byte first radix sort and spills them, without duplicates,
+	to a temporary run file. Runs are compressed by front coding : each URL
+	is stored as the length of the prefix it shares with the previous one
+	and the remaining suffix, which removes most of the repeated schemes and
+	hosts. As soon as URL_SORT_FANIN runs of the same level exist, they are
+	merged into one run of the next level, so that the number of open run
+	files stays logarithmic in the input size. When finishing, the
+	remaining runs are merged URL_SORT_FANIN at a time by the worker
+	threads until few enough are left, then merged a last time to return
+	each distinct URL once, in memcmp() order.
+*/
+
+// Default memory used for the buffers of URLs to be sorted
+#define URL_SORT_MEMORY (256*1024*1024)
+
+// Maximum number of runs merged at once
+#define URL_SORT_FANIN 64
+
+typedef struct url_sorter url_sorter;
+
+/**
+ * Function called by url_SorterFinish() for each distinct URL, in order.
+ * @param  ctx Pointer given to url_SorterFinish().
+ * @param  url Pointer to the NUL terminated canonicalized URL, valid until
+ *             the function returns.
+ * @param  len Length of the URL.
+ * @return     0 to continue, anything else to stop the merge.
+ */
+typedef int (*url_sort_callback)(void *ctx, const char *url, size_t len);
+
+
+/**
+ * Create a new external sorter.
+ * @param  tmp_dir Directory of the temporary run files, or NULL for "/tmp".
+ *                 Files are deleted as soon as they are created, so nothing
+ *                 is left behind if the process dies.
+ * @param  memory  Memory used to buffer URLs, or 0 for URL_SORT_MEMORY.
+ *                 Canonicalization and sorting of a buffer need about as
+ *                 much again.
+ * @param  threads Number of worker threads, or 0 to do everything in the
+ *                 calling thread.
+ * @return         Pointer to a new sorter, to be freed with url_SorterFree(),
+ *                 or NULL if error.
+ */
+extern url_sorter *url_SorterNew(const char *tmp_dir, size_t memory, unsigned threads);
+
+/**
+ * Add an URL to be canonicalized and sorted.
+ * @param  s   Sorter.
+ * @param  url Pointer to the URL.
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     0, or -1 if error.
+ */
+extern int url_SorterAdd(url_sorter *s, const char *url, size_t len);
+
+/**
+ * Merge all the URLs added so far and call a function for each distinct
+ * canonicalized URL, in memcmp() order. URLs which could not be
+ * canonicalized are ignored. Can only be called once.
+ * @param  s        Sorter.
+ * @param  callback Function to be called.
+ * @param  ctx      Pointer given to the callback.
+ * @return          Number of distinct URLs given to the callback, or -1 if
+ *                  error.
+ */
+extern int64_t url_SorterFinish(url_sorter *s, url_sort_callback callback, void *ctx);
+
+/**
+ * Free a sorter and its temporary files.
+ * @param s Pointer returned by url_SorterNew(), or NULL.
+ */
+extern void url_SorterFree(url_sorter *s);
+
+#endif
@@ -0,0 +1,973 @@
+/*
+	Incremental canonicalization.
+
+	url_Canonicalize() is made of successive passes over the whole URL. Here
+	the same transformations are applied by a pipeline of small stages, each
+	one fed byte by byte by the previous one :
+
+	- clean : removes leading and trailing spaces, tab, CR and LF, and stops
+	  at the fragment, like url_RemoveTabCRLF() and url_RemoveFragment().
+	- unescape : percent-decodes until no more decoding can be done, like
+	  url_Unescape(). Decoded bytes are kept on a stack as long as they can
+	  still be part of a "%XX" sequence.
+	- normalize : scheme, host and path rules of url_Normalize(). Only the
+	  prefix of the URL while looking for a scheme, a host made of digits
+	  and the path (which a "/../" can shorten) need to be buffered.
+	- escape : like url_Escape() or url_EscapeIncludingReservedChars().
+
+	The first cleaned bytes are held back until it is known if the URL has an
+	opaque scheme (see url_IsOpaque()) : if so, they skip all the other
+	stages, as in url_Canonicalize().
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "url.h"
+#include "url_stream.h"
+
+
+
+// Convert an hexadecimal character [0-9a-zA-Z] to it's integer value
+#define VAL(x) ((x>='0' && x<='9') ? x-'0' : ((x>='a' && x<='f') ? x-'a'+10 : ((x>='A' && x<='F') ? x-'A'+10 : 0)))
+
+#define IS_HEX(x) (((x)>='0' && (x)<='9') || ((x)>='a' && (x)<='f') || ((x)>='A' && (x)<='F'))
+
+#define LOWERCASE(x) ((x)>='A' && (x)<='Z' ? (x)-'A'+'a' : (x))
+
+#define URL_STREAM_NO_COLON SIZE_MAX
+
+
+typedef url_canonicalizer_callback url_stream_sink;
+
+typedef struct {
+	char *data;
+	size_t len, cap;
+	bool fixed;			// data is not allocated by the stream and cannot grow
+} url_stream_buf;
+
+typedef enum {
+	URL_STREAM_SCHEME,
+	URL_STREAM_SLASHES,
+	URL_STREAM_HOST,
+	URL_STREAM_PATH,
+	URL_STREAM_QUERY
+} url_stream_state;
+
+typedef enum {
+	URL_STREAM_OPAQUE_UNKNOWN,
+	URL_STREAM_OPAQUE_NO,
+	URL_STREAM_OPAQUE_YES
+} url_stream_opaque;
+
+typedef struct {
+	bool full_escape;
+	url_stream_sink sink;
+	void *ctx;
+
+	bool ended;			// the rest of the input is to be ignored
+	bool failed;		// a buffer could not grow
+	size_t max_state;	// maximum bytes buffered at once, 0 if unbounded
+
+	// clean
+	bool started;		// leading spaces have been skipped
+	size_t spaces;		// spaces that will be dropped if they end the URL
+	size_t kept;		// bytes kept, the fragment counting for one
+
+	// opaque scheme
+	url_stream_opaque opaque;
+	char prefix[URL_OPAQUE_SCHEME_MAX+1];
+	size_t prefix_len;
+	int opaque_policy;
+	size_t opaque_max;	// maximum length of a truncated URL
+	size_t opaque_len;	// bytes of the opaque URL given to the sink or hashed
+	url_hash64_state opaque_hash;
+
+	// unescape
+	url_stream_buf stack;
+
+	// normalize
+	url_stream_state state;
+	url_stream_buf scheme;
+	size_t colon;
+	bool host_started;
+	bool host_digits;
+	size_t host_dots;
+	unsigned long host_value;
+	url_stream_buf host;
+	char look[4];
+	size_t look_len;
+	url_stream_buf path;
+} url_stream;
+
+
+
+static void url_StreamInit(url_stream *s, bool full_escape, url_stream_sink sink, void *ctx)
+{
+	memset(s, 0, sizeof(url_stream));
+	s->full_escape = full_escape;
+	s->sink = sink;
+	s->ctx = ctx;
+	s->state = URL_STREAM_SCHEME;
+	s->colon = URL_STREAM_NO_COLON;
+	s->host_digits = true;
+	s->opaque_policy = URL_OPAQUE_PASSTHROUGH;
+	s->opaque_max = URL_OPAQUE_MAX_LEN;
+}
+
+
+static inline void url_StreamUseBuffer(url_stream_buf *buf, char *storage, size_t size)
+{
+	buf->data = storage;
+	buf->len = 0;
+	buf->cap = size;
+	buf->fixed = true;
+}
+
+
+static inline bool url_StreamPush(url_stream *s, url_stream_buf *buf, char c)
+{
+	if(buf->len == buf->cap) {
+		if(buf->fixed) {
+			s->failed = true;
+			s->ended = true;
+			return(false);
+		}
+		if(s->max_state && s->stack.len+s->scheme.len+s->host.len+s->path.len >= s->max_state) {
+			s->failed = true;
+			s->ended = true;
+			return(false);
+		}
+		size_t cap = buf->cap ? 2*buf->cap : 64;
+		char *data = realloc(buf->data, cap);
+		if(data==NULL) {
+			s->failed = true;
+			s->ended = true;
+			return(false);
+		}
+		buf->data = data;
+		buf->cap = cap;
+	}
+	buf->data[buf->len++] = c;
+	return(true);
+}
+
+
+/**
+ * Percent-encode normalized bytes and give them to the sink.
+ */
+static void url_StreamEmit(url_stream *s, const char *bytes, size_t len)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char out[256];
+	size_t n = 0;
+
+	for(size_t i=0; i<len; i++) {
+		unsigned char c = bytes[i];
+		if(    c<=32 || c>=127 || c=='%'
+			|| (s->full_escape ? strchr("!*'();:@&=+$,/?#[]", c)!=NULL : c=='#')) {
+			out[n++] = '%';
+			out[n++] = hex[c >> 4];
+			out[n++] = hex[c & 15];
+		} else
+			out[n++] = c;
+		if(n > sizeof(out)-3) {
+			s->sink(s->ctx, out, n);
+			n = 0;
+		}
+	}
+	if(n)
+		s->sink(s->ctx, out, n);
+}
+
+
+static void url_StreamHostNotNumber(url_stream *s)
+{
+	if(s->host_digits) {
+		s->host_digits = false;
+		url_StreamEmit(s, s->host.data, s->host.len);
+		s->host.len = 0;
+	}
+}
+
+
+static void url_StreamHostChar(url_stream *s, char c)
+{
+	// Ignore leading dots
+	if(!s->host_started) {
+		if(c=='.')
+			return;
+		s->host_started = true;
+	}
+
+	// Dots are kept only if they are not trailing ones
+	if(c=='.') {
+		s->host_dots++;
+		return;
+	}
+	if(s->host_dots) {
+		url_StreamHostNotNumber(s);
+		for( ; s->host_dots; s->host_dots--)
+			url_StreamEmit(s, ".", 1);
+	}
+
+	// A host only made of digits is converted to an IP address
+	if(s->host_digits && c>='0' && c<='9') {
+		if(!url_StreamPush(s, &s->host, c))
+			return;
+		unsigned long digit = c - '0';
+		if(s->host_value > (ULONG_MAX - digit)/10)
+			s->host_value = ULONG_MAX;
+		else
+			s->host_value = s->host_value*10 + digit;
+		return;
+	}
+
+	url_StreamHostNotNumber(s);
+	c = LOWERCASE(c);
+	url_StreamEmit(s, &c, 1);
+}
+
+
+static void url_StreamHostEnd(url_stream *s)
+{
+	s->host_dots = 0;
+	if(s->host_digits) {
+		uint32_t ip = (uint32_t)s->host_value;
+		char str[16];
+		int n = sprintf(str, "%u.%u.%u.%u", ip >> 24, (ip >> 16) & 255, (ip >> 8) & 255, ip & 255);
+		url_StreamEmit(s, str, n);
+		s->host.len = 0;
+	}
+
+	// The '/' following the host is part of the path, as "/.." can remove it
+	url_StreamPush(s, &s->path, '/');
+}
+
+
+static void url_StreamPathCommit(url_stream *s)
+{
+	url_StreamEmit(s, s->path.data, s->path.len);
+	s->path.len = 0;
+}
+
+
+/**
+ * Apply url_Normalize() path rules to the first lookahead byte. Called with
+ * 4 lookahead bytes, or less at the end of the URL.
+ */
+static void url_StreamPathStep(url_stream *s)
+{
+	char c[4] = { '\0', '\0', '\0', '\0' };
+	memcpy(c, s->look, s->look_len);
+	size_t used = 1;
+
+	switch(c[0]) {
+		case '?':
+			// Entering query : the path cannot change anymore
+			url_StreamPush(s, &s->path, '?');
+			url_StreamPathCommit(s);
+			s->state = URL_STREAM_QUERY;
+			break;
+		case '/':
+			if(c[1]=='.' && c[2]=='/') {
+				// replace "/./" with "/"
+				url_StreamPush(s, &s->path, '/');
+				used = 2;
+			} else if(c[1]=='.' && c[2]=='.' && (c[3]=='/' || c[3]=='\0')) {
+				// Remove "/../" along with the preceding path component.
+				// Index 0 of the path is the '/' following the host.
+				long d = (long)s->path.len;
+				if(d>=1 && s->path.data[d-1]=='/')
+					d--;
+				do {
+					d--;
+				} while(d>=1 && s->path.data[d]!='/');
+				d++;
+				s->path.len = d;
+				used = 3;
+			} else
+				url_StreamPush(s, &s->path, '/');
+			// Replace runs of consecutive slashes with a single slash character.
+			if(s->path.len>=2 && s->path.data[s->path.len-1]=='/' && s->path.data[s->path.len-2]=='/')
+				s->path.len--;
+			break;
+		default:
+			url_StreamPush(s, &s->path, c[0]);
+	}
+
+	memmove(s->look, s->look+used, s->look_len-used);
+	s->look_len -= used;
+
+	if(s->state==URL_STREAM_QUERY) {
+		url_StreamEmit(s, s->look, s->look_len);
+		s->look_len = 0;
+	}
+}
+
+
+// Normalize a byte following the scheme part
+static void url_StreamAfterScheme(url_stream *s, char c)
+{
+	switch(s->state) {
+		case URL_STREAM_SLASHES:
+			// Skip leading '/' if any
+			if(c=='/')
+				return;
+			s->state = URL_STREAM_HOST;
+			// fall through
+		case URL_STREAM_HOST:
+			if(c=='/' || c=='?') {
+				url_StreamHostEnd(s);
+				s->state = URL_STREAM_PATH;
+			} else {
+				url_StreamHostChar(s, c);
+				return;
+			}
+			// fall through
+		case URL_STREAM_PATH:
+			s->look[s->look_len++] = c;
+			if(s->look_len==4)
+				url_StreamPathStep(s);
+			return;
+		case URL_STREAM_QUERY:
+			url_StreamEmit(s, &c, 1);
+			return;
+		default:
+			return;
+	}
+}
+
+
+// Decide if the buffered prefix of the URL starts with a scheme
+static void url_StreamSchemeEnd(url_stream *s)
+{
+	url_stream_buf *buf = &s->scheme;
+
+	s->state = URL_STREAM_SLASHES;
+
+	if(	   s->colon!=URL_STREAM_NO_COLON && buf->len>=s->colon+3
+		&& buf->data[s->colon+1]=='/' && buf->data[s->colon+2]=='/') {
+		for(size_t i=0; i<s->colon; i++)
+			buf->data[i] = LOWERCASE(buf->data[i]);
+		url_StreamEmit(s, buf->data, s->colon+3);
+		for(size_t i=s->colon+3; i<buf->len; i++)
+			url_StreamAfterScheme(s, buf->data[i]);
+	} else {
+		// No scheme part, use "http" as default
+		url_StreamEmit(s, "http://", 7);
+		for(size_t i=0; i<buf->len; i++)
+			url_StreamAfterScheme(s, buf->data[i]);
+	}
+	buf->len = 0;
+}
+
+
+// Normalize an unescaped byte
+static void url_StreamNormalize(url_stream *s, char c)
+{
+	if(s->state!=URL_STREAM_SCHEME) {
+		url_StreamAfterScheme(s, c);
+		return;
+	}
+
+	// The scheme ends at the first ':', if followed by "//"
+	if(!url_StreamPush(s, &s->scheme, c))
+		return;
+	if(c==':' && s->colon==URL_STREAM_NO_COLON)
+		s->colon = s->scheme.len - 1;
+	if(s->colon!=URL_STREAM_NO_COLON && s->scheme.len==s->colon+3)
+		url_StreamSchemeEnd(s);
+}
+
+
+static void url_StreamNormalizeEnd(url_stream *s)
+{
+	if(s->state==URL_STREAM_SCHEME)
+		url_StreamSchemeEnd(s);
+	if(s->state==URL_STREAM_SLASHES)
+		s->state = URL_STREAM_HOST;
+	if(s->state==URL_STREAM_HOST) {
+		url_StreamHostEnd(s);
+		s->state = URL_STREAM_PATH;
+	}
+	while(s->state==URL_STREAM_PATH && s->look_len>0)
+		url_StreamPathStep(s);
+	if(s->state==URL_STREAM_PATH)
+		url_StreamPathCommit(s);
+}
+
+
+// Unescape a cleaned byte
+static void url_StreamUnescape(url_stream *s, char c)
+{
+	url_stream_buf *stack = &s->stack;
+
+	if(s->ended || !url_StreamPush(s, stack, c))
+		return;
+
+	// Decode as long as the top of the stack is a "%XX" sequence
+	while(	   stack->len>=3 && stack->data[stack->len-3]=='%'
+			&& IS_HEX(stack->data[stack->len-2]) && IS_HEX(stack->data[stack->len-1])) {
+		char decoded = 16*VAL(stack->data[stack->len-2]) + VAL(stack->data[stack->len-1]);
+		stack->len -= 2;
+		stack->data[stack->len-1] = decoded;
+		if(decoded=='\0') {
+			// A decoded NUL character ends the URL
+			stack->len--;
+			s->ended = true;
+			break;
+		}
+	}
+
+	// Bytes below the first '%' of the trailing run of '%' and hex digits
+	// cannot be decoded anymore. As those are flushed after each byte, the
+	// stack is always a single such run, starting with '%' unless it is a
+	// lone hex digit : no need to scan it again.
+	size_t live = stack->len;
+	if(!s->ended && stack->len>0) {
+		char top = stack->data[stack->len-1];
+		if(top=='%' || IS_HEX(top))
+			live = stack->data[0]=='%' ? 0 : 1;
+	}
+
+	for(size_t i=0; i<live; i++)
+		url_StreamNormalize(s, stack->data[i]);
+	memmove(stack->data, stack->data+live, stack->len-live);
+	stack->len -= live;
+}
+
+
+/**
+ * Give escaped bytes of an URL with an opaque scheme to the sink, following
+ * the policy.
+ */
+static void url_StreamOpaqueOut(url_stream *s, const char *bytes, size_t len)
+{
+	if(s->opaque_policy==URL_OPAQUE_HASH)
+		url_Hash64Update(&s->opaque_hash, bytes, len);
+	else
+		s->sink(s->ctx, bytes, len);
+	s->opaque_len += len;
+}
+
+
+/**
+ * Canonicalize the bytes of an URL with an opaque scheme following the
+ * scheme, the same way url_Canonicalize() does : they are only cleaned and
+ * escaped.
+ */
+static void url_StreamOpaque(url_stream *s, const char *chunk, size_t len)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char out[256];
+	size_t n = 0;
+
+	for(size_t i=0; i<len && !s->ended; i++) {
+		unsigned char c = chunk[i];
+		if(c==' ') {
+			s->spaces++;
+			continue;
+		}
+		for( ; s->spaces; s->spaces--) {
+			if(s->opaque_policy==URL_OPAQUE_TRUNCATE && s->opaque_len + n + 3 > s->opaque_max)
+				goto truncated;
+			out[n++] = '%'; out[n++] = '2'; out[n++] = '0';
+			if(n > sizeof(out)-3) {
+				url_StreamOpaqueOut(s, out, n);
+				n = 0;
+			}
+		}
+		if(c=='\0' || c=='#') {
+			s->ended = true;
+			break;
+		}
+		if(c=='\t' || c=='\r' || c=='\n')
+			continue;
+		size_t size = (c<=32 || c>=127) ? 3 : 1;
+		if(s->opaque_policy==URL_OPAQUE_TRUNCATE && s->opaque_len + n + size > s->opaque_max)
+			goto truncated;
+		if(size==3) {
+			out[n++] = '%';
+			out[n++] = hex[c >> 4];
+			out[n++] = hex[c & 15];
+		} else
+			out[n++] = c;
+		if(n > sizeof(out)-3) {
+			url_StreamOpaqueOut(s, out, n);
+			n = 0;
+		}
+	}
+	if(n)
+		url_StreamOpaqueOut(s, out, n);
+	return;
+
+truncated:
+	if(n)
+		url_StreamOpaqueOut(s, out, n);
+	s->ended = true;
+}
+
+
+/**
+ * Pass a cleaned byte to the unescape stage, unless the URL has an opaque
+ * scheme.
+ */
+static void url_StreamCleaned(url_stream *s, char c)
+{
+	if(s->opaque==URL_STREAM_OPAQUE_NO) {
+		url_StreamUnescape(s, c);
+		return;
+	}
+	if(s->opaque==URL_STREAM_OPAQUE_YES) {
+		url_StreamOpaque(s, &c, 1);
+		return;
+	}
+
+	s->prefix[s->prefix_len++] = c;
+	if(c==':' && url_IsOpaque(s->prefix, s->prefix_len)) {
+		s->opaque = URL_STREAM_OPAQUE_YES;
+		for(size_t i=0; i<s->prefix_len; i++)
+			s->prefix[i] = LOWERCASE(s->prefix[i]);
+		if(s->opaque_policy==URL_OPAQUE_HASH) {
+			// The scheme is kept in front of the hash
+			s->sink(s->ctx, s->prefix, s->prefix_len);
+			url_Hash64Start(&s->opaque_hash, 0);
+		}
+		url_StreamOpaque(s, s->prefix, s->prefix_len);
+		return;
+	}
+
+	c = LOWERCASE(c);
+	if(c==':' || c<'a' || c>'z' || s->prefix_len>URL_OPAQUE_SCHEME_MAX) {
+		s->opaque = URL_STREAM_OPAQUE_NO;
+		for(size_t i=0; i<s->prefix_len; i++)
+			url_StreamUnescape(s, s->prefix[i]);
+		s->prefix_len = 0;
+	}
+}
+
+
+/**
+ * Feed raw bytes of an URL to the stream.
+ */
+static void url_StreamFeed(url_stream *s, const char *chunk, size_t len)
+{
+	for(size_t i=0; i<len && !s->ended; i++) {
+		if(s->opaque==URL_STREAM_OPAQUE_YES) {
+			url_StreamOpaque(s, chunk+i, len-i);
+			return;
+		}
+
+		char c = chunk[i];
+
+		// Leading spaces are skipped, trailing ones are kept only if
+		// something else follows them
+		if(c==' ') {
+			if(s->started)
+				s->spaces++;
+			continue;
+		}
+		s->started = true;
+		for( ; s->spaces && !s->ended; s->spaces--) {
+			s->kept++;
+			url_StreamCleaned(s, ' ');
+		}
+
+		switch(c) {
+			case '\r':
+			case '\n':
+			case '\t':
+				break;
+			case '\0':
+				s->ended = true;
+				break;
+			case '#':
+				s->kept++;
+				s->ended = true;
+				break;
+			default:
+				s->kept++;
+				url_StreamCleaned(s, c);
+		}
+	}
+}
+
+
+/**
+ * Signal the end of the URL to the stream, flushing all the remaining output.
+ * @return true if the URL was canonicalized, false if it was empty or a
+ *         buffer could not grow.
+ */
+static bool url_StreamFinish(url_stream *s)
+{
+	// Bytes held back while looking for an opaque scheme, even if the rest of
+	// the input was ignored
+	if(s->opaque==URL_STREAM_OPAQUE_UNKNOWN) {
+		s->opaque = URL_STREAM_OPAQUE_NO;
+		s->ended = false;
+		for(size_t i=0; i<s->prefix_len; i++)
+			url_StreamUnescape(s, s->prefix[i]);
+		s->prefix_len = 0;
+	}
+
+	s->ended = true;
+	if(s->kept==0 || s->failed)
+		return(false);
+
+	if(s->opaque==URL_STREAM_OPAQUE_YES) {
+		if(s->opaque_policy==URL_OPAQUE_HASH) {
+			char str[17];
+			sprintf(str, "%016llx", (unsigned long long)url_Hash64Digest(&s->opaque_hash));
+			s->sink(s->ctx, str, 16);
+		}
+		return(true);
+	}
+
+	for(size_t i=0; i<s->stack.len; i++)
+		url_StreamNormalize(s, s->stack.data[i]);
+	s->stack.len = 0;
+
+	url_StreamNormalizeEnd(s);
+	return(!s->failed);
+}
+
+
+
+struct url_canonicalizer {
+	url_stream stream;
+	bool full_escape;
+	size_t max_state;
+	int opaque_policy;
+	size_t opaque_max;
+	url_canonicalizer_callback callback;
+	void *ctx;
+};
+
+
+/**
+ * Create a canonicalizer, fed with an URL piece by piece.
+ * @param  full_escape If true, reserved characters are escaped as
+ *                     url_EscapeIncludingReservedChars() does.
+ * @param  max_state   Maximum number of bytes kept between chunks, or 0 for
+ *                     URL_CANONICALIZER_STATE. Longer paths or scheme-less
+ *                     prefixes make the URL fail.
+ * @param  callback    Function receiving the canonicalized bytes.
+ * @param  ctx         Pointer given to the callback.
+ * @return             Pointer to a new canonicalizer, to be freed with
+ *                     url_CanonicalizerFree(), or NULL if error.
+ */
+extern url_canonicalizer *url_CanonicalizerNew(bool full_escape, size_t max_state, url_canonicalizer_callback callback, void *ctx)
+{
+	if(callback==NULL)
+		return(NULL);
+
+	url_canonicalizer *c = calloc(1, sizeof(url_canonicalizer));
+	if(c==NULL)
+		return(NULL);
+	c->full_escape = full_escape;
+	c->max_state = max_state ? max_state : URL_CANONICALIZER_STATE;
+	c->opaque_policy = URL_OPAQUE_PASSTHROUGH;
+	c->opaque_max = URL_OPAQUE_MAX_LEN;
+	c->callback = callback;
+	c->ctx = ctx;
+	url_StreamInit(&c->stream, full_escape, callback, ctx);
+	c->stream.max_state = c->max_state;
+	return(c);
+}
+
+
+/**
+ * Choose how the URLs with an opaque scheme given to a canonicalizer are
+ * canonicalized, as url_CanonicalizeWithOpaquePolicy() does. Applies from
+ * the current URL, unless its opaque scheme was already fed.
+ * @param c       Canonicalizer.
+ * @param policy  URL_OPAQUE_PASSTHROUGH (default), URL_OPAQUE_TRUNCATE or
+ *                URL_OPAQUE_HASH.
+ * @param max_len Maximum length of a canonicalized URL with the
+ *                URL_OPAQUE_TRUNCATE policy, or 0 for URL_OPAQUE_MAX_LEN.
+ */
+extern void url_CanonicalizerSetOpaquePolicy(url_canonicalizer *c, int policy, size_t max_len)
+{
+	if(c==NULL)
+		return;
+	c->opaque_policy = policy;
+	c->opaque_max = max_len ? max_len : URL_OPAQUE_MAX_LEN;
+	if(c->stream.opaque!=URL_STREAM_OPAQUE_YES) {
+		c->stream.opaque_policy = c->opaque_policy;
+		c->stream.opaque_max = c->opaque_max;
+	}
+}
+
+
+/**
+ * Feed the next bytes of an URL to a canonicalizer. The callback may be
+ * called with the canonicalized bytes that cannot change anymore.
+ * @param  c     Canonicalizer.
+ * @param  chunk Pointer to the bytes.
+ * @param  len   Number of bytes.
+ * @return       0, or -1 if the URL already failed.
+ */
+extern int url_CanonicalizerFeed(url_canonicalizer *c, const char *chunk, size_t len)
+{
+	if(c==NULL || (chunk==NULL && len>0))
+		return(-1);
+	url_StreamFeed(&c->stream, chunk, len);
+	return(c->stream.failed ? -1 : 0);
+}
+
+
+/**
+ * Forget the current URL, to start a new one.
+ * @param c Canonicalizer.
+ */
+extern void url_CanonicalizerReset(url_canonicalizer *c)
+{
+	if(c==NULL)
+		return;
+
+	// Keep the buffers already grown for the next URL
+	url_stream *s = &c->stream;
+	url_stream_buf stack = s->stack, scheme = s->scheme, host = s->host, path = s->path;
+	url_StreamInit(s, c->full_escape, c->callback, c->ctx);
+	s->max_state = c->max_state;
+	s->opaque_policy = c->opaque_policy;
+	s->opaque_max = c->opaque_max;
+	s->stack = stack;
+	s->scheme = scheme;
+	s->host = host;
+	s->path = path;
+	s->stack.len = s->scheme.len = s->host.len = s->path.len = 0;
+}
+
+
+/**
+ * Signal the end of the URL, giving the remaining canonicalized bytes to the
+ * callback, then get ready for the next URL.
+ * @param  c Canonicalizer.
+ * @return   0 if the URL was canonicalized, -1 if it was empty or went over
+ *           the state limit. Bytes already given to the callback for such an
+ *           URL are to be discarded.
+ */
+extern int url_CanonicalizerFinish(url_canonicalizer *c)
+{
+	if(c==NULL)
+		return(-1);
+	bool valid = url_StreamFinish(&c->stream);
+	url_CanonicalizerReset(c);
+	return(valid ? 0 : -1);
+}
+
+
+/**
+ * Free a canonicalizer.
+ * @param c Pointer returned by url_CanonicalizerNew(), or NULL.
+ */
+extern void url_CanonicalizerFree(url_canonicalizer *c)
+{
+	if(c==NULL)
+		return;
+	free(c->stream.stack.data);
+	free(c->stream.scheme.data);
+	free(c->stream.host.data);
+	free(c->stream.path.data);
+	free(c);
+}
+
+
+
+// Room for the output of a whole URL window, scheme-less prefix included
+#define URL_EQUIVALENT_OUTPUT (4*URL_EQUIVALENT_BUFFER)
+
+// Sizes of the buffers that should never grow much in practice
+#define URL_EQUIVALENT_SMALL 64
+
+typedef struct {
+	url_stream stream;
+	const char *src;
+	size_t len, pos;
+	bool finished, valid;
+	char output[URL_EQUIVALENT_OUTPUT];
+	size_t output_len;
+	bool overflow;
+	char stack[URL_EQUIVALENT_SMALL];
+	char host[URL_EQUIVALENT_SMALL];
+	char scheme[URL_EQUIVALENT_BUFFER];
+	char path[URL_EQUIVALENT_BUFFER];
+} url_equivalent_side;
+
+
+static void url_EquivalentSink(void *ctx, const char *bytes, size_t len)
+{
+	url_equivalent_side *side = ctx;
+	if(side->output_len + len > sizeof(side->output)) {
+		side->overflow = true;
+		return;
+	}
+	memcpy(side->output + side->output_len, bytes, len);
+	side->output_len += len;
+}
+
+
+static void url_EquivalentInit(url_equivalent_side *side, const char *src, size_t len)
+{
+	url_StreamInit(&side->stream, false, url_EquivalentSink, side);
+	url_StreamUseBuffer(&side->stream.stack, side->stack, sizeof(side->stack));
+	url_StreamUseBuffer(&side->stream.host, side->host, sizeof(side->host));
+	url_StreamUseBuffer(&side->stream.scheme, side->scheme, sizeof(side->scheme));
+	url_StreamUseBuffer(&side->stream.path, side->path, sizeof(side->path));
+	side->src = src;
+	side->len = len;
+	side->pos = 0;
+	side->finished = false;
+	side->valid = false;
+	side->output_len = 0;
+	side->overflow = false;
+}
+
+
+static void url_EquivalentStep(url_equivalent_side *side)
+{
+	size_t chunk = side->len - side->pos;
+	if(chunk > URL_EQUIVALENT_WINDOW)
+		chunk = URL_EQUIVALENT_WINDOW;
+	url_StreamFeed(&side->stream, side->src + side->pos, chunk);
+	side->pos += chunk;
+
+	if(side->stream.ended || side->pos==side->len) {
+		side->valid = url_StreamFinish(&side->stream);
+		side->finished = true;
+	}
+}
+
+
+/**
+ * Check if two URLs have the same canonicalized form, that is if
+ * url_Canonicalize() would return the same string for both of them.
+ * Both URLs are canonicalized in lockstep, URL_EQUIVALENT_WINDOW bytes at a
+ * time, and the comparison stops at the first differing canonicalized byte.
+ * No memory is allocated, unless a scheme-less prefix, a numeric host or a
+ * path does not fit in URL_EQUIVALENT_BUFFER bytes : then both URLs are
+ * canonicalized with url_Canonicalize() and compared.
+ * @param  a    Pointer to the first URL.
+ * @param  alen Length of the first URL. If 0, strlen() will be used.
+ * @param  b    Pointer to the second URL.
+ * @param  blen Length of the second URL. If 0, strlen() will be used.
+ * @return      true if both URLs have the same canonicalized form, false
+ *              otherwise or if one of them cannot be canonicalized.
+ */
+extern bool url_Equivalent(const char *a, size_t alen, const char *b, size_t blen)
+{
+	if(a==NULL || b==NULL)
+		return(false);
+
+	if(alen==0)
+		alen = strlen(a);
+	if(blen==0)
+		blen = strlen(b);
+
+	url_equivalent_side side[2];
+	url_EquivalentInit(&side[0], a, alen);
+	url_EquivalentInit(&side[1], b, blen);
+
+	for(;;) {
+		// Compare what both URLs produced so far, keeping the excess
+		size_t n = side[0].output_len < side[1].output_len ? side[0].output_len : side[1].output_len;
+		if(memcmp(side[0].output, side[1].output, n))
+			return(false);
+		for(int i=0; i<2; i++) {
+			memmove(side[i].output, side[i].output+n, side[i].output_len-n);
+			side[i].output_len -= n;
+		}
+
+		for(int i=0; i<2; i++)
+			if(side[i].overflow || side[i].stream.failed)
+				goto fallback;
+
+		for(int i=0; i<2; i++) {
+			if(side[i].finished && !side[i].valid)
+				return(false);
+			// One URL is over while the other still has output
+			if(side[i].finished && side[i].output_len==0 && side[1-i].output_len>0)
+				return(false);
+		}
+		if(side[0].finished && side[1].finished)
+			return(true);
+
+		// Feed the URLs that have nothing left to be compared
+		for(int i=0; i<2; i++)
+			if(!side[i].finished && side[i].output_len==0)
+				url_EquivalentStep(&side[i]);
+	}
+
+fallback:
+	{
+		char *ca = url_Canonicalize(a, alen, NULL);
+		char *cb = url_Canonicalize(b, blen, NULL);
+		bool equivalent = ca && cb && strcmp(ca, cb)==0;
+		free(ca);
+		free(cb);
+		return(equivalent);
+	}
+}
+
+
+static void url_CanonicalLengthSink(void *ctx, const char *bytes, size_t len)
+{
+	(void)bytes;
+	*(size_t *)ctx += len;
+}
+
+
+/**
+ * Compute the exact length of the string url_Canonicalize(), or
+ * url_CanonicalizeWithFullEscape(), would return, without building it. Only
+ * a scheme-less prefix, a numeric host or a path longer than
+ * URL_EQUIVALENT_BUFFER bytes need memory to be allocated.
+ * @param  src         Pointer to the URL.
+ * @param  len         Length of the URL. If 0, strlen() will be used.
+ * @param  full_escape If true, count reserved characters as encoded.
+ * @return             Length of the canonicalized URL, NUL character excluded,
+ *                     or -1 if it cannot be canonicalized.
+ */
+extern int64_t url_CanonicalLength(const char *src, size_t len, bool full_escape)
+{
+	if(src==NULL)
+		return(-1);
+
+	if(len==0)
+		len = strlen(src);
+
+	char stack[URL_EQUIVALENT_SMALL], host[URL_EQUIVALENT_SMALL];
+	char scheme[URL_EQUIVALENT_BUFFER], path[URL_EQUIVALENT_BUFFER];
+	size_t count = 0;
+	url_stream s;
+
+	url_StreamInit(&s, full_escape, url_CanonicalLengthSink, &count);
+	url_StreamUseBuffer(&s.stack, stack, sizeof(stack));
+	url_StreamUseBuffer(&s.host, host, sizeof(host));
+	url_StreamUseBuffer(&s.scheme, scheme, sizeof(scheme));
+	url_StreamUseBuffer(&s.path, path, sizeof(path));
+	url_StreamFeed(&s, src, len);
+	bool valid = url_StreamFinish(&s);
+
+	if(s.failed) {
+		// Start again with buffers that can grow
+		count = 0;
+		url_StreamInit(&s, full_escape, url_CanonicalLengthSink, &count);
+		url_StreamFeed(&s, src, len);
+		valid = url_StreamFinish(&s);
+		free(s.stack.data);
+		free(s.host.data);
+		free(s.scheme.data);
+		free(s.path.data);
+	}
+	return(valid ? (int64_t)count : -1);
+}
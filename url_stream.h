@@ -0,0 +1,134 @@
+#ifndef _URL_STREAM_H_
+#define _URL_STREAM_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+	Incremental canonicalization. The functions declared here run the same
+	canonicalization as url_Canonicalize() as a state machine fed with
+	pieces of the URL, emitting the canonicalized URL as soon as each part
+	of it is known for sure.
+
+	A url_canonicalizer is fed with chunks of a single URL, for instance as
+	they are read from a socket, and gives the canonicalized bytes to a
+	callback as soon as they are final. Between two chunks, it only keeps
+	the percent escapes that can still be decoded, the prefix of the URL
+	until its scheme is known, the digits of a numeric host and the path
+	(whose segments a "/../" can still remove). Once in the query, memory
+	does not grow anymore, whatever the length of the URL.
+*/
+
+
+// Default maximum number of bytes a url_canonicalizer keeps between chunks
+#define URL_CANONICALIZER_STATE (64*1024)
+
+// Number of input bytes fed at a time to each URL by url_Equivalent()
+#define URL_EQUIVALENT_WINDOW 64
+
+// Size of the fixed buffers used by url_Equivalent() for the parts of an
+// URL that cannot be emitted yet (scheme lookup, numeric host, path).
+#define URL_EQUIVALENT_BUFFER 1024
+
+typedef struct url_canonicalizer url_canonicalizer;
+
+/**
+ * Function receiving the canonicalized URL, one piece after the other.
+ * @param ctx   Pointer given to url_CanonicalizerNew().
+ * @param bytes Next bytes of the canonicalized URL, not NUL terminated.
+ * @param len   Number of bytes.
+ */
+typedef void (*url_canonicalizer_callback)(void *ctx, const char *bytes, size_t len);
+
+
+/**
+ * Create a canonicalizer, fed with an URL piece by piece.
+ * @param  full_escape If true, reserved characters are escaped as
+ *                     url_EscapeIncludingReservedChars() does.
+ * @param  max_state   Maximum number of bytes kept between chunks, or 0 for
+ *                     URL_CANONICALIZER_STATE. Longer paths or scheme-less
+ *                     prefixes make the URL fail.
+ * @param  callback    Function receiving the canonicalized bytes.
+ * @param  ctx         Pointer given to the callback.
+ * @return             Pointer to a new canonicalizer, to be freed with
+ *                     url_CanonicalizerFree(), or NULL if error.
+ */
+extern url_canonicalizer *url_CanonicalizerNew(bool full_escape, size_t max_state, url_canonicalizer_callback callback, void *ctx);
+
+/**
+ * Feed the next bytes of an URL to a canonicalizer. The callback may be
+ * called with the canonicalized bytes that cannot change anymore.
+ * @param  c     Canonicalizer.
+ * @param  chunk Pointer to the bytes.
+ * @param  len   Number of bytes.
+ * @return       0, or -1 if the URL already failed.
+ */
+extern int url_CanonicalizerFeed(url_canonicalizer *c, const char *chunk, size_t len);
+
+/**
+ * Choose how the URLs with an opaque scheme given to a canonicalizer are
+ * canonicalized, as url_CanonicalizeWithOpaquePolicy() does. Applies from
+ * the current URL, unless its opaque scheme was already fed.
+ * @param c       Canonicalizer.
+ * @param policy  URL_OPAQUE_PASSTHROUGH (default), URL_OPAQUE_TRUNCATE or
+ *                URL_OPAQUE_HASH.
+ * @param max_len Maximum length of a canonicalized URL with the
+ *                URL_OPAQUE_TRUNCATE policy, or 0 for URL_OPAQUE_MAX_LEN.
+ */
+extern void url_CanonicalizerSetOpaquePolicy(url_canonicalizer *c, int policy, size_t max_len);
+
+/**
+ * Signal the end of the URL, giving the remaining canonicalized bytes to the
+ * callback, then get ready for the next URL.
+ * @param  c Canonicalizer.
+ * @return   0 if the URL was canonicalized, -1 if it was empty or went over
+ *           the state limit. Bytes already given to the callback for such an
+ *           URL are to be discarded.
+ */
+extern int url_CanonicalizerFinish(url_canonicalizer *c);
+
+/**
+ * Forget the current URL, to start a new one.
+ * @param c Canonicalizer.
+ */
+extern void url_CanonicalizerReset(url_canonicalizer *c);
+
+/**
+ * Free a canonicalizer.
+ * @param c Pointer returned by url_CanonicalizerNew(), or NULL.
+ */
+extern void url_CanonicalizerFree(url_canonicalizer *c);
+
+
+/**
+ * Check if two URLs have the same canonicalized form, that is if
+ * url_Canonicalize() would return the same string for both of them.
+ * Both URLs are canonicalized in lockstep, URL_EQUIVALENT_WINDOW bytes at a
+ * time, and the comparison stops at the first differing canonicalized byte.
+ * No memory is allocated, unless a scheme-less prefix, a numeric host or a
+ * path does not fit in URL_EQUIVALENT_BUFFER bytes : then both URLs are
+ * canonicalized with url_Canonicalize() and compared.
+ * @param  a    Pointer to the first URL.
+ * @param  alen Length of the first URL. If 0, strlen() will be used.
+ * @param  b    Pointer to the second URL.
+ * @param  blen Length of the second URL. If 0, strlen() will be used.
+ * @return      true if both URLs have the same canonicalized form, false
+ *              otherwise or if one of them cannot be canonicalized.
+ */
+extern bool url_Equivalent(const char *a, size_t alen, const char *b, size_t blen);
+
+/**
+ * Compute the exact length of the string url_Canonicalize(), or
+ * url_CanonicalizeWithFullEscape(), would return, without building it. Only
+ * a scheme-less prefix, a numeric host or a path longer than
+ * URL_EQUIVALENT_BUFFER bytes need memory to be allocated.
+ * @param  src         Pointer to the URL.
+ * @param  len         Length of the URL. If 0, strlen() will be used.
+ * @param  full_escape If true, count reserved characters as encoded.
+ * @return             Length of the canonicalized URL, NUL character excluded,
+ *                     or -1 if it cannot be canonicalized.
+ */
+extern int64_t url_CanonicalLength(const char *src, size_t len, bool full_escape);
+
+#endif
@@ -0,0 +1,501 @@
+/*
+	Heavy hitters (top-K) with Space-Saving and a count-min sketch.
+
+	The K tracked keys live in a fixed array of entries, ordered by a
+	min-heap on their counts and found through an open-addressing index
+	(entry number + 1, 0 marking an empty slot, removal by backward shift).
+	When a key that is not tracked comes in, it replaces the entry with the
+	lowest count only if the count-min sketch says it may be more frequent.
+ */
+
+
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "url.h"
+#include "url_topk.h"
+
+
+
+typedef struct {
+	char *key;
+	size_t len, cap;
+	uint64_t hash;
+	uint64_t count;
+	uint64_t error;
+	size_t heap_pos;
+} url_topk_entry;
+
+struct url_topk {
+	size_t k;
+	size_t used;
+	url_topk_entry *entries;
+	size_t *heap;
+
+	uint32_t *index;
+	size_t index_mask;
+
+	uint64_t *cms;
+	size_t width;
+	unsigned depth;
+};
+
+// Key of the union of two sketches, used when merging
+typedef struct {
+	const char *key;
+	size_t len;
+	uint64_t hash;
+	uint64_t count;
+	uint64_t lower;
+} url_topk_candidate;
+
+
+
+/**
+ * Create a new top-K sketch.
+ * @param  k     Number of keys to track.
+ * @param  width Width of the count-min sketch, rounded up to a power of 2,
+ *               or 0 for URL_TOPK_WIDTH.
+ * @param  depth Depth of the count-min sketch, or 0 for URL_TOPK_DEPTH.
+ * @return       Pointer to a new sketch, to be freed with url_TopkFree(),
+ *               or NULL if error.
+ */
+extern url_topk *url_TopkNew(size_t k, size_t width, unsigned depth)
+{
+	if(k==0 || k>=UINT32_MAX/2)
+		return(NULL);
+	if(width==0)
+		width = URL_TOPK_WIDTH;
+	if(depth==0)
+		depth = URL_TOPK_DEPTH;
+
+	url_topk *t = calloc(1, sizeof(url_topk));
+	if(t==NULL)
+		return(NULL);
+
+	t->k = k;
+	for(t->width=1; t->width<width; t->width*=2)
+		;
+	t->depth = depth;
+
+	size_t index_size;
+	for(index_size=1; index_size<2*k; index_size*=2)
+		;
+	t->index_mask = index_size - 1;
+
+	t->entries = calloc(k, sizeof(url_topk_entry));
+	t->heap = malloc(k * sizeof(size_t));
+	t->index = calloc(index_size, sizeof(uint32_t));
+	t->cms = calloc(t->width * depth, sizeof(uint64_t));
+	if(t->entries==NULL || t->heap==NULL || t->index==NULL || t->cms==NULL) {
+		url_TopkFree(t);
+		return(NULL);
+	}
+
+	return(t);
+}
+
+
+/**
+ * Free a top-K sketch.
+ * @param t Pointer returned by url_TopkNew(), or NULL.
+ */
+extern void url_TopkFree(url_topk *t)
+{
+	if(t==NULL)
+		return;
+	if(t->entries)
+		for(size_t i=0; i<t->k; i++)
+			free(t->entries[i].key);
+	free(t->entries);
+	free(t->heap);
+	free(t->index);
+	free(t->cms);
+	free(t);
+}
+
+
+/**
+ * Forget everything counted so far, for example at the end of a time window.
+ * @param t Top-K sketch.
+ */
+extern void url_TopkReset(url_topk *t)
+{
+	if(t==NULL)
+		return;
+	t->used = 0;
+	memset(t->index, 0, (t->index_mask+1) * sizeof(uint32_t));
+	memset(t->cms, 0, t->width * t->depth * sizeof(uint64_t));
+}
+
+
+// Count-min sketch columns are derived from two hashes (h1 + row * h2)
+static inline uint64_t url_TopkSecondHash(const char *key, size_t len)
+{
+	return(url_Hash64(key, len, 1) | 1);
+}
+
+
+static uint64_t url_TopkCmsAdd(url_topk *t, uint64_t h1, uint64_t h2, uint64_t count)
+{
+	uint64_t estimate = UINT64_MAX;
+	for(unsigned row=0; row<t->depth; row++) {
+		uint64_t *cell = &t->cms[row*t->width + ((h1 + row*h2) & (t->width-1))];
+		*cell += count;
+		if(*cell < estimate)
+			estimate = *cell;
+	}
+	return(estimate);
+}
+
+
+static uint64_t url_TopkCmsEstimate(const url_topk *t, uint64_t h1, uint64_t h2)
+{
+	uint64_t estimate = UINT64_MAX;
+	for(unsigned row=0; row<t->depth; row++) {
+		uint64_t cell = t->cms[row*t->width + ((h1 + row*h2) & (t->width-1))];
+		if(cell < estimate)
+			estimate = cell;
+	}
+	return(estimate);
+}
+
+
+static void url_TopkHeapSwap(url_topk *t, size_t a, size_t b)
+{
+	size_t tmp = t->heap[a];
+	t->heap[a] = t->heap[b];
+	t->heap[b] = tmp;
+	t->entries[t->heap[a]].heap_pos = a;
+	t->entries[t->heap[b]].heap_pos = b;
+}
+
+
+static void url_TopkHeapDown(url_topk *t, size_t pos)
+{
+	for(;;) {
+		size_t smallest = pos, left = 2*pos+1, right = 2*pos+2;
+		if(left<t->used && t->entries[t->heap[left]].count < t->entries[t->heap[smallest]].count)
+			smallest = left;
+		if(right<t->used && t->entries[t->heap[right]].count < t->entries[t->heap[smallest]].count)
+			smallest = right;
+		if(smallest==pos)
+			return;
+		url_TopkHeapSwap(t, pos, smallest);
+		pos = smallest;
+	}
+}
+
+
+static void url_TopkHeapUp(url_topk *t, size_t pos)
+{
+	while(pos>0 && t->entries[t->heap[pos]].count < t->entries[t->heap[(pos-1)/2]].count) {
+		url_TopkHeapSwap(t, pos, (pos-1)/2);
+		pos = (pos-1)/2;
+	}
+}
+
+
+static url_topk_entry *url_TopkFind(const url_topk *t, const char *key, size_t len, uint64_t hash)
+{
+	for(size_t i = hash & t->index_mask; t->index[i]; i = (i+1) & t->index_mask) {
+		url_topk_entry *entry = &t->entries[t->index[i]-1];
+		if(entry->hash==hash && entry->len==len && memcmp(entry->key, key, len)==0)
+			return(entry);
+	}
+	return(NULL);
+}
+
+
+static void url_TopkIndexInsert(url_topk *t, size_t entry)
+{
+	size_t i = t->entries[entry].hash & t->index_mask;
+	while(t->index[i])
+		i = (i+1) & t->index_mask;
+	t->index[i] = (uint32_t)entry + 1;
+}
+
+
+static void url_TopkIndexRemove(url_topk *t, size_t entry)
+{
+	size_t mask = t->index_mask;
+	size_t i = t->entries[entry].hash & mask;
+	while(t->index[i] != entry+1)
+		i = (i+1) & mask;
+
+	// Move back the following entries that would not be found anymore
+	for(size_t j = (i+1) & mask; t->index[j]; j = (j+1) & mask) {
+		size_t home = t->entries[t->index[j]-1].hash & mask;
+		bool stays = (i<=j) ? (i<home && home<=j) : (i<home || home<=j);
+		if(!stays) {
+			t->index[i] = t->index[j];
+			i = j;
+		}
+	}
+	t->index[i] = 0;
+}
+
+
+static bool url_TopkSetKey(url_topk_entry *entry, const char *key, size_t len, uint64_t hash)
+{
+	if(len+1 > entry->cap) {
+		char *p = realloc(entry->key, len+1);
+		if(p==NULL)
+			return(false);
+		entry->key = p;
+		entry->cap = len+1;
+	}
+	memcpy(entry->key, key, len);
+	entry->key[len] = '\0';
+	entry->len = len;
+	entry->hash = hash;
+	return(true);
+}
+
+
+// Track a new key while there is room for it
+static int url_TopkAppend(url_topk *t, const char *key, size_t len, uint64_t hash, uint64_t count, uint64_t error)
+{
+	size_t n = t->used;
+	url_topk_entry *entry = &t->entries[n];
+	if(!url_TopkSetKey(entry, key, len, hash))
+		return(-1);
+	entry->count = count;
+	entry->error = error;
+	entry->heap_pos = n;
+	t->heap[n] = n;
+	t->used++;
+	url_TopkIndexInsert(t, n);
+	url_TopkHeapUp(t, n);
+	return(0);
+}
+
+
+/**
+ * Count occurrences of a key.
+ * @param  t     Top-K sketch.
+ * @param  key   Pointer to the key.
+ * @param  len   Length of the key. If 0, strlen() will be used.
+ * @param  count Number of occurrences to be counted.
+ * @return       0, or -1 if error.
+ */
+extern int url_TopkAdd(url_topk *t, const char *key, size_t len, uint64_t count)
+{
+	if(t==NULL || key==NULL)
+		return(-1);
+	if(len==0)
+		len = strlen(key);
+
+	uint64_t hash = url_Hash64(key, len, 0);
+	uint64_t estimate = url_TopkCmsAdd(t, hash, url_TopkSecondHash(key, len), count);
+
+	url_topk_entry *entry = url_TopkFind(t, key, len, hash);
+	if(entry) {
+		entry->count += count;
+		url_TopkHeapDown(t, entry->heap_pos);
+		return(0);
+	}
+
+	// Nothing was ever evicted while there is room left : counts are exact
+	if(t->used < t->k)
+		return(url_TopkAppend(t, key, len, hash, count, 0));
+
+	// Replace the least frequent key, unless the new one cannot be more frequent
+	size_t victim = t->heap[0];
+	entry = &t->entries[victim];
+	uint64_t new_count = entry->count + count;
+	if(estimate < new_count)
+		new_count = estimate;
+	if(new_count <= entry->count)
+		return(0);
+
+	url_TopkIndexRemove(t, victim);
+	if(!url_TopkSetKey(entry, key, len, hash)) {
+		// The victim is left untouched
+		url_TopkIndexInsert(t, victim);
+		return(-1);
+	}
+	url_TopkIndexInsert(t, victim);
+	entry->error = new_count - count;
+	entry->count = new_count;
+	url_TopkHeapDown(t, 0);
+	return(0);
+}
+
+
+/**
+ * Count one occurrence of the hostname of a canonicalized URL, as found by
+ * url_FindHostname().
+ * @param  t   Top-K sketch.
+ * @param  url Pointer to the canonicalized URL.
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     0, or -1 if error.
+ */
+extern int url_TopkAddHost(url_topk *t, const char *url, size_t len)
+{
+	size_t host_len;
+	const char *host = url_FindHostname(url, len, &host_len);
+	if(host==NULL || host_len==0)
+		return(-1);
+	return(url_TopkAdd(t, host, host_len, 1));
+}
+
+
+/**
+ * Return an upper bound of the number of occurrences of any key, from the
+ * count-min sketch.
+ * @param  t   Top-K sketch.
+ * @param  key Pointer to the key.
+ * @param  len Length of the key. If 0, strlen() will be used.
+ * @return     Estimated number of occurrences.
+ */
+extern uint64_t url_TopkEstimate(const url_topk *t, const char *key, size_t len)
+{
+	if(t==NULL || key==NULL)
+		return(0);
+	if(len==0)
+		len = strlen(key);
+	return(url_TopkCmsEstimate(t, url_Hash64(key, len, 0), url_TopkSecondHash(key, len)));
+}
+
+
+static int url_TopkCompareCandidates(const void *a, const void *b)
+{
+	const url_topk_candidate *ca = a, *cb = b;
+	if(ca->count != cb->count)
+		return(ca->count > cb->count ? -1 : 1);
+	return(0);
+}
+
+
+/**
+ * Add the counts of a sketch to another one. Both must have been created
+ * with the same width and depth.
+ * @param  dst Top-K sketch receiving the counts.
+ * @param  src Top-K sketch to be merged in dst. Not modified.
+ * @return     0, or -1 if error.
+ */
+extern int url_TopkMerge(url_topk *dst, const url_topk *src)
+{
+	if(dst==NULL || src==NULL || dst->width!=src->width || dst->depth!=src->depth)
+		return(-1);
+
+	for(size_t i=0; i<dst->width*dst->depth; i++)
+		dst->cms[i] += src->cms[i];
+
+	// A key missing from a full sketch may have been counted up to its
+	// lowest count there
+	uint64_t dst_missing = dst->used==dst->k ? dst->entries[dst->heap[0]].count : 0;
+	uint64_t src_missing = src->used==src->k ? src->entries[src->heap[0]].count : 0;
+
+	url_topk_candidate *candidates = malloc((dst->used + src->used) * sizeof(url_topk_candidate) + 1);
+	if(candidates==NULL)
+		return(-1);
+	size_t n = 0;
+
+	for(size_t i=0; i<dst->used; i++) {
+		const url_topk_entry *a = &dst->entries[i];
+		const url_topk_entry *b = url_TopkFind(src, a->key, a->len, a->hash);
+		url_topk_candidate *c = &candidates[n++];
+		c->key = a->key;
+		c->len = a->len;
+		c->hash = a->hash;
+		c->count = a->count + (b ? b->count : src_missing);
+		c->lower = a->count - a->error + (b ? b->count - b->error : 0);
+	}
+	for(size_t i=0; i<src->used; i++) {
+		const url_topk_entry *b = &src->entries[i];
+		if(url_TopkFind(dst, b->key, b->len, b->hash))
+			continue;
+		url_topk_candidate *c = &candidates[n++];
+		c->key = b->key;
+		c->len = b->len;
+		c->hash = b->hash;
+		c->count = b->count + dst_missing;
+		c->lower = b->count - b->error;
+	}
+
+	for(size_t i=0; i<n; i++) {
+		uint64_t estimate = url_TopkCmsEstimate(dst, candidates[i].hash, url_TopkSecondHash(candidates[i].key, candidates[i].len));
+		if(estimate < candidates[i].count)
+			candidates[i].count = estimate;
+	}
+	qsort(candidates, n, sizeof(url_topk_candidate), url_TopkCompareCandidates);
+	if(n > dst->k)
+		n = dst->k;
+
+	// Keys of dst are about to be overwritten : copy the kept ones first
+	char **keys = malloc(n * sizeof(char *) + 1);
+	if(keys==NULL) {
+		free(candidates);
+		return(-1);
+	}
+	int ret = 0;
+	size_t copied;
+	for(copied=0; copied<n; copied++) {
+		keys[copied] = malloc(candidates[copied].len + 1);
+		if(keys[copied]==NULL) {
+			ret = -1;
+			break;
+		}
+		memcpy(keys[copied], candidates[copied].key, candidates[copied].len);
+	}
+
+	if(ret==0) {
+		dst->used = 0;
+		memset(dst->index, 0, (dst->index_mask+1) * sizeof(uint32_t));
+		for(size_t i=0; i<n && ret==0; i++)
+			ret = url_TopkAppend(dst, keys[i], candidates[i].len, candidates[i].hash,
+				candidates[i].count, candidates[i].count - candidates[i].lower);
+	}
+
+	for(size_t i=0; i<copied; i++)
+		free(keys[i]);
+	free(keys);
+	free(candidates);
+	return(ret);
+}
+
+
+static int url_TopkCompareItems(const void *a, const void *b)
+{
+	const url_topk_item *ia = a, *ib = b;
+	if(ia->count != ib->count)
+		return(ia->count > ib->count ? -1 : 1);
+	return(0);
+}
+
+
+/**
+ * Get the top-K keys, most frequent first.
+ * @param  t     Top-K sketch.
+ * @param  items Array receiving the keys.
+ * @param  max   Size of the items array.
+ * @return       Number of keys stored in items.
+ */
+extern size_t url_TopkList(const url_topk *t, url_topk_item *items, size_t max)
+{
+	if(t==NULL || items==NULL)
+		return(0);
+
+	url_topk_item *all = malloc(t->used * sizeof(url_topk_item) + 1);
+	if(all==NULL)
+		return(0);
+	for(size_t i=0; i<t->used; i++) {
+		all[i].key = t->entries[i].key;
+		all[i].len = t->entries[i].len;
+		all[i].count = t->entries[i].count;
+		all[i].error = t->entries[i].error;
+	}
+	qsort(all, t->used, sizeof(url_topk_item), url_TopkCompareItems);
+
+	size_t n = t->used < max ? t->used : max;
+	memcpy(items, all, n * sizeof(url_topk_item));
+	free(all);
+	return(n);
+}
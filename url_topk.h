@@ -0,0 +1,102 @@
+#ifndef _URL_TOPK_H_
+#define _URL_TOPK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	Heavy hitters (top-K) of a stream of keys, such as canonicalized URLs or
+	their hostnames, in constant memory.
+
+	The K most frequent keys are tracked with the Space-Saving algorithm.
+	A count-min sketch gives an upper bound of the count of any key, used
+	to tighten the count of keys entering the top-K. Sketches created with
+	the same parameters (one per thread for example) can be merged.
+*/
+
+// Default count-min sketch dimensions
+#define URL_TOPK_WIDTH 65536
+#define URL_TOPK_DEPTH 4
+
+typedef struct url_topk url_topk;
+
+typedef struct {
+	const char *key;	// Key, valid until the next change of the sketch
+	size_t len;			// Length of the key
+	uint64_t count;		// Estimated count, never lower than the real one
+	uint64_t error;		// Maximum overestimation of count
+} url_topk_item;
+
+
+/**
+ * Create a new top-K sketch.
+ * @param  k     Number of keys to track.
+ * @param  width Width of the count-min sketch, rounded up to a power of 2,
+ *               or 0 for URL_TOPK_WIDTH.
+ * @param  depth Depth of the count-min sketch, or 0 for URL_TOPK_DEPTH.
+ * @return       Pointer to a new sketch, to be freed with url_TopkFree(),
+ *               or NULL if error.
+ */
+extern url_topk *url_TopkNew(size_t k, size_t width, unsigned depth);
+
+/**
+ * Free a top-K sketch.
+ * @param t Pointer returned by url_TopkNew(), or NULL.
+ */
+extern void url_TopkFree(url_topk *t);
+
+/**
+ * Forget everything counted so far, for example at the end of a time window.
+ * @param t Top-K sketch.
+ */
+extern void url_TopkReset(url_topk *t);
+
+/**
+ * Count occurrences of a key.
+ * @param  t     Top-K sketch.
+ * @param  key   Pointer to the key.
+ * @param  len   Length of the key. If 0, strlen() will be used.
+ * @param  count Number of occurrences to be counted.
+ * @return       0, or -1 if error.
+ */
+extern int url_TopkAdd(url_topk *t, const char *key, size_t len, uint64_t count);
+
+/**
+ * Count one occurrence of the hostname of a canonicalized URL, as found by
+ * url_FindHostname().
+ * @param  t   Top-K sketch.
+ * @param  url Pointer to the canonicalized URL.
+ * @param  len Length of the URL. If 0, strlen() will be used.
+ * @return     0, or -1 if error.
+ */
+extern int url_TopkAddHost(url_topk *t, const char *url, size_t len);
+
+/**
+ * Return an upper bound of the number of occurrences of any key, from the
+ * count-min sketch.
+ * @param  t   Top-K sketch.
+ * @param  key Pointer to the key.
+ * @param  len Length of the key. If 0, strlen() will be used.
+ * @return     Estimated number of occurrences.
+ */
+extern uint64_t url_TopkEstimate(const url_topk *t, const char *key, size_t len);
+
+/**
+ * Add the counts of a sketch to another one. Both must have been created
+ * with the same width and depth.
+ * @param  dst Top-K sketch receiving the counts.
+ * @param  src Top-K sketch to be merged in dst. Not modified.
+ * @return     0, or -1 if error.
+ */
+extern int url_TopkMerge(url_topk *dst, const url_topk *src);
+
+/**
+ * Get the top-K keys, most frequent first.
+ * @param  t     Top-K sketch.
+ * @param  items Array receiving the keys.
+ * @param  max   Size of the items array.
+ * @return       Number of keys stored in items.
+ */
+extern size_t url_TopkList(const url_topk *t, url_topk_item *items, size_t max);
+
+#endif
@@ -0,0 +1,289 @@
+#define _BSD_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "url.h"
+#include "url_dedupe.h"
+#include "url_topk.h"
+#include "url_batch.h"
+#include "url_columns.h"
+#include "url_sort.h"
+
+/*
+	Canonicalize URLs read from the standard input, one per line, and write
+	them to the standard output.
+
+	To compile : gcc -std=c99 -Wall urlcanon.c url.c url_dedupe.c url_topk.c url_intern.c url_batch.c url_columns.c url_sort.c -o urlcanon -pthread -lm
+*/
+
+// Number of URLs canonicalized at once when writing a columnar file
+#define COLUMNS_BATCH 4096
+
+
+static void Usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-f] [-u | -c | -H | -t K | -T K | -C file | -s] [-e] [-w] [-p precision]\n"
+		"  Canonicalize URLs read from stdin, one per line.\n"
+		"  -f            Also percent-encode reserved characters.\n"
+		"  -u            Only print the first occurrence of each canonicalized URL.\n"
+		"  -c            Only print the number of distinct canonicalized URLs.\n"
+		"  -H            Print the number of distinct canonicalized URLs per host.\n"
+		"  -t K          Print the K most frequent hosts, with their counts.\n"
+		"  -T K          Print the K most frequent canonicalized URLs, with their counts.\n"
+		"  -C file       Write the canonicalized URLs to a columnar file (see url_columns.h).\n"
+		"  -s            Sort the canonicalized URLs and remove duplicates, using\n"
+		"                temporary files in $TMPDIR for inputs bigger than the memory.\n"
+		"  -e            Estimate distinct counts in bounded memory (HyperLogLog).\n"
+		"  -w            Use 128 bits fingerprints instead of 64 bits ones.\n"
+		"  -p precision  HyperLogLog precision, between 4 and 18 (default %d).\n",
+		name, URL_DEDUPE_HLL_PRECISION);
+}
+
+
+static void PrintHost(void *ctx, const char *host, uint64_t count)
+{
+	(void)ctx;
+	printf("%llu\t%s\n", (unsigned long long)count, host);
+}
+
+
+// Lines read for a columnar file, kept until COLUMNS_BATCH of them can be
+// canonicalized at once
+typedef struct {
+	char *data;
+	size_t len, cap;
+	size_t offsets[COLUMNS_BATCH];
+	size_t lens[COLUMNS_BATCH];
+	size_t count;
+} Lines;
+
+
+static int AddLine(Lines *lines, const char *line, size_t len)
+{
+	if(lines->len + len > lines->cap) {
+		size_t cap = lines->cap ? lines->cap : 65536;
+		while(cap < lines->len + len)
+			cap *= 2;
+		char *data = realloc(lines->data, cap);
+		if(data==NULL)
+			return(-1);
+		lines->data = data;
+		lines->cap = cap;
+	}
+	memcpy(lines->data + lines->len, line, len);
+	lines->offsets[lines->count] = lines->len;
+	lines->lens[lines->count++] = len;
+	lines->len += len;
+	return(0);
+}
+
+
+// Canonicalize the lines kept in one batch, and add it to the columnar file
+static int WriteLines(Lines *lines, url_batch *batch, url_columns_writer *columns)
+{
+	const char *urls[COLUMNS_BATCH];
+	for(size_t i=0; i<lines->count; i++)
+		urls[i] = lines->data + lines->offsets[i];
+	url_BatchReset(batch);
+	if(url_CanonicalizeBatch(batch, urls, lines->lens, lines->count) < lines->count)
+		for(size_t i=0; i<lines->count; i++)
+			if(url_BatchGet(batch, i, NULL)==NULL)
+				fprintf(stderr, "Error while canonicalizing URL [%.*s]\n", (int)lines->lens[i], urls[i]);
+	lines->len = 0;
+	lines->count = 0;
+	return(url_ColumnsWriterAddBatch(columns, batch));
+}
+
+
+static int PrintSorted(void *ctx, const char *url, size_t len)
+{
+	(void)ctx;
+	fwrite(url, 1, len, stdout);
+	return(putchar('\n')==EOF);
+}
+
+
+int main(int argc, char *argv[])
+{
+	bool full_escape = false;
+	enum { CANONICALIZE, FIRST_SEEN, COUNT, PER_HOST, TOP_HOSTS, TOP_URLS, COLUMNS, SORTED } mode = CANONICALIZE;
+	int flags = 0;
+	unsigned precision = 0;
+	size_t top = 0;
+	const char *columns_path = NULL;
+
+	int opt;
+	while((opt = getopt(argc, argv, "fucHt:T:C:sewp:")) != -1) {
+		switch(opt) {
+			case 'f': full_escape = true; break;
+			case 'u': mode = FIRST_SEEN; break;
+			case 'c': mode = COUNT; break;
+			case 'H': mode = PER_HOST; flags |= URL_DEDUPE_PER_HOST; break;
+			case 't': mode = TOP_HOSTS; top = (size_t)atol(optarg); break;
+			case 'T': mode = TOP_URLS; top = (size_t)atol(optarg); break;
+			case 'C': mode = COLUMNS; columns_path = optarg; break;
+			case 's': mode = SORTED; break;
+			case 'e': flags |= URL_DEDUPE_HLL; break;
+			case 'w': flags |= URL_DEDUPE_FINGERPRINT128; break;
+			case 'p': precision = (unsigned)atoi(optarg); break;
+			default:
+				Usage(argv[0]);
+				return(EXIT_FAILURE);
+		}
+	}
+
+	if(mode==FIRST_SEEN && (flags & URL_DEDUPE_HLL)) {
+		fprintf(stderr, "%s: -u needs exact deduplication, -e cannot be used\n", argv[0]);
+		return(EXIT_FAILURE);
+	}
+	if(full_escape && mode!=CANONICALIZE) {
+		fprintf(stderr, "%s: -f can only be used alone\n", argv[0]);
+		return(EXIT_FAILURE);
+	}
+
+	url_topk *topk = NULL;
+	if(mode==TOP_HOSTS || mode==TOP_URLS) {
+		topk = url_TopkNew(top, 0, 0);
+		if(topk==NULL) {
+			fprintf(stderr, "%s: cannot create top-K sketch of %zu keys\n", argv[0], top);
+			return(EXIT_FAILURE);
+		}
+	}
+
+	url_columns_writer *columns = NULL;
+	url_batch *batch = NULL;
+	Lines *lines = NULL;
+	if(mode==COLUMNS) {
+		columns = url_ColumnsWriterNew(columns_path);
+		batch = url_BatchNew();
+		lines = calloc(1, sizeof(Lines));
+		if(columns==NULL || batch==NULL || lines==NULL) {
+			fprintf(stderr, "%s: cannot create columnar file %s\n", argv[0], columns_path);
+			return(EXIT_FAILURE);
+		}
+	}
+
+	url_sorter *sorter = NULL;
+	if(mode==SORTED) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		sorter = url_SorterNew(getenv("TMPDIR"), 0, cpus>1 ? (unsigned)cpus : 0);
+		if(sorter==NULL) {
+			fprintf(stderr, "%s: cannot create sorter\n", argv[0]);
+			return(EXIT_FAILURE);
+		}
+	}
+
+	url_dedupe *dedupe = NULL;
+	if(mode==FIRST_SEEN || mode==COUNT || mode==PER_HOST) {
+		dedupe = url_DedupeNew(flags, precision);
+		if(dedupe==NULL) {
+			fprintf(stderr, "%s: cannot create deduplication table\n", argv[0]);
+			return(EXIT_FAILURE);
+		}
+	}
+
+	int ret = EXIT_SUCCESS;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t line_len;
+	while((line_len = getline(&line, &line_size, stdin)) != -1) {
+		if(line_len>0 && line[line_len-1]=='\n')
+			line[--line_len] = '\0';
+		if(line_len==0)
+			continue;
+
+		if(columns) {
+			if(AddLine(lines, line, line_len)
+			|| (lines->count==COLUMNS_BATCH && WriteLines(lines, batch, columns))) {
+				fprintf(stderr, "%s: error while writing %s\n", argv[0], columns_path);
+				ret = EXIT_FAILURE;
+				break;
+			}
+			continue;
+		}
+
+		if(sorter) {
+			if(url_SorterAdd(sorter, line, line_len)) {
+				fprintf(stderr, "%s: error while sorting\n", argv[0]);
+				ret = EXIT_FAILURE;
+				break;
+			}
+			continue;
+		}
+
+		size_t len;
+		uint64_t hash[2];
+		char *canonical = full_escape
+			? url_CanonicalizeWithFullEscape(line, line_len, &len)
+			: url_CanonicalizeAndHash128(line, line_len, &len, 0, hash);
+		if(canonical==NULL) {
+			fprintf(stderr, "Error while canonicalizing URL [%s]\n", line);
+			continue;
+		}
+
+		if(topk) {
+			int ret = mode==TOP_HOSTS
+				? url_TopkAddHost(topk, canonical, len)
+				: url_TopkAdd(topk, canonical, len, 1);
+			if(ret<0)
+				fprintf(stderr, "Error while counting URL [%s]\n", canonical);
+		} else if(dedupe==NULL) {
+			puts(canonical);
+		} else {
+			int added = url_DedupeAddHashed(dedupe, canonical, len, hash);
+			if(added<0) {
+				fprintf(stderr, "%s: out of memory\n", argv[0]);
+				ret = EXIT_FAILURE;
+				free(canonical);
+				break;
+			}
+			if(added && mode==FIRST_SEEN)
+				puts(canonical);
+		}
+		free(canonical);
+	}
+	free(line);
+
+	if(mode==COUNT)
+		printf("%llu\n", (unsigned long long)url_DedupeCount(dedupe));
+	else if(mode==PER_HOST)
+		url_DedupeForEachHost(dedupe, PrintHost, NULL);
+	else if(topk) {
+		url_topk_item *items = malloc(top * sizeof(url_topk_item));
+		size_t n = items ? url_TopkList(topk, items, top) : 0;
+		for(size_t i=0; i<n; i++)
+			printf("%llu\t%.*s\n", (unsigned long long)items[i].count, (int)items[i].len, items[i].key);
+		free(items);
+	}
+
+	if(columns) {
+		bool failed = ret!=EXIT_SUCCESS || WriteLines(lines, batch, columns);
+		if(url_ColumnsWriterFinish(columns) || failed) {
+			if(ret==EXIT_SUCCESS)
+				fprintf(stderr, "%s: error while writing %s\n", argv[0], columns_path);
+			ret = EXIT_FAILURE;
+		}
+		url_BatchFree(batch);
+		free(lines->data);
+		free(lines);
+	}
+
+	// No partial output when some URLs could not be added
+	if(sorter) {
+		if(ret==EXIT_SUCCESS && url_SorterFinish(sorter, PrintSorted, NULL) < 0) {
+			fprintf(stderr, "%s: error while sorting\n", argv[0]);
+			ret = EXIT_FAILURE;
+		}
+		url_SorterFree(sorter);
+	}
+
+	url_TopkFree(topk);
+	url_DedupeFree(dedupe);
+	return(ret);
+}
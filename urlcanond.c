@@ -0,0 +1,464 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "url.h"
+#include "url_batch.h"
+
+/*
+	Daemon serving canonicalization, hostname and lookup expression
+	requests over a Unix socket, so that programs in any language share the
+	results of url.c instead of their own ports.
+
+	Requests and responses are frames : a 32 bits little-endian length, then
+	as many bytes. A request frame holds an operation byte then the URL, a
+	response frame a status byte then the result :
+
+		'c'  canonicalize     the canonicalized URL
+		'h'  hostname         the hostname, as url_GetHostname() returns it
+		'l'  lookup           the canonicalized URL, then its Safe Browsing
+		                      expressions (see url_GetLookupExpressions()),
+		                      each one NUL terminated
+
+	Status is 0, URLCANOND_FAILED if the URL could not be processed or
+	URLCANOND_UNKNOWN for an unknown operation. Clients can send several
+	requests before reading the responses, which come in the same order.
+
+	A single thread waits for all the connections with epoll. Each round,
+	all the complete requests read from all the connections are
+	canonicalized at once with url_CanonicalizeBatch(), then the responses
+	are written. A connection whose responses are not read stops being read
+	until they are.
+
+	To compile : gcc -std=c99 -Wall urlcanond.c url.c url_batch.c -o urlcanond -lm
+*/
+
+// Maximum length of an URL in a request
+#define URLCANOND_MAX_URL (64*1024)
+
+// Maximum number of requests canonicalized at once
+#define URLCANOND_BATCH 4096
+
+// Unread responses of a connection above which it is not read anymore
+#define URLCANOND_MAX_PENDING (1024*1024)
+
+// Size of the reads
+#define URLCANOND_READ (64*1024)
+
+#define URLCANOND_EVENTS 256
+
+// Status of the responses
+#define URLCANOND_OK 0
+#define URLCANOND_FAILED 1
+#define URLCANOND_UNKNOWN 2
+
+typedef struct {
+	int fd;
+	char *in;				// Bytes read, frames not handled yet
+	size_t in_len, in_cap;
+	char *out;				// Responses, written from out_pos
+	size_t out_len, out_pos, out_cap;
+	uint32_t events;		// Events of the connection in the epoll set
+	bool queued;			// Has complete requests waiting for a round
+	bool eof;				// No more requests, close once answered
+	bool closed;
+} Connection;
+
+typedef struct {
+	Connection *c;
+	char op;
+	char *url;
+	size_t len;
+	size_t index;			// Index in the batch, for 'c' and 'l'
+} Request;
+
+// Index of the requests not canonicalized, as a length of 0 means strlen()
+#define URLCANOND_EMPTY ((size_t)-1)
+
+static volatile sig_atomic_t stopping = 0;
+
+
+static void Usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-b batch] socket\n"
+		"  Serve canonicalization requests on a Unix socket.\n"
+		"  -b batch  Maximum number of requests canonicalized at once (default %d).\n",
+		name, URLCANOND_BATCH);
+}
+
+
+static void Stop(int sig)
+{
+	(void)sig;
+	stopping = 1;
+}
+
+
+static bool Reserve(char **buffer, size_t *cap, size_t size)
+{
+	if(size <= *cap)
+		return(true);
+	size_t new_cap = *cap ? *cap : 4096;
+	while(new_cap < size)
+		new_cap *= 2;
+	char *p = realloc(*buffer, new_cap);
+	if(p==NULL)
+		return(false);
+	*buffer = p;
+	*cap = new_cap;
+	return(true);
+}
+
+
+static void Update(int epoll_fd, Connection *c)
+{
+	size_t pending = c->out_len - c->out_pos;
+	uint32_t events = (pending ? EPOLLOUT : 0) | (pending < URLCANOND_MAX_PENDING && !c->eof ? EPOLLIN : 0);
+	if(events != c->events) {
+		struct epoll_event ev = { .events = events, .data.ptr = c };
+		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+		c->events = events;
+	}
+}
+
+
+// Return true if c has a complete request, or an invalid one
+static bool Complete(const Connection *c)
+{
+	if(c->in_len < 4)
+		return(false);
+	const unsigned char *p = (const unsigned char *)c->in;
+	uint32_t len = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+	return(c->in_len - 4 >= len || len > URLCANOND_MAX_URL+1);
+}
+
+
+static void Read(Connection *c)
+{
+	// Below 2 reads, there is always room for a whole request
+	while(!c->eof && c->in_len < 2*URLCANOND_READ) {
+		// One more byte, to NUL terminate the last URL
+		if(!Reserve(&c->in, &c->in_cap, c->in_len + URLCANOND_READ + 1)) {
+			c->closed = true;
+			return;
+		}
+		ssize_t n = read(c->fd, c->in + c->in_len, URLCANOND_READ);
+		if(n > 0)
+			c->in_len += n;
+		else {
+			if(n==0)
+				c->eof = true;
+			else if(errno!=EAGAIN && errno!=EINTR)
+				c->closed = true;
+			break;
+		}
+	}
+}
+
+
+static void Write(Connection *c)
+{
+	while(c->out_pos < c->out_len) {
+		ssize_t n = send(c->fd, c->out + c->out_pos, c->out_len - c->out_pos, MSG_NOSIGNAL);
+		if(n > 0)
+			c->out_pos += n;
+		else {
+			if(n<0 && errno!=EAGAIN && errno!=EINTR)
+				c->closed = true;
+			break;
+		}
+	}
+	if(c->out_pos == c->out_len)
+		c->out_pos = c->out_len = 0;
+}
+
+
+// Append a response made of a status and up to two parts to c
+static void Respond(Connection *c, int status, const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	size_t len = 1 + a_len + b_len;
+	if(!Reserve(&c->out, &c->out_cap, c->out_len + 4 + len)) {
+		c->closed = true;
+		return;
+	}
+	unsigned char *p = (unsigned char *)c->out + c->out_len;
+	p[0] = len & 0xFF;
+	p[1] = (len >> 8) & 0xFF;
+	p[2] = (len >> 16) & 0xFF;
+	p[3] = (len >> 24) & 0xFF;
+	p[4] = status;
+	if(a_len)
+		memcpy(p+5, a, a_len);
+	if(b_len)
+		memcpy(p+5+a_len, b, b_len);
+	c->out_len += 4 + len;
+}
+
+
+static void Handle(Request *r, const url_batch *batch)
+{
+	Connection *c = r->c;
+	const char *canonical = NULL;
+	size_t canonical_len = 0;
+
+	switch(r->op) {
+		case 'c':
+			if(r->index != URLCANOND_EMPTY)
+				canonical = url_BatchGet(batch, r->index, &canonical_len);
+			if(canonical==NULL)
+				Respond(c, URLCANOND_FAILED, NULL, 0, NULL, 0);
+			else
+				Respond(c, URLCANOND_OK, canonical, canonical_len, NULL, 0);
+			break;
+
+		case 'h': {
+			// The frame is followed by another one or by a spare byte
+			char next = r->url[r->len];
+			r->url[r->len] = '\0';
+			char *hostname = url_GetHostname(r->url);
+			r->url[r->len] = next;
+			if(hostname==NULL)
+				Respond(c, URLCANOND_FAILED, NULL, 0, NULL, 0);
+			else
+				Respond(c, URLCANOND_OK, hostname, strlen(hostname), NULL, 0);
+			free(hostname);
+			break;
+		}
+
+		case 'l': {
+			if(r->index != URLCANOND_EMPTY)
+				canonical = url_BatchGet(batch, r->index, &canonical_len);
+			size_t count, len;
+			char *expressions = canonical ? url_GetLookupExpressions(canonical, canonical_len, &count, &len) : NULL;
+			if(expressions==NULL)
+				Respond(c, URLCANOND_FAILED, NULL, 0, NULL, 0);
+			else
+				Respond(c, URLCANOND_OK, canonical, canonical_len+1, expressions, len);
+			free(expressions);
+			break;
+		}
+
+		default:
+			Respond(c, URLCANOND_UNKNOWN, NULL, 0, NULL, 0);
+	}
+}
+
+
+// Take up to max complete requests of c, return the number taken
+static size_t Take(Connection *c, Request *requests, size_t max, size_t *consumed)
+{
+	size_t count = 0;
+	size_t pos = 0;
+	while(count < max && c->in_len - pos >= 4) {
+		const unsigned char *p = (const unsigned char *)c->in + pos;
+		uint32_t len = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+		if(len==0 || len > URLCANOND_MAX_URL+1) {
+			c->closed = true;
+			break;
+		}
+		if(c->in_len - pos - 4 < len)
+			break;
+		requests[count].c = c;
+		requests[count].op = c->in[pos+4];
+		requests[count].url = c->in + pos + 5;
+		requests[count++].len = len - 1;
+		pos += 4 + len;
+	}
+	*consumed = pos;
+	return(count);
+}
+
+
+int main(int argc, char *argv[])
+{
+	size_t batch_max = URLCANOND_BATCH;
+
+	int opt;
+	while((opt = getopt(argc, argv, "b:")) != -1) {
+		switch(opt) {
+			case 'b': batch_max = (size_t)atol(optarg); break;
+			default: Usage(argv[0]); return(1);
+		}
+	}
+	if(optind != argc-1 || batch_max==0) {
+		Usage(argv[0]);
+		return(1);
+	}
+	const char *path = argv[optind];
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long [%s]\n", path);
+		return(1);
+	}
+	strcpy(addr.sun_path, path);
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	unlink(path);
+	if(listen_fd<0 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listen_fd, SOMAXCONN)) {
+		perror(path);
+		return(1);
+	}
+
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	if(epoll_fd<0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev)) {
+		perror("epoll");
+		return(1);
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = Stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	url_batch *batch = url_BatchNew();
+	Request *requests = malloc(batch_max * sizeof(Request));
+	const char **urls = malloc(batch_max * sizeof(char *));
+	size_t *lens = malloc(batch_max * sizeof(size_t));
+
+	// Connections with complete requests left by a full round
+	Connection **queue = NULL;
+	size_t queue_len = 0, queue_cap = 0;
+	Connection **touched = NULL;
+	size_t touched_cap = 0;
+
+	if(batch==NULL || requests==NULL || urls==NULL || lens==NULL) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return(1);
+	}
+
+	struct epoll_event events[URLCANOND_EVENTS];
+	while(!stopping) {
+		int n = epoll_wait(epoll_fd, events, URLCANOND_EVENTS, queue_len ? 0 : -1);
+		if(n<0) {
+			if(errno==EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		for(int i=0; i<n; i++) {
+			Connection *c = events[i].data.ptr;
+			if(c==NULL) {
+				int fd;
+				while((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+					c = calloc(1, sizeof(Connection));
+					struct epoll_event cev = { .events = EPOLLIN, .data.ptr = c };
+					if(c==NULL || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &cev)) {
+						free(c);
+						close(fd);
+						continue;
+					}
+					c->fd = fd;
+					c->events = EPOLLIN;
+				}
+				continue;
+			}
+
+			if(events[i].events & EPOLLOUT)
+				Write(c);
+			if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				Read(c);
+			if(!c->queued && (c->closed || c->eof || Complete(c))) {
+				if(queue_len == queue_cap) {
+					queue_cap = queue_cap ? queue_cap*2 : 256;
+					Connection **q = realloc(queue, queue_cap * sizeof(Connection *));
+					if(q==NULL) {
+						fprintf(stderr, "Cannot allocate memory\n");
+						return(1);
+					}
+					queue = q;
+				}
+				queue[queue_len++] = c;
+				c->queued = true;
+			}
+		}
+
+		if(queue_len==0)
+			continue;
+
+		// Take requests from the queued connections, up to a full batch
+		size_t count = 0, taken = 0, batched = 0;
+		if(touched_cap < queue_len) {
+			touched_cap = queue_cap;
+			free(touched);
+			if((touched = malloc(touched_cap * sizeof(Connection *)))==NULL) {
+				fprintf(stderr, "Cannot allocate memory\n");
+				return(1);
+			}
+		}
+		size_t consumed[URLCANOND_EVENTS];
+		for( ; taken<queue_len && taken<URLCANOND_EVENTS && count<batch_max; taken++) {
+			Connection *c = queue[taken];
+			touched[taken] = c;
+			consumed[taken] = 0;
+			if(!c->closed && c->out_len - c->out_pos < URLCANOND_MAX_PENDING)
+				count += Take(c, requests + count, batch_max - count, &consumed[taken]);
+		}
+
+		url_BatchReset(batch);
+		for(size_t i=0; i<count; i++)
+			if((requests[i].op=='c' || requests[i].op=='l') && requests[i].len==0)
+				requests[i].index = URLCANOND_EMPTY;
+			else if(requests[i].op=='c' || requests[i].op=='l') {
+				requests[i].index = batched;
+				urls[batched] = requests[i].url;
+				lens[batched++] = requests[i].len;
+			}
+		url_CanonicalizeBatch(batch, urls, lens, batched);
+		for(size_t i=0; i<count; i++)
+			Handle(&requests[i], batch);
+
+		// Write the responses, keep connections with requests left queued
+		size_t kept = 0;
+		for(size_t i=0; i<taken; i++) {
+			Connection *c = touched[i];
+			memmove(c->in, c->in + consumed[i], c->in_len - consumed[i]);
+			c->in_len -= consumed[i];
+			Write(c);
+			if(c->eof && c->out_len==0 && !Complete(c))
+				c->closed = true;
+			if(c->closed) {
+				close(c->fd);
+				free(c->in);
+				free(c->out);
+				free(c);
+				continue;
+			}
+			Update(epoll_fd, c);
+			c->queued = Complete(c) && c->out_len - c->out_pos < URLCANOND_MAX_PENDING;
+			if(c->queued)
+				touched[kept++] = c;
+		}
+		memcpy(touched + kept, queue + taken, (queue_len - taken) * sizeof(Connection *));
+		queue_len = kept + queue_len - taken;
+		memcpy(queue, touched, queue_len * sizeof(Connection *));
+	}
+
+	unlink(path);
+	close(epoll_fd);
+	close(listen_fd);
+	url_BatchFree(batch);
+	free(requests);
+	free(urls);
+	free(lens);
+	free(queue);
+	free(touched);
+	return(0);
+}